@@ -0,0 +1,1653 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <boost/iterator/iterator_facade.hpp>
+#include <geomc/geomc_defs.h>
+
+// todo: ArrayTree and Tree could share QueryIterator and the algorithms built
+//       on the Subtree interface if SubtreeBase were templated over its storage.
+
+
+namespace geom {
+
+
+/** @addtogroup storage
+ *  @{
+ */
+
+
+// forward decls
+template <typename NodeItem, typename LeafItem> class ArrayTree;
+template <typename NodeItem, typename LeafItem, bool Const> class ArraySubtreeBase;
+template <typename NodeItem, typename LeafItem> class ArraySubtree;
+template <typename NodeItem, typename LeafItem> class ConstArraySubtree;
+
+
+namespace detail {
+
+// A flat array with a movable hole in it. Each element has a "logical" index
+// (its position in sequence) and a "physical" index (its slot in `data`); the two
+// differ by the width of the gap for elements which lie beyond it. Inserting or
+// erasing at the gap is O(1); moving the gap costs the number of elements it
+// passes over, so edits which are near each other are cheap.
+template <typename T>
+struct GapBuffer {
+
+    // elements formerly in the physical range `[lo, hi)` now live at `[lo + shift, hi + shift)`.
+    // `at` is the logical index of the first of them.
+    struct Shift {
+        size_t    lo;
+        size_t    hi;
+        ptrdiff_t shift;
+        size_t    at;
+    };
+    
+    std::vector<T> data;
+    size_t gap_lo = 0;
+    size_t gap_hi = 0;
+    
+    inline size_t gap()   const { return gap_hi - gap_lo; }
+    inline size_t size()  const { return data.size() - gap(); }
+    // physical off-end position
+    inline size_t end()   const { return data.size(); }
+    inline size_t first() const { return gap_lo == 0 ? gap_hi : 0; }
+    
+    inline size_t phys(size_t l)    const { return l < gap_lo ? l : l + gap(); }
+    inline size_t logical(size_t p) const { return p < gap_lo ? p : p - gap(); }
+    
+    inline size_t next(size_t p) const { ++p; return p == gap_lo ? gap_hi : p; }
+    inline size_t prev(size_t p) const { return p == gap_hi ? gap_lo - 1 : p - 1; }
+    
+    // move the gap to lie just before logical index `l`.
+    Shift move_to(size_t l) {
+        size_t w = gap();
+        Shift s {0, 0, 0, l};
+        if (w == 0) {
+            // nothing physically moves.
+            gap_lo = gap_hi = l;
+        } else if (l < gap_lo) {
+            s = {l, gap_lo, (ptrdiff_t) w, l};
+            std::move_backward(data.begin() + l, data.begin() + gap_lo, data.begin() + gap_hi);
+            gap_hi -= gap_lo - l;
+            gap_lo  = l;
+        } else if (l > gap_lo) {
+            size_t n = l - gap_lo;
+            s = {gap_hi, gap_hi + n, -(ptrdiff_t) w, gap_lo};
+            std::move(data.begin() + gap_hi, data.begin() + gap_hi + n, data.begin() + gap_lo);
+            gap_lo += n;
+            gap_hi += n;
+        }
+        return s;
+    }
+    
+    // widen the gap to at least `k` slots, at least doubling the storage if it
+    // must grow. elements beyond the gap are shifted upward.
+    Shift reserve(size_t k) {
+        if (gap() >= k) return {0, 0, 0, 0};
+        size_t cap = std::max({2 * data.size(), size() + k, (size_t) 16});
+        size_t d   = cap - data.size();
+        std::vector<T> buf(cap);
+        std::move(data.begin(), data.begin() + gap_lo, buf.begin());
+        std::move(data.begin() + gap_hi, data.end(), buf.begin() + gap_hi + d);
+        Shift s {gap_hi, data.size(), (ptrdiff_t) d, gap_lo};
+        data.swap(buf);
+        gap_hi += d;
+        return s;
+    }
+
+};
+
+
+// bidirectional iterator over the elements of a GapBuffer, which hops the gap.
+template <typename T, bool Const>
+class GapBufferIterator : public boost::iterator_facade<
+        GapBufferIterator<T, Const>,
+        typename std::conditional<Const, const T, T>::type,
+        boost::bidirectional_traversal_tag> {
+    
+    friend class boost::iterator_core_access;
+    template <typename, bool> friend class GapBufferIterator;
+    
+    typedef typename std::conditional<
+            Const,
+            const GapBuffer<T>*,
+            GapBuffer<T>*>::type buffer_ptr;
+    
+    buffer_ptr _buf = nullptr;
+    size_t     _i   = 0;
+
+public:
+
+    GapBufferIterator() {}
+    
+    GapBufferIterator(buffer_ptr buf, size_t i):
+        _buf(buf),
+        _i(i) {}
+    
+    // non-const to const conversion
+    template <bool C> requires (Const and not C)
+    GapBufferIterator(const GapBufferIterator<T, C>& other):
+        _buf(other._buf),
+        _i(other._i) {}
+    
+    // physical index of the element
+    inline size_t index() const { return _i; }
+
+private:
+
+    typename std::conditional<Const, const T&, T&>::type dereference() const {
+        return _buf->data[_i];
+    }
+    
+    template <bool C>
+    bool equal(const GapBufferIterator<T, C>& other) const {
+        return _i == other._i;
+    }
+    
+    void increment() { _i = _buf->next(_i); }
+    void decrement() { _i = _buf->prev(_i); }
+
+};
+
+} // namespace detail
+
+
+/**
+@brief A dynamic tree of arbitrary arity, stored in flat arrays.
+
+ArrayTree has the same structure and the same interface as Tree: All mutation
+and access is provided through the ArraySubtree and ConstArraySubtree classes, which
+offer the same methods as Subtree and ConstSubtree. Nodes are kept in the same
+"sibling-contiguous" order, and `LeafItem`s in the same depth-first order.
+
+Rather than linked lists, the nodes and items are stored in two contiguous arrays,
+so that traversals and queries walk memory in order. Each array has a single
+movable "gap" of free space, which sits wherever the last edit was made. Inserting
+or removing at the gap is cheap, and moving it costs the number of elements it
+passes over; building a tree in order, or making edits which are close
+together, is therefore amortized constant-time per element.
+
+Items occupying a subtree are a contiguous range, so `find_parent()` and the
+ownership checks on item insertion and erasure are `O(k log n)` rather than linear.
+
+Iterator invalidation differs from Tree in one respect: Like those of
+`std::vector`, `item_iterator`s are invalidated by any insertion or removal
+of items. ArraySubtree handles refer to their node by a stable id, and remain
+valid until that node is erased; `end()` handles are invalidated by mutation
+as in Tree.
+
+`NodeItem` and `LeafItem` must be default-constructible and move-assignable.
+
+@tparam NodeItem Type of data to be kept with internal tree nodes.
+@tparam LeafItem Type of data to be kept by leaf nodes.
+*/
+template <typename NodeItem, typename LeafItem>
+class ArrayTree {
+
+    friend class ArraySubtreeBase<NodeItem, LeafItem, true>;
+    friend class ArraySubtreeBase<NodeItem, LeafItem, false>;
+    friend class ConstArraySubtree<NodeItem, LeafItem>;
+    friend class ArraySubtree<NodeItem, LeafItem>;
+    
+    typedef uint32_t NodeRef; // physical slot in `_nodes`
+    typedef uint32_t NodeId;  // stable identity of a node
+    typedef uint32_t ItemRef; // physical slot in `_items`
+    
+    static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+    static constexpr NodeId   ROOT = 0;
+    
+    struct Node {
+        NodeId   id          = NONE;
+        NodeRef  parent      = NONE;
+        NodeRef  child_first = NONE;
+        ItemRef  items_first = NONE;
+        
+        index_t  n_children  = 0; // i.e. direct children
+        index_t  n_items     = 0; // i.e. all descendents
+        
+        NodeItem data        = NodeItem();
+    };
+    
+    typedef detail::GapBuffer<Node>     NodeBuffer;
+    typedef detail::GapBuffer<LeafItem> ItemBuffer;
+    
+    NodeBuffer           _nodes;
+    ItemBuffer           _items;
+    std::vector<NodeRef> _phys;     // physical position of each node, by id
+    std::vector<NodeId>  _free_ids;
+    // scratch space for item fixups: (node, logical offset of its first item)
+    std::vector<std::pair<NodeRef, size_t>> _walk;
+
+public:
+
+    /// Subtree handle type for this tree.
+    typedef ArraySubtree<NodeItem, LeafItem>      subtree_t;
+    /// Const subtree handle type for this tree.
+    typedef ConstArraySubtree<NodeItem, LeafItem> const_subtree_t;
+    
+    
+    /// Construct an empty ArrayTree.
+    ArrayTree() {
+        init_root();
+    }
+    
+    
+    /// Default move constructor.
+    ArrayTree(ArrayTree<NodeItem, LeafItem>&& other) = default;
+    
+    
+    /// Make a copy of the given tree.
+    ArrayTree(const ArrayTree<NodeItem, LeafItem>& other) = default;
+    
+    
+    /**
+     * @brief Construct a tree having a single root node, and copy the
+     * items in `[begin, end)` to it.
+     */
+    template <typename LeafItemIterator>
+    ArrayTree(LeafItemIterator begin, LeafItemIterator end) {
+        init_root();
+        root().insert_items(begin, end);
+    }
+    
+    
+    /// Construct a new tree from the given subtree.
+    ArrayTree(const ConstArraySubtree<NodeItem, LeafItem>& other) {
+        init_root();
+        *root() = *other;
+        root().copy_from(other);
+    }
+    
+    
+    /// Default move assignment.
+    ArrayTree& operator=(ArrayTree<NodeItem, LeafItem>&& other) = default;
+    
+    
+    /// Default copy assignment.
+    ArrayTree& operator=(const ArrayTree<NodeItem, LeafItem>& other) = default;
+    
+    
+    /// Get a subtree iterator to the root of this tree.
+    inline ArraySubtree<NodeItem, LeafItem> root() {
+        return ArraySubtree<NodeItem, LeafItem>(ROOT, this);
+    }
+    
+    
+    /// Get a const subtree iterator to the root of this tree.
+    inline ConstArraySubtree<NodeItem, LeafItem> root() const {
+        return ConstArraySubtree<NodeItem, LeafItem>(ROOT, this);
+    }
+    
+    
+    /**
+     * @brief Return an iterator to the first item in the tree (root),
+     * in sibling-contiguous order.
+     */
+    ArraySubtree<NodeItem, LeafItem> begin() {
+        return root();
+    }
+    
+    
+    /**
+     * @brief Return an iterator to the last (off-end) item in the tree,
+     * in sibling-contiguous order.
+     */
+    ArraySubtree<NodeItem, LeafItem> end() {
+        return ArraySubtree<NodeItem, LeafItem>(NONE, this);
+    }
+    
+    
+    /**
+     * @brief Return a const iterator to the first item in the tree (root),
+     * in sibling-contiguous order.
+     */
+    ConstArraySubtree<NodeItem, LeafItem> begin() const {
+        return root();
+    }
+    
+    
+    /**
+     * @brief Return a const iterator to the last (off-end) item in the tree,
+     * in sibling-contiguous order.
+     */
+    ConstArraySubtree<NodeItem, LeafItem> end() const {
+        return ConstArraySubtree<NodeItem, LeafItem>(NONE, this);
+    }
+    
+    
+    /**
+     * @brief Convert a ConstArraySubtree into an ArraySubtree by removing its constness.
+     *
+     * If the supplied ConstArraySubtree does not belong to this tree, then `end()` is returned.
+     */
+    inline ArraySubtree<NodeItem, LeafItem> subtree(ConstArraySubtree<NodeItem, LeafItem>& i) {
+        if (i._storage == this) {
+            return ArraySubtree<NodeItem, LeafItem>(i._id, this);
+        } else {
+            return end();
+        }
+    }
+    
+    
+    /// Total number of nodes in this tree.
+    inline size_t size() const {
+        return _nodes.size();
+    }
+    
+    
+    /// Total number of items in this tree.
+    inline size_t item_count() const {
+        return root_node().n_items;
+    }
+    
+    
+    /**
+     * @brief Ensure space for at least `n_nodes` nodes and `n_items` items in total,
+     * so that growing the tree to that size will not reallocate.
+     *
+     * Invalidates all `item_iterator`s.
+     */
+    void reserve(size_t n_nodes, size_t n_items) {
+        if (n_nodes > _nodes.size()) fix_nodes(_nodes.reserve(n_nodes - _nodes.size()));
+        if (n_items > _items.size()) fix_items(_items.reserve(n_items - _items.size()));
+    }
+    
+    
+    /**
+     * @brief Move the free space in the node and item arrays to their ends,
+     * so that the entire tree lies in memory exactly in order.
+     *
+     * This costs time proportional to the number of elements after the last
+     * edit. It is worth doing once after a tree is built and before it is
+     * heavily searched. Invalidates all `item_iterator`s.
+     */
+    void compact() {
+        fix_nodes(_nodes.move_to(_nodes.size()));
+        fix_items(_items.move_to(_items.size()));
+    }
+    
+    
+    /// Tree equality
+    bool operator==(const ArrayTree<NodeItem, LeafItem>& other) const {
+        if (this == &other) return true;
+        if (size()       != other.size())       return false;
+        if (item_count() != other.item_count()) return false;
+        
+        // the two trees may have their gaps in different places,
+        // so walk both in logical order.
+        for (size_t a = _items.first(), b = other._items.first();
+                a != _items.end();
+                a = _items.next(a), b = other._items.next(b)) {
+            if (_items.data[a] != other._items.data[b]) return false;
+        }
+        for (size_t a = _nodes.first(), b = other._nodes.first();
+                a != _nodes.end();
+                a = _nodes.next(a), b = other._nodes.next(b)) {
+            const Node& x =       _nodes.data[a];
+            const Node& y = other._nodes.data[b];
+            if (x.n_items    != y.n_items)    return false;
+            if (x.n_children != y.n_children) return false;
+            if (x.data       != y.data)       return false;
+        }
+        return true;
+    }
+    
+    
+    /// Tree inequality
+    bool operator!=(const ArrayTree<NodeItem, LeafItem>& other) const {
+        return not (*this == other);
+    }
+
+
+protected:
+
+    /*************************************
+     * Addressing                        *
+     *************************************/
+    
+    void init_root() {
+        _nodes.reserve(1);
+        _nodes.data[0] = Node();
+        _nodes.data[0].id = ROOT;
+        _nodes.gap_lo = 1;
+        _phys.assign(1, 0);
+    }
+    
+    inline const Node& root_node() const {
+        return _nodes.data[_phys[ROOT]];
+    }
+    
+    inline NodeId id_at(size_t p) const {
+        return p < _nodes.end() ? _nodes.data[p].id : NONE;
+    }
+    
+    // physical position just past the last child of `n`; the global end if `n` has none.
+    inline size_t child_end(const Node& n) const {
+        if (n.n_children == 0) return NONE;
+        return _nodes.phys(_nodes.logical(n.child_first) + n.n_children);
+    }
+    
+    // physical position just past the last item of `n`; the global end if `n` has none.
+    inline size_t items_end(const Node& n) const {
+        if (n.n_items == 0) return _items.end();
+        return _items.phys(_items.logical(n.items_first) + n.n_items);
+    }
+    
+    // compute the position of the node that follows `node`'s subtree in
+    // sibling-contiguous order; i.e. the start of the nearest populated child
+    // list to the right of `node`. this is where `node`'s children begin, or
+    // would begin if it had any. an `O(k * log(n))` operation.
+    size_t node_successor(size_t node) const {
+        const Node* d = _nodes.data.data();
+        size_t child  = node;
+        for (size_t anc = d[node].parent; anc != NONE; child = anc, anc = d[anc].parent) {
+            size_t off_end = child_end(d[anc]);
+            for (size_t c = _nodes.next(child); c != off_end; c = _nodes.next(c)) {
+                if (d[c].n_children > 0) return d[c].child_first;
+            }
+        }
+        return _nodes.end();
+    }
+    
+    // logical index of the first item of `node`; or if it is empty,
+    // of the place where its items would be inserted.
+    size_t item_offset(size_t node) const {
+        const Node* d = _nodes.data.data();
+        if (d[node].n_items > 0) return _items.logical(d[node].items_first);
+        size_t child = node;
+        for (size_t anc = d[node].parent; anc != NONE; child = anc, anc = d[anc].parent) {
+            size_t off_end = child_end(d[anc]);
+            for (size_t c = _nodes.next(child); c != off_end; c = _nodes.next(c)) {
+                if (d[c].n_items > 0) return _items.logical(d[c].items_first);
+            }
+        }
+        return _items.size();
+    }
+    
+    /*************************************
+     * Fixups                            *
+     *************************************/
+    
+    // a block of nodes has moved; repoint every reference into it, and
+    // every reference held by it to a node which did not move.
+    void fix_nodes(const typename NodeBuffer::Shift& s) {
+        if (s.lo == s.hi) return;
+        Node* d = _nodes.data.data();
+        size_t new_lo = s.lo + s.shift;
+        size_t new_hi = s.hi + s.shift;
+        auto moved = [&s](size_t p) { return p != NONE and p >= s.lo and p < s.hi; };
+        
+        // visit the moved nodes in the direction they moved, so that no node's new
+        // position is mistaken for the old position of one not yet visited.
+        size_t count = s.hi - s.lo;
+        for (size_t i = 0; i < count; ++i) {
+            size_t np = (s.shift > 0) ? new_hi - 1 - i : new_lo + i;
+            Node&  m  = d[np];
+            size_t op = np - s.shift;
+            _phys[m.id] = np;
+            if (m.parent != NONE) {
+                if (moved(m.parent)) {
+                    m.parent += s.shift;
+                } else if (d[m.parent].child_first == op) {
+                    // our parent stayed put, and we are its first child
+                    d[m.parent].child_first = np;
+                }
+            }
+            if (m.n_children > 0) {
+                if (moved(m.child_first)) m.child_first += s.shift;
+                // children which stayed put must be told where we went.
+                // (those which moved will fix their own parent link).
+                size_t c = m.child_first;
+                for (index_t k = 0; k < m.n_children; ++k, c = _nodes.next(c)) {
+                    if (c < new_lo or c >= new_hi) d[c].parent = np;
+                }
+            }
+        }
+    }
+    
+    // a block of items has moved; repoint the nodes whose first item was among them.
+    // those nodes are found by descending from the root through the
+    // subtrees whose items overlap the moved block.
+    void fix_items(const typename ItemBuffer::Shift& s) {
+        if (s.lo == s.hi) return;
+        Node*  d = _nodes.data.data();
+        size_t a = s.at;
+        size_t b = s.at + (s.hi - s.lo);
+        _walk.clear();
+        _walk.emplace_back(_phys[ROOT], 0);
+        while (not _walk.empty()) {
+            auto [p, offs] = _walk.back();
+            _walk.pop_back();
+            Node& n = d[p];
+            if (n.n_items == 0 or offs >= b or offs + n.n_items <= a) continue;
+            if (offs >= a) n.items_first += s.shift;
+            size_t c = n.child_first;
+            for (index_t k = 0; k < n.n_children; ++k, c = _nodes.next(c)) {
+                _walk.emplace_back(c, offs);
+                offs += d[c].n_items;
+            }
+        }
+    }
+    
+    /*************************************
+     * Editing                           *
+     *************************************/
+    
+    NodeId new_id() {
+        if (_free_ids.empty()) {
+            _phys.push_back(NONE);
+            return _phys.size() - 1;
+        }
+        NodeId id = _free_ids.back();
+        _free_ids.pop_back();
+        return id;
+    }
+    
+    // insert `k` new children of `parent` at logical position `at`, which must
+    // lie within or at either end of `parent`'s child list. `init(data, i)`
+    // fills in the i-th new node. returns the physical position of the first.
+    template <typename Init>
+    size_t insert_nodes(NodeId parent, size_t at, size_t k, Init&& init) {
+        fix_nodes(_nodes.reserve(k));
+        fix_nodes(_nodes.move_to(at));
+        
+        size_t first = _nodes.gap_lo;
+        size_t p     = _phys[parent];
+        Node*  d     = _nodes.data.data();
+        bool childless = d[p].n_children == 0;
+        bool at_front  = not childless and _nodes.logical(d[p].child_first) == at;
+        
+        for (size_t i = 0; i < k; ++i) {
+            Node& n  = d[first + i];
+            n        = Node();
+            n.id     = new_id();
+            n.parent = p;
+            _phys[n.id] = first + i;
+            init(n.data, i);
+        }
+        _nodes.gap_lo += k;
+        
+        Node& pn = d[p];
+        if (childless) {
+            // the first child inherits all of the parent's items
+            d[first].items_first = pn.items_first;
+            d[first].n_items     = pn.n_items;
+            pn.child_first       = first;
+        } else if (at_front) {
+            pn.child_first = first;
+        }
+        pn.n_children += k;
+        return first;
+    }
+    
+    // erase the nodes at logical positions `[a, b)`. the caller is responsible for
+    // unlinking them from the rest of the tree. returns the physical position
+    // formerly held by the first erased node.
+    size_t erase_nodes(size_t a, size_t b) {
+        fix_nodes(_nodes.move_to(a));
+        size_t gone = _nodes.gap_hi;
+        for (size_t p = gone; p < gone + (b - a); ++p) {
+            Node& n = _nodes.data[p];
+            _phys[n.id] = NONE;
+            _free_ids.push_back(n.id);
+            n = Node();
+        }
+        _nodes.gap_hi += b - a;
+        return gone;
+    }
+    
+    // remove all the descendents of `id`, leaving it in possession of their items.
+    void flatten(NodeId id) {
+        size_t p = _phys[id];
+        if (_nodes.data[p].n_children == 0) return;
+        // because of sibling-contiguous order,
+        // this is exactly all the descendents of `id`:
+        size_t a = _nodes.logical(_nodes.data[p].child_first);
+        size_t b = _nodes.logical(node_successor(p));
+        erase_nodes(a, b);
+        Node& n = _nodes.data[_phys[id]];
+        n.n_children  = 0;
+        n.child_first = NONE;
+    }
+    
+    // remove the childless, itemless node `id`. returns the node which
+    // followed it.
+    NodeId erase_leaf(NodeId id) {
+        size_t a      = _nodes.logical(_phys[id]);
+        NodeId parent = _nodes.data[_nodes.data[_phys[id]].parent].id;
+        size_t gone   = erase_nodes(a, a + 1);
+        Node&  pn     = _nodes.data[_phys[parent]];
+        pn.n_children -= 1;
+        if (pn.n_children == 0) {
+            pn.child_first = NONE;
+        } else if (pn.child_first == gone) {
+            // the next sibling is now first
+            pn.child_first = _nodes.gap_hi;
+        }
+        return id_at(_nodes.phys(a));
+    }
+    
+    // insert `k` items into the leaf `leaf` at logical item index `at`. `fill(dst)`
+    // writes the new items to the contiguous array `dst`. returns the physical
+    // position of the first new item.
+    template <typename Fill>
+    size_t insert_items(NodeId leaf, size_t at, size_t k, Fill&& fill) {
+        fix_items(_items.reserve(k));
+        fix_items(_items.move_to(at));
+        
+        size_t first     = _items.gap_lo;
+        // physical position of the item which was at `at`, which does not move:
+        size_t displaced = _items.gap_hi;
+        fill(_items.data.data() + first);
+        _items.gap_lo += k;
+        
+        // update ancestors' item counts and boundary items. if the new items were
+        // placed in front of an ancestor's first item, they become its first items.
+        Node* d = _nodes.data.data();
+        for (size_t p = _phys[leaf]; p != NONE; p = d[p].parent) {
+            Node& n = d[p];
+            if (n.n_items == 0 or n.items_first == displaced) n.items_first = first;
+            n.n_items += k;
+        }
+        return first;
+    }
+    
+    // erase the items at logical indices `[a, b)`, all of which belong to `leaf`.
+    void erase_items(NodeId leaf, size_t a, size_t b) {
+        size_t k = b - a;
+        if (k == 0) return;
+        fix_items(_items.move_to(a));
+        
+        size_t gone = _items.gap_hi;
+        for (size_t i = gone; i < gone + k; ++i) {
+            _items.data[i] = LeafItem();
+        }
+        _items.gap_hi += k;
+        
+        // ancestors whose first item was erased now begin with the item after the
+        // erased range (which must also be theirs, if they have any items left).
+        Node* d = _nodes.data.data();
+        for (size_t p = _phys[leaf]; p != NONE; p = d[p].parent) {
+            Node& n = d[p];
+            n.n_items -= k;
+            if (n.items_first == gone) {
+                n.items_first = (n.n_items > 0) ? _items.gap_hi : NONE;
+            }
+        }
+    }
+
+};
+
+
+/**
+ * @brief Base class for all iterators into ArrayTrees.
+ *
+ * Offers the same interface as SubtreeBase. An ArraySubtree's lifetime is
+ * valid no longer than the ArrayTree from which it came.
+ *
+ * Mutations to the source tree generally invalidate `end()` iterators, and any
+ * insertion or removal of items invalidates all `item_iterator`s.
+ *
+ * It is invalid to dereference, mutate, or increment an `end()` iterator.
+ */
+template <typename NodeItem, typename LeafItem, bool Const=true>
+class ArraySubtreeBase {
+
+protected:
+
+    typedef ArrayTree<NodeItem, LeafItem> Storage;
+    typedef typename Storage::Node        Node;
+    typedef typename Storage::NodeId      NodeId;
+    typedef typename std::conditional<
+            Const,
+            const Storage*,
+            Storage*>::type               StorageRef;
+    typedef typename std::conditional<
+            Const,
+            const Node&,
+            Node&>::type                  NodeReference;
+    
+    
+    StorageRef _storage = nullptr;
+    NodeId     _id      = Storage::NONE;
+    
+    
+    ArraySubtreeBase() {}
+    
+    // construct an iterator to a particular node
+    ArraySubtreeBase(NodeId id, StorageRef storage):
+        _storage(storage),
+        _id(id) {}
+
+public:
+
+    /// Self type. A ConstArraySubtree if this is a const iterator; an ArraySubtree otherwise.
+    typedef typename std::conditional<
+            Const,
+            ConstArraySubtree<NodeItem, LeafItem>,
+            ArraySubtree<NodeItem, LeafItem>
+        >::type self_t;
+    /// Const iterator to `LeafItem`s.
+    typedef detail::GapBufferIterator<LeafItem, true>  const_item_iterator;
+    /// A (possibly const) iterator to `LeafItem`s.
+    typedef detail::GapBufferIterator<LeafItem, Const> item_iterator;
+    
+    /// A (possibly const) iterator over subtrees.
+    typedef self_t iterator;
+    /// Const iterator over subtrees
+    typedef ConstArraySubtree<NodeItem, LeafItem> const_iterator;
+    /// The tree's `NodeItem` type
+    typedef NodeItem value_type;
+    /// A (possibly const) reference to the tree's `NodeItem` type
+    typedef typename std::conditional<
+            Const,
+            const NodeItem&,
+            NodeItem&
+        >::type reference;
+    /// A const reference to the tree's `NodeItem` type
+    typedef const NodeItem& const_reference;
+    /// A (possibly const) pointer to the tree's `NodeItem` type
+    typedef typename std::conditional<
+            Const,
+            const NodeItem*,
+            NodeItem*
+        >::type pointer;
+    /// Type of tree into which this iterator points.
+    typedef ArrayTree<NodeItem, LeafItem> tree_t;
+    /// Iterator difference type.
+    typedef std::ptrdiff_t difference_type;
+    /// Iterator category.
+    typedef std::bidirectional_iterator_tag iterator_category;
+    
+    
+    /**
+     * @brief A forward iterator over this type of subtree, which visits
+     * all the nodes which pass the supplied `TestFn`.
+     *
+     * Behaves as SubtreeBase::QueryIterator. Because the off-end subtree of the
+     * query root is a real node (the first node after its children), the
+     * iterator keeps its own record of having run out of results, and only then
+     * compares equal to that subtree.
+     *
+     * @tparam I The type of subtree to visit.
+     * @tparam BoundingFn A callable object which accepts an `I` and
+     * returns `true` if that subtree may contain items which pass `TestFn`.
+     * @tparam TestFn A callable object which accepts an `I` and returns
+     * `true` if that subtree should be visited by this `QueryIterator`.
+     */
+    template <typename I, typename Key, typename BoundingFn, typename TestFn>
+    class QueryIterator : public boost::iterator_facade<
+            QueryIterator<I, Key, BoundingFn, TestFn>,
+            I,
+            boost::forward_traversal_tag,
+            const I&> {
+        
+        friend class boost::iterator_core_access;
+        
+        I          _item;
+        I          _root;
+        Key        _key;
+        BoundingFn _bound;
+        TestFn     _test;
+        bool       _done = false;
+    
+    public:
+    
+        /// Construct a new QueryIterator.
+        QueryIterator(const I& start, const Key& key, BoundingFn bound, TestFn test):
+                _item(start),
+                _root(start),
+                _key(key),
+                _bound(bound),
+                _test(test) {
+            find_result();
+        }
+        
+        /// Return true if this iterator points to the subtree at `other`.
+        bool operator==(const I& other) const {
+            if (other == _root.end()) return _done;
+            return not _done and other == _item;
+        }
+        
+        /// Return true if this iterator does not point to the subtree at `other`.
+        bool operator!=(const I& other) const {
+            return not (*this == other);
+        }
+        
+        /// Find the next result at or beyond the subtree `other`.
+        QueryIterator& operator=(const I& other) {
+            _item = other;
+            _done = false;
+            find_result();
+            return *this;
+        }
+    
+    private:
+    
+        void next_candidate() {
+            if (_item.node_count() > 0 and _bound(_item, _key)) {
+                // descend into tree
+                _item = _item.begin();
+            } else if (_item == _root) {
+                finish();
+            } else {
+                // nothing further for us here. pop back out.
+                // while item is the last child of its parent, ascend:
+                I parent = _item.parent();
+                while (parent != _root and std::next(_item) == parent.end()) {
+                    _item  = parent;
+                    parent = _item.parent();
+                }
+                if (std::next(_item) == parent.end()) finish();
+                else ++_item;
+            }
+        }
+        
+        void finish() {
+            _item = _root.end();
+            _done = true;
+        }
+        
+        void find_result() {
+            while (not _done and not _test(_item, _key)) {
+                next_candidate();
+            }
+        }
+        
+        // iterator_facade:
+        
+        void increment() {
+            next_candidate();
+            find_result();
+        }
+        
+        bool equal(const QueryIterator& other) const {
+            return _done == other._done and _item == other._item;
+        }
+        
+        const I& dereference() const {
+            return _item;
+        }
+    
+    };
+    
+    /// Convenience test function for `query()` which returns `true` on all nodes.
+    template <typename Key>
+    static bool visit_all_nodes(const self_t& s, const Key& k)  { return true; }
+    /// Convenience test function for `query()` which returns `true` on all nodes with zero child nodes.
+    template <typename Key>
+    static bool visit_all_leaf_nodes(const self_t& s, const Key& k) { return s.node_count() == 0; }
+    
+    
+    /************************************
+     * Methods                          *
+     ************************************/
+
+public:
+
+    
+    /// Obtain the tree into which this iterator points.
+    inline typename std::conditional<Const, const tree_t&, tree_t&>::type
+    tree() const {
+        return *_storage;
+    }
+    
+    /**
+     * @brief Get the parent node.
+     *
+     * The parent of `tree()->root()` is `tree()->end()`.
+     */
+    inline self_t parent() const {
+        return at(node().parent);
+    }
+    
+    /// Return whether this node is the root of the entire tree.
+    inline bool is_root() const {
+        return _id == Storage::ROOT;
+    }
+    
+    /// `+i`: Become first child
+    inline self_t& operator+() {
+        _id = _storage->id_at(node().child_first);
+        return *static_cast<self_t*>(this);
+    }
+    
+    /// `-i`: Become parent
+    inline self_t& operator-() {
+        _id = _storage->id_at(node().parent);
+        return *static_cast<self_t*>(this);
+    }
+    
+    /// `++i`: Become next sibling
+    inline self_t& operator++() {
+        _id = _storage->id_at(_storage->_nodes.next(pos()));
+        return *static_cast<self_t*>(this);
+    }
+    
+    /// `--i`: Become previous sibling
+    inline self_t& operator--() {
+        _id = _storage->id_at(_storage->_nodes.prev(pos()));
+        return *static_cast<self_t*>(this);
+    }
+    
+    /// `i++`: Become next sibling
+    inline self_t operator++(int) {
+        self_t tmp = *static_cast<self_t*>(this);
+        ++(*this);
+        return tmp;
+    }
+    
+    /// `i--`: Become previous sibling
+    inline self_t operator--(int) {
+        self_t tmp = *static_cast<self_t*>(this);
+        --(*this);
+        return tmp;
+    }
+    
+    /// Returns `true` iff `other` points to the same node of the same tree.
+    inline bool operator==(const self_t& other) const {
+        return _id == other._id;
+    }
+    
+    /// Returns `true` iff `other` does not point to the same node of the same tree.
+    inline bool operator!=(const self_t& other) const {
+        return _id != other._id;
+    }
+    
+    /// `*i`: Get the value of the current node
+    inline reference operator*() const {
+        return node().data;
+    }
+    
+    /// `i->...`: Access member of current node
+    inline pointer operator->() const {
+        return &node().data;
+    }
+    
+    /// Number of direct child nodes
+    inline index_t node_count() const {
+        return node().n_children;
+    }
+    
+    /// Number of leaf items in this subtree
+    inline index_t item_count() const {
+        return node().n_items;
+    }
+    
+    /// Get first child
+    inline self_t begin() const {
+        return at(node().child_first);
+    }
+    
+    /// Get last (off-end) child
+    inline self_t end() const {
+        return at(_storage->child_end(node()));
+    }
+    
+    /// Get first object inside this subtree
+    inline item_iterator items_begin() const {
+        const Node& n = node();
+        return item_iterator(
+            &_storage->_items,
+            n.n_items > 0 ? n.items_first : _storage->_items.end());
+    }
+    
+    /**
+     * @brief Get last (off-end) object in this subtree.
+     * It is invalid to increment or dereference this iterator.
+     */
+    inline item_iterator items_end() const {
+        return item_iterator(&_storage->_items, _storage->items_end(node()));
+    }
+    
+    
+    /**
+     * @brief Return the first subtree in a sequence covering all the
+     * nodes in this subtree, beginning with the first child of this node.
+     */
+    inline self_t subtree_begin() const {
+        return node_count() > 0 ? begin() : subtree_end();
+    }
+    
+    
+    /**
+     * @brief Return the last (off-end) subtree in the sequence of all subtrees
+     * below this node.
+     */
+    inline self_t subtree_end() const {
+        return at(_storage->node_successor(pos()));
+    }
+    
+    
+    /**
+     * @brief Return an iterator to the first item in the entire tree
+     * (the global root).
+     *
+     * Alias for `this->tree().begin()`.
+     */
+    inline self_t global_begin() const {
+        return self_t(Storage::ROOT, _storage);
+    }
+    
+    /**
+     * @brief Return an iterator to the last item in the entire tree
+     * (the global off-end node).
+     *
+     * Alias for `this->tree().end()`.
+     */
+    inline self_t global_end() const {
+        return self_t(Storage::NONE, _storage);
+    }
+    
+    
+    /**
+     * @brief Find the direct parent node of item `i` in this subtree.
+     *
+     * Because the items of every subtree are a contiguous range, this
+     * descends directly to the parent in `O(k log n)` time.
+     *
+     * If `i` is not in the subtree under this node, then return `end()`.
+     */
+    self_t find_parent(const const_item_iterator& i) const {
+        const auto& items = _storage->_items;
+        const Node* d     = _storage->_nodes.data.data();
+        const Node* n     = &node();
+        if (n->n_items == 0 or i.index() >= items.end()) return this->end();
+        
+        size_t k  = items.logical(i.index());
+        size_t lo = items.logical(n->items_first);
+        if (k < lo or k >= lo + n->n_items) return this->end();
+        
+        while (n->n_children > 0) {
+            // the children's items are consecutive and in order.
+            size_t c = n->child_first;
+            for (index_t j = 0; j < n->n_children - 1; ++j, c = _storage->_nodes.next(c)) {
+                if (k < lo + d[c].n_items) break;
+                lo += d[c].n_items;
+            }
+            n = d + c;
+        }
+        return self_t(n->id, _storage);
+    }
+    
+    
+    /**
+     * @brief Find the direct parent node of item `i` in this subtree.
+     *
+     * Provided for compatibility with SubtreeBase. The item ranges of an ArrayTree
+     * locate the parent exactly, so `BoundingFn` is not needed, and this is
+     * equivalent to `find_parent(i)`.
+     */
+    template <bool BoundingFn(const NodeItem&, const LeafItem&)>
+    self_t find_parent(const const_item_iterator& i) const {
+        return find_parent(i);
+    }
+    
+    
+    /**
+     * @brief Return an iterator over all the subtrees for which `test(*subtree, key)` returns
+     * true. The iterator dereferences to `self_t`.
+     *
+     * The iterator's sequence finishes on this node's `end()` node.
+     * (`QueryIterator`s and subtree nodes can be compared directly).
+     *
+     * `visit_all_nodes()` and `visit_all_leaf_nodes()` are convenience static member
+     * functions of this class which can be passed to `test()`.
+     *
+     * @param bound A callable object which accepts a subtree as its first argument, and
+     * a `Key` as its second, and returns `true` if that subtree might contain objects
+     * which pass `test()` for that key. Children of subtrees which do not pass `bound()` will be skipped.
+     * @param test A callable object which accepts a subtree as its first argument and
+     * a `Key` as its second, and returns `true` if that subtree should be visited
+     * by the iterator. If omitted, all nodes which pass `bound()` will be visited.
+     */
+    template <typename Key, typename BoundingFn, typename TestFn>
+    inline QueryIterator<self_t, Key, BoundingFn, TestFn> query(
+            const Key& key,
+            BoundingFn bound,
+            TestFn test=visit_all_nodes<Key>) const {
+        return QueryIterator<self_t, Key, BoundingFn, TestFn>(
+            *static_cast<const self_t*>(this), key, bound, test);
+    }
+
+protected:
+
+    inline size_t pos() const {
+        return _storage->_phys[_id];
+    }
+    
+    inline NodeReference node() const {
+        return _storage->_nodes.data[pos()];
+    }
+    
+    inline self_t at(size_t p) const {
+        return self_t(_storage->id_at(p), _storage);
+    }
+    
+    // logical position at which to insert new children just before `insert_before`.
+    // returns false if `insert_before` is not a child or end-child of this node.
+    bool child_position(const self_t& insert_before, size_t* at) const {
+        const auto& nodes = _storage->_nodes;
+        const Node& n     = node();
+        if (insert_before._storage != _storage) return false;
+        if (insert_before == end()) {
+            *at = (n.n_children == 0)
+                ? nodes.logical(_storage->node_successor(pos()))
+                : nodes.logical(n.child_first) + n.n_children;
+            return true;
+        }
+        if (insert_before._id == Storage::NONE or
+                insert_before.is_root() or
+                insert_before.node().parent != pos()) {
+            return false;
+        }
+        *at = nodes.logical(insert_before.pos());
+        return true;
+    }
+    
+    // logical position at which to insert new items just before `insert_before`.
+    // returns false if this is not a leaf, or `insert_before` is not one of its items
+    // (or its end item).
+    bool item_position(const const_item_iterator& insert_before, size_t* at) const {
+        const auto& items = _storage->_items;
+        const Node& n     = node();
+        if (n.n_children > 0) return false;
+        if (n.n_items == 0) {
+            *at = _storage->item_offset(pos());
+            return true;
+        }
+        size_t lo = items.logical(n.items_first);
+        size_t k  = items.logical(std::min(insert_before.index(), items.end()));
+        if (k < lo or k > lo + n.n_items) return false;
+        *at = k;
+        return true;
+    }
+
+}; // class ArraySubtreeBase
+
+
+
+/**
+ * @brief A const iterator to a subtree of an ArrayTree.
+ */
+template <typename NodeItem, typename LeafItem>
+class ConstArraySubtree : public ArraySubtreeBase<NodeItem, LeafItem, true> {
+
+protected:
+
+    typedef ArraySubtreeBase<NodeItem, LeafItem, true> base_t;
+    using typename base_t::NodeId;
+    using typename base_t::StorageRef;
+    
+    friend class ArraySubtreeBase<NodeItem, LeafItem, true>;
+    friend class ArraySubtreeBase<NodeItem, LeafItem, false>;
+    friend class ArraySubtree<NodeItem, LeafItem>;
+    friend class ArrayTree<NodeItem, LeafItem>;
+    
+    ConstArraySubtree(NodeId id, StorageRef storage):
+        base_t(id, storage) {}
+
+public:
+
+    using typename base_t::iterator;
+    using typename base_t::const_iterator;
+    using typename base_t::item_iterator;
+    using typename base_t::const_item_iterator;
+    
+    ConstArraySubtree() {}
+    
+    /// Construct a duplicate iterator to the same node of the same tree.
+    ConstArraySubtree(const ConstArraySubtree<NodeItem, LeafItem>& other) = default;
+    
+    /// Construct a duplicate iterator to the same node of the same tree.
+    ConstArraySubtree(const ArraySubtree<NodeItem, LeafItem>& other):
+        base_t(other._id, other._storage) {}
+    
+    ConstArraySubtree& operator=(const ConstArraySubtree<NodeItem, LeafItem>& other) = default;
+
+};
+
+
+
+/**
+ * @brief A non-const iterator to a subtree of an ArrayTree.
+ *
+ * Offers the same mutation functions as Subtree, with the same semantics.
+ */
+template <typename NodeItem, typename LeafItem>
+class ArraySubtree : public ArraySubtreeBase<NodeItem, LeafItem, false> {
+
+protected:
+
+    typedef ArraySubtreeBase<NodeItem, LeafItem, false> base_t;
+    typedef typename base_t::Storage Storage;
+    typedef typename base_t::Node    Node;
+    using typename base_t::NodeId;
+    using typename base_t::StorageRef;
+    
+    friend class ArraySubtreeBase<NodeItem, LeafItem, false>;
+    friend class ConstArraySubtree<NodeItem, LeafItem>;
+    friend class ArrayTree<NodeItem, LeafItem>;
+    
+    ArraySubtree(NodeId id, StorageRef storage):
+        base_t(id, storage) {}
+
+public:
+
+    typedef ArraySubtree<NodeItem, LeafItem> self_t;
+    using typename base_t::iterator;
+    using typename base_t::const_iterator;
+    using typename base_t::item_iterator;
+    using typename base_t::const_item_iterator;
+    
+    
+    /// Construct a duplicate iterator to the same node of the same tree.
+    ArraySubtree(const ArraySubtree<NodeItem, LeafItem>& other) = default;
+    
+    ArraySubtree() {}
+    
+    ArraySubtree& operator=(const ArraySubtree<NodeItem, LeafItem>& other) = default;
+    
+    /// @name Mutation functions
+    /// @{
+    
+    
+    /**
+     * @brief Insert a new tree node under this one, to the left of
+     * `insert_before`.
+     *
+     * If this node was previously empty, then its new first child will
+     * contain all of its `LeafItem`s. Otherwise, the new node
+     * will be empty of any `LeafItem`s.
+     *
+     * If `insert_before` is the root node, or if `insert_before` is not
+     * a direct child (or end-child) of this node, then the tree is unaffected
+     * and `end()` is returned. Otherwise, the new node is returned.
+     *
+     * @param insert_before A subtree pointing to a child or
+     * end-child of this node.
+     * @param args Construction arguments for the new `NodeItem`.
+     * @return The newly created node, or `end()` if the node could not be
+     * created.
+     */
+    template <typename ... Args>
+    self_t insert_child_node(const self_t& insert_before, Args&& ... args) const {
+        size_t at;
+        if (not this->child_position(insert_before, &at)) return this->end();
+        size_t p = this->_storage->insert_nodes(this->_id, at, 1,
+            [&](NodeItem& data, size_t) {
+                data = NodeItem(std::forward<Args>(args)...);
+            });
+        return this->at(p);
+    }
+    
+    
+    /**
+     * @brief Convenience function to insert a new child node at the
+     * end of this node's children.
+     *
+     * @param obj NodeItem to insert into the new node.
+     */
+    inline self_t insert_child_node(const NodeItem& obj) const {
+        return insert_child_node(this->end(), obj);
+    }
+    
+    
+    /**
+     * @brief Insert new tree nodes to the left of `insert_before`,
+     * under this node. Return the first newly created node.
+     *
+     * If this node was previously empty, then its new first child will
+     * contain all its `LeafItem`s. All other new nodes will be empty of
+     * any `LeafItem`s.
+     *
+     * If `insert_before` is the root node, or if `insert_before` is not
+     * a child (or end-child) of this node, then the tree is unaffected and
+     * `end()` is returned. Likewise, if no new nodes were inserted,
+     * `end()` is returned. Otherwise, the first new node is returned.
+     *
+     * @param insert_before A subtree pointing to the sibling just
+     * after the last new node to be inserted.
+     * @param i_begin A forward iterator to the first NodeItem to be inserted.
+     * @param i_end A forward iterator just beyond the last NodeItem to be inserted.
+     * @return The first newly created node, or `end()` if no new nodes were created.
+     */
+    template <typename NodeItemIterator>
+    self_t insert_child_nodes(
+            const self_t& insert_before,
+            NodeItemIterator i_begin,
+            NodeItemIterator i_end) const {
+        size_t at;
+        size_t k = std::distance(i_begin, i_end);
+        if (k == 0 or not this->child_position(insert_before, &at)) return this->end();
+        size_t p = this->_storage->insert_nodes(this->_id, at, k,
+            [&](NodeItem& data, size_t) {
+                data = *i_begin;
+                ++i_begin;
+            });
+        return this->at(p);
+    }
+    
+    
+    /**
+     * @brief Convenience function to insert multiple new child nodes at the
+     * end of this node's children.
+     */
+    template <typename NodeItemIterator>
+    inline self_t insert_child_nodes(
+            NodeItemIterator i_begin,
+            NodeItemIterator i_end) const {
+        return insert_child_nodes(this->end(), i_begin, i_end);
+    }
+    
+    
+    /**
+     * @brief Insert an item under this node.
+     *
+     * The new item will be inserted before the item at `insert_before`,
+     * which must belong to this node; it is permissible for `insert_before`
+     * to be this node's `items_begin()` or `items_end()`. If this node is
+     * empty, `insert_before` is ignored.
+     *
+     * This must be a leaf node; i.e. one with no child nodes, so that
+     * placement of the new objects is not abiguous. If this is not a
+     * leaf node, or `insert_before` does not belong to it, the tree is unchanged.
+     *
+     * Invalidates all `item_iterator`s.
+     *
+     * @param insert_before Item belonging to this node which the new item
+     * is to be inserted before.
+     * @param args New `LeafItem` to be inserted, or constructor arguments
+     * for the new `LeafItem`.
+     *
+     * @return An iterator to the newly placed item if it was placed;
+     * `items_end()` otherwise.
+     */
+    template <typename ... Args>
+    item_iterator insert_item(
+            const const_item_iterator& insert_before,
+            Args&& ... args) const {
+        size_t at;
+        if (not this->item_position(insert_before, &at)) return this->items_end();
+        size_t p = this->_storage->insert_items(this->_id, at, 1,
+            [&](LeafItem* dst) {
+                *dst = LeafItem(std::forward<Args>(args)...);
+            });
+        return item_iterator(&this->_storage->_items, p);
+    }
+    
+    
+    /// Convenience function to insert a new item at the end.
+    inline item_iterator insert_item(const LeafItem& item) const {
+        return insert_item(this->items_end(), item);
+    }
+    
+    
+    /**
+     * @brief Insert multiple leaf items into this node.
+     *
+     * The new items will be inserted before the item at `insert_before`, in
+     * the same order. `insert_before` must belong to this node; it is
+     * permissible for `insert_before` to be the node's `items_begin()` or
+     * `items_end()`. If this node is empty, `insert_before` is ignored.
+     *
+     * This must be a leaf node; i.e. one with no child nodes, so that
+     * placement of the new objects is not abiguous. If this is not a
+     * leaf node, or `insert_before` does not belong to it, the tree is unchanged.
+     *
+     * Invalidates all `item_iterator`s.
+     *
+     * @param insert_before Item belonging to this node which the new items
+     * are to be inserted before.
+     * @param first_item Forward iterator to first `LeafItem` to be inserted.
+     * @param off_end_item Forward iterator just beyond the last `LeafItem`
+     * to be inserted.
+     * @param new_item_count Optional return pointer to receive the count
+     * of newly placed objects.
+     *
+     * @return An iterator to the first newly placed item if any were placed;
+     * `items_end()` otherwise.
+     */
+    template <typename LeafItemIterator>
+    item_iterator insert_items(
+            const const_item_iterator& insert_before,
+            LeafItemIterator first_item,
+            LeafItemIterator off_end_item,
+            index_t* new_item_count=nullptr) const {
+        size_t at;
+        size_t k = std::distance(first_item, off_end_item);
+        if (new_item_count) *new_item_count = 0;
+        if (k == 0 or not this->item_position(insert_before, &at)) return this->items_end();
+        size_t p = this->_storage->insert_items(this->_id, at, k,
+            [&](LeafItem* dst) {
+                std::copy(first_item, off_end_item, dst);
+            });
+        if (new_item_count) *new_item_count = k;
+        return item_iterator(&this->_storage->_items, p);
+    }
+    
+    
+    /**
+     * @brief Convenience function to insert multiple new items at
+     * the end of this node's item list.
+     */
+    template <typename LeafItemIterator>
+    inline item_iterator insert_items(
+            LeafItemIterator first_item,
+            LeafItemIterator off_end_item) const {
+        return insert_items(this->items_end(), first_item, off_end_item);
+    }
+    
+    
+    /**
+     * @brief Make a copy of `other_subtree` and insert it as a child of
+     * this node immediately before `insert_before`.
+     *
+     * `other_subtree` may belong to this tree, and may even contain this node.
+     *
+     * If `insert_before` is not a child or end-child of this node, the
+     * tree is unchanged and `end()` is returned.
+     *
+     * @param other_subtree The subtree to copy and adopt as a child.
+     * @param insert_before The child of this node before which to insert the new subtree.
+     * @return An iterator pointing at the root of the new adopted subtree.
+     */
+    self_t adopt(const const_iterator& other_subtree, const self_t& insert_before) const {
+        if (&other_subtree.tree() == this->_storage) {
+            // our own insertions would move the nodes and items we're
+            // copying out from under us. copy them somewhere safe first.
+            Storage tmp(other_subtree);
+            return adopt(tmp.root(), insert_before);
+        }
+        self_t new_node = insert_child_node(insert_before, *other_subtree);
+        if (new_node == this->end()) return new_node;
+        new_node.copy_from(other_subtree);
+        return new_node;
+    }
+    
+    
+    /**
+     * @brief Split this node into two sibling nodes.
+     *
+     * A new node will be created just before this one, under the same parent,
+     * and this node's items will be split between them according to the
+     * result of `compare(item, pivot)`: If the comparison is less than zero,
+     * the item will be moved to the left (new) node. Otherwise, it will
+     * remain in the right (existing) node.
+     *
+     * The split node must not be the root, must have no children, and must contain
+     * at least two items. If any of these is the case, the tree will not be changed
+     * and the off-end node will be returned.
+     *
+     * All iterators to the items under this node are invalidated by this operation.
+     *
+     * @param compare A callable object `compare(a,b)` which accepts a
+     * `LeafItem` as its left argument and a `P` as its right
+     * argument, and returns a signed number (negative for `a < b`,
+     * positive for `a > b`, zero for equality).
+     * @param pivot The value to compare items against.
+     * @param args Constructor arguments for the `NodeItem` object
+     * to be assigned to the newly-created (low) node.
+     *
+     * @return The newly created sibling, or the off-end node if this
+     *         is the root node or has child nodes.
+     */
+    template <typename Func, typename P, typename ... Args>
+    self_t split(Func compare, P pivot, Args&& ... args) const {
+        if (this->is_root() or this->node_count() > 0 or this->item_count() < 2) {
+            return this->end();
+        }
+        
+        Storage& s = *this->_storage;
+        self_t new_node = this->parent().insert_child_node(*this, std::forward<Args>(args)...);
+        
+        // our items must be contiguous in memory to partition them.
+        // if they straddle the gap, push the gap past them.
+        size_t n  = this->item_count();
+        size_t lo = s._items.logical(this->node().items_first);
+        if (s._items.gap_lo > lo and s._items.gap_lo < lo + n) {
+            s.fix_items(s._items.move_to(lo + n));
+        }
+        
+        Node& hi  = this->node();
+        Node& low = new_node.node();
+        LeafItem* b = s._items.data.data() + hi.items_first;
+        LeafItem* m = std::partition(b, b + n,
+            [&](const LeafItem& x) { return compare(x, pivot) < 0; });
+        size_t n_lo = m - b;
+        
+        // `low` lies just before `hi`, so it takes the front of the range.
+        // we didn't move any items across the boundary of the parent,
+        // so the ancestors' boundary items are unaffected.
+        low.n_items     = n_lo;
+        low.items_first = (n_lo > 0) ? hi.items_first : Storage::NONE;
+        hi.n_items      = n - n_lo;
+        hi.items_first  = (n_lo < n) ? hi.items_first + n_lo : Storage::NONE;
+        
+        return new_node;
+    }
+    
+    
+    /**
+     * @brief Remove an item from this subtree.
+     *
+     * If `item` is not in the subtree, or if this subtree is not a leaf
+     * node, the tree will be unchanged.
+     *
+     * Invalidates all `item_iterator`s.
+     *
+     * @param item The item to delete; a direct child of this node.
+     * @param success Optional return value pointer to be filled with `true`
+     * if the item was deleted; `false` if the tree is unchanged.
+     * @return An iterator pointing to the position of the item just beyond
+     * the one that was deleted. This will be `items_end()` if the
+     * deleted item was the last one in its parent node.
+     */
+    item_iterator erase(const item_iterator& item, bool* success=nullptr) const {
+        Storage&    s = *this->_storage;
+        const Node& n = this->node();
+        bool ok = false;
+        
+        if (n.n_children == 0 and n.n_items > 0 and item.index() < s._items.end()) {
+            // verify that the item actually belongs to us.
+            size_t k  = s._items.logical(item.index());
+            size_t lo = s._items.logical(n.items_first);
+            if (k >= lo and k < lo + n.n_items) {
+                s.erase_items(this->_id, k, k + 1);
+                ok = true;
+                if (this->item_count() > 0) {
+                    if (success) *success = true;
+                    return item_iterator(&s._items, s._items.phys(k));
+                }
+            }
+        }
+        
+        if (success) *success = ok;
+        return this->items_end();
+    }
+    
+    
+    /**
+     * @brief Empty this node of all child nodes and descendent items.
+     */
+    void clear() const {
+        flatten();
+        Storage& s = *this->_storage;
+        if (this->item_count() > 0) {
+            size_t a = s._items.logical(this->node().items_first);
+            s.erase_items(this->_id, a, a + this->item_count());
+        }
+    }
+    
+    
+    /**
+     * @brief Remove the subtree and its root at `child`, including all its leaf items.
+     *
+     * If `child` is not a direct child of this node, the tree is unchanged.
+     *
+     * @param child The child to remove.
+     * @param success An optional return value pointer; to be filled with `true`
+     * if the child was deleted; `false` if the tree is unchanged.
+     * @return An iterator pointing to the position of the node following the
+     * deleted one (which may be `end()`).
+     */
+    self_t erase(const self_t& child, bool* success=nullptr) const {
+        // child must be our child (and so must not be the global root)
+        if (child._storage != this->_storage or
+                child._id == Storage::NONE or
+                child.is_root() or
+                child.node().parent != this->pos()) {
+            if (success) *success = false;
+            return this->end();
+        }
+        
+        child.clear();
+        NodeId next = this->_storage->erase_leaf(child._id);
+        
+        if (success) *success = true;
+        return self_t(next, this->_storage);
+    }
+    
+    
+    /**
+     * @brief Recursively remove all the children of this node, and take
+     * ownership of all items beneath them.
+     */
+    void flatten() const {
+        this->_storage->flatten(this->_id);
+    }
+    
+    
+    /// @}   // Mutation functions group
+
+
+protected:
+
+    // append copies of the descendents and items of `src` beneath this (empty) node.
+    // we go depth-first, so that when building a fresh tree all the new nodes
+    // and items are placed at the end of their arrays, where the gaps are.
+    void copy_from(const const_iterator& src) const {
+        if (src.node_count() == 0) {
+            insert_items(src.items_begin(), src.items_end());
+            return;
+        }
+        self_t c = insert_child_nodes(src.begin(), src.end());
+        for (const_iterator sc = src.begin(); sc != src.end(); ++sc, ++c) {
+            c.copy_from(sc);
+        }
+    }
+
+}; // ArraySubtree
+
+
+
+/// @} // addtogroup storage
+
+} // namespace geom
@@ -0,0 +1,328 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+#include <geomc/geomc_defs.h>
+
+namespace geom {
+
+namespace detail {
+
+/****************************************
+ * Chunks                               *
+ ****************************************/
+
+// a fixed-size slab of memory, carved into blocks by a PoolArena.
+// chunks link together so that whole lists of them can change hands at once.
+struct alignas(std::max_align_t) PoolChunk {
+    static constexpr size_t Bytes = 64 * 1024;
+    
+    PoolChunk* next;
+};
+
+
+// each thread keeps the chunks of its dead arenas, so that new arenas on the
+// same thread can be built without touching the global allocator.
+//
+// arenas which outlive the cache (those owned by objects with static storage,
+// or by thread_locals constructed before it) must not touch it once it has been
+// destroyed; `acquire_local()` and `release_local()` fall back to the global
+// allocator in that case.
+struct PoolChunkCache {
+    static constexpr size_t MaxChunks = 64;
+    
+    enum class State : uint8_t {
+        Unborn,
+        Alive,
+        Dead
+    };
+    
+    PoolChunk* head  = nullptr;
+    size_t     count = 0;
+    
+    PoolChunkCache() {
+        state() = State::Alive;
+    }
+    
+    ~PoolChunkCache() {
+        free_list(head);
+        head  = nullptr;
+        count = 0;
+        state() = State::Dead;
+    }
+    
+    PoolChunk* acquire() {
+        if (head) {
+            PoolChunk* c = head;
+            head = c->next;
+            --count;
+            return c;
+        }
+        return static_cast<PoolChunk*>(::operator new(PoolChunk::Bytes));
+    }
+    
+    // take ownership of the `n` chunks in the list `[first ... last]`.
+    void release(PoolChunk* first, PoolChunk* last, size_t n) {
+        if (count + n <= MaxChunks) {
+            // splice the whole list in at once
+            last->next = head;
+            head       = first;
+            count     += n;
+        } else {
+            free_list(first);
+        }
+    }
+    
+    static void free_list(PoolChunk* first) {
+        while (first) {
+            PoolChunk* c = first;
+            first = c->next;
+            ::operator delete(c);
+        }
+    }
+    
+    // state of the current thread's cache. trivially destructible, so it
+    // can still be read while the thread's other thread_locals are destroyed.
+    static State& state() {
+        static thread_local State s = State::Unborn;
+        return s;
+    }
+    
+    static PoolChunkCache& local() {
+        static thread_local PoolChunkCache cache;
+        return cache;
+    }
+    
+    // acquire a chunk from the current thread's cache, if it is still alive.
+    static PoolChunk* acquire_local() {
+        if (state() == State::Dead) {
+            return static_cast<PoolChunk*>(::operator new(PoolChunk::Bytes));
+        }
+        return local().acquire();
+    }
+    
+    // release a list of chunks to the current thread's cache, if it is still alive.
+    static void release_local(PoolChunk* first, PoolChunk* last, size_t n) {
+        if (state() == State::Dead) {
+            free_list(first);
+        } else {
+            local().release(first, last, n);
+        }
+    }
+};
+
+
+/****************************************
+ * Arena                                *
+ ****************************************/
+
+// hands out small blocks from a list of chunks. freed blocks are kept on a free
+// list for their size class and reused; the chunks themselves are returned all
+// together when the arena is destroyed.
+class PoolArena {
+    
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+    
+    static constexpr size_t Granule   = alignof(std::max_align_t);
+    static constexpr size_t N_Classes = 32;
+    
+    PoolChunk* _first  = nullptr;
+    PoolChunk* _last   = nullptr;
+    size_t     _chunks = 0;
+    std::byte* _cursor = nullptr;
+    std::byte* _limit  = nullptr;
+    FreeBlock* _free[N_Classes] = {};
+    
+    static constexpr size_t size_class(size_t bytes) {
+        return (bytes + Granule - 1) / Granule;
+    }
+    
+    void new_chunk() {
+        PoolChunk* c = PoolChunkCache::acquire_local();
+        c->next = nullptr;
+        if (_last) _last->next = c;
+        else       _first      = c;
+        _last = c;
+        ++_chunks;
+        // blocks begin after the chunk's header, which is one granule wide.
+        _cursor = reinterpret_cast<std::byte*>(c) + sizeof(PoolChunk);
+        _limit  = reinterpret_cast<std::byte*>(c) + PoolChunk::Bytes;
+    }
+    
+public:
+    
+    /// Largest block (in bytes) served from the arena's chunks.
+    static constexpr size_t MaxBlock = Granule * (N_Classes - 1);
+    
+    PoolArena() = default;
+    PoolArena(const PoolArena&) = delete;
+    PoolArena& operator=(const PoolArena&) = delete;
+    
+    ~PoolArena() {
+        if (_first) PoolChunkCache::release_local(_first, _last, _chunks);
+    }
+    
+    /// Number of chunks held by this arena.
+    size_t chunk_count() const { return _chunks; }
+    
+    static constexpr bool serves(size_t bytes, size_t align) {
+        return bytes > 0 and bytes <= MaxBlock and align <= Granule;
+    }
+    
+    void* allocate(size_t bytes) {
+        size_t k = size_class(bytes);
+        if (FreeBlock* b = _free[k]) {
+            _free[k] = b->next;
+            return b;
+        }
+        size_t sz = k * Granule;
+        if (_cursor == nullptr or _cursor + sz > _limit) new_chunk();
+        void* p = _cursor;
+        _cursor += sz;
+        return p;
+    }
+    
+    void deallocate(void* p, size_t bytes) {
+        size_t k = size_class(bytes);
+        FreeBlock* b = static_cast<FreeBlock*>(p);
+        b->next  = _free[k];
+        _free[k] = b;
+    }
+    
+};
+
+} // namespace detail
+
+
+/** @addtogroup storage
+ *  @{
+ */
+
+/**
+ * @brief A standard allocator which carves node-sized blocks out of large,
+ * thread-cached chunks of memory.
+ *
+ * Node-based containers such as `std::list` (and therefore Tree) make one
+ * allocation per element. Under a multithreaded workload, those calls contend
+ * on the global heap. A `PoolAllocator` instead draws its blocks from an arena
+ * of 64 KiB chunks; blocks which are freed are kept by the arena for reuse,
+ * and when the last allocator sharing the arena is destroyed, all of its
+ * chunks are released at once to a cache belonging to the current thread,
+ * where new arenas on that thread will find them.
+ *
+ * Copies of an allocator share its arena, and compare equal. A
+ * default-constructed allocator makes a new arena. Copying a container
+ * makes a new arena for the copy (see `select_on_container_copy_construction()`),
+ * so that each container owns the memory of its elements; moving or swapping
+ * containers carries the arena along with the elements.
+ *
+ * Requests which are larger than `detail::PoolArena::MaxBlock` bytes, or which
+ * are over-aligned, are passed to the global `operator new`. The pool therefore
+ * suits node-based containers such as `Tree`; a container backed by one growing
+ * array, such as `KDTree` or `std::vector`, only benefits while it is small.
+ *
+ * An arena must not be used from more than one thread at once. This is
+ * already the case for containers which are not themselves shared between
+ * threads.
+ *
+ * Example:
+ *
+ *     Tree<Rect3d, Vec3d, PoolAllocator<Vec3d>> tree;
+ *
+ * @tparam T Type of object to allocate.
+ */
+template <typename T>
+class PoolAllocator {
+    
+    template <typename U> friend class PoolAllocator;
+    
+    std::shared_ptr<detail::PoolArena> _arena;
+    
+public:
+    
+    typedef T value_type;
+    typedef std::false_type is_always_equal;
+    typedef std::true_type  propagate_on_container_move_assignment;
+    typedef std::true_type  propagate_on_container_swap;
+    typedef std::false_type propagate_on_container_copy_assignment;
+    
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U> other;
+    };
+    
+    /// Construct an allocator with a new, empty arena.
+    PoolAllocator():
+        _arena(std::make_shared<detail::PoolArena>()) {}
+    
+    /// Construct an allocator sharing the arena of `other`.
+    // (there is deliberately no move constructor; a container which has been
+    // moved from must still be able to allocate.)
+    PoolAllocator(const PoolAllocator& other) noexcept = default;
+    
+    /// Share the arena of `other`.
+    PoolAllocator& operator=(const PoolAllocator& other) noexcept = default;
+    
+    /// Construct an allocator sharing the arena of `other`.
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) noexcept:
+        _arena(other._arena) {}
+    
+    /// Allocate uninitialized storage for `n` objects of type `T`.
+    T* allocate(size_t n) {
+        size_t bytes = n * sizeof(T);
+        if (detail::PoolArena::serves(bytes, alignof(T))) {
+            return static_cast<T*>(_arena->allocate(bytes));
+        }
+        if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            return static_cast<T*>(::operator new(bytes, std::align_val_t(alignof(T))));
+        } else {
+            return static_cast<T*>(::operator new(bytes));
+        }
+    }
+    
+    /// Release the storage for `n` objects at `p`, obtained from `allocate(n)`.
+    void deallocate(T* p, size_t n) noexcept {
+        size_t bytes = n * sizeof(T);
+        if (detail::PoolArena::serves(bytes, alignof(T))) {
+            _arena->deallocate(p, bytes);
+        } else if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            ::operator delete(p, std::align_val_t(alignof(T)));
+        } else {
+            ::operator delete(p);
+        }
+    }
+    
+    /// A copied container gets an arena of its own.
+    PoolAllocator select_on_container_copy_construction() const {
+        return PoolAllocator();
+    }
+    
+    /// Number of 64 KiB chunks held by this allocator's arena.
+    size_t chunk_count() const {
+        return _arena->chunk_count();
+    }
+    
+    /// Allocators are equal if they share an arena.
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const {
+        return _arena == other._arena;
+    }
+    
+    /// Allocators are unequal if they do not share an arena.
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const {
+        return _arena != other._arena;
+    }
+    
+};
+
+/// @} // addtogroup storage
+
+} // namespace geom
@@ -2,6 +2,7 @@
 #include <geomc/geomc_defs.h>
 #include <geomc/Templates.h>
 #include <list>
+#include <memory>
 #include <type_traits>
 
 // todo: t.query<Key, BoundingFn(k,node), MatchingFn(k,item)>(Key k) -> item_iterator (derived)
@@ -16,17 +17,10 @@
 //         - t.query<Key, BoundingFn(k,node), MatchingFn(k,node)>(Key k) -> node_iterator (derived)
 //       *** consider what happens if the tree is mutated underneath you
 // todo: permit key/value structure. use BoundingFn for search.
-// todo: permit a distance metric; allow KNN.
-//       >> implement as a free function.
+// (distance-ordered / KNN search is in TreeSearch.h, as a free function.)
 // todo: consider factoring the above simply as free functions which implement algorithms.
 // todo: specialize for when leaf items or node items are void
 // todo: smarter/more optimized underlying data structure
-// todo: "flat array" variant tree. abstract NodeRef and ItemRef to be ptrs.
-// todo: might be good to implement take(subtree) which removes 
-//       the subtree from its source and adopts it. if it belongs to the
-//       same tree, a copy could be avoided. be sure to permit the case
-//       of re-rooting (i.e. root().take(some_descendent_of_self)).
-//       generally only cheap if `list` permits slicing and splicing.
 // todo: it is not possible to have an empty tree. (can have zero items, but must have one node).
 
 // todo: get the docs correct about what end() and begin() iterators are invalidated.
@@ -63,7 +57,7 @@
 //     > ...which is probably OK.
 
 // ...OR:
-//   - an R-tree "has a" Tree, not "is a" tree.
+//   - an R-tree "has a" Tree, not "is a" tree. (this is the scheme shape/RTree.h took.)
 //   - R-tree has insert(item), erase({item,node}_iterator), find(item), find_parent(item)
 //     which return iterators, and call the tree iterators.
 //     - uses Bound(item) -> Boundary
@@ -84,9 +78,14 @@ namespace geom {
 
 
 // forward decls
-template <typename NodeItem, typename LeafItem, bool Const> class SubtreeBase;
-template <typename NodeItem, typename LeafItem> class Subtree;
-template <typename NodeItem, typename LeafItem> class ConstSubtree;
+template <typename NodeItem, typename LeafItem, typename Allocator=std::allocator<LeafItem>>
+class Tree;
+template <typename NodeItem, typename LeafItem, bool Const=true, typename Allocator=std::allocator<LeafItem>>
+class SubtreeBase;
+template <typename NodeItem, typename LeafItem, typename Allocator=std::allocator<LeafItem>>
+class Subtree;
+template <typename NodeItem, typename LeafItem, typename Allocator=std::allocator<LeafItem>>
+class ConstSubtree;
 
 
 /**
@@ -126,29 +125,44 @@ which produces nodes in this order:
 In this manner, a subtree may be distant from its root, but that entire
 subtree is contiguous. This also preserves the contiguousness of siblings.
 
+A subtree can be moved without copying by `Subtree::take()`. Only a move within
+one tree meets the `O(k * d)` bound (for `k` the arity and `d` the depth of the
+tree). Each tree keeps its own node and item lists, so moving a subtree between
+two trees also costs time proportional to the number of nodes and items moved.
+
 @tparam NodeItem Type of data to be kept with internal tree nodes.
 @tparam LeafItem Type of data to be kept by leaf nodes.
+@tparam Allocator Allocator for the tree's nodes and items. It is rebound
+for each. Every tree holds one copy of it, shared by both; see PoolAllocator
+for an allocator which avoids a trip to the global heap for each node.
 */
-template <typename NodeItem, typename LeafItem>
+template <typename NodeItem, typename LeafItem, typename Allocator>
 class Tree {
     
-    friend class SubtreeBase<NodeItem, LeafItem, true>;
-    friend class SubtreeBase<NodeItem, LeafItem, false>;
-    friend class ConstSubtree<NodeItem, LeafItem>;
-    friend class Subtree<NodeItem, LeafItem>;
+    friend class SubtreeBase<NodeItem, LeafItem, true, Allocator>;
+    friend class SubtreeBase<NodeItem, LeafItem, false, Allocator>;
+    friend class ConstSubtree<NodeItem, LeafItem, Allocator>;
+    friend class Subtree<NodeItem, LeafItem, Allocator>;
     
     struct Node;
     
-    typedef typename std::list<Node>::iterator           NodeRef;
-    typedef typename std::list<LeafItem>::iterator       ItemRef;
-    typedef typename std::list<LeafItem>::const_iterator ConstItemRef;
+    typedef std::allocator_traits<Allocator> alloc_traits;
+    typedef typename alloc_traits::template rebind_alloc<Node>     NodeAlloc;
+    typedef typename alloc_traits::template rebind_alloc<LeafItem> ItemAlloc;
+    typedef std::list<Node,     NodeAlloc>  NodeList;
+    typedef std::list<LeafItem, ItemAlloc>  ItemList;
+    
+    typedef typename NodeList::iterator       NodeRef;
+    typedef typename NodeList::const_iterator ConstNodeRef;
+    typedef typename ItemList::iterator       ItemRef;
+    typedef typename ItemList::const_iterator ConstItemRef;
     
     struct Node {
         
         Node() {}
         
         template <typename ... Args>
-        Node(Tree<NodeItem, LeafItem>* storage,
+        Node(Tree<NodeItem, LeafItem, Allocator>* storage,
              NodeRef parent,
              Args&& ... args):
                 parent(parent),
@@ -173,19 +187,33 @@ class Tree {
         
     };
     
-    std::list<Node>     _nodes;
-    std::list<LeafItem> _items;
+    NodeList _nodes;
+    ItemList _items;
     
 public:
     
+    /// Mutable subtree type.
+    typedef Subtree<NodeItem, LeafItem, Allocator>      subtree_t;
+    /// Const subtree type.
+    typedef ConstSubtree<NodeItem, LeafItem, Allocator> const_subtree_t;
+    
+    /// Type of allocator used by this Tree.
+    typedef Allocator allocator_type;
+    
     /// Construct an empty Tree.
-    Tree() {
+    Tree(): Tree(Allocator()) {}
+    
+    
+    /// Construct an empty Tree which uses the allocator `alloc`.
+    explicit Tree(const Allocator& alloc):
+            _nodes(NodeAlloc(alloc)),
+            _items(ItemAlloc(alloc)) {
         _nodes.push_back(Node(this, _nodes.end()));
     }
     
     
     /// Default move constructor.
-    Tree(Tree<NodeItem, LeafItem>&& other) = default;
+    Tree(Tree<NodeItem, LeafItem, Allocator>&& other) = default;
     
     
     /**
@@ -193,7 +221,9 @@ public:
      * items in `[begin, end)` to it.
      */
     template <typename LeafItemIterator>
-    Tree(LeafItemIterator begin, LeafItemIterator end) {
+    Tree(LeafItemIterator begin, LeafItemIterator end, const Allocator& alloc=Allocator()):
+            _nodes(NodeAlloc(alloc)),
+            _items(ItemAlloc(alloc)) {
         // load items
         _items.assign(begin, end);
         
@@ -202,42 +232,53 @@ public:
         NodeRef node = _nodes.begin();
         
         // assign items to root
-        node->items_first = _items.begin();
-        node->items_last  = _items.end(); --(node->items_last);
-        node->n_items     = _nodes.size();
+        if (not _items.empty()) {
+            node->items_first = _items.begin();
+            node->items_last  = _items.end(); --(node->items_last);
+            node->n_items     = _items.size();
+        }
     }
     
     
     /// Make a copy of the given tree.
-    Tree(const Tree<NodeItem, LeafItem>& other):
-            _nodes(other._nodes),
-            _items(other._items) {
-        recalculate_tree();
+    Tree(const Tree<NodeItem, LeafItem, Allocator>& other):
+            Tree(other, alloc_traits::select_on_container_copy_construction(other.get_allocator())) {}
+    
+    
+    /// Make a copy of the given tree, using the allocator `alloc`.
+    Tree(const Tree<NodeItem, LeafItem, Allocator>& other, const Allocator& alloc):
+            _nodes(NodeAlloc(alloc)),
+            _items(ItemAlloc(alloc)) {
+        copy_root(*other._nodes.begin());
     }
     
     
     /// Construct a new tree from the given subtree.
-    Tree(const ConstSubtree<NodeItem, LeafItem>& other):
-            _nodes(other.subtree_begin(), other.subtree_end()),
-            _items(other.items_begin(), other.items_end()) {
-        // make a root (we only added the children)
-        _nodes.push_front(*other._root);
-        recalculate_tree();
+    Tree(const ConstSubtree<NodeItem, LeafItem, Allocator>& other, const Allocator& alloc=Allocator()):
+            _nodes(NodeAlloc(alloc)),
+            _items(ItemAlloc(alloc)) {
+        copy_root(*other._root);
     }
     
     
     // xxx: Todo: make a constructor which populates the NodeItem
     
     
+    /// Return a copy of the allocator used by this tree.
+    inline Allocator get_allocator() const {
+        return Allocator(_items.get_allocator());
+    }
+    
+    
     /// Get a subtree iterator to the root of this tree.
-    inline Subtree<NodeItem, LeafItem> root() {
-        return Subtree<NodeItem, LeafItem>(_nodes.begin(), this);
+    inline Subtree<NodeItem, LeafItem, Allocator> root() {
+        return Subtree<NodeItem, LeafItem, Allocator>(_nodes.begin(), this);
     }
     
     
     /// Get a const subtree iterator to the root of this tree.
-    inline ConstSubtree<NodeItem, LeafItem> root() const {
-        return ConstSubtree<NodeItem, LeafItem>(_nodes.begin(), this);
+    inline ConstSubtree<NodeItem, LeafItem, Allocator> root() const {
+        return ConstSubtree<NodeItem, LeafItem, Allocator>(_nodes.begin(), this);
     }
     
     
@@ -245,7 +286,7 @@ public:
      * @brief Return an iterator to the first item in the tree (root), 
      * in sibling-contiguous order.
      */
-    Subtree<NodeItem, LeafItem> begin() {
+    Subtree<NodeItem, LeafItem, Allocator> begin() {
         return root();
     }
     
@@ -254,8 +295,8 @@ public:
      * @brief Return an iterator to the last (off-end) item in the tree, 
      * in sibling-contiguous order.
      */
-    Subtree<NodeItem, LeafItem> end() {
-        return Subtree<NodeItem, LeafItem>(_nodes.end(), this);
+    Subtree<NodeItem, LeafItem, Allocator> end() {
+        return Subtree<NodeItem, LeafItem, Allocator>(_nodes.end(), this);
     }
     
     
@@ -263,7 +304,7 @@ public:
      * @brief Return a const iterator to the first item in the tree (root), 
      * in sibling-contiguous order.
      */
-    ConstSubtree<NodeItem, LeafItem> begin() const {
+    ConstSubtree<NodeItem, LeafItem, Allocator> begin() const {
         return root();
     }
     
@@ -272,8 +313,8 @@ public:
      * @brief Return a const iterator to the last (off-end) item in the tree, 
      * in sibling-contiguous order.
      */
-    ConstSubtree<NodeItem, LeafItem> end() const {
-        return ConstSubtree<NodeItem, LeafItem>(_nodes.end(), this);
+    ConstSubtree<NodeItem, LeafItem, Allocator> end() const {
+        return ConstSubtree<NodeItem, LeafItem, Allocator>(_nodes.end(), this);
     }
     
     
@@ -285,9 +326,10 @@ public:
      *
      * If the supplied ConstSubtree does not belong to this Tree, then `end()` is returned.
      */
-    inline Subtree<NodeItem, LeafItem> subtree(ConstSubtree<NodeItem, LeafItem>& i) {
+    inline Subtree<NodeItem, LeafItem, Allocator> subtree(ConstSubtree<NodeItem, LeafItem, Allocator>& i) {
         if (i._storage == this) {
-            return Subtree<NodeItem, LeafItem>(i._root, this);
+            // an empty erase() converts a const list iterator to a mutable one.
+            return Subtree<NodeItem, LeafItem, Allocator>(_nodes.erase(i._root, i._root), this);
         } else {
             return end();
         }
@@ -308,88 +350,125 @@ public:
     
     
     /// Tree equality
-    bool operator==(const Tree<NodeItem, LeafItem>& other) const {
+    bool operator==(const Tree<NodeItem, LeafItem, Allocator>& other) const {
         if (this == &other) return true;
         if (item_count() != other.item_count()) return false;
         if (_items       != other._items)       return false;
         
         // because the references will point to different memory,
         // we can't compare raw data. we have to examine the structure of the tree.
-        auto a_n =       _nodes.begin();
-        auto b_n = other._nodes.begin();
-        for (; a_n != _nodes.end() and b_n != other._nodes.end(); ++a_n, ++b_n) {
-            if (a_n->n_items    != b_n->n_items)    return false;
-            if (a_n->n_children != b_n->n_children) return false;
-            if (a_n->data       != b_n->data)       return false;
-        }
-        
-        // must have same total number of nodes; not just a matching prefix subtree.
-        // we don't check item_count() beforehand because it may not be stored, 
-        // and will thus doubly incur the linear cost we have pay above.
-        if (not (a_n == _nodes.end() and b_n == other._nodes.end())) return false;
-        
-        return true;
+        // (the order of the node lists may differ, even between equal trees).
+        if (_nodes.size() != other._nodes.size()) return false;
+        return equal_subtrees(*_nodes.begin(), *other._nodes.begin());
     }
     
     
     /// Tree inequality
-    bool operator!=(const Tree<NodeItem, LeafItem>& other) const {
+    bool operator!=(const Tree<NodeItem, LeafItem, Allocator>& other) const {
         return not (*this == other);
     }
     
     
 protected:
     
-    inline void recalculate_tree() {
-        NodeRef n = _nodes.begin();
-        n->child_first = std::next(n);
-        n->child_last  = _nodes.end(); --(n->child_last);
-        n->items_first = _items.begin();
-        n->items_last  = _items.end(); --(n->items_last);
-        root().recalculate_references();
+    static bool equal_subtrees(const Node& a, const Node& b) {
+        if (a.n_items    != b.n_items)    return false;
+        if (a.n_children != b.n_children) return false;
+        if (a.data       != b.data)       return false;
+        NodeRef a_c = a.child_first;
+        NodeRef b_c = b.child_first;
+        for (index_t i = 0; i < a.n_children; ++i, ++a_c, ++b_c) {
+            if (not equal_subtrees(*a_c, *b_c)) return false;
+        }
+        return true;
+    }
+    
+    
+    // make a copy of `src` (a node of another tree) the root of this
+    // (empty) tree, and copy its descendents and items beneath it.
+    inline void copy_root(const Node& src) {
+        NodeRef root = _nodes.insert(_nodes.end(), src);
+        root->parent = _nodes.end();
+        copy_descendents(src, root);
+    }
+    
+    
+    // append copies of the descendents of `src` to this tree beneath `dst`, 
+    // a copy of `src`. the copy is made in sibling-contiguous order, and its
+    // leaves take their items in turn; this makes no assumption about the 
+    // layout of the source tree, which may have been edited into any order
+    // which keeps siblings and subtrees contiguous.
+    void copy_descendents(const Node& src, NodeRef dst) {
+        dst->child_first = dst->child_last = _nodes.end();
+        dst->items_first = dst->items_last = _items.end();
+        if (src.n_children > 0) {
+            // siblings first...
+            NodeRef s = src.child_first;
+            for (index_t i = 0; i < src.n_children; ++i, ++s) {
+                NodeRef c = _nodes.insert(_nodes.end(), *s);
+                c->parent = dst;
+                if (i == 0) dst->child_first = c;
+                dst->child_last = c;
+            }
+            // ...then each of their subtrees
+            NodeRef c = dst->child_first;
+            s = src.child_first;
+            for (index_t i = 0; i < src.n_children; ++i, ++s, ++c) {
+                copy_descendents(*s, c);
+                if (c->n_items > 0) {
+                    if (dst->items_first == _items.end()) dst->items_first = c->items_first;
+                    dst->items_last = c->items_last;
+                }
+            }
+        } else if (src.n_items > 0) {
+            dst->items_first = _items.insert(
+                _items.end(),
+                src.items_first,
+                std::next(src.items_last));
+            dst->items_last = std::prev(_items.end());
+        }
+    }
+    
+    
+    // add `delta_items` to the item count of `n` and each of its ancestors,
+    // and recompute their edge items from their children. `O(k * depth)`, 
+    // for `k` the arity. used when a whole subtree has been attached or detached.
+    void update_item_counts(NodeRef n, index_t delta_items) {
+        for (; n != _nodes.end(); n = n->parent) {
+            n->n_items += delta_items;
+            if (n->n_items == 0) {
+                n->items_first = n->items_last = _items.end();
+            } else if (n->n_children > 0) {
+                bool found = false;
+                NodeRef c = n->child_first;
+                for (index_t i = 0; i < n->n_children; ++i, ++c) {
+                    if (c->n_items == 0) continue;
+                    if (not found) n->items_first = c->items_first;
+                    n->items_last = c->items_last;
+                    found = true;
+                }
+            }
+        }
     }
     
     
     // called when a leaf node adds or removes one or more of its edge items.
     // the edge items for the anscestors potentially need to be updated to
-    // include/exclude the affected items.
+    // include/exclude the affected items. an ancestor's edge item may come
+    // from any of its children, so each is recomputed from its children.
     void update_boundary_items(
             NodeRef leaf,
             ItemRef new_first,
             ItemRef new_last,
             index_t delta_items) {
-        
-        NodeRef prev_child = _nodes.end();
-        NodeRef n = leaf;
-        
-        ItemRef old_first = n->items_first;
-        ItemRef old_last  = n->items_last;
-        
-        // update ancestors' item count and boundary items
-        while (n != _nodes.end()) {
-            n->n_items += delta_items;
-            
-            if (n->n_items == 0) {
-                n->items_first = n->items_last = _items.end();
-            } else {
-                // If we ascended from an edge node, that node certainly
-                // controls (or used to control) our edge item. 
-                // But it might have also controlled our edge item if the 
-                // edge sibling doesn't have any items. In this case,
-                // its previous edge item will also be ours.
-                if (n->child_first == prev_child or 
-                        n->items_first == old_first) {
-                    n->items_first = new_first;
-                }
-                if (n->child_last == prev_child or
-                        n->items_last == old_last) {
-                    n->items_last = new_last;
-                }
-            }
-            
-            prev_child = n;
-            n = n->parent;
+        leaf->n_items += delta_items;
+        if (leaf->n_items == 0) {
+            leaf->items_first = leaf->items_last = _items.end();
+        } else {
+            leaf->items_first = new_first;
+            leaf->items_last  = new_last;
         }
+        update_item_counts(leaf->parent, delta_items);
     }
     
 };
@@ -406,16 +485,23 @@ protected:
  *
  * It is invalid to dereference, mutate, or increment an end() iterator.
  */
-template <typename NodeItem, typename LeafItem, bool Const=true>
+template <typename NodeItem, typename LeafItem, bool Const, typename Allocator>
 class SubtreeBase {
     
 protected:
     
-    typedef Tree<NodeItem, LeafItem>  Storage;
-    typedef typename Storage::NodeRef NodeRef;
-    typedef typename Storage::ItemRef ItemRef;
-    typedef typename Storage::ItemRef ConstItemRef;
-    typedef typename Storage::Node    Node;
+    typedef Tree<NodeItem, LeafItem, Allocator>  Storage;
+    // a ConstSubtree points into a const Tree, so it holds const list iterators.
+    typedef typename std::conditional<
+            Const,
+            typename Storage::ConstNodeRef,
+            typename Storage::NodeRef>::type  NodeRef;
+    typedef typename std::conditional<
+            Const,
+            typename Storage::ConstItemRef,
+            typename Storage::ItemRef>::type  ItemRef;
+    typedef typename Storage::ConstItemRef    ConstItemRef;
+    typedef typename Storage::Node            Node;
     typedef typename std::conditional<
             Const,
             const Storage*,
@@ -438,8 +524,8 @@ public:
     /// Self type. A ConstSubtree if this is a const iterator; a Subtree otherwise.
     typedef typename std::conditional<
             Const,
-            ConstSubtree<NodeItem, LeafItem>,
-            Subtree<NodeItem, LeafItem>
+            ConstSubtree<NodeItem, LeafItem, Allocator>,
+            Subtree<NodeItem, LeafItem, Allocator>
         >::type self_t;
     /// Const iterator to `LeafItem`s.
     typedef ConstItemRef    const_item_iterator;
@@ -453,7 +539,7 @@ public:
     /// A (possibly const) iterator over subtrees.
     typedef self_t iterator;
     /// Const iterator over subtrees
-    typedef ConstSubtree<NodeItem, LeafItem>  const_iterator;
+    typedef ConstSubtree<NodeItem, LeafItem, Allocator>  const_iterator;
     /// The tree's `NodeItem` type
     typedef NodeItem value_type;
     /// A (possibly const) reference to the tree's `NodeItem` type
@@ -471,7 +557,7 @@ public:
             NodeItem*
         >::type pointer;
     /// Type of tree into which this iterator points.
-    typedef Tree<NodeItem, LeafItem> tree_t;
+    typedef Tree<NodeItem, LeafItem, Allocator> tree_t;
     /// Iterator difference type.
     typedef typename std::iterator_traits<NodeRef>::difference_type difference_type;
     /// Iterator category.
@@ -486,6 +572,11 @@ public:
      * as such it supports standard forward iterator semantics and operators
      * like `++i`, `i->xxx`, and `*i`.
      *
+     * The off-end subtree of the query root is generally a real node (in
+     * sibling-contiguous order, the node after the root's last child is
+     * usually its first grandchild), so the iterator keeps its own record of
+     * having run out of results, and only then compares equal to that subtree.
+     *
      * @tparam I The type of Subtree to visit.
      * @tparam BoundingFn A callable object which accepts an `I` and
      * returns `true` if that Subtree may contain items which pass `TestFn`.
@@ -509,6 +600,7 @@ public:
         Key        _key;
         BoundingFn _bound;
         TestFn     _test;
+        bool       _done = false;
         
     public:
         
@@ -524,18 +616,21 @@ public:
         
         /// Return true if this iterator points to the subtree at `other`.
         bool operator==(const I& other) const {
-            return other == _item;
+            if (other == _root.end()) return _done;
+            return not _done and other == _item;
         }
         
         /// Return true if this iterator does not point to the subtree at `other`.
         bool operator!=(const I& other) const {
-            return other != _item;
+            return not (*this == other);
         }
         
         /// Find the next result at or beyond the Subtree `other`.
         QueryIterator& operator=(const I& other) {
             _item = other;
+            _done = false;
             find_result();
+            return *this;
         }
     
     private:
@@ -545,19 +640,27 @@ public:
                 // descend into tree
                 _item = _item.begin();
             } else if (_item == _root) {
-                _item = _root.end();
+                finish();
             } else {
                 // nothing further for us here. pop back out.
                 // while item is the last child of its parent, ascend:
-                while (_item._root == _item.parent()._root->child_last and _item.parent() != _root) {
-                    _item = _item.parent();
+                I parent = _item.parent();
+                while (parent != _root and _item._root == parent._root->child_last) {
+                    _item  = parent;
+                    parent = _item.parent();
                 }
-                ++_item;
+                if (_item._root == parent._root->child_last) finish();
+                else ++_item;
             }
         }
         
+        void finish() {
+            _item = _root.end();
+            _done = true;
+        }
+        
         void find_result() {
-            while (_item != _root.end() and _item != _item.tree().end() and not _test(_item, _key)) {
+            while (not _done and not _test(_item, _key)) {
                 next_candidate();
             }
         }
@@ -570,7 +673,7 @@ public:
         }
         
         bool equal(const QueryIterator& other) const {
-            return _item == other._item;
+            return _done == other._done and _item == other._item;
         }
         
         const I& dereference() const {
@@ -756,8 +859,14 @@ public:
      * If `i` is not in the subtree under this node, then return `end()`.
      */
     self_t find_parent(const const_item_iterator& i) const {
-        NodeRef subtree_last = node_successor(_root);
-        for (NodeRef n = _root; n != subtree_last; ++n) {
+        NodeRef first = _root;
+        NodeRef last  = std::next(_root);
+        if (_root->n_children > 0) {
+            // the leaves are among the descendents, which are contiguous.
+            first = _root->child_first;
+            last  = node_successor(_root);
+        }
+        for (NodeRef n = first; n != last; ++n) {
             if (n->n_children == 0 and n->n_items > 0) {
                 ItemRef end_item = n->items_last; ++end_item;
                 for (ItemRef j = n->items_first; j != end_item; ++j) {
@@ -861,8 +970,9 @@ protected:
         while (ancestor != _storage->_nodes.end()) {
             NodeRef off_end_child = ancestor->child_last; 
             if (ancestor->n_children > 0) ++off_end_child;
-            // look for a populated node to the right of us
-            for (NodeRef c = child; c != off_end_child; ++c) {
+            // look for a populated node to the right of us. (our own 
+            // children, if any, begin our subtree; they don't follow it).
+            for (NodeRef c = std::next(child); c != off_end_child; ++c) {
                 if (c->n_children > 0) {
                     successor = c->child_first;
                     break;
@@ -889,7 +999,7 @@ protected:
                 node = parent, parent = node->parent) {
             if (parent->n_children != 0) {
                 NodeRef end_c = parent->child_last; ++end_c;
-                for (NodeRef c = node; c != end_c; ++c) {
+                for (NodeRef c = std::next(node); c != end_c; ++c) {
                     if (c->n_items > 0) {
                         return c->items_first;
                     }
@@ -906,19 +1016,22 @@ protected:
 /**
  * @brief An const iterator to a subtree.
  */
-template <typename NodeItem, typename LeafItem>
-class ConstSubtree : public SubtreeBase<NodeItem, LeafItem, true> {
+template <typename NodeItem, typename LeafItem, typename Allocator>
+class ConstSubtree : public SubtreeBase<NodeItem, LeafItem, true, Allocator> {
     
 protected:
     
-    typedef SubtreeBase<NodeItem, LeafItem, true> base_t;
-    friend class SubtreeBase<NodeItem, LeafItem, true>;
-    friend class Tree<NodeItem, LeafItem>;
+    typedef SubtreeBase<NodeItem, LeafItem, true, Allocator> base_t;
+    friend class SubtreeBase<NodeItem, LeafItem, true, Allocator>;
+    friend class Tree<NodeItem, LeafItem, Allocator>;
     
     // allow myself to construct myself.
     // curiously recurring pattern is weird :[
     ConstSubtree(const base_t& other):base_t(other) {}
     
+    ConstSubtree(const typename base_t::NodeRef& root, typename base_t::StorageRef storage):
+        base_t(root, storage) {}
+    
     ConstSubtree() {}
     
 public:
@@ -929,10 +1042,10 @@ public:
     using typename base_t::const_item_iterator;
     
     /// Construct a duplicate iterator to the same node of the same tree.
-    ConstSubtree(const ConstSubtree<NodeItem, LeafItem>& other) = default;
+    ConstSubtree(const ConstSubtree<NodeItem, LeafItem, Allocator>& other) = default;
     
     /// Construct a duplicate iterator to the same node of the same tree.
-    ConstSubtree(const Subtree<NodeItem, LeafItem>& other):
+    ConstSubtree(const Subtree<NodeItem, LeafItem, Allocator>& other):
         base_t(other._root, other._storage) {}
     
 };
@@ -942,18 +1055,19 @@ public:
 /**
  * @brief A non-const iterator to a subtree.
  */
-template <typename NodeItem, typename LeafItem>
-class Subtree : public SubtreeBase<NodeItem, LeafItem, false> {
+template <typename NodeItem, typename LeafItem, typename Allocator>
+class Subtree : public SubtreeBase<NodeItem, LeafItem, false, Allocator> {
     
 protected:
     
-    typedef SubtreeBase<NodeItem, LeafItem, false> base_t;
+    typedef SubtreeBase<NodeItem, LeafItem, false, Allocator> base_t;
     using typename base_t::NodeRef;
     using typename base_t::ItemRef;
     using typename base_t::StorageRef;
     
-    friend class SubtreeBase<NodeItem, LeafItem, false>;
-    friend class Tree<NodeItem, LeafItem>;
+    friend class SubtreeBase<NodeItem, LeafItem, false, Allocator>;
+    friend class ConstSubtree<NodeItem, LeafItem, Allocator>;
+    friend class Tree<NodeItem, LeafItem, Allocator>;
     
     // allow myself to construct myself.
     Subtree(const base_t& other):base_t(other) {}
@@ -963,14 +1077,14 @@ protected:
         
 public:
     
-    typedef Subtree<NodeItem, LeafItem> self_t;
+    typedef Subtree<NodeItem, LeafItem, Allocator> self_t;
     using typename base_t::iterator;
     using typename base_t::const_iterator;
     using typename base_t::item_iterator;
     
     
     /// Construct a duplicate iterator to the same node of the same tree.
-    Subtree(const Subtree<NodeItem, LeafItem>& other) = default;
+    Subtree(const Subtree<NodeItem, LeafItem, Allocator>& other) = default;
     
     Subtree() {}
     
@@ -1103,7 +1217,7 @@ public:
         // todo: this->_storage->_nodes.reserve(n_items);
         NodeRef prev_end_node  = this->end()._root;
         NodeRef first_new_node = this->_storage->_nodes.insert(
-            n, base_t::Node(this->_storage, p, *(i_begin++)));
+            n, typename base_t::Node(this->_storage, p, *(i_begin++)));
         NodeRef last_new_node  = first_new_node;
         
         // transfer ownership of the parent's items to the first child.
@@ -1119,7 +1233,7 @@ public:
         index_t ct = 1;
         for (NodeItemIterator i = i_begin; i != i_end; ++i, ++ct) {
             last_new_node = this->_storage->_nodes.insert(
-                n, base_t::Node(this->_storage, p, *i));
+                n, typename base_t::Node(this->_storage, p, *i));
         }
         
         // adjust child endpoints if necessary
@@ -1252,7 +1366,7 @@ public:
     template <typename LeafItemIterator>
     item_iterator insert_items(
             const item_iterator& insert_before,
-            const LeafItemIterator  begin_item,
+                  LeafItemIterator  begin_item,
             const LeafItemIterator& end_item,
             index_t* new_item_count=nullptr) const {
         // todo: it would be great if we could protect against the user
@@ -1270,8 +1384,8 @@ public:
         // retrieve parent and insert point
         NodeRef n = this->_root;
         ItemRef insert_pt = insert_before;
-        if (n.n_items == 0) {
-            insert_pt = item_successor(n);
+        if (n->n_items == 0) {
+            insert_pt = this->item_successor(n);
         }
         
         // insert the first item
@@ -1288,7 +1402,7 @@ public:
         
         // figure out the new begin/end items
         ItemRef new_begin, new_end;
-        if (insert_before == n->items_first) {
+        if (insert_pt == n->items_first or n->n_items == 0) {
             new_begin = first_new_item;
         } else {
             new_begin = n->items_first;
@@ -1373,6 +1487,168 @@ public:
     }
     
     
+    /**
+     * @brief Move the subtree `other` and all its items to become a child 
+     * of this node, immediately before `insert_before`, without copying.
+     *
+     * `other` may belong to this tree or to another tree of the same type.
+     * Its nodes and items are relinked into this tree in `O(k * d)` time, for 
+     * `k` the arity and `d` the depth of the source and destination, only if
+     * `other` belongs to this tree. When it belongs to another tree, the move 
+     * takes `O(n)` time for `n` the number of nodes and items in `other`, 
+     * since the lists must count, and re-point, the nodes and items which 
+     * cross over. Nothing is allocated or copied in either case.
+     *
+     * `other` may be a descendent of this node (for example, 
+     * `t.root().take(some_grandchild)` re-roots that subtree directly under the root).
+     *
+     * If `other` is the root of its tree, if this node is `other` or one of 
+     * its descendents, if `insert_before` is not a child or end-child of this 
+     * node, if this node is a leaf which holds items, or if `other` belongs to a
+     * tree whose allocator does not compare equal to this tree's allocator, then
+     * neither tree is changed and `end()` is returned.
+     *
+     * Iterator invalidation:
+     *   - Item iterators into `other` remain valid, and now point into this tree.
+     *   - If `other` belongs to this tree, Subtrees pointing into `other` remain
+     *     valid. Otherwise they still refer to the source tree, and must be
+     *     re-obtained by navigating from the returned Subtree.
+     *   - Subtrees and item iterators elsewhere in either tree remain valid,
+     *     except for `end()` subtrees and `items_end()` iterators, which may 
+     *     be invalidated.
+     *
+     * @param other The subtree to move.
+     * @param insert_before The child of this node before which to insert `other`.
+     * @return A Subtree pointing at the moved node, or `end()` if it could not be moved.
+     */
+    self_t take(const self_t& other, const self_t& insert_before) const {
+        StorageRef src = other._storage;
+        StorageRef dst = this->_storage;
+        NodeRef  r   = other._root;
+        NodeRef  p   = this->_root;
+        NodeRef  q   = r->parent;
+        NodeRef  ins = insert_before._root;
+        bool to_end  = ins == this->end()._root;
+        
+        // check invalid cases
+        if (q == src->_nodes.end())                         return this->end();
+        if (not to_end and ins->parent != p)                return this->end();
+        if (p->n_children == 0 and p->n_items > 0)          return this->end();
+        if (src != dst and src->_nodes.get_allocator() != dst->_nodes.get_allocator()) {
+            return this->end();
+        }
+        if (src == dst) {
+            for (NodeRef a = p; a != dst->_nodes.end(); a = a->parent) {
+                if (a == r) return this->end();
+            }
+            // already in place. (a subtree's end() is a real node, 
+            // which may be `r` itself when appending.)
+            if (not to_end and ins == r) return other;
+        }
+        
+        // park the subtree at the ends of the source lists (as [D..., r] and [I...]),
+        // out of the way of both trees while they are repaired. each of these 
+        // is O(1), as nodes only move within their own lists.
+        NodeRef q_first = (r == q->child_first) ? std::next(r) : q->child_first;
+        NodeRef q_last  = (r == q->child_last)  ? std::prev(r) : q->child_last;
+        // the descendents of `r` are contiguous. they go before `r`, which 
+        // is not among them, so that `r` can't land inside their range.
+        NodeRef d_first = r->child_first;
+        NodeRef d_last  = d_first;
+        if (r->n_children > 0) {
+            src->_nodes.splice(src->_nodes.end(), src->_nodes, d_first, other.node_successor(r));
+            d_last = std::prev(src->_nodes.end());
+        }
+        src->_nodes.splice(src->_nodes.end(), src->_nodes, r);
+        if (r->n_items > 0) {
+            src->_items.splice(
+                src->_items.end(), 
+                src->_items, 
+                r->items_first, 
+                std::next(r->items_last));
+        }
+        
+        // detach from the old parent
+        if (--(q->n_children) == 0) {
+            q->child_first = q->child_last = src->_nodes.end();
+        } else {
+            q->child_first = q_first;
+            q->child_last  = q_last;
+        }
+        src->update_item_counts(q, -r->n_items);
+        
+        // find where the subtree goes in this tree: `r` among its new siblings,
+        // its descendents just before those of the next populated sibling,
+        // and its items just before those of the next sibling which has items.
+        bool    childless = p->n_children == 0;
+        bool    to_front  = childless or ins == p->child_first;
+        NodeRef node_pt;
+        NodeRef desc_pt;
+        ItemRef item_pt;
+        if (childless) {
+            node_pt = desc_pt = this->node_successor(p);
+            item_pt = this->item_successor(p);
+        } else {
+            NodeRef c_end = std::next(p->child_last);
+            node_pt = to_end ? c_end : ins;
+            desc_pt = dst->_nodes.end();
+            item_pt = dst->_items.end();
+            bool found_desc  = false;
+            bool found_items = false;
+            for (NodeRef c = node_pt; c != c_end; ++c) {
+                if (not found_desc and c->n_children > 0) {
+                    desc_pt    = c->child_first;
+                    found_desc = true;
+                }
+                if (not found_items and c->n_items > 0) {
+                    item_pt     = c->items_first;
+                    found_items = true;
+                }
+            }
+            if (not found_desc)  desc_pt = this->node_successor(p);
+            if (not found_items) item_pt = this->item_successor(p);
+        }
+        
+        // the end() sentinels held by leaves and empty nodes must 
+        // refer to the lists they now belong to. the moved nodes are
+        // parked as [D..., r], so the walk starts with the descendents.
+        if (src != dst) {
+            NodeRef moved = (r->n_children > 0) ? d_first : r;
+            for (NodeRef n = moved; n != src->_nodes.end(); ++n) {
+                if (n->n_children == 0) n->child_first = n->child_last = dst->_nodes.end();
+                if (n->n_items    == 0) n->items_first = n->items_last = dst->_items.end();
+            }
+        }
+        
+        // relink. `r` goes first, as its descendents may be placed right after it.
+        dst->_nodes.splice(node_pt, src->_nodes, r);
+        if (r->n_children > 0) {
+            dst->_nodes.splice(desc_pt, src->_nodes, d_first, std::next(d_last));
+        }
+        if (r->n_items > 0) {
+            dst->_items.splice(item_pt, src->_items, r->items_first, std::next(r->items_last));
+        }
+        
+        // attach to the new parent
+        r->parent = p;
+        p->n_children++;
+        if (to_front)            p->child_first = r;
+        if (to_end or childless) p->child_last  = r;
+        dst->update_item_counts(p, r->n_items);
+        
+        return self_t(r, dst);
+    }
+    
+    
+    /**
+     * @brief Move the subtree `other` and all its items to become the last 
+     * child of this node, without copying. See `take(other, insert_before)`.
+     */
+    inline self_t take(const self_t& other) const {
+        return take(other, this->end());
+    }
+    
+    
     /**
      * @brief Split this node into two sibling nodes.
      * 
@@ -1488,8 +1764,8 @@ public:
             // this is a linear check; if we *knew* we were the parent, the
             // entire operation would be log(n). laaaaame.
             bool found = false;
-            for (item_iterator i = n->items_begin(); 
-                    i != n->items_end(); 
+            for (item_iterator i = this->items_begin(); 
+                    i != this->items_end(); 
                     ++i) {
                 if (i == item) {
                     found = true;
@@ -1511,7 +1787,7 @@ public:
                 if (item == n->items_last) {
                     new_end = prev_item;
                 } else {
-                    new_end = prev_item;
+                    new_end = n->items_last;
                 }
                 
                 this->_storage->update_boundary_items(
@@ -1542,12 +1818,8 @@ public:
             ItemRef endpt = n->items_last; ++endpt;
             
             // delete the items
-            ItemRef next_item;
-            index_t n_deleted = 0;
-            for (next_item = n->items_first; next_item != endpt; ++next_item) {
-                this->_storage->_items.erase(next_item);
-                ++n_deleted;
-            }
+            index_t n_deleted = n->n_items;
+            ItemRef next_item = this->_storage->_items.erase(n->items_first, endpt);
             ItemRef prev_item = next_item; --prev_item;
             
             // update item boundaries / counts
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <functional>
+#include <iterator>
+#include <queue>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <boost/iterator/iterator_facade.hpp>
+#include <geomc/geomc_defs.h>
+
+// Search algorithms over the Subtree interface shared by Tree and ArrayTree.
+
+
+namespace geom {
+
+
+/** @addtogroup storage
+ *  @{
+ */
+
+
+/**
+ * @brief A forward iterator over the leaf items below a subtree, in order of
+ * increasing distance from a key.
+ *
+ * The traversal is best-first: a priority queue holds subtrees, keyed by a lower
+ * bound on the distance to any item inside them, and items, keyed by their exact
+ * distance. Only as much of the tree is explored as is needed to produce the next
+ * item, so a search which stops after the first few results touches only the nodes
+ * near the key. This is the usual branch-and-bound nearest-neighbor search; the
+ * caller supplies the metric, so it works with any `NodeItem` which can bound its
+ * subtree (boxes, spheres, intervals, ...).
+ *
+ * For the items to come out in order, `bound(s, key)` must never exceed
+ * `dist(item, key)` for any item below `s`. A subtree whose bound is infinite
+ * (or any value greater than all the distances of interest) is never opened
+ * before the items that precede it.
+ *
+ * The iterator is exhausted when it compares equal to `std::default_sentinel`.
+ * Copying the iterator copies its queue; a copy resumes the search independently.
+ *
+ * The iterator is invalidated by any change to the tree it points into.
+ *
+ * @tparam I The type of subtree to search; a Subtree or ArraySubtree, or their
+ * const variants.
+ * @tparam Key The type of object to search near.
+ * @tparam BoundFn A callable object `bound(const I&, const Key&) -> D` returning
+ * a lower bound on the distance from the key to any item in the given subtree.
+ * @tparam DistFn A callable object `dist(const LeafItem&, const Key&) -> D`
+ * returning the distance from the key to the given item.
+ */
+template <typename I, typename Key, typename BoundFn, typename DistFn>
+class BestFirstIterator : public boost::iterator_facade<
+        BestFirstIterator<I, Key, BoundFn, DistFn>,
+        typename std::iterator_traits<typename I::item_iterator>::value_type,
+        boost::forward_traversal_tag,
+        typename std::iterator_traits<typename I::item_iterator>::reference> {
+    
+    friend class boost::iterator_core_access;
+    
+public:
+    
+    /// Iterator to the items of the searched tree.
+    typedef typename I::item_iterator item_iterator;
+    /// Type of the item to key distances (and the subtree bounds).
+    typedef std::common_type_t<
+            std::invoke_result_t<BoundFn&, const I&, const Key&>,
+            std::invoke_result_t<DistFn&,
+                typename std::iterator_traits<item_iterator>::reference,
+                const Key&>
+        > distance_type;
+        
+private:
+    
+    typedef typename std::iterator_traits<item_iterator>::reference item_reference;
+    
+    struct Entry {
+        distance_type                    dist;
+        std::variant<I, item_iterator>   ref;
+        
+        inline bool is_item() const { return ref.index() == 1; }
+    };
+    
+    // orders the queue with the nearest entry on top. among equal distances,
+    // items come out before subtrees, so that an item is produced as soon as it
+    // is known to be next.
+    struct Farther {
+        bool operator()(const Entry& a, const Entry& b) const {
+            if (a.dist != b.dist) return a.dist > b.dist;
+            return b.is_item() and not a.is_item();
+        }
+    };
+    
+    Key     _key;
+    BoundFn _bound;
+    DistFn  _dist;
+    std::priority_queue<Entry, std::vector<Entry>, Farther> _queue;
+    
+public:
+    
+    /// Construct a new BestFirstIterator over the items below `start`.
+    BestFirstIterator(const I& start, const Key& key, BoundFn bound, DistFn dist):
+            _key(key),
+            _bound(bound),
+            _dist(dist) {
+        _queue.push({_bound(start, _key), start});
+        find_result();
+    }
+    
+    /// Return `true` if there are no more items to visit.
+    inline bool done() const {
+        return _queue.empty();
+    }
+    
+    /// Return an iterator to the current item in the tree. The search must not be `done()`.
+    inline item_iterator item() const {
+        return std::get<1>(_queue.top().ref);
+    }
+    
+    /// Return the distance to the current item. The search must not be `done()`.
+    inline distance_type distance() const {
+        return _queue.top().dist;
+    }
+    
+    /// Return `true` if the search is `done()`.
+    inline bool operator==(std::default_sentinel_t) const {
+        return done();
+    }
+    
+    /// Return `true` if the search is not `done()`.
+    inline bool operator!=(std::default_sentinel_t) const {
+        return not done();
+    }
+    
+private:
+    
+    // open subtrees until an item is at the front of the queue.
+    void find_result() {
+        while (not _queue.empty() and not _queue.top().is_item()) {
+            I s = std::get<0>(_queue.top().ref);
+            _queue.pop();
+            if (s.node_count() == 0) {
+                for (item_iterator i = s.items_begin(); i != s.items_end(); ++i) {
+                    _queue.push({_dist(*i, _key), i});
+                }
+            } else {
+                for (I c = s.begin(); c != s.end(); ++c) {
+                    _queue.push({_bound(c, _key), c});
+                }
+            }
+        }
+    }
+    
+    // iterator_facade:
+    
+    void increment() {
+        _queue.pop();
+        find_result();
+    }
+    
+    bool equal(const BestFirstIterator& other) const {
+        if (done() or other.done()) return done() == other.done();
+        return item() == other.item();
+    }
+    
+    item_reference dereference() const {
+        return *item();
+    }
+    
+};
+
+
+/**
+ * @brief Visit the leaf items below `subtree` in order of increasing distance from `key`.
+ *
+ * Example, with a `Tree` whose nodes hold a bounding box for their subtree:
+ *
+ *     auto i = best_first(tree.root(), p,
+ *         [](const auto& s, const Vec3d& p) { return s->dist2(p); },
+ *         [](const Vec3d& x, const Vec3d& p) { return x.dist2(p); });
+ *     for (; i != std::default_sentinel and i.distance() < r2; ++i) {
+ *         // ...
+ *     }
+ *
+ * See `BestFirstIterator` for the requirements on `bound` and `dist`.
+ *
+ * @param subtree The subtree to search.
+ * @param key The object to search near.
+ * @param bound A lower bound on the distance from `key` to any item in a given subtree.
+ * @param dist The distance from `key` to a given item.
+ */
+template <typename I, typename Key, typename BoundFn, typename DistFn>
+inline BestFirstIterator<I, Key, BoundFn, DistFn> best_first(
+        const I&   subtree,
+        const Key& key,
+        BoundFn    bound,
+        DistFn     dist) {
+    return BestFirstIterator<I, Key, BoundFn, DistFn>(subtree, key, bound, dist);
+}
+
+
+/**
+ * @brief Find the `k` leaf items below `subtree` which are nearest to `key`.
+ *
+ * Iterators to the items are written to `out` in order of increasing distance.
+ * Fewer than `k` items are written if the subtree has fewer items.
+ *
+ * @param subtree The subtree to search.
+ * @param key The object to search near.
+ * @param bound A lower bound on the distance from `key` to any item in a given subtree.
+ * @param dist The distance from `key` to a given item.
+ * @param k The number of items to find.
+ * @param out An output iterator which accepts `I::item_iterator`s.
+ * @return The number of items found.
+ */
+template <typename I, typename Key, typename BoundFn, typename DistFn, typename OutputIterator>
+index_t nearest_items(
+        const I&       subtree,
+        const Key&     key,
+        BoundFn        bound,
+        DistFn         dist,
+        index_t        k,
+        OutputIterator out) {
+    if (k <= 0) return 0;
+    index_t n = 0;
+    for (auto i = best_first(subtree, key, bound, dist); i != std::default_sentinel and n < k; ++i, ++n) {
+        *out++ = i.item();
+    }
+    return n;
+}
+
+
+/// @} // addtogroup storage
+
+} // namespace geom
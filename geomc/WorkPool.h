@@ -0,0 +1,261 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <geomc/geomc_defs.h>
+
+namespace geom {
+
+// todo: tasks are type-erased with std::function, which may allocate.
+//       a small inline task buffer would avoid this for small captures.
+
+/**
+ * @brief A set of tasks submitted to a `WorkPool`, which can be waited on together.
+ *
+ * If a task throws, the first exception thrown by a task in the group is rethrown
+ * from `WorkPool::wait()`.
+ */
+class WorkGroup {
+    friend class WorkPool;
+    
+    std::atomic<index_t> _pending {0};
+    std::mutex           _error_mtx;
+    std::exception_ptr   _error;
+    
+public:
+    
+    WorkGroup() = default;
+    WorkGroup(const WorkGroup&) = delete;
+    WorkGroup& operator=(const WorkGroup&) = delete;
+    
+    /// Number of tasks in this group which have not yet completed.
+    index_t pending() const {
+        return _pending.load(std::memory_order_acquire);
+    }
+};
+
+
+/**
+ * @brief A pool of worker threads which execute tasks, with work stealing.
+ *
+ * Each worker owns a queue of tasks. Tasks submitted from inside a worker are pushed
+ * onto the back of that worker's own queue, and the worker pops from the back, so it
+ * runs them most-recent-first, which keeps recursively subdivided work local and
+ * cache-warm. An idle worker steals the oldest task from the front of some other
+ * queue, which tends to be the largest remaining piece of work.
+ * Tasks submitted from outside the pool go to a shared queue which any worker
+ * may take from.
+ *
+ * A thread which calls `wait()` executes queued tasks until the group completes, so a
+ * pool with zero background threads is valid, and runs all work on the waiting thread.
+ * When there is nothing left to take but the group's tasks are still running elsewhere,
+ * the waiting thread sleeps until a task is queued or the group finishes.
+ *
+ * Example:
+ *
+ *     WorkPool pool;
+ *     WorkGroup group;
+ *     for (index_t i = 0; i < n; ++i) {
+ *         pool.submit(group, [&,i]() { process(i); });
+ *     }
+ *     pool.wait(group);
+ */
+class WorkPool {
+    
+    struct Task {
+        std::function<void()> fn;
+        WorkGroup*            group;
+    };
+    
+    struct Queue {
+        std::mutex       mtx;
+        std::deque<Task> tasks;
+    };
+    
+    struct WorkerId {
+        const WorkPool* pool;
+        index_t         idx;
+    };
+    
+    std::vector<std::thread> _threads;
+    // one queue per worker, and a last one for tasks from outside the pool.
+    std::unique_ptr<Queue[]> _queues;
+    index_t                  _n_queues;
+    
+    std::mutex               _sleep_mtx;
+    std::condition_variable  _wake;
+    std::atomic<index_t>     _n_queued {0};
+    bool                     _stopping = false;
+    
+    static WorkerId& _self() {
+        static thread_local WorkerId self {nullptr, 0};
+        return self;
+    }
+    
+    // queue belonging to the calling thread
+    index_t _home() const {
+        const WorkerId& self = _self();
+        return self.pool == this ? self.idx : _n_queues - 1;
+    }
+    
+    bool _pop(index_t home, Task* out) {
+        {
+            // newest task from our own queue
+            Queue& q = _queues[home];
+            std::lock_guard<std::mutex> lk(q.mtx);
+            if (not q.tasks.empty()) {
+                *out = std::move(q.tasks.back());
+                q.tasks.pop_back();
+                _n_queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        // oldest task from someone else's
+        for (index_t k = 1; k < _n_queues; ++k) {
+            Queue& q = _queues[(home + k) % _n_queues];
+            std::lock_guard<std::mutex> lk(q.mtx);
+            if (not q.tasks.empty()) {
+                *out = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                _n_queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    bool _run_one(index_t home) {
+        Task task;
+        if (not _pop(home, &task)) return false;
+        try {
+            task.fn();
+        } catch (...) {
+            std::lock_guard<std::mutex> lk(task.group->_error_mtx);
+            if (not task.group->_error) task.group->_error = std::current_exception();
+        }
+        // `task.group` may be destroyed by its waiter as soon as this reaches zero.
+        if (task.group->_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            {
+                // synchronize with sleeping waiters so the wakeup is not lost
+                std::lock_guard<std::mutex> lk(_sleep_mtx);
+            }
+            _wake.notify_all();
+        }
+        return true;
+    }
+    
+    void _work(index_t idx) {
+        _self() = {this, idx};
+        while (true) {
+            if (_run_one(idx)) continue;
+            std::unique_lock<std::mutex> lk(_sleep_mtx);
+            _wake.wait(lk, [this]() {
+                return _stopping or _n_queued.load(std::memory_order_relaxed) > 0;
+            });
+            if (_stopping and _n_queued.load(std::memory_order_relaxed) == 0) return;
+        }
+    }
+    
+public:
+    
+    /// A default number of background threads, which leaves one hardware thread for the caller.
+    static index_t default_thread_count() {
+        index_t n = std::thread::hardware_concurrency();
+        return n > 1 ? n - 1 : 0;
+    }
+    
+    /**
+     * Construct a pool with `n_threads` background worker threads.
+     * If zero, all tasks will be run by the threads which wait on them.
+     */
+    explicit WorkPool(index_t n_threads=default_thread_count()):
+            _queues(new Queue[n_threads + 1]),
+            _n_queues(n_threads + 1) {
+        _threads.reserve(n_threads);
+        for (index_t i = 0; i < n_threads; ++i) {
+            _threads.emplace_back(&WorkPool::_work, this, i);
+        }
+    }
+    
+    WorkPool(const WorkPool&) = delete;
+    WorkPool& operator=(const WorkPool&) = delete;
+    
+    /// Complete all outstanding tasks and join the worker threads.
+    ~WorkPool() {
+        {
+            std::lock_guard<std::mutex> lk(_sleep_mtx);
+            _stopping = true;
+        }
+        _wake.notify_all();
+        for (std::thread& t : _threads) t.join();
+    }
+    
+    /// Number of background worker threads.
+    index_t thread_count() const {
+        return _threads.size();
+    }
+    
+    /**
+     * Index of the calling thread among the pool's workers, in `[0, thread_count())`,
+     * or `thread_count()` if the caller is not one of them (for instance, a thread
+     * running tasks from inside `wait()`).
+     *
+     * Useful for keeping per-worker scratch state in an array of `thread_count() + 1` slots.
+     */
+    index_t worker_index() const {
+        return _home();
+    }
+    
+    /**
+     * Queue `fn()` for execution as part of `group`. Tasks may themselves submit
+     * further tasks to any group.
+     */
+    template <typename Fn>
+    void submit(WorkGroup& group, Fn&& fn) {
+        group._pending.fetch_add(1, std::memory_order_relaxed);
+        Queue& q = _queues[_home()];
+        {
+            std::lock_guard<std::mutex> lk(q.mtx);
+            q.tasks.push_back({std::function<void()>(std::forward<Fn>(fn)), &group});
+        }
+        _n_queued.fetch_add(1, std::memory_order_relaxed);
+        {
+            // synchronize with sleeping workers so the wakeup is not lost
+            std::lock_guard<std::mutex> lk(_sleep_mtx);
+        }
+        _wake.notify_one();
+    }
+    
+    /**
+     * Execute queued tasks on the calling thread until every task in `group`,
+     * including tasks submitted by those tasks, has completed. If any task threw,
+     * rethrow the first exception.
+     */
+    void wait(WorkGroup& group) {
+        index_t home = _home();
+        while (group.pending() > 0) {
+            if (_run_one(home)) continue;
+            // nothing to take; the rest of the group is running on other threads.
+            std::unique_lock<std::mutex> lk(_sleep_mtx);
+            _wake.wait(lk, [this, &group]() {
+                return group.pending() == 0 or _n_queued.load(std::memory_order_relaxed) > 0;
+            });
+        }
+        if (group._error) {
+            std::exception_ptr err = group._error;
+            group._error = nullptr;
+            std::rethrow_exception(err);
+        }
+    }
+    
+};
+
+} // namespace geom
@@ -0,0 +1,354 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <geomc/linalg/Vec.h>
+#include <geomc/shape/Intersect.h>
+#include <geomc/WorkPool.h>
+
+namespace geom {
+
+/** @addtogroup shape
+ *  @{
+ */
+
+
+/**
+ * @brief Tests many pairs of convex shapes for overlap at once, as in the
+ * narrow phase of collision detection.
+ *
+ * Each pair is given as the indices of its two shapes. Results are written to
+ * caller-owned arrays, at the position of each pair in the list:
+ *
+ *     BatchIntersector<double,3> narrow;
+ *     std::vector<std::pair<index_t,index_t>> pairs = broad_phase(bodies);
+ *     std::unique_ptr<bool[]> hits(new bool[pairs.size()]);
+ *     narrow.intersects(bodies.data(), pairs, hits.get(), nullptr, pool);
+ *
+ * The shapes may all be of one type, or `std::variant`s of several. Pairs of
+ * variants are first sorted into groups by the types of their two shapes, and each
+ * group is tested by a loop instantiated for those types, so that the support
+ * functions are called directly and may be inlined, and the branches of the loop
+ * are the same from one pair to the next. (This is much faster than testing a
+ * list of `AnyConvex` shapes through virtual calls.)
+ *
+ * The pairs are divided into runs, several per thread, which are tested in
+ * parallel if a `WorkPool` is given. Each worker of the pool, and the calling
+ * thread, has its own `Intersector`, which it uses for every run it takes, and
+ * which is kept for the next batch. The grouping and planning buffers are also
+ * kept between batches, so they are not reallocated in steady state (though
+ * submitting runs to the pool may allocate).
+ *
+ * A `BatchIntersector` may be used by only one thread at a time.
+ *
+ * @tparam T Coordinate type.
+ * @tparam N Dimension of the space.
+ */
+template <typename T, index_t N>
+class BatchIntersector {
+public:
+    
+    typedef std::pair<index_t,index_t> pair_t;
+    
+protected:
+    
+    // indexes an array of variants known to hold `S`, as if it were an array of `S`.
+    template <typename S, typename... Shapes>
+    struct VariantView {
+        const std::variant<Shapes...>* shapes;
+        inline const S& operator[](index_t i) const {
+            return *std::get_if<S>(shapes + i);
+        }
+    };
+    
+    // a run of `_order` (or of the pairs, if they aren't reordered)
+    struct Task {
+        index_t begin;
+        index_t end;
+    };
+    
+    // one for each worker of the pool, and a last one for the calling thread.
+    // a deque, so that growing it doesn't move the intersectors, which point into themselves.
+    std::deque<Intersector<T,N>>  _gjk;
+    std::vector<Task>             _tasks;
+    // pair indices, grouped by the types of their shapes
+    std::vector<index_t>          _order;
+    std::vector<index_t>          _group_start;
+    index_t                       _n_groups = 0;
+    
+public:
+    
+    /*****************************
+     * Homogeneous shapes        *
+     *****************************/
+    
+    /**
+     * @brief Test whether the shapes of each pair overlap.
+     *
+     * For each `i`, the shapes `shapes_a[pairs[i].first]` and `shapes_b[pairs[i].second]`
+     * are tested, and the result written to `hits[i]`.
+     *
+     * @param shapes_a The first shape of each pair is taken from here.
+     * @param shapes_b The second shape of each pair is taken from here. May be the
+     * same as `shapes_a`.
+     * @param pairs Indices of the shapes of each pair.
+     * @param hits Array of `pairs.size()` results.
+     * @param axes If not null, array of `pairs.size()` axes. Where the shapes are
+     * disjoint, the axis is a direction separating them (as `Intersector::separation_axis`);
+     * otherwise its value is unspecified.
+     */
+    template <ConvexObject ShapeA, ConvexObject ShapeB>
+    void intersects(
+            const ShapeA*           shapes_a,
+            const ShapeB*           shapes_b,
+            std::span<const pair_t> pairs,
+            bool*                   hits,
+            Vec<T,N>*               axes=nullptr)
+    {
+        intersects_impl(shapes_a, shapes_b, pairs, hits, axes, nullptr);
+    }
+    
+    /**
+     * @brief Test whether the shapes of each pair overlap, dividing the work
+     * between the threads of `pool`.
+     *
+     * See `intersects(const ShapeA*, const ShapeB*, std::span<const pair_t>, bool*, Vec<T,N>*)`.
+     */
+    template <ConvexObject ShapeA, ConvexObject ShapeB>
+    void intersects(
+            const ShapeA*           shapes_a,
+            const ShapeB*           shapes_b,
+            std::span<const pair_t> pairs,
+            bool*                   hits,
+            Vec<T,N>*               axes,
+            WorkPool&               pool)
+    {
+        intersects_impl(shapes_a, shapes_b, pairs, hits, axes, &pool);
+    }
+    
+    /// Test whether the shapes of each pair, both taken from `shapes`, overlap.
+    template <ConvexObject Shape>
+    void intersects(
+            const Shape*            shapes,
+            std::span<const pair_t> pairs,
+            bool*                   hits,
+            Vec<T,N>*               axes=nullptr)
+    {
+        intersects_impl(shapes, shapes, pairs, hits, axes, nullptr);
+    }
+    
+    /**
+     * @brief Test whether the shapes of each pair, both taken from `shapes`, overlap,
+     * dividing the work between the threads of `pool`.
+     */
+    template <ConvexObject Shape>
+    void intersects(
+            const Shape*            shapes,
+            std::span<const pair_t> pairs,
+            bool*                   hits,
+            Vec<T,N>*               axes,
+            WorkPool&               pool)
+    {
+        intersects_impl(shapes, shapes, pairs, hits, axes, &pool);
+    }
+    
+    /*****************************
+     * Mixed shapes              *
+     *****************************/
+    
+    /**
+     * @brief Test whether the shapes of each pair, both taken from `shapes`, overlap.
+     *
+     * The pairs are grouped by the types held by their two variants, and each group
+     * is tested by a loop instantiated for that combination of types. Results are
+     * written in the order of `pairs`, as with the other overloads.
+     *
+     * The types of the variant must be distinct convex shapes of coordinate type
+     * `T` and dimension `N`.
+     */
+    template <ConvexObject... Shapes>
+    void intersects(
+            const std::variant<Shapes...>* shapes,
+            std::span<const pair_t>         pairs,
+            bool*                           hits,
+            Vec<T,N>*                       axes=nullptr)
+    {
+        intersects_impl(shapes, pairs, hits, axes, nullptr);
+    }
+    
+    /**
+     * @brief Test whether the shapes of each pair, both taken from `shapes`, overlap,
+     * dividing the work between the threads of `pool`.
+     *
+     * See `intersects(const std::variant<Shapes...>*, std::span<const pair_t>, bool*, Vec<T,N>*)`.
+     */
+    template <ConvexObject... Shapes>
+    void intersects(
+            const std::variant<Shapes...>* shapes,
+            std::span<const pair_t>         pairs,
+            bool*                           hits,
+            Vec<T,N>*                       axes,
+            WorkPool&                       pool)
+    {
+        intersects_impl(shapes, pairs, hits, axes, &pool);
+    }
+    
+    /// Number of groups of pairs with distinct shape types in the last batch.
+    inline index_t group_count() const {
+        return _n_groups;
+    }
+    
+    /// Number of runs into which the last batch was divided.
+    inline index_t task_count() const {
+        return _tasks.size();
+    }
+    
+protected:
+    
+    // the monomorphic inner loop. tests the pairs `pairs[idx(i)]` for `i` in `[begin, end)`.
+    // `shapes_a` and `shapes_b` are arrays of shapes, or views of them.
+    template <typename ShapesA, typename ShapesB, typename IndexFn>
+    static void test_pairs(
+            Intersector<T,N>& gjk,
+            ShapesA           shapes_a,
+            ShapesB           shapes_b,
+            const pair_t*     pairs,
+            IndexFn           idx,
+            index_t           begin,
+            index_t           end,
+            bool*             hits,
+            Vec<T,N>*         axes)
+    {
+        for (index_t i = begin; i < end; ++i) {
+            const index_t j = idx(i);
+            const pair_t& p = pairs[j];
+            hits[j] = gjk.intersects(shapes_a[p.first], shapes_b[p.second]);
+            if (axes) axes[j] = gjk.separation_axis;
+        }
+    }
+    
+    // cut each of `n_groups` groups (given by `_group_start`) into runs of roughly
+    // equal size; several per thread, so that stealing can even out the load.
+    void plan_tasks(index_t n_pairs, index_t n_groups, WorkPool* pool) {
+        index_t n_tasks = pool ? 8 * (pool->thread_count() + 1) : 1;
+        index_t target  = std::max<index_t>(n_pairs / n_tasks, 256);
+        _tasks.clear();
+        for (index_t g = 0; g < n_groups; ++g) {
+            index_t g0 = _group_start[g];
+            index_t g1 = _group_start[g + 1];
+            for (index_t i = g0; i < g1; i += target) {
+                _tasks.push_back({i, std::min(i + target, g1)});
+            }
+        }
+        index_t n_gjk = pool ? pool->thread_count() + 1 : 1;
+        if ((index_t) _gjk.size() < n_gjk) _gjk.resize(n_gjk);
+    }
+    
+    // call `fn(t, gjk)` for each task `t`, with the `Intersector` of the thread running it.
+    template <typename Fn>
+    void run_tasks(Fn&& fn, WorkPool* pool) {
+        if (pool and _tasks.size() > 1) {
+            const std::thread::id caller = std::this_thread::get_id();
+            auto run = [&](index_t t) {
+                index_t w = pool->worker_index();
+                if (w == pool->thread_count() and std::this_thread::get_id() != caller) {
+                    // some other thread waiting on the pool took this task;
+                    // it may not share the caller's intersector.
+                    Intersector<T,N> gjk;
+                    fn(t, gjk);
+                } else {
+                    fn(t, _gjk[w]);
+                }
+            };
+            WorkGroup group;
+            for (index_t t = 0; t < (index_t) _tasks.size(); ++t) {
+                pool->submit(group, [&run, t]() { run(t); });
+            }
+            pool->wait(group);
+        } else {
+            for (index_t t = 0; t < (index_t) _tasks.size(); ++t) fn(t, _gjk.back());
+        }
+    }
+    
+    template <typename ShapeA, typename ShapeB>
+    void intersects_impl(
+            const ShapeA*           shapes_a,
+            const ShapeB*           shapes_b,
+            std::span<const pair_t> pairs,
+            bool*                   hits,
+            Vec<T,N>*               axes,
+            WorkPool*               pool)
+    {
+        const index_t n = pairs.size();
+        _group_start.assign({0, n});
+        _n_groups = n > 0 ? 1 : 0;
+        plan_tasks(n, _n_groups, pool);
+        auto identity = [](index_t i) { return i; };
+        run_tasks([&](index_t t, Intersector<T,N>& gjk) {
+            const Task& task = _tasks[t];
+            test_pairs(gjk, shapes_a, shapes_b, pairs.data(), identity, task.begin, task.end, hits, axes);
+        }, pool);
+    }
+    
+    template <typename... Shapes>
+    void intersects_impl(
+            const std::variant<Shapes...>* shapes,
+            std::span<const pair_t>         pairs,
+            bool*                           hits,
+            Vec<T,N>*                       axes,
+            WorkPool*                       pool)
+    {
+        constexpr index_t K = sizeof...(Shapes);
+        const index_t n = pairs.size();
+        auto group_of = [&](const pair_t& p) {
+            return (index_t) (shapes[p.first].index() * K + shapes[p.second].index());
+        };
+        // counting sort of the pairs by group
+        _group_start.assign(K * K + 1, 0);
+        for (const pair_t& p : pairs) _group_start[group_of(p) + 1] += 1;
+        for (index_t g = 0; g < K * K; ++g) _group_start[g + 1] += _group_start[g];
+        _order.resize(n);
+        for (index_t i = 0; i < n; ++i) {
+            _order[_group_start[group_of(pairs[i])]++] = i;
+        }
+        // the counts were consumed; shift the starts back into place
+        for (index_t g = K * K; g > 0; --g) _group_start[g] = _group_start[g - 1];
+        _group_start[0] = 0;
+        _n_groups = 0;
+        for (index_t g = 0; g < K * K; ++g) _n_groups += _group_start[g + 1] > _group_start[g];
+        
+        plan_tasks(n, K * K, pool);
+        const index_t* order = _order.data();
+        auto by_group = [order](index_t i) { return order[i]; };
+        run_tasks([&](index_t t, Intersector<T,N>& gjk) {
+            const Task&   task = _tasks[t];
+            const pair_t& p0   = pairs[order[task.begin]];
+            // every pair in the run has the same types as the first
+            std::visit(
+                [&](const auto& a0, const auto& b0) {
+                    typedef std::decay_t<decltype(a0)> A;
+                    typedef std::decay_t<decltype(b0)> B;
+                    test_pairs(
+                        gjk,
+                        VariantView<A, Shapes...> {shapes},
+                        VariantView<B, Shapes...> {shapes},
+                        pairs.data(), by_group, task.begin, task.end, hits, axes);
+                },
+                shapes[p0.first],
+                shapes[p0.second]
+            );
+        }, pool);
+    }
+    
+};
+
+/// @} // addtogroup shape
+
+} // namespace geom
@@ -18,6 +18,11 @@
  *
  * Plays nice in one dimension; point_t will revert to T instead of Vec<T,1>
  *
+ * For large sets of points which are rebuilt wholesale (e.g. every frame of
+ * a simulation), HashGrid keeps its items in one contiguous array, and is
+ * much cheaper to fill and query. For objects with extents, especially of
+ * very different sizes, see HierarchicalGrid.
+ *
  *  Created on: Aug 19, 2012
  *      Author: tbabb
  */
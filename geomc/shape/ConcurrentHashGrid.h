@@ -0,0 +1,229 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <geomc/shape/HashGrid.h>
+
+namespace geom {
+
+/** @addtogroup shape
+ *  @{
+ */
+
+
+namespace detail {
+
+// a number which identifies one fill phase of one ConcurrentHashGrid. never reused.
+inline uint64_t new_fill_id() {
+    static std::atomic<uint64_t> next {1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+// the stripes most recently assigned to the calling thread, by fill id.
+struct StripeCache {
+    static constexpr index_t Size = 4;
+    
+    uint64_t fill[Size]   = {};
+    index_t  stripe[Size] = {};
+    index_t  victim       = 0;
+    
+    static StripeCache& local() {
+        static thread_local StripeCache cache;
+        return cache;
+    }
+};
+
+} // namespace detail
+
+
+/**
+ * @brief A `HashGrid` which may be filled by many threads at once.
+ *
+ * The grid is used in two phases. In the fill phase, any number of threads may call
+ * `insert()` concurrently. Items are appended to one of several "stripes", each a
+ * buffer with its own lock. Within a fill, each inserting thread is given its own
+ * stripe, in the order of its first insertion, until there are more inserting threads
+ * than stripes. Producers therefore almost never contend for a lock, and insertion
+ * scales with the number of threads. Stripes are handed out afresh after each
+ * `freeze()` or `clear()`, so threads which have since exited do not hold on to them.
+ *
+ * Once every producer has finished (for instance, after waiting on the `WorkGroup`
+ * of the producing tasks), a single thread calls `freeze()`, which gathers the
+ * stripes and sorts the items into bins. The frozen `HashGrid` returned by `freeze()`
+ * and `grid()` is then read-only, and may be queried by any number of threads:
+ *
+ *     ConcurrentHashGrid<double,3,index_t> cgrid(radius);
+ *     WorkGroup group;
+ *     for (auto& chunk : chunks) {
+ *         pool.submit(group, [&]() {
+ *             for (index_t i : chunk) cgrid.insert(particles[i].x, i);
+ *         });
+ *     }
+ *     pool.wait(group);
+ *     const HashGrid<double,3,index_t>& grid = cgrid.freeze();
+ *
+ * `freeze()`, `clear()`, and queries of `grid()` must not overlap with calls to
+ * `insert()`. Buffers are kept between fills, as with `HashGrid`.
+ *
+ * @tparam T Coordinate type.
+ * @tparam N Dimension of the space.
+ * @tparam O Type of the object stored at each location.
+ */
+template <typename T, index_t N, typename O>
+class ConcurrentHashGrid {
+public:
+    
+    typedef HashGrid<T,N,O>                 grid_t;
+    typedef typename grid_t::point_t        point_t;
+    typedef typename grid_t::item_t         item_t;
+    
+protected:
+    
+    // on its own cache line, so that producers don't share lines.
+    struct alignas(64) Stripe {
+        std::mutex          mtx;
+        std::vector<item_t> items;
+    };
+    
+    grid_t                    _grid;
+    std::unique_ptr<Stripe[]> _stripes;
+    index_t                   _mask;
+    // identifies the current fill phase, and counts the threads which have inserted during it.
+    uint64_t                  _fill = detail::new_fill_id();
+    std::atomic<index_t>      _n_inserters {0};
+    
+public:
+    
+    /*****************************
+     * Structors                 *
+     *****************************/
+    
+    /**
+     * @brief Construct an empty grid with bins of width `cellsize` along each axis.
+     *
+     * @param cellsize Width of the bins.
+     * @param n_stripes Number of insertion buffers. Rounded up to a power of two.
+     * Defaults to twice the number of hardware threads.
+     */
+    explicit ConcurrentHashGrid(T cellsize=1, index_t n_stripes=0):_grid(cellsize) {
+        if (n_stripes <= 0) n_stripes = 2 * std::max<index_t>(std::thread::hardware_concurrency(), 1);
+        index_t n = 1;
+        while (n < n_stripes) n *= 2;
+        _stripes.reset(new Stripe[n]);
+        _mask = n - 1;
+    }
+    
+    ConcurrentHashGrid(const ConcurrentHashGrid&) = delete;
+    ConcurrentHashGrid& operator=(const ConcurrentHashGrid&) = delete;
+    
+    /*****************************
+     * Fill phase                *
+     *****************************/
+    
+    /**
+     * @brief Add `value` at `location`. Safe to call from many threads at once.
+     *
+     * The item will not be found by queries until the next `freeze()`.
+     */
+    void insert(const point_t& location, const O& value) {
+        Stripe& s = stripe();
+        std::lock_guard<std::mutex> lock(s.mtx);
+        s.items.emplace_back(location, value);
+    }
+    
+    /**
+     * @brief Add each of the items (pairs of location and value) in `[begin, end)`.
+     * Safe to call from many threads at once.
+     *
+     * The stripe's lock is taken only once, so this is cheaper than inserting
+     * the items one at a time.
+     */
+    template <typename ItemIterator>
+    void insert(ItemIterator begin, ItemIterator end) {
+        Stripe& s = stripe();
+        std::lock_guard<std::mutex> lock(s.mtx);
+        s.items.insert(s.items.end(), begin, end);
+    }
+    
+    /*****************************
+     * Query phase               *
+     *****************************/
+    
+    /**
+     * @brief Sort all the items inserted so far into the grid, and return the grid.
+     *
+     * No other thread may be inserting during this call. Linear in the number
+     * of items in the grid. Items inserted by one thread keep their order within
+     * a bin.
+     */
+    const grid_t& freeze() {
+        for (index_t i = 0; i <= _mask; ++i) {
+            std::vector<item_t>& items = _stripes[i].items;
+            _grid.insert(std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()));
+            items.clear();
+        }
+        _grid.rebuild();
+        new_fill();
+        return _grid;
+    }
+    
+    /// The grid, as of the last `freeze()`.
+    inline const grid_t& grid() const {
+        return _grid;
+    }
+    
+    /**
+     * @brief Remove all items, including those not yet frozen. Memory is retained
+     * for reuse. No other thread may be inserting during this call.
+     */
+    void clear() {
+        for (index_t i = 0; i <= _mask; ++i) _stripes[i].items.clear();
+        _grid.clear();
+        new_fill();
+    }
+    
+    /// Number of insertion buffers.
+    inline index_t stripe_count() const {
+        return _mask + 1;
+    }
+    
+    /// Number of items awaiting a `freeze()`. No other thread may be inserting during this call.
+    index_t staged_count() const {
+        index_t n = _grid.staged_count();
+        for (index_t i = 0; i <= _mask; ++i) n += _stripes[i].items.size();
+        return n;
+    }
+    
+protected:
+    
+    // no thread may be inserting.
+    void new_fill() {
+        _fill = detail::new_fill_id();
+        _n_inserters.store(0, std::memory_order_relaxed);
+    }
+    
+    // the stripe of the calling thread, assigned at its first insertion during this fill.
+    Stripe& stripe() {
+        detail::StripeCache& cache = detail::StripeCache::local();
+        for (index_t i = 0; i < detail::StripeCache::Size; ++i) {
+            if (cache.fill[i] == _fill) return _stripes[cache.stripe[i]];
+        }
+        index_t s = _n_inserters.fetch_add(1, std::memory_order_relaxed) & _mask;
+        index_t i = cache.victim;
+        cache.victim    = (i + 1) % detail::StripeCache::Size;
+        cache.fill[i]   = _fill;
+        cache.stripe[i] = s;
+        return _stripes[s];
+    }
+    
+};
+
+/// @} // addtogroup shape
+
+} // namespace geom
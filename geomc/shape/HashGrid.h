@@ -0,0 +1,613 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include <geomc/linalg/Vec.h>
+#include <geomc/shape/Rect.h>
+#include <geomc/WorkPool.h>
+
+// todo: a mutable view of the values (but not the locations) of the items.
+
+namespace geom {
+
+namespace detail {
+
+// Fibonacci hashing of the coordinates of a grid bin. the high bits are well-mixed.
+template <index_t N, typename Bin>
+inline uint64_t hash_grid_bin(const Bin& key) {
+    uint64_t h = 0;
+    for (index_t k = 0; k < N; ++k) {
+        h = (h ^ (uint64_t) coord(key, k)) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 31;
+    }
+    return h * 0x9E3779B97F4A7C15ULL;
+}
+
+} // namespace detail
+
+/** @addtogroup shape
+ *  @{
+ */
+
+
+/**
+ * @brief Lists of neighbors for a batch of queries, in compressed sparse row form.
+ *
+ * The neighbors of query `q` are `indices[offsets[q]]` through `indices[offsets[q + 1] - 1]`.
+ * A list may be reused for several batches, without reallocating.
+ */
+struct NeighborList {
+    std::vector<index_t> offsets;
+    std::vector<index_t> indices;
+    
+    /// Number of queries in the batch.
+    inline index_t query_count() const {
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+    
+    /// Total number of neighbors found, over all queries.
+    inline index_t size() const {
+        return indices.size();
+    }
+    
+    /// The neighbors of query `q`.
+    inline std::span<const index_t> operator[](index_t q) const {
+        return {indices.data() + offsets[q], indices.data() + offsets[q + 1]};
+    }
+};
+
+
+/**
+ * @brief A compact, N-dimensional grid of bins holding located objects, for fast
+ * proximity queries over large, frequently rebuilt sets of points.
+ *
+ * This is a rebuild-oriented counterpart to `BinLatticePartition`. Instead of keeping
+ * a node for each item in a hash multimap, all the items are kept in one array,
+ * grouped by bin, and an open-addressed hash table maps each occupied bin to its
+ * span of that array. Finding a bin costs one probe sequence into a flat table,
+ * and the items of a bin are contiguous in memory.
+ *
+ * Items are added with `insert()`, which only stages them; they become visible
+ * to queries after the next call to `rebuild()`. A rebuild counting-sorts every item
+ * into place, in time linear in the number of items. The grid keeps all of its
+ * buffers between rebuilds, so a grid that is cleared, refilled and rebuilt each
+ * frame with a similar number of items does no allocation in steady state:
+ *
+ *     HashGrid<double,3,index_t> grid(radius);
+ *     while (simulating) {
+ *         grid.clear();
+ *         for (index_t i = 0; i < n; ++i) grid.insert(particles[i].x, i);
+ *         grid.rebuild();
+ *         grid.within_radius(p, radius, [&](const auto& item) { ... });
+ *     }
+ *
+ * As with `BinLatticePartition`, the grid has no bounds and empty bins cost nothing,
+ * and multiple items may share a location.
+ *
+ * Bins are laid out in the order in which they are first seen among the items. If
+ * the items are inserted in a spatially coherent order (see `spatial_sort()`),
+ * neighboring bins will tend to be near each other in memory.
+ *
+ * `O` must be default-constructible and move-assignable.
+ *
+ * @tparam T Coordinate type.
+ * @tparam N Dimension of the space.
+ * @tparam O Type of the object stored at each location.
+ */
+template <typename T, index_t N, typename O>
+class HashGrid {
+public:
+    
+    typedef typename PointType<index_t,N>::point_t bin_t;
+    typedef typename PointType<T,N>::point_t       point_t;
+    typedef std::pair<point_t, O>                  item_t;
+    typedef const item_t*                          const_iterator;
+    
+protected:
+    
+    // an entry in the hash table: an occupied bin, and its index in `_bin_keys`.
+    struct Slot {
+        bin_t   key;
+        index_t bin;
+    };
+    
+    T                    _cellsize;
+    // items sorted by bin. the items of bin `i` are `[_offsets[i], _offsets[i + 1])`.
+    std::vector<item_t>  _items;
+    std::vector<index_t> _offsets;
+    std::vector<bin_t>   _bin_keys;
+    // open-addressed, linearly probed; the size is a power of two, at least
+    // twice the number of occupied bins. empty slots have `bin < 0`.
+    std::vector<Slot>    _table;
+    index_t              _shift = 64;
+    // items inserted since the last rebuild
+    std::vector<item_t>  _staged;
+    // scratch space for rebuilds, kept to avoid reallocation
+    std::vector<index_t> _bin_of_staged;
+    std::vector<index_t> _cursor;
+    
+public:
+    
+    /*****************************
+     * Structors                 *
+     *****************************/
+    
+    /// Construct an empty grid with bins of width `cellsize` along each axis.
+    explicit HashGrid(T cellsize=1):_cellsize(cellsize) {
+        _offsets.push_back(0);
+    }
+    
+    /// Construct a grid with bins of width `cellsize`, holding the items in `[begin, end)`.
+    template <typename ItemIterator>
+    HashGrid(ItemIterator begin, ItemIterator end, T cellsize=1):HashGrid(cellsize) {
+        build(begin, end);
+    }
+    
+    /*****************************
+     * Building                  *
+     *****************************/
+    
+    /**
+     * @brief Stage `value` for insertion at `location`. The item will not be found
+     * by queries until the next `rebuild()`.
+     */
+    inline void insert(const point_t& location, const O& value) {
+        _staged.emplace_back(location, value);
+    }
+    
+    /**
+     * @brief Stage each of the items (pairs of location and value) in `[begin, end)`
+     * for insertion.
+     */
+    template <typename ItemIterator>
+    void insert(ItemIterator begin, ItemIterator end) {
+        _staged.insert(_staged.end(), begin, end);
+    }
+    
+    /**
+     * @brief Sort all the items in the grid, including those staged by `insert()`,
+     * into their bins.
+     *
+     * Linear in the total number of items. Items keep their insertion order
+     * within a bin. Invalidates all iterators and spans into the grid.
+     */
+    void rebuild() {
+        if (_staged.empty()) return;
+        _staged.insert(
+            _staged.end(),
+            std::make_move_iterator(_items.begin()),
+            std::make_move_iterator(_items.end()));
+        const index_t n = _staged.size();
+        
+        // guess that there are about as many bins as last time
+        reset_table(std::max<index_t>(_bin_keys.size(), 8));
+        _bin_keys.clear();
+        _offsets.clear();
+        
+        // assign bins, and count their items
+        _bin_of_staged.resize(n);
+        for (index_t i = 0; i < n; ++i) {
+            bin_t   key  = bin_of(_staged[i].first);
+            index_t slot = probe(key);
+            if (_table[slot].bin < 0) {
+                if (2 * (_bin_keys.size() + 1) > _table.size()) {
+                    // grow, and find the new slot
+                    reset_table(_bin_keys.size() + 1);
+                    for (index_t b = 0; b < (index_t) _bin_keys.size(); ++b) {
+                        _table[probe(_bin_keys[b])] = {_bin_keys[b], b};
+                    }
+                    slot = probe(key);
+                }
+                _table[slot] = {key, (index_t) _bin_keys.size()};
+                _bin_keys.push_back(key);
+                _offsets.push_back(0);
+            }
+            index_t b = _table[slot].bin;
+            _bin_of_staged[i] = b;
+            _offsets[b] += 1;
+        }
+        
+        // counts -> offsets
+        const index_t n_bins = _bin_keys.size();
+        _offsets.push_back(0);
+        index_t sum = 0;
+        for (index_t b = 0; b <= n_bins; ++b) {
+            index_t c   = _offsets[b];
+            _offsets[b] = sum;
+            sum += c;
+        }
+        
+        // scatter the items into place
+        _cursor.assign(_offsets.begin(), _offsets.end() - 1);
+        _items.resize(n);
+        for (index_t i = 0; i < n; ++i) {
+            _items[_cursor[_bin_of_staged[i]]++] = std::move(_staged[i]);
+        }
+        _staged.clear();
+    }
+    
+    /**
+     * @brief Replace the contents of the grid with the items in `[begin, end)`,
+     * and rebuild.
+     */
+    template <typename ItemIterator>
+    void build(ItemIterator begin, ItemIterator end) {
+        clear();
+        insert(begin, end);
+        rebuild();
+    }
+    
+    /**
+     * @brief Remove all items from the grid, including staged items. Memory is
+     * retained for reuse by the next rebuild.
+     */
+    void clear() {
+        _items.clear();
+        _staged.clear();
+        _bin_keys.clear();
+        _offsets.assign(1, 0);
+        // the table is only consulted when there are bins, and is reset by rebuild().
+    }
+    
+    /*****************************
+     * Properties                *
+     *****************************/
+    
+    /// Width of each bin along each axis.
+    inline T cell_size() const {
+        return _cellsize;
+    }
+    
+    /// Number of items in the grid, not counting those which have yet to be sorted by `rebuild()`.
+    inline index_t size() const {
+        return _items.size();
+    }
+    
+    /// `true` if there are no items in the grid, not counting those which have yet to be sorted by `rebuild()`.
+    inline bool empty() const {
+        return _items.empty();
+    }
+    
+    /// Number of items awaiting a `rebuild()`.
+    inline index_t staged_count() const {
+        return _staged.size();
+    }
+    
+    /// Number of bins which contain at least one item.
+    inline index_t bin_count() const {
+        return _bin_keys.size();
+    }
+    
+    /// The first item in the grid. Items are grouped by bin.
+    inline const_iterator begin() const {
+        return _items.data();
+    }
+    
+    /// Off-end iterator for the items in the grid.
+    inline const_iterator end() const {
+        return _items.data() + _items.size();
+    }
+    
+    /*****************************
+     * Bins                      *
+     *****************************/
+    
+    /// The bin which contains `location`.
+    inline bin_t bin_of(const point_t& location) const {
+        bin_t b;
+        for (index_t k = 0; k < N; ++k) {
+            coord(b, k) = (index_t) std::floor(coord(location, k) / _cellsize);
+        }
+        return b;
+    }
+    
+    /// The key of the `i`th occupied bin, for `0 <= i < bin_count()`.
+    inline const bin_t& bin_key(index_t i) const {
+        return _bin_keys[i];
+    }
+    
+    /// The items in the `i`th occupied bin, for `0 <= i < bin_count()`.
+    inline std::span<const item_t> bin_items(index_t i) const {
+        return {_items.data() + _offsets[i], _items.data() + _offsets[i + 1]};
+    }
+    
+    /// The index of the occupied bin with key `key`, or -1 if that bin is empty.
+    index_t find_bin(const bin_t& key) const {
+        if (_bin_keys.empty()) return -1;
+        return _table[probe(key)].bin;
+    }
+    
+    /// The items in the bin with key `key`.
+    inline std::span<const item_t> items_in(const bin_t& key) const {
+        index_t i = find_bin(key);
+        if (i < 0) return {};
+        return bin_items(i);
+    }
+    
+    /*****************************
+     * Queries                   *
+     *****************************/
+    
+    /**
+     * Call `visit(item)` on each item no farther than `r` from `p`.
+     * Items are visited in no particular order. No memory is allocated.
+     *
+     * The grid must not be modified during the search.
+     */
+    template <typename Visitor>
+    void within_radius(const point_t& p, T r, Visitor&& visit) const {
+        const T r2 = r * r;
+        point_t d;
+        for (index_t k = 0; k < N; ++k) coord(d, k) = r;
+        visit_bins(Rect<T,N>(p - d, p + d), [&](const item_t& item) {
+            T d2 = 0;
+            for (index_t k = 0; k < N; ++k) {
+                T x = coord(item.first, k) - coord(p, k);
+                d2 += x * x;
+            }
+            if (d2 <= r2) visit(item);
+        });
+    }
+    
+    /**
+     * Call `visit(item)` on each item inside `region`, including its boundary.
+     * Items are visited in no particular order. No memory is allocated.
+     *
+     * The grid must not be modified during the search.
+     */
+    template <typename Visitor>
+    void in_rect(const Rect<T,N>& region, Visitor&& visit) const {
+        visit_bins(region, [&](const item_t& item) {
+            if (region.contains(item.first)) visit(item);
+        });
+    }
+    
+    /**
+     * @brief Find the items within distance `r` of each of the `n` points in `pts`.
+     *
+     * The neighbors of `pts[q]` are written to `(*out)[q]`, as positions in the
+     * grid's item array (i.e. offsets from `begin()`), in no particular order.
+     *
+     * Rather than answering one query at a time, the queries are binned, and each bin
+     * of items near a bin of queries is read once and tested against all of those
+     * queries together.
+     */
+    void within_radius(const point_t* pts, index_t n, T r, NeighborList* out) const {
+        within_radius_impl(pts, n, r, out, nullptr);
+    }
+    
+    /**
+     * @brief Find the items within distance `r` of each of the `n` points in `pts`,
+     * dividing the work between the threads of `pool`.
+     *
+     * See `within_radius(const point_t*, index_t, T, NeighborList*)`.
+     */
+    void within_radius(const point_t* pts, index_t n, T r, NeighborList* out, WorkPool& pool) const {
+        within_radius_impl(pts, n, r, out, &pool);
+    }
+    
+    /**
+     * @brief Find, for every item in the grid, the items within distance `r` of it.
+     *
+     * The neighbors of the item at position `i` (offset from `begin()`) are written
+     * to `(*out)[i]`, as positions of items, in no particular order. Each item is
+     * its own neighbor.
+     */
+    void neighbors(T r, NeighborList* out) const {
+        batch_within_radius(*this, item_position {this}, size(), r, out, nullptr);
+    }
+    
+    /**
+     * @brief Find, for every item in the grid, the items within distance `r` of it,
+     * dividing the work between the threads of `pool`.
+     *
+     * See `neighbors(T, NeighborList*)`.
+     */
+    void neighbors(T r, NeighborList* out, WorkPool& pool) const {
+        batch_within_radius(*this, item_position {this}, size(), r, out, &pool);
+    }
+    
+protected:
+    
+    template <typename, index_t, typename> friend class HashGrid;
+    
+    // position of an item in the grid's item array
+    struct item_position {
+        const HashGrid* grid;
+        inline index_t operator()(const item_t& item) const {
+            return &item - grid->_items.data();
+        }
+    };
+    
+    void within_radius_impl(const point_t* pts, index_t n, T r, NeighborList* out, WorkPool* pool) const {
+        // bin the queries the same way as the items
+        HashGrid<T,N,index_t> qgrid(_cellsize);
+        for (index_t i = 0; i < n; ++i) qgrid.insert(pts[i], i);
+        qgrid.rebuild();
+        auto qindex = [](const typename HashGrid<T,N,index_t>::item_t& q) { return q.second; };
+        batch_within_radius(qgrid, qindex, n, r, out, pool);
+    }
+    
+    inline uint64_t hash_bin(const bin_t& key) const {
+        return detail::hash_grid_bin<N>(key);
+    }
+    
+    // empty the table, and size it to hold `n_bins` at no more than half load.
+    void reset_table(index_t n_bins) {
+        index_t log_cap = 4;
+        while ((index_t(1) << log_cap) < 2 * n_bins) ++log_cap;
+        _shift = 64 - log_cap;
+        _table.assign(index_t(1) << log_cap, Slot {bin_t(), -1});
+    }
+    
+    // index of the slot holding `key`, or of the empty slot where it would go.
+    index_t probe(const bin_t& key) const {
+        const uint64_t mask = _table.size() - 1;
+        uint64_t i = hash_bin(key) >> _shift;
+        while (true) {
+            const Slot& s = _table[i];
+            if (s.bin < 0 or s.key == key) return i;
+            i = (i + 1) & mask;
+        }
+    }
+    
+    // call `fn(item)` for every item in a bin which touches `region`.
+    template <typename Fn>
+    void visit_bins(const Rect<T,N>& region, Fn&& fn) const {
+        visit_block(bin_of(region.lo), bin_of(region.hi), [&](index_t b) {
+            for (const item_t& item : bin_items(b)) fn(item);
+        });
+    }
+    
+    // call `fn(b)` for every occupied bin `b` whose key is in the block `[lo, hi]`
+    // (inclusive along every axis).
+    template <typename Fn>
+    void visit_block(const bin_t& lo, const bin_t& hi, Fn&& fn) const {
+        if (_bin_keys.empty()) return;
+        // if the block covers more bins than are occupied, it's
+        // cheaper to check every occupied bin than every covered one.
+        double n_covered = 1;
+        for (index_t k = 0; k < N; ++k) {
+            if (coord(hi, k) < coord(lo, k)) return;
+            n_covered *= (double) coord(hi, k) - (double) coord(lo, k) + 1;
+        }
+        if (n_covered > (double) _bin_keys.size()) {
+            for (index_t b = 0; b < (index_t) _bin_keys.size(); ++b) {
+                const bin_t& key = _bin_keys[b];
+                bool inside = true;
+                for (index_t k = 0; k < N; ++k) {
+                    if (coord(key, k) < coord(lo, k) or coord(key, k) > coord(hi, k)) {
+                        inside = false;
+                        break;
+                    }
+                }
+                if (inside) fn(b);
+            }
+            return;
+        }
+        // odometer over the covered bins
+        bin_t cur = lo;
+        while (true) {
+            index_t b = find_bin(cur);
+            if (b >= 0) fn(b);
+            index_t k = 0;
+            for (; k < N; ++k) {
+                if (coord(cur, k) < coord(hi, k)) {
+                    coord(cur, k) += 1;
+                    break;
+                }
+                coord(cur, k) = coord(lo, k);
+            }
+            if (k == N) break;
+        }
+    }
+    
+    // find the neighbors of the queries held in the bins of `qgrid`, which may be
+    // this grid. `qindex(qitem)` gives the index of a query among the results.
+    // work is divided between tasks by query bin. each task writes the hit counts of
+    // its own queries, so no two tasks write the same element of `out`.
+    template <typename QGrid, typename QIndex>
+    void batch_within_radius(
+            const QGrid&  qgrid,
+            QIndex        qindex,
+            index_t       n_queries,
+            T             r,
+            NeighborList* out,
+            WorkPool*     pool) const
+    {
+        typedef typename QGrid::item_t qitem_t;
+        struct Task {
+            index_t b0, b1;
+            // (query, item) pairs, grouped by query
+            std::vector<std::pair<index_t, index_t>> hits;
+        };
+        
+        out->offsets.assign(n_queries + 1, 0);
+        out->indices.clear();
+        if (n_queries == 0 or _items.empty() or not (r >= 0)) return;
+        
+        // cut the query bins into runs with similar numbers of queries;
+        // several per thread, so that stealing can even out the load.
+        index_t n_tasks = pool ? 8 * (pool->thread_count() + 1) : 1;
+        index_t target  = std::max<index_t>(n_queries / n_tasks, 64);
+        std::vector<Task> tasks;
+        for (index_t b = 0, n = 0, b0 = 0; b < qgrid.bin_count(); ++b) {
+            n += qgrid.bin_items(b).size();
+            if (n >= target or b + 1 == qgrid.bin_count()) {
+                tasks.push_back({b0, b + 1, {}});
+                b0 = b + 1;
+                n  = 0;
+            }
+        }
+        
+        const T       r2     = r * r;
+        const index_t reach  = (index_t) std::ceil(r / _cellsize);
+        index_t*      counts = out->offsets.data() + 1;
+        auto find_hits = [&](Task& task) {
+            for (index_t qb = task.b0; qb < task.b1; ++qb) {
+                std::span<const qitem_t> qs = qgrid.bin_items(qb);
+                bin_t lo = qgrid.bin_key(qb);
+                bin_t hi = lo;
+                for (index_t k = 0; k < N; ++k) {
+                    coord(lo, k) -= reach;
+                    coord(hi, k) += reach;
+                }
+                size_t h0 = task.hits.size();
+                // each item in range is loaded once, and tested against all the queries in the bin
+                visit_block(lo, hi, [&](index_t b) {
+                    for (const item_t& item : bin_items(b)) {
+                        const index_t i = &item - _items.data();
+                        for (const qitem_t& q : qs) {
+                            T d2 = 0;
+                            for (index_t k = 0; k < N; ++k) {
+                                T x = coord(item.first, k) - coord(q.first, k);
+                                d2 += x * x;
+                            }
+                            if (d2 <= r2) task.hits.push_back({qindex(q), i});
+                        }
+                    }
+                });
+                auto first_less = [](const auto& a, const auto& b) { return a.first < b.first; };
+                std::stable_sort(task.hits.begin() + h0, task.hits.end(), first_less);
+                for (size_t h = h0; h < task.hits.size(); ++h) counts[task.hits[h].first] += 1;
+            }
+        };
+        auto for_each_task = [&](auto&& fn) {
+            if (pool and tasks.size() > 1) {
+                WorkGroup group;
+                for (Task& task : tasks) pool->submit(group, [&fn, &task]() { fn(task); });
+                pool->wait(group);
+            } else {
+                for (Task& task : tasks) fn(task);
+            }
+        };
+        for_each_task(find_hits);
+        
+        // counts -> offsets
+        for (index_t q = 0; q < n_queries; ++q) out->offsets[q + 1] += out->offsets[q];
+        out->indices.resize(out->offsets[n_queries]);
+        
+        for_each_task([out](Task& task) {
+            index_t prev = -1;
+            index_t pos  = 0;
+            for (const auto& [q, i] : task.hits) {
+                if (q != prev) {
+                    pos  = out->offsets[q];
+                    prev = q;
+                }
+                out->indices[pos++] = i;
+            }
+        });
+    }
+    
+};
+
+/// @} // addtogroup shape
+
+} // namespace geom
@@ -0,0 +1,495 @@
+#pragma once
+
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <geomc/linalg/Vec.h>
+#include <geomc/shape/HashGrid.h>
+#include <geomc/shape/Rect.h>
+#include <geomc/shape/shapedetail/IndexHelpers.h>
+
+// todo: a batched, parallel overlapping_pairs(), in the style of HashGrid::neighbors().
+
+namespace geom {
+
+/** @addtogroup shape
+ *  @{
+ */
+
+
+/**
+ * @brief A dynamic, multi-resolution grid of bounded objects, for overlap queries
+ * over objects of widely varying sizes.
+ *
+ * A single grid like `BinLatticePartition` or `HashGrid` works well only when the
+ * objects are about the size of its cells: an object much larger than a cell
+ * touches many cells, and one much smaller wastes the cell's resolution. A
+ * hierarchical grid keeps a stack of sparse grids ("levels"), each with cells
+ * twice as wide as the one below, starting from `min_cell_size()` at level 0.
+ * Each object is stored once, at the finest level whose cells are at least as
+ * wide as the object's bounding box, in the cell containing the box's lower corner.
+ *
+ * A query visits each occupied level. Because no object at a level is wider than
+ * its cells, a query box only has to look in the cells which it covers, plus one
+ * more along the lower side of each axis. Each of those cells holds objects
+ * comparable in size to the cell, so the work done is proportional to the number
+ * of objects found, plus a small constant per level. Both insertion and erasure
+ * are `O(1)` expected, independent of how the object sizes are distributed.
+ *
+ * Objects larger than the cells of the top level (`max_levels - 1`) are kept at
+ * the top level, and queries at that level reach far enough to find them. Such
+ * objects can make queries slower, but never incorrect.
+ *
+ * Each object is known by the id returned by `insert()`, which remains valid
+ * until the object is erased. Ids of erased objects are reused.
+ *
+ * Objects are tested against queries by their bounding boxes, which are treated
+ * as closed; boxes that only touch are considered to overlap.
+ *
+ * Plays nice in one dimension; bounds and points are `Rect<T,1>` and `T`.
+ *
+ * @tparam T Coordinate type.
+ * @tparam N Dimension of the space.
+ * @tparam Object Spatial object to be indexed. May be a `Rect<T,N>`, a `Vec<T,N>`,
+ * another `BoundedObject`, or a `std::pair<K,V>` with `K` any of the former.
+ * Must be copy-assignable.
+ */
+template <typename T, index_t N, typename Object>
+class HierarchicalGrid {
+public:
+    
+    typedef typename PointType<index_t,N>::point_t bin_t;
+    typedef typename PointType<T,N>::point_t       point_t;
+    
+    /// Maximum number of levels. Objects wider than the cells of the top level are kept there.
+    static constexpr index_t max_levels = 48;
+    
+protected:
+    
+    typedef detail::ShapeIndexHelper<T,N,Object> helper_t;
+    
+    struct Entry {
+        Object    obj;
+        Rect<T,N> box;
+        bin_t     bin;
+        // the level of the object, or -1 if this entry is free
+        index_t   level;
+        // neighbors in the bin's list. free entries are chained by `next`.
+        index_t   prev;
+        index_t   next;
+    };
+    
+    // an entry in a level's hash table: an occupied bin, and its first entry.
+    struct Slot {
+        bin_t   key;
+        index_t head;
+    };
+    
+    struct Level {
+        // open-addressed and linearly probed, as in HashGrid; the size is a power
+        // of two, at least twice the number of occupied bins. empty slots have
+        // `head < 0`. erasure shifts later slots back, so there are no tombstones.
+        std::vector<Slot> table;
+        index_t shift  = 64;
+        index_t n_bins = 0;
+        // the widest box ever stored at this level; never wider than the cells,
+        // except at the top level. does not shrink when objects are erased.
+        T       reach = 0;
+        index_t count = 0;
+    };
+    
+    T                  _cellsize;
+    std::vector<Entry> _entries;
+    std::vector<Level> _levels;
+    // bit `i` is set if level `i` holds any objects
+    uint64_t           _occupied = 0;
+    index_t            _free     = -1;
+    index_t            _size     = 0;
+    
+    static_assert(max_levels <= 64);
+    
+public:
+    
+    /*****************************
+     * Structors                 *
+     *****************************/
+    
+    /// Construct an empty grid whose finest cells have width `min_cellsize`.
+    explicit HierarchicalGrid(T min_cellsize=1):_cellsize(min_cellsize) {}
+    
+    /// Construct a grid whose finest cells have width `min_cellsize`, holding the objects in `[begin, end)`.
+    template <typename ObjectIterator>
+    HierarchicalGrid(ObjectIterator begin, ObjectIterator end, T min_cellsize=1):
+            HierarchicalGrid(min_cellsize)
+    {
+        for (; begin != end; ++begin) insert(*begin);
+    }
+    
+    /*****************************
+     * Modification              *
+     *****************************/
+    
+    /**
+     * @brief Add `obj` to the grid.
+     *
+     * @return An id for the object, by which it may be erased or updated.
+     */
+    index_t insert(const Object& obj) {
+        index_t id;
+        if (_free >= 0) {
+            id    = _free;
+            _free = _entries[id].next;
+            _entries[id].obj = obj;
+        } else {
+            id = _entries.size();
+            _entries.push_back({obj, {}, {}, -1, -1, -1});
+        }
+        place(id);
+        ++_size;
+        return id;
+    }
+    
+    /**
+     * @brief Remove the object with id `id` from the grid. The id may be reused
+     * by a later insertion.
+     */
+    void erase(index_t id) {
+        unlink(id);
+        Entry& e = _entries[id];
+        e.level = -1;
+        e.next  = _free;
+        _free   = id;
+        --_size;
+    }
+    
+    /**
+     * @brief Replace the object with id `id` by `obj` (for instance, a copy of the
+     * object which has moved), keeping its id.
+     */
+    void update(index_t id, const Object& obj) {
+        unlink(id);
+        _entries[id].obj = obj;
+        place(id);
+    }
+    
+    /// Remove all objects from the grid.
+    void clear() {
+        _entries.clear();
+        _levels.clear();
+        _occupied = 0;
+        _free     = -1;
+        _size     = 0;
+    }
+    
+    /*****************************
+     * Properties                *
+     *****************************/
+    
+    /// Number of objects in the grid.
+    inline index_t size() const {
+        return _size;
+    }
+    
+    /// `true` if there are no objects in the grid.
+    inline bool empty() const {
+        return _size == 0;
+    }
+    
+    /// The object with id `id`.
+    inline const Object& operator[](index_t id) const {
+        return _entries[id].obj;
+    }
+    
+    /// The bounding box of the object with id `id`.
+    inline const Rect<T,N>& bounds_of(index_t id) const {
+        return _entries[id].box;
+    }
+    
+    /// The level at which the object with id `id` is stored.
+    inline index_t level_of(index_t id) const {
+        return _entries[id].level;
+    }
+    
+    /// Width of the cells at level 0.
+    inline T min_cell_size() const {
+        return _cellsize;
+    }
+    
+    /// Width of the cells at level `level`; `min_cell_size() * 2^level`.
+    inline T cell_size(index_t level) const {
+        return std::ldexp(_cellsize, level);
+    }
+    
+    /// Number of objects stored at level `level`.
+    inline index_t level_size(index_t level) const {
+        return level < (index_t) _levels.size() ? _levels[level].count : 0;
+    }
+    
+    /// The level at which an object with bounding box `box` would be stored.
+    index_t level_for(const Rect<T,N>& box) const {
+        T extent = 0;
+        for (index_t k = 0; k < N; ++k) {
+            extent = std::max(extent, coord(box.hi, k) - coord(box.lo, k));
+        }
+        if (not (extent > _cellsize)) return 0;
+        // the least `L` with `2^L >= extent / cellsize`
+        int e;
+        T   m = std::frexp(extent / _cellsize, &e);
+        index_t level = (m == (T) 0.5) ? e - 1 : e;
+        return std::min(level, max_levels - 1);
+    }
+    
+    /*****************************
+     * Queries                   *
+     *****************************/
+    
+    /**
+     * Call `visit(id, obj)` for each object whose bounding box overlaps `region`.
+     * Objects are visited in no particular order. No memory is allocated.
+     *
+     * The grid must not be modified during the search.
+     */
+    template <typename Visitor>
+    void overlapping(const Rect<T,N>& region, Visitor&& visit) const {
+        for_each_level(0, [&](index_t level) {
+            visit_level(level, region, [&](index_t id) {
+                const Entry& e = _entries[id];
+                if (boxes_touch(e.box, region)) visit(id, e.obj);
+            });
+        });
+    }
+    
+    /**
+     * Call `visit(id, obj)` for each object no farther than `r` from `p`.
+     * Objects are visited in no particular order. No memory is allocated.
+     *
+     * Distance is measured to the object itself if it provides `dist2()`, and to its
+     * bounding box otherwise. The grid must not be modified during the search.
+     */
+    template <typename Visitor>
+    void within_radius(const point_t& p, T r, Visitor&& visit) const {
+        const T r2 = r * r;
+        point_t d;
+        for (index_t k = 0; k < N; ++k) coord(d, k) = r;
+        const Rect<T,N> region(p - d, p + d);
+        for_each_level(0, [&](index_t level) {
+            visit_level(level, region, [&](index_t id) {
+                const Entry& e = _entries[id];
+                if (boxes_touch(e.box, region) and helper_t::dist2(e.obj, p) <= r2) visit(id, e.obj);
+            });
+        });
+    }
+    
+    /**
+     * Call `visit(id_a, id_b)` once for each pair of distinct objects whose bounding
+     * boxes overlap. Pairs are visited in no particular order.
+     *
+     * Each object is only checked against the objects at its own level and above.
+     * The grid must not be modified during the search.
+     */
+    template <typename Visitor>
+    void overlapping_pairs(Visitor&& visit) const {
+        for (index_t a = 0; a < (index_t) _entries.size(); ++a) {
+            const Entry& ea = _entries[a];
+            if (ea.level < 0) continue;
+            for_each_level(ea.level, [&](index_t level) {
+                visit_level(level, ea.box, [&](index_t b) {
+                    // pairs within a level are found from both ends; keep one
+                    if (level == ea.level and b <= a) return;
+                    if (boxes_touch(ea.box, _entries[b].box)) visit(a, b);
+                });
+            });
+        }
+    }
+    
+protected:
+    
+    static inline Rect<T,N> bound_of(const Object& obj) {
+        Rect<T,N> bnd;
+        bnd |= helper_t::bounds(obj);
+        return bnd;
+    }
+    
+    // closed box overlap
+    static inline bool boxes_touch(const Rect<T,N>& a, const Rect<T,N>& b) {
+        for (index_t k = 0; k < N; ++k) {
+            if (coord(a.hi, k) < coord(b.lo, k) or coord(b.hi, k) < coord(a.lo, k)) return false;
+        }
+        return true;
+    }
+    
+    inline bin_t bin_of(const point_t& p, T cellsize) const {
+        bin_t b;
+        for (index_t k = 0; k < N; ++k) {
+            coord(b, k) = (index_t) std::floor(coord(p, k) / cellsize);
+        }
+        return b;
+    }
+    
+    // file the (unlinked) entry `id` under the level and bin of its object.
+    void place(index_t id) {
+        Entry& e = _entries[id];
+        e.box   = bound_of(e.obj);
+        e.level = level_for(e.box);
+        e.bin   = bin_of(e.box.lo, cell_size(e.level));
+        if (e.level >= (index_t) _levels.size()) _levels.resize(e.level + 1);
+        Level& lvl = _levels[e.level];
+        for (index_t k = 0; k < N; ++k) {
+            lvl.reach = std::max(lvl.reach, coord(e.box.hi, k) - coord(e.box.lo, k));
+        }
+        e.prev = -1;
+        e.next = -1;
+        index_t slot = find_slot(lvl, e.bin);
+        if (slot >= 0) {
+            index_t head = lvl.table[slot].head;
+            e.next = head;
+            _entries[head].prev = id;
+            lvl.table[slot].head = id;
+        } else {
+            add_bin(lvl, e.bin, id);
+        }
+        lvl.count += 1;
+        _occupied |= uint64_t(1) << e.level;
+    }
+    
+    // remove the entry `id` from its bin.
+    void unlink(index_t id) {
+        Entry& e   = _entries[id];
+        Level& lvl = _levels[e.level];
+        if (e.next >= 0) _entries[e.next].prev = e.prev;
+        if (e.prev >= 0) {
+            _entries[e.prev].next = e.next;
+        } else if (e.next >= 0) {
+            lvl.table[find_slot(lvl, e.bin)].head = e.next;
+        } else {
+            remove_bin(lvl, find_slot(lvl, e.bin));
+        }
+        if (--lvl.count == 0) _occupied &= ~(uint64_t(1) << e.level);
+    }
+    
+    static inline index_t home_slot(const Level& lvl, const bin_t& key) {
+        return detail::hash_grid_bin<N>(key) >> lvl.shift;
+    }
+    
+    // index of the slot holding `key`, or of the empty slot where it would go.
+    static index_t probe(const Level& lvl, const bin_t& key) {
+        const uint64_t mask = lvl.table.size() - 1;
+        uint64_t i = home_slot(lvl, key);
+        while (true) {
+            const Slot& s = lvl.table[i];
+            if (s.head < 0 or s.key == key) return i;
+            i = (i + 1) & mask;
+        }
+    }
+    
+    // index of the slot holding `key`, or -1 if that bin is empty.
+    static index_t find_slot(const Level& lvl, const bin_t& key) {
+        if (lvl.n_bins == 0) return -1;
+        index_t i = probe(lvl, key);
+        return lvl.table[i].head < 0 ? -1 : i;
+    }
+    
+    // add a bin which is not in the table, whose first entry is `head`.
+    static void add_bin(Level& lvl, const bin_t& key, index_t head) {
+        if (2 * (lvl.n_bins + 1) > (index_t) lvl.table.size()) {
+            // grow to at most half load, and re-place the occupied slots
+            std::vector<Slot> old = std::move(lvl.table);
+            index_t log_cap = 4;
+            while ((index_t(1) << log_cap) < 2 * (lvl.n_bins + 1)) ++log_cap;
+            lvl.shift = 64 - log_cap;
+            lvl.table.assign(index_t(1) << log_cap, Slot {bin_t(), -1});
+            for (const Slot& s : old) {
+                if (s.head >= 0) lvl.table[probe(lvl, s.key)] = s;
+            }
+        }
+        lvl.table[probe(lvl, key)] = {key, head};
+        lvl.n_bins += 1;
+    }
+    
+    // empty the occupied slot `i`, shifting back any later slots in its probe
+    // sequence which could then no longer be found.
+    static void remove_bin(Level& lvl, index_t i) {
+        const index_t mask = lvl.table.size() - 1;
+        index_t j = i;
+        while (true) {
+            j = (j + 1) & mask;
+            const Slot& s = lvl.table[j];
+            if (s.head < 0) break;
+            // the slot stays put if its home is cyclically in `(i, j]`
+            index_t h = home_slot(lvl, s.key);
+            bool stays = (i <= j) ? (i < h and h <= j) : (i < h or h <= j);
+            if (stays) continue;
+            lvl.table[i] = s;
+            i = j;
+        }
+        lvl.table[i].head = -1;
+        lvl.n_bins -= 1;
+    }
+    
+    // call `fn(level)` for each occupied level at or above `min_level`.
+    template <typename Fn>
+    inline void for_each_level(index_t min_level, Fn&& fn) const {
+        for (uint64_t m = _occupied & (~uint64_t(0) << min_level); m; m &= m - 1) {
+            fn((index_t) std::countr_zero(m));
+        }
+    }
+    
+    // call `fn(id)` for each object at `level` whose box might overlap `region`.
+    template <typename Fn>
+    void visit_level(index_t level, const Rect<T,N>& region, Fn&& fn) const {
+        const Level& lvl = _levels[level];
+        const T      cs  = cell_size(level);
+        // an object's lower corner can't be more than `reach` below the region
+        point_t lo_pt = region.lo;
+        for (index_t k = 0; k < N; ++k) coord(lo_pt, k) -= lvl.reach;
+        const bin_t lo = bin_of(lo_pt, cs);
+        const bin_t hi = bin_of(region.hi, cs);
+        auto visit_bin = [&](index_t id) {
+            for (; id >= 0; id = _entries[id].next) fn(id);
+        };
+        // if the block covers more cells than are occupied, it's
+        // cheaper to check every occupied cell than every covered one.
+        double n_covered = 1;
+        for (index_t k = 0; k < N; ++k) {
+            if (coord(hi, k) < coord(lo, k)) return;
+            n_covered *= (double) coord(hi, k) - (double) coord(lo, k) + 1;
+        }
+        if (n_covered > (double) lvl.n_bins) {
+            for (const auto& [key, head] : lvl.table) {
+                if (head < 0) continue;
+                bool inside = true;
+                for (index_t k = 0; k < N; ++k) {
+                    if (coord(key, k) < coord(lo, k) or coord(key, k) > coord(hi, k)) {
+                        inside = false;
+                        break;
+                    }
+                }
+                if (inside) visit_bin(head);
+            }
+            return;
+        }
+        // odometer over the covered cells
+        bin_t cur = lo;
+        while (true) {
+            index_t slot = find_slot(lvl, cur);
+            if (slot >= 0) visit_bin(lvl.table[slot].head);
+            index_t k = 0;
+            for (; k < N; ++k) {
+                if (coord(cur, k) < coord(hi, k)) {
+                    coord(cur, k) += 1;
+                    break;
+                }
+                coord(cur, k) = coord(lo, k);
+            }
+            if (k == N) break;
+        }
+    }
+    
+};
+
+/// @} // addtogroup shape
+
+} // namespace geom
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <concepts>
+#include <limits>
+
 #include <geomc/linalg/Vec.h>
 #include <geomc/linalg/Orthogonal.h>
 #include <geomc/shape/Simplex.h>
@@ -10,10 +15,68 @@
 #endif
 
 #include <geomc/shape/shapedetail/SimplexProject.h>
+#include <geomc/shape/shapedetail/ExpandingPolytope.h>
 
 
 namespace geom {
 
+/**
+ * @brief The separation of two convex shapes, as found by `Intersector::distance()`.
+ */
+template <typename T, index_t N>
+struct ConvexDistance {
+    /// Distance between the shapes; zero if they overlap. If `beyond_threshold`,
+    /// a lower bound on the distance.
+    T        distance         = 0;
+    /// Point on the first shape nearest to the second. If the shapes overlap,
+    /// a point inside both.
+    Vec<T,N> point_a;
+    /// Point on the second shape nearest to the first. If the shapes overlap,
+    /// equal to `point_a`.
+    Vec<T,N> point_b;
+    /// `true` if the shapes overlap.
+    bool     overlapping      = false;
+    /// `true` if the search stopped early, because the shapes are farther apart
+    /// than the threshold. The points are then the nearest found so far.
+    bool     beyond_threshold = false;
+};
+
+
+/**
+ * @brief The overlap of two convex shapes, as found by `Intersector::penetration()`.
+ */
+template <typename T, index_t N>
+struct ConvexPenetration {
+    /// `true` if the shapes overlap. If not, the other fields are not meaningful.
+    bool     overlapping = false;
+    /// Length of the shortest translation of either shape which separates them.
+    T        depth       = 0;
+    /// Unit direction in which to move the second shape (or opposite which to move
+    /// the first) to separate them.
+    Vec<T,N> normal;
+    /// The point of the first shape deepest inside the second.
+    Vec<T,N> point_a;
+    /// The point of the second shape deepest inside the first.
+    /// `point_a - point_b` is `depth * normal`.
+    Vec<T,N> point_b;
+};
+
+
+/**
+ * @brief The state needed to resume testing a pair of shapes, as saved by
+ * `Intersector::warm_start_state()`.
+ */
+template <typename T, index_t N>
+struct IntersectorWarmStart {
+    /// Axis separating the shapes, or the last search direction if they overlapped.
+    Vec<T,N> axis = Vec<T,N>::unit_x;
+    /// Directions in which the vertices of the final simplex were found, if the shapes overlapped.
+    Vec<T,N> directions[N + 1];
+    /// Number of `directions`; zero if the shapes were disjoint.
+    index_t  n = 0;
+};
+
+
 template <typename T, index_t N>
 struct Intersector {
     // afaict this is never reached in 2D or 3D
@@ -25,6 +88,16 @@ struct Intersector {
     index_t iterations        = 0;
     /// set to `true` iff the last intersection test resulted in a degenerate simplex
     bool was_degenerate       = false;
+    /// iteration limit for `distance()`. polytopes converge exactly in a few
+    /// iterations; curved shapes converge linearly, and may take dozens.
+    index_t max_distance_iterations = 64;
+    /// relative precision to which `distance()` finds the separation of two shapes,
+    /// and `penetration()` finds their overlap.
+    T distance_tolerance      = std::sqrt(std::numeric_limits<T>::epsilon());
+    /// iteration limit for `penetration()`. each iteration adds a vertex to the polytope.
+    /// polytopes converge in a few iterations; curved shapes may need hundreds for
+    /// full precision.
+    index_t max_penetration_iterations = 128;
 
 #if DEBUG_INTERSECTION
     FILE* debug_file = nullptr;
@@ -37,29 +110,319 @@ protected:
     // front and back buffer:
     Simplex<T,N>* cur_simplex  = &simplex_a;
     Simplex<T,N>* next_simplex = &simplex_b;
+    // the points on each shape whose difference is each vertex of `cur_simplex`.
+    // kept only by distance queries.
+    Vec<T,N> support_a[N + 1];
+    Vec<T,N> support_b[N + 1];
+    // buffers for penetration queries, kept to avoid reallocation
+    detail::ExpandingPolytope<T,N> polytope;
+    // the search direction which found each vertex of `cur_simplex`.
+    // kept by intersection tests.
+    Vec<T,N> support_dir[N + 1];
+    // directions to find the starting simplex of the next intersection test, if any
+    Vec<T,N> seed_dir[N + 1];
+    index_t  seed_n = 0;
 
 public:
 
     const Simplex<T,N>& simplex() const { return *cur_simplex; }
     
+    /**
+     * @brief Save what is needed to resume testing the shapes of the last
+     * `intersects()` test, after they have moved.
+     */
+    IntersectorWarmStart<T,N> warm_start_state(bool overlapping) const {
+        IntersectorWarmStart<T,N> w;
+        w.axis = separation_axis;
+        if (overlapping) {
+            w.n = cur_simplex->n;
+            std::copy(support_dir, support_dir + w.n, w.directions);
+        }
+        return w;
+    }
+    
+    /**
+     * @brief Start the next `intersects()` or `penetration()` test from the
+     * state saved after an earlier test of the same two shapes.
+     *
+     * If the shapes have moved only a little since, the next test will usually
+     * finish in a single iteration: Shapes which are still separated along the
+     * saved axis are rejected with one support query each, and overlapping shapes
+     * are accepted if the supports in the saved directions still enclose the origin.
+     * Otherwise, the search continues from there as usual.
+     *
+     * `distance()` starts from the saved axis, but discards the saved directions,
+     * so that they are not applied to whichever pair is tested next.
+     */
+    void warm_start(const IntersectorWarmStart<T,N>& w) {
+        if (not w.axis.is_zero()) separation_axis = w.axis;
+        seed_n = w.n;
+        std::copy(w.directions, w.directions + w.n, seed_dir);
+    }
+    
+    /**
+     * @brief Test whether two convex shapes overlap.
+     *
+     * The shapes are accessed through virtual calls, so a single instantiation
+     * serves every combination of shape types. Use this with heterogeneous
+     * collections of shapes.
+     */
     bool intersects(
         const AnyConvex<T,N>& shape_a,
         const AnyConvex<T,N>& shape_b)
     {
+        return gjk_intersects(shape_a, shape_b);
+    }
+    
+    /**
+     * @brief Test whether two convex shapes overlap.
+     *
+     * The GJK loop is instantiated for this pair of shape types, so both support
+     * functions are called directly and may be inlined. Prefer this in hot loops
+     * over shapes of known type.
+     */
+    template <ConvexObject ShapeA, ConvexObject ShapeB>
+    requires (ShapeA::N == N and ShapeB::N == N)
+        and std::same_as<T, typename ShapeA::elem_t>
+        and std::same_as<T, typename ShapeB::elem_t>
+        // shapes wrapped by `as_any_convex()` take the virtual path
+        and (not std::derived_from<ShapeA, AnyConvex<T,N>>)
+        and (not std::derived_from<ShapeB, AnyConvex<T,N>>)
+    bool intersects(const ShapeA& shape_a, const ShapeB& shape_b) {
+        return gjk_intersects(shape_a, shape_b);
+    }
+
+    /**
+     * @brief Find the distance between two convex shapes, and the nearest points on each.
+     *
+     * After the query, `simplex()` is the face of the minkowski difference (`shape_a - shape_b`)
+     * nearest to the origin, or a simplex enclosing the origin if the shapes overlap.
+     *
+     * @param shape_a First shape.
+     * @param shape_b Second shape.
+     * @param threshold Give up as soon as the shapes are known to be farther apart
+     * than this.
+     */
+    ConvexDistance<T,N> distance(
+        const AnyConvex<T,N>& shape_a,
+        const AnyConvex<T,N>& shape_b,
+        T threshold=std::numeric_limits<T>::infinity())
+    {
+        return gjk_distance(shape_a, shape_b, threshold);
+    }
+    
+    /**
+     * @brief Find the distance between two convex shapes of known type, and the nearest
+     * points on each.
+     *
+     * See `distance(const AnyConvex<T,N>&, const AnyConvex<T,N>&, T)`.
+     */
+    template <ConvexObject ShapeA, ConvexObject ShapeB>
+    requires (ShapeA::N == N and ShapeB::N == N)
+        and std::same_as<T, typename ShapeA::elem_t>
+        and std::same_as<T, typename ShapeB::elem_t>
+        and (not std::derived_from<ShapeA, AnyConvex<T,N>>)
+        and (not std::derived_from<ShapeB, AnyConvex<T,N>>)
+    ConvexDistance<T,N> distance(
+        const ShapeA& shape_a,
+        const ShapeB& shape_b,
+        T threshold=std::numeric_limits<T>::infinity())
+    {
+        return gjk_distance(shape_a, shape_b, threshold);
+    }
+
+    /**
+     * @brief Find how deeply two convex shapes overlap, and the direction in which
+     * to separate them.
+     *
+     * The shapes are first tested for overlap, as by `intersects()`. If they overlap,
+     * the final simplex is grown into a polytope inside their minkowski difference,
+     * by the expanding polytope algorithm (EPA), until it finds the nearest point on
+     * the boundary of the difference. Buffers are kept between calls, so steady-state
+     * use does not allocate.
+     *
+     * Available in two and three dimensions.
+     */
+    ConvexPenetration<T,N> penetration(
+        const AnyConvex<T,N>& shape_a,
+        const AnyConvex<T,N>& shape_b) requires (N == 2 or N == 3)
+    {
+        return gjk_penetration(shape_a, shape_b);
+    }
+    
+    /**
+     * @brief Find how deeply two convex shapes of known type overlap, and the direction
+     * in which to separate them.
+     *
+     * See `penetration(const AnyConvex<T,N>&, const AnyConvex<T,N>&)`.
+     */
+    template <ConvexObject ShapeA, ConvexObject ShapeB>
+    requires (N == 2 or N == 3)
+        and (ShapeA::N == N and ShapeB::N == N)
+        and std::same_as<T, typename ShapeA::elem_t>
+        and std::same_as<T, typename ShapeB::elem_t>
+        and (not std::derived_from<ShapeA, AnyConvex<T,N>>)
+        and (not std::derived_from<ShapeB, AnyConvex<T,N>>)
+    ConvexPenetration<T,N> penetration(const ShapeA& shape_a, const ShapeB& shape_b) {
+        return gjk_penetration(shape_a, shape_b);
+    }
+
+protected:
+
+    // reorder the kept supports to match the vertices of the simplex
+    // `face`, as `SimplexProjection::projected_face()` does.
+    void keep_face_supports(const detail::SimplexFace<T,N>& face) {
+        keep_face(face, support_a);
+        keep_face(face, support_b);
+    }
+    
+    static void keep_face(const detail::SimplexFace<T,N>& face, Vec<T,N>* v) {
+        Vec<T,N> kept[N + 1];
+        for (index_t i = 0; i <= face.n; ++i) kept[i] = v[face.included[i]];
+        std::copy(kept, kept + face.n + 1, v);
+    }
+
+    template <typename ShapeA, typename ShapeB>
+    ConvexPenetration<T,N> gjk_penetration(const ShapeA& shape_a, const ShapeB& shape_b) {
+        ConvexPenetration<T,N> out;
+        if (not gjk_intersects<true>(shape_a, shape_b)) return out;
+        detail::PolytopeVertex<T,N> s[N + 1];
+        for (index_t i = 0; i < cur_simplex->n; ++i) {
+            s[i] = {cur_simplex->pts[i], support_a[i], support_b[i]};
+        }
+        auto support = [&](const Vec<T,N>& d) {
+            Vec<T,N> pa = shape_a.convex_support( d);
+            Vec<T,N> pb = shape_b.convex_support(-d);
+            return detail::PolytopeVertex<T,N> {pa - pb, pa, pb};
+        };
+        polytope.expand(s, cur_simplex->n, support, max_penetration_iterations, distance_tolerance, &out);
+        return out;
+    }
+
+    // GJK in its original form: walk the simplex toward the point of the
+    // minkowski difference nearest the origin, `v`, until the support in the
+    // direction of the origin gets no closer.
+    template <typename ShapeA, typename ShapeB>
+    ConvexDistance<T,N> gjk_distance(const ShapeA& shape_a, const ShapeB& shape_b, T threshold) {
+        ConvexDistance<T,N> out;
+        const T tol = 2 * distance_tolerance;
+        // a warm start is only consumed by the overlap test
+        seed_n = 0;
+        support_a[0] = shape_a.convex_support( separation_axis);
+        support_b[0] = shape_b.convex_support(-separation_axis);
+        Vec<T,N> v   = support_a[0] - support_b[0];
+        T        vv  = v.mag2();
+        T        vw  = 0;
+        cur_simplex->n = 0;
+        cur_simplex->insert(v);
+        was_degenerate = false;
+        
+        iterations = 0;
+        while (vv > 0 and iterations < max_distance_iterations) {
+            iterations += 1;
+            Vec<T,N> pa = shape_a.convex_support(-v);
+            Vec<T,N> pb = shape_b.convex_support( v);
+            Vec<T,N> w  = pa - pb;
+            vw = v.dot(w);
+            if (vw > 0 and vw * vw > threshold * threshold * vv) {
+                // `vw / |v|` is a lower bound on the distance
+                out.beyond_threshold = true;
+                break;
+            }
+            // no closer in the direction of the origin
+            if (vv - vw <= tol * vv) break;
+            bool seen = false;
+            for (index_t i = 0; i < cur_simplex->n; ++i) seen = seen or cur_simplex->pts[i] == w;
+            if (seen) break;
+            
+            index_t k = cur_simplex->n;
+            cur_simplex->insert(w);
+            support_a[k] = pa;
+            support_b[k] = pb;
+            detail::SimplexProjection<T,N> proj {
+                *cur_simplex,
+                {}, // origin
+                detail::ProjectionOp::CLIP,
+                detail::SimplexFaces::SKIP_BACKFACE
+            };
+            was_degenerate = was_degenerate or proj.result.is_degenerate;
+            if (proj.result.contains) {
+                // the origin is inside the simplex
+                vv = 0;
+                break;
+            }
+            Vec<T,N> next_v  = proj.projected_point();
+            T        next_vv = next_v.mag2();
+            if (next_vv >= vv) {
+                // numerically stalled; keep what we had
+                cur_simplex->n = k;
+                break;
+            }
+            // reduce the simplex (and its supports) to the face nearest the origin
+            *next_simplex = proj.projected_face();
+            keep_face_supports(proj.result.face);
+            std::swap(cur_simplex, next_simplex);
+            v  = next_v;
+            vv = next_vv;
+        }
+        
+        // the nearest points are the same combination of the supports
+        // as `v` is of the simplex
+        T w[N + 1];
+        const Simplex<T,N>& s = *cur_simplex;
+        detail::barycentric_coords(s.pts, s.n, vv > 0 ? v : Vec<T,N>(), w);
+        for (index_t i = 0; i < s.n; ++i) {
+            out.point_a += w[i] * support_a[i];
+            out.point_b += w[i] * support_b[i];
+        }
+        if (vv > 0) {
+            out.distance    = std::sqrt(vv);
+            separation_axis = -v;
+            // report the lower bound
+            if (out.beyond_threshold) out.distance = vw / out.distance;
+        } else {
+            out.overlapping = true;
+            out.point_b     = out.point_a;
+        }
+        return out;
+    }
+
+    // if `KeepSupports`, the points of each shape making up the vertices
+    // of the simplex are kept in `support_a` and `support_b`.
+    template <bool KeepSupports=false, typename ShapeA, typename ShapeB>
+    bool gjk_intersects(const ShapeA& shape_a, const ShapeB& shape_b) {
+        iterations = 0;
         // `a` is a point on the minkowski difference
-        Vec<T,N> a = shape_a.convex_support( separation_axis) -
-                     shape_b.convex_support(-separation_axis);
-        // `d` is the previous search direction
-        Vec<T,N> d = -a;
+        Vec<T,N> pa = shape_a.convex_support( separation_axis);
+        Vec<T,N> pb = shape_b.convex_support(-separation_axis);
+        Vec<T,N> a  = pa - pb;
         // initialize the simplex with a single point:
         cur_simplex->n = 0;
         cur_simplex->insert(a);
+        if (a.dot(separation_axis) < 0) {
+            // the shapes are still separated along the previous axis
+            iterations     = 1;
+            was_degenerate = false;
+            seed_n         = 0;
+            return false;
+        }
+        // `d` is the previous search direction
+        Vec<T,N> d = -a;
+        support_dir[0] = separation_axis;
+        if constexpr (KeepSupports) {
+            support_a[0] = pa;
+            support_b[0] = pb;
+        }
+        if (seed_n > 0) {
+            int seeded = gjk_seed<KeepSupports>(shape_a, shape_b, &d);
+            if (seeded >= 0) return seeded;
+        }
         
-        iterations = 0;
         while (true) {
             iterations += 1;
-            a = shape_a.convex_support( d) - 
-                shape_b.convex_support(-d);
+            pa = shape_a.convex_support( d);
+            pb = shape_b.convex_support(-d);
+            a  = pa - pb;
             T k = a.dot(d);
             if (k < 0 or a == cur_simplex->pts[cur_simplex->n - 1]) {
                 // we tried to search as far as we could in direction `d`,
@@ -68,6 +431,11 @@ public:
                 // return whether the origin is inside the minkowski difference
                 return k >= 0;
             }
+            support_dir[cur_simplex->n] = d;
+            if constexpr (KeepSupports) {
+                support_a[cur_simplex->n] = pa;
+                support_b[cur_simplex->n] = pb;
+            }
             cur_simplex->insert(a);
             // project the origin onto the simplex,
             // putting the projection face into `next_simplex`
@@ -80,6 +448,8 @@ public:
             d = proj.normal_direction();
             *next_simplex  = proj.projected_face();
             was_degenerate = proj.result.is_degenerate;
+            keep_face(proj.result.face, support_dir);
+            if constexpr (KeepSupports) keep_face_supports(proj.result.face);
             
 #if DEBUG_INTERSECTION
             if (debug_file) {
@@ -89,12 +459,76 @@ public:
             std::swap(cur_simplex, next_simplex);
             if (cur_simplex->n == N + 1 or d.is_zero()) {
                 // the simplex is full, and the origin is inside it.
-                separation_axis = d;
+                // keep the previous axis if `d` is zero; a zero axis
+                // would be a degenerate starting direction for the next test.
+                if (not d.is_zero()) separation_axis = d;
                 return true;
             }
             if (iterations > max_iterations or d.mag2() == 0) { return true; }
         }
     }
+    
+    // build a simplex from the supports in the directions `seed_dir`, and project
+    // the origin onto it. returns 0 or 1 if that decides the test; otherwise -1,
+    // with the projected face in `cur_simplex` and the next search direction in `d`,
+    // or with `cur_simplex` untouched if the seed was no use.
+    template <bool KeepSupports, typename ShapeA, typename ShapeB>
+    int gjk_seed(const ShapeA& shape_a, const ShapeB& shape_b, Vec<T,N>* d) {
+        index_t n_seed = seed_n;
+        seed_n     = 0;
+        iterations = 1;
+        Simplex<T,N>& s = *next_simplex;
+        Vec<T,N> sa[N + 1];
+        Vec<T,N> sb[N + 1];
+        Vec<T,N> dirs[N + 1];
+        s.n = 0;
+        for (index_t i = 0; i < n_seed; ++i) {
+            const Vec<T,N>& u = seed_dir[i];
+            Vec<T,N> pa = shape_a.convex_support( u);
+            Vec<T,N> pb = shape_b.convex_support(-u);
+            Vec<T,N> w  = pa - pb;
+            if (w.dot(u) < 0) {
+                // `u` separates the shapes
+                separation_axis = u;
+                was_degenerate  = false;
+                return 0;
+            }
+            bool seen = false;
+            for (index_t j = 0; j < s.n; ++j) seen = seen or s.pts[j] == w;
+            if (seen) continue;
+            sa[s.n]   = pa;
+            sb[s.n]   = pb;
+            dirs[s.n] = u;
+            s.insert(w);
+        }
+        if (s.n < 2) return -1;
+        // every face must be checked; unlike in the GJK loop, the
+        // last vertex is not known to be nearest the origin
+        detail::SimplexProjection<T,N> proj {
+            s,
+            {}, // origin
+            detail::ProjectionOp::CLIP,
+            detail::SimplexFaces::ALL
+        };
+        // a flat simplex can't be trusted to enclose the origin; start afresh
+        if (proj.result.is_degenerate) return -1;
+        Vec<T,N> next_d = proj.normal_direction();
+        *cur_simplex    = proj.projected_face();
+        was_degenerate  = false;
+        std::copy(dirs, dirs + s.n, support_dir);
+        keep_face(proj.result.face, support_dir);
+        if constexpr (KeepSupports) {
+            std::copy(sa, sa + s.n, support_a);
+            std::copy(sb, sb + s.n, support_b);
+            keep_face_supports(proj.result.face);
+        }
+        if (cur_simplex->n == N + 1 or next_d.is_zero()) {
+            if (not next_d.is_zero()) separation_axis = next_d;
+            return 1;
+        }
+        *d = next_d;
+        return -1;
+    }
 
 }; // struct Intersector
 
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+
+#include <geomc/Hash.h>
+#include <geomc/shape/Intersect.h>
+
+namespace geom {
+
+/** @addtogroup shape
+ *  @{
+ */
+
+
+/**
+ * @brief Remembers the result of the last intersection test of each of many pairs
+ * of shapes, and starts the next test of each pair from there.
+ *
+ * An `Intersector` starts each test from the separating axis found by its previous
+ * test, which helps only when it tests the same pair over and over. When one
+ * intersector tests many persistent pairs in turn (for instance, the candidate
+ * pairs of a simulation, every tick), this cache keeps the separating axis and
+ * the search directions of the final simplex of each pair instead, keyed by an id
+ * chosen by the caller. Pairs which move only a little between tests usually finish
+ * in one or two iterations.
+ *
+ *     IntersectionCache<double,3> cache;
+ *     while (simulating) {
+ *         for (auto [i, j] : candidate_pairs) {
+ *             if (cache.intersects({i, j}, bodies[i], bodies[j])) resolve(i, j);
+ *         }
+ *         // forget pairs which were not tested this tick
+ *         cache.end_frame();
+ *     }
+ *
+ * Keys are hashed with `geom::hash()`, so any type with a `Digest` may be used.
+ * The shapes of each pair should be passed in the same order every time.
+ *
+ * Not thread safe; use one cache per thread.
+ *
+ * @tparam T Coordinate type.
+ * @tparam N Dimension of the space.
+ * @tparam Key Id of a pair of shapes.
+ */
+template <typename T, index_t N, typename Key=std::pair<index_t,index_t>>
+class IntersectionCache {
+public:
+    
+    typedef Key key_t;
+    
+protected:
+    
+    struct Entry {
+        IntersectorWarmStart<T,N> state;
+        // the frame of the last test
+        uint64_t frame = 0;
+    };
+    
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            return geom::hash<Key,size_t>(k);
+        }
+    };
+    
+    Intersector<T,N>                      _gjk;
+    std::unordered_map<Key,Entry,KeyHash> _pairs;
+    uint64_t                              _frame = 0;
+    
+public:
+    
+    /**
+     * @brief Test whether two convex shapes overlap, starting from the result
+     * of the last test of the pair `pair`.
+     *
+     * The shapes may be of known type, or wrapped by `as_any_convex()`; see
+     * `Intersector::intersects()`.
+     */
+    template <typename ShapeA, typename ShapeB>
+    bool intersects(const Key& pair, const ShapeA& shape_a, const ShapeB& shape_b) {
+        Entry& e = _pairs[pair];
+        _gjk.warm_start(e.state);
+        bool hit = _gjk.intersects(shape_a, shape_b);
+        e.state  = _gjk.warm_start_state(hit);
+        e.frame  = _frame;
+        return hit;
+    }
+    
+    /**
+     * @brief Finish a frame of tests, and forget the pairs which were not tested
+     * in the last `max_age + 1` frames (including this one).
+     *
+     * @return The number of pairs forgotten.
+     */
+    index_t end_frame(index_t max_age=0) {
+        index_t n = std::erase_if(_pairs, [&](const auto& item) {
+            return _frame - item.second.frame > (uint64_t) max_age;
+        });
+        _frame += 1;
+        return n;
+    }
+    
+    /// Forget the pair `pair`. Returns whether it was known.
+    bool erase(const Key& pair) {
+        return _pairs.erase(pair) > 0;
+    }
+    
+    /// Forget all pairs.
+    void clear() {
+        _pairs.clear();
+    }
+    
+    /// Whether the pair `pair` is remembered.
+    inline bool contains(const Key& pair) const {
+        return _pairs.find(pair) != _pairs.end();
+    }
+    
+    /// Number of pairs remembered.
+    inline index_t size() const {
+        return _pairs.size();
+    }
+    
+    /// Number of calls to `end_frame()` so far.
+    inline uint64_t frame() const {
+        return _frame;
+    }
+    
+    /// The intersector which runs the tests. Its limits and tolerances may be changed.
+    inline Intersector<T,N>& intersector() {
+        return _gjk;
+    }
+    
+    /// The intersector which runs the tests, and the statistics of the last test.
+    inline const Intersector<T,N>& intersector() const {
+        return _gjk;
+    }
+    
+};
+
+/// @} // addtogroup shape
+
+} // namespace geom
@@ -1,38 +1,29 @@
+#pragma once
+
 #include <geomc/shape/shapedetail/IndexHelpers.h>
+#include <geomc/shape/SpatialSort.h>
+#include <geomc/SmallStorage.h>
 #include <geomc/Templates.h>
+#include <geomc/WorkPool.h>
 
 #include <cmath>
-#include <list>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <vector>
 
 namespace geom {
 
 
-// todo: std::list may be arbitrarily stupid with memory allocation. look into this.
-// todo: owned std::list would allow a native, light swap() on items (aka splice?)
-//       owned list would also permit reserve()
-//       owned list could avoid copying unnecessary objects to newly constructed child nodes
-//       > or consider going back to flat arrays. :[
-//       > consider looking into how to make/use a std::allocator.
-// todo: helper should first try to call dist2() on bounded objects, 
-//       then revert to obj.bounds().dist2().
 // todo: could make the bound a generic Concept type.
 // todo: make a thin Container wrapper for i.getPoints() and i.rangeSearch()
-// todo: it is an invariant that node->last == ++node->first?
-//       if so, we could probably eliminate some fixup and memory by using that convention.
-//       > no, I don't think that's the case, because split nodes are not adjacent.
-//         they could be, but then the refinement order is not the same as child order.
-// todo: range search
-// todo: knn?
 // todo: generic proximity search. some kind of distance<>(a,b), overlaps<a,b>, matches<a,b>, etc.
 //       e.g. ray or segment intersect, generic shape intersect, disjoint tests, and so on.
+// todo: structural edits (insert overflow, erase, flatten) re-lay the whole node array
+//       in O(n). a gap buffer per tree level could make these cheaper.
 
-// todo: come up with a portable alloca() and remove the arity restriction
-//       you could do: fast_buffer<N>(n). always statically allocates N, 
-//                     if n > N, malloc also and use that instead
 // todo: xxx: fix clients of Rect to handle boundary issue
-// todo: xxx: erase() on objects.
-// todo: xxx: enforce that node_arity <= MAX_ARITY when inserting kids.
-// todo: xxx: median pivot
 
 /** @addtogroup shape
  *  @{
@@ -59,7 +50,15 @@ enum class KDPivotChoice {
     /// Split a node at the population average.
     PIVOT_MEAN,
     /// Split a node at the population median.
-    PIVOT_MEDIAN
+    PIVOT_MEDIAN,
+    /**
+     * Split a node where the surface area heuristic predicts the cheapest search.
+     * Object centers are binned along every axis, and the split between bins which
+     * minimizes the total boundary measure of the two halves, weighted by their object
+     * counts, is chosen. The axis strategy is ignored. This is slower to build, but
+     * gives much better trees for objects of widely varying size.
+     */
+    PIVOT_SAH
 };
 
 
@@ -72,30 +71,223 @@ enum class KDInsertionChoice {
 };
 
 
-// if I had a cross-platform alloca(), I could instead obey the zero/one/infinity princicple. >:(
-// I am going to use this space to gripe about c++ apologists who think "you can't do it, therefore you don't need it".
-#define MAX_KDTREE_ARITY 16
+/*****************************************
+ * Query statistics                      *
+ *****************************************/
+
+/**
+ * @brief Counts of the work done by queries on a KDTree.
+ *
+ * Collected only by trees whose `QueryStats` template parameter is set. Useful for
+ * telling whether slow queries are due to the shape of the tree or to the data;
+ * for example, many object tests per leaf scanned suggests a smaller `leaf_arity`,
+ * while many nodes visited per query suggests heavily overlapping nodes.
+ */
+struct KDQueryStats {
+    /// Number of queries counted.
+    size_t  queries        = 0;
+    /// Number of nodes entered, including the root.
+    size_t  nodes_visited  = 0;
+    /// Number of leaves whose objects were tested individually.
+    size_t  leaves_scanned = 0;
+    /// Number of individual object tests (distance evaluations, or ray or region tests).
+    size_t  object_tests   = 0;
+    /// Deepest level of the tree reached by a query; i.e. the maximum recursion depth.
+    /// The root is at depth zero.
+    index_t max_depth      = 0;
+    
+    KDQueryStats& operator+=(const KDQueryStats& other) {
+        queries        += other.queries;
+        nodes_visited  += other.nodes_visited;
+        leaves_scanned += other.leaves_scanned;
+        object_tests   += other.object_tests;
+        max_depth       = std::max(max_depth, other.max_depth);
+        return *this;
+    }
+};
 
 
 /*****************************************
  * KDTree class                          *
  *****************************************/
 
+namespace detail {
+
+// nodes with at most this many children are split and searched without touching the heap.
+// wider nodes are permitted; their per-node scratch buffers simply spill to the heap.
+constexpr index_t KDInlineArity = 16;
+
+/**
+ * For each of the `n_kids` sibling nodes starting at `first`, compute the squared
+ * distance from `p` to the box (`near2`), and an upper bound on the squared distance
+ * to the nearest object inside it (`worst2`; see `detail::worst_case_nearest2()`).
+ *
+ * Node boxes are stored axis-major: the lower extreme of node `i` along axis `k` is
+ * `box_lo[k * stride + i]`. The inner loops run over the whole sibling group without
+ * branching, so that the compiler can test several boxes per instruction.
+ */
+template <typename T, index_t N>
+void kd_child_box_distances(
+        const T*        box_lo,
+        const T*        box_hi,
+        size_t          stride,
+        size_t          first,
+        index_t         n_kids,
+        const Vec<T,N>& p,
+        T*              near2,
+        T*              worst2)
+{
+    // the farthest corner, and the largest saving from pulling one axis in to the nearer face.
+    SmallStorage<T, KDInlineArity> far2(n_kids);
+    SmallStorage<T, KDInlineArity> face(n_kids);
+    for (index_t c = 0; c < n_kids; ++c) {
+        near2[c] = 0;
+        far2[c]  = 0;
+        face[c]  = 0;
+    }
+    for (index_t k = 0; k < N; ++k) {
+        const T* lo = box_lo + k * stride + first;
+        const T* hi = box_hi + k * stride + first;
+        const T  x  = p[k];
+        for (index_t c = 0; c < n_kids; ++c) {
+            T d_lo = lo[c] - x;
+            T d_hi = x - hi[c];
+            T out  = std::max(std::max(d_lo, d_hi), (T)0);
+            T a    = std::abs(d_lo);
+            T b    = std::abs(d_hi);
+            T f    = std::max(a, b);
+            T nr   = std::min(a, b);
+            near2[c] += out * out;
+            far2[c]  += f * f;
+            face[c]   = std::min(face[c], nr * nr - f * f);
+        }
+    }
+    for (index_t c = 0; c < n_kids; ++c) {
+        worst2[c] = far2[c] + face[c];
+    }
+}
+
+
+/**
+ * Find the object nearest `p` below `node`, shared by `KDTree` and `KDTreeView`.
+ *
+ * `src` describes the tree being searched. It must provide:
+ *
+ *   - `node(i)`: the node at index `i`, with members `child_begin`, `child_end`,
+ *     `objects_begin`, and `objects_end`. A node with no children is a leaf.
+ *   - `child_box_distances(first, n_kids, p, near2, worst2)`: as `kd_child_box_distances()`.
+ *   - `dist2(i, p)`: the squared distance from `p` to the object at index `i`.
+ *   - `visit()`: an object which lives for the duration of a node's visit.
+ *   - `count_leaf(n)`: record the scan of a leaf with `n` objects.
+ *
+ * `nearest` and `best_d2` carry the best object found so far and its squared distance;
+ * `worst_best` carries an upper bound on the squared distance to the nearest object.
+ */
+template <typename T, index_t N, typename Source>
+void kd_nearest_in_node(
+        const Source&   src,
+        uint32_t        node,
+        const Vec<T,N>& p,
+        uint32_t*       nearest,
+        T*              best_d2,
+        T*              worst_best)
+{
+    struct SearchInfo {
+        uint32_t n;
+        T best_case;
+    };
+    const auto& nd = src.node(node);
+    [[maybe_unused]] auto visiting = src.visit();
+    
+    // is leaf?
+    // seach objects for actual nearest obj.
+    if (nd.child_begin == nd.child_end) {
+        src.count_leaf(nd.objects_end - nd.objects_begin);
+        for (uint32_t i = nd.objects_begin; i < nd.objects_end; ++i) {
+            T d2 = src.dist2(i, p);
+            if (d2 < *best_d2) {
+                *best_d2 = d2;
+                *nearest = i;
+            }
+        }
+        return;
+    }
+    
+    index_t recurse_ct = 0;
+    
+    index_t n_kids = nd.child_end - nd.child_begin;
+    SmallStorage<SearchInfo, KDInlineArity> buf(n_kids);
+    SmallStorage<T,          KDInlineArity> near2(n_kids);
+    SmallStorage<T,          KDInlineArity> worst2(n_kids);
+    src.child_box_distances(nd.child_begin, n_kids, p, near2.data(), worst2.data());
+    
+    for (index_t c = 0; c < n_kids; ++c) {
+        uint32_t i = nd.child_begin + c;
+        const auto& kid = src.node(i);
+        if (kid.objects_begin == kid.objects_end) continue;
+        if (near2[c] < *best_d2 and near2[c] <= *worst_best) {
+            buf[recurse_ct++] = {i, near2[c]};
+        }
+        *worst_best = std::min(*worst_best, worst2[c]);
+    }
+    // visit the nearest boxes first; they are most likely to tighten our bounds
+    std::sort(buf.begin(), buf.begin() + recurse_ct, [](const SearchInfo& a, const SearchInfo& b) {
+        return a.best_case < b.best_case;
+    });
+    // recurse
+    for (index_t k = 0; k < recurse_ct; ++k) {
+        // subsequently added nodes may have better worst cases than we knew about before,
+        // or subsequent recursions may have improved the best estimate, rendering our
+        // checks obsolete and allowing us to discard more nodes. check again plz.
+        if (buf[k].best_case < *best_d2 and buf[k].best_case <= *worst_best) {
+            kd_nearest_in_node<T,N>(src, buf[k].n, p, nearest, best_d2, worst_best);
+        }
+    }
+}
+
+} // namespace detail
+
+
 
 /**
  * @brief A hierarchical spatial index.
  *
+ * Nodes are kept in a single contiguous array in breadth-first order, so that
+ * the children of any node are adjacent, and every node precedes its descendents.
+ * Objects are kept in a second contiguous array in leaf order, so that the objects
+ * below any node occupy a single contiguous range. Nodes refer to their children
+ * and objects by 32-bit index ranges.
+ *
+ * This layout favors queries: a traversal touches a small number of densely packed
+ * cache lines. Structural edits (splitting an overfull leaf on insertion, erasing or
+ * flattening a node) re-lay the node array in `O(n)` time, and inserting or erasing an
+ * object shifts the object array, also in `O(n)` time. For large batches of objects,
+ * prefer constructing the tree from the whole batch at once, or calling `rebalance()`.
+ *
  * @tparam T Numeric type.
  * @tparam N Dimensionality of data.
- * @tparam Object Spatial object to be indexed. May be a `Vec<T,N>`, a `Bounded<T,N>`, or a 
+ * @tparam Object Spatial object to be indexed. May be a `Vec<T,N>`, a `BoundedObject`, or a
  * `std::pair<K,V>` with `K` either of the former.
  * @tparam NodeData Optional data to store with each internal node of the tree.
- */ 
-template <typename T, index_t N, 
-          typename Object, 
-          typename NodeData>
+ * @tparam QueryStats Whether to count the work done by each query; see `KDQueryStats`.
+ * Off by default, in which case the counting is compiled out entirely.
+ * @tparam Allocator Allocator for the node, object, and bounds arrays; rebound for each.
+ * Nodes built in parallel by `rebalance(WorkPool&)` are staged in ordinary heap memory
+ * by the worker threads, and then copied into the tree's own arrays. Since each array is
+ * a single block, a `PoolAllocator` only pools the arrays of small trees; once an array
+ * outgrows `detail::PoolArena::MaxBlock` bytes, it comes from the global `operator new`
+ * as it would with the default allocator.
+ */
+template <typename T, index_t N,
+          typename Object,
+          typename NodeData,
+          bool QueryStats,
+          typename Allocator>
 class KDTree {
-
+    
+    template <typename, index_t, typename>
+    friend class KDTreeView;
+    
 private:
     
     /************************************
@@ -104,25 +296,50 @@ private:
     
     struct KDNode;
     
-    typedef typename std::list<KDNode>::iterator KDNodeRef;
-    typedef typename std::list<Object>::iterator KDDataRef;
+    // index into `nodes`
+    typedef uint32_t KDNodeRef;
+    // index into `objects`
+    typedef uint32_t KDDataRef;
     typedef detail::ShapeIndexHelper<T,N,Object> helper_t;
+    typedef std::allocator_traits<Allocator> alloc_traits;
+    typedef std::vector<KDNode, typename alloc_traits::template rebind_alloc<KDNode>> node_array_t;
+    typedef std::vector<Object, typename alloc_traits::template rebind_alloc<Object>> object_array_t;
+    typedef std::vector<T,      typename alloc_traits::template rebind_alloc<T>>      bound_array_t;
+    // per-node working space, one item per child. lives on the stack for typical arities.
+    template <typename U>
+    using scratch_t = SmallStorage<U, detail::KDInlineArity>;
+    
+    // parent of the root; child range of a leaf.
+    static constexpr KDNodeRef NO_NODE = std::numeric_limits<KDNodeRef>::max();
     
     struct KDNode {
         
-        KDNodeRef  parent;
-        KDNodeRef  child_begin;
-        KDNodeRef  child_end;
-        KDDataRef  objects_begin;
-        KDDataRef  objects_end;
-        index_t    nobjs;
+        KDNodeRef  parent        = NO_NODE;
+        KDNodeRef  child_begin   = NO_NODE;
+        KDNodeRef  child_end     = NO_NODE;
+        KDDataRef  objects_begin = 0;
+        KDDataRef  objects_end   = 0;
         
         Rect<T,N>  bounds;
-        NodeData   data;
+        NodeData   data {};
+        
+        // surface area heuristic cost of this subtree, as of the last update,
+        // and as of when it was built (negative if not yet recorded).
+        T          cost       =  0;
+        T          cost_built = -1;
+        
+        inline bool    is_leaf() const { return child_begin == child_end; }
+        inline index_t nobjs()   const { return objects_end - objects_begin; }
     };
-
+    
 public:
     
+    /// Nodes with at most this many children are searched without allocating.
+    static constexpr index_t InlineArity = detail::KDInlineArity;
+    /// Batched nearest-neighbor queries are sorted and answered this many at a time,
+    /// so that the sort key buffer lives on the stack.
+    static constexpr index_t QueryBlock  = 256;
+    
     /**
      * An optionally-const iterator over the internal nodes of a KD tree.
      *
@@ -131,14 +348,18 @@ public:
     template <bool Const>
     class KDNodeIterator {
         
-        friend class KDTree<T,N,Object,NodeData>;
-        
-        KDNodeRef node;
+        friend class KDTree<T,N,Object,NodeData,QueryStats,Allocator>;
         
-        KDNodeIterator(KDNodeRef n) : node(n) {}
+        typedef typename ConstType<KDTree<T,N,Object,NodeData,QueryStats,Allocator>,Const>::pointer_t tree_ptr;
         
-        KDNodeIterator(const KDNodeIterator<false>& i) : node(i.node) {}
+        tree_ptr  tree;
+        KDNodeRef node;
         
+        // any index off the end of the node array is the end() node.
+        KDNodeIterator(tree_ptr tree, KDNodeRef n):
+            tree(tree),
+            node(n < tree->nodes.size() ? n : NO_NODE) {}
+            
     public:
         
         typedef NodeData                                         value_type;
@@ -147,32 +368,40 @@ public:
         typedef const NodeData&                                  const_reference;
         typedef KDNodeIterator<Const>                            iterator;
         typedef KDNodeIterator<Const>                            self_t;
-        typedef typename ConstType<Rect<T,N>,Const>::reference_t bound_reference;
+        typedef const Rect<T,N>&                                bound_reference;
         typedef typename std::conditional<Const,
-                            typename std::list<Object>::const_iterator,
-                            typename std::list<Object>::iterator>::type   object_iterator;
+                            typename object_array_t::const_iterator,
+                            typename object_array_t::iterator>::type        object_iterator;
+        
+        KDNodeIterator(const KDNodeIterator&) = default;
+        KDNodeIterator& operator=(const KDNodeIterator&) = default;
+        
+        /// Convert a non-const iterator to a const one.
+        KDNodeIterator(const KDNodeIterator<false>& i) requires Const :
+            tree(i.tree),
+            node(i.node) {}
         
         /// `+i`: Become first child
         inline self_t& operator+() {
-            node = node->child_begin;
+            node = tree->nodes[node].child_begin;
             return *this;
         }
         
         /// `-i`: Become parent
         inline self_t& operator-() {
-            node = node->parent;
+            node = tree->nodes[node].parent;
             return *this;
         }
         
         /// `++i`: Become next sibling
         inline self_t& operator++() {
-            node = ++node;
+            node = (node + 1 < tree->nodes.size()) ? node + 1 : NO_NODE;
             return *this;
         }
         
         /// `--i`: Become previous sibling
         inline self_t& operator--() {
-            node = --node;
+            node = (node == NO_NODE) ? tree->nodes.size() - 1 : node - 1;
             return *this;
         }
         
@@ -190,39 +419,59 @@ public:
             return tmp;
         }
         
+        /// Returns `true` iff `other` points to the same node.
+        inline bool operator==(const self_t& other) const {
+            return node == other.node;
+        }
+        
+        /// Returns `true` iff `other` does not point to the same node.
+        inline bool operator!=(const self_t& other) const {
+            return node != other.node;
+        }
+        
         /// `*i`: Get node value
         inline reference operator*() const {
-            return node->data;
+            return tree->nodes[node].data;
         }
         
         /// `i->...`: Access node value member
         inline pointer operator->() const {
-            return &node->data;
+            return &tree->nodes[node].data;
         }
         
         /// Get first child
         inline self_t begin() const {
-            return node->child_begin;
+            return self_t(tree, tree->nodes[node].child_begin);
         }
         
         /// Get last (off-end) child
         inline self_t end() const {
-            return node->child_end;
+            return self_t(tree, tree->nodes[node].child_end);
         }
         
         /// Get first object inside this node
         inline object_iterator objects_begin() const {
-            return node->objects_begin;
+            return tree->objects.begin() + tree->nodes[node].objects_begin;
         }
         
         /// Get last (off-end) object in this node
         inline object_iterator objects_end() const {
-            return node->objects_end;
+            return tree->objects.begin() + tree->nodes[node].objects_end;
+        }
+        
+        /// Number of objects inside this node
+        inline index_t nobjects() const {
+            return tree->nodes[node].nobjs();
+        }
+        
+        /// Whether this node has no child nodes
+        inline bool is_leaf() const {
+            return tree->nodes[node].is_leaf();
         }
         
         /// Get bound
-        inline bound_reference bound() {
-            return node->bounds;
+        inline bound_reference bound() const {
+            return tree->nodes[node].bounds;
         }
         
     };
@@ -235,10 +484,55 @@ public:
     typedef KDNodeIterator<true>  const_node_iterator;
     
     /// Iterator over objects
-    typedef typename std::list<Object>::iterator object_iterator;
+    typedef typename object_array_t::iterator object_iterator;
     
     /// Const iterator over objects
-    typedef typename std::list<Object>::const_iterator const_object_iterator;
+    typedef typename object_array_t::const_iterator const_object_iterator;
+    
+    
+    /// An object found by a proximity query, along with its squared distance to the query point.
+    struct KDNeighbor {
+        /// The object found. Invalidated by any change to the tree's objects.
+        const Object* object;
+        /// Squared distance from the query point to the object.
+        T dist2;
+    };
+    
+    
+    /// An object struck by a ray.
+    struct KDRayHit {
+        /// The object hit. Invalidated by any change to the tree's objects.
+        const Object* object;
+        /// The range of ray parameters over which the ray is inside the object.
+        /// The ray enters the object at `ray * s.lo`.
+        Rect<T,1> s;
+    };
+    
+    
+    /// A summary of the shape of a tree, produced by `tree_statistics()`.
+    struct KDTreeStatistics {
+        /// Total number of nodes, including the root.
+        index_t n_nodes   = 0;
+        /// Number of leaf nodes.
+        index_t n_leaves  = 0;
+        /// Number of objects in the tree.
+        index_t n_objects = 0;
+        /// Depth of the deepest leaf. The root is at depth zero.
+        index_t max_depth = 0;
+        /// `leaf_depths[d]` is the number of leaves at depth `d`.
+        std::vector<index_t> leaf_depths;
+        /// `leaf_occupancy[k]` is the number of leaves holding `k` objects.
+        std::vector<index_t> leaf_occupancy;
+        /// Average number of objects per nonempty leaf.
+        T mean_leaf_occupancy = 0;
+        /// Sum of the volumes of all the nonempty node boxes below the root.
+        T node_volume    = 0;
+        /// Sum of the volumes shared by each pair of sibling boxes. Queries which land in
+        /// overlapping regions must descend into several siblings.
+        T overlap_volume = 0;
+        /// Surface area heuristic cost of the whole tree; lower is better.
+        T sah_cost       = 0;
+    };
     
     
     /// Structure encapsulating the tree balancing parameters
@@ -249,10 +543,13 @@ public:
         KDPivotChoice pivot;
         /// Strategy for insertion of an object into an existing node.
         KDInsertionChoice insert;
-        /// Maximum number of children an internal node can have
+        /// Maximum number of children an internal node can have. Any value of 2 or more
+        /// is permitted, though arities above `InlineArity` allocate during search.
         index_t node_arity;
         /// Maximum number of data objects a leaf node can have
         index_t leaf_arity;
+        /// Number of candidate split bins per axis when using `PIVOT_SAH`.
+        index_t sah_bins = 16;
     };
     
 private:
@@ -261,19 +558,51 @@ private:
      * Members                          *
      ************************************/
     
-    // invariant after construction: root node exists.
-    
-    std::list<KDNode> nodes;
-    std::list<Object> objects;
-    KDStructureParams params;
+    // invariants after construction:
+    //   - root node exists, at index 0.
+    //   - nodes are in breadth-first order; siblings are contiguous.
+    //   - every node's objects are contiguous, and tile its parent's objects in child order.
+    //   - node bounds are the minimal box around the objects below them.
+    //   - box_lo and box_hi mirror the node bounds.
+    
+    node_array_t        nodes;
+    object_array_t      objects;
+    KDStructureParams   params;
+    
+    // a copy of the node bounds in structure-of-arrays form, for testing many sibling boxes at once.
+    // the low corner of node `i` along axis `k` is `box_lo[k * nodes.size() + i]`.
+    // siblings are adjacent, so the bounds of a whole child group are contiguous along each axis.
+    bound_array_t       box_lo;
+    bound_array_t       box_hi;
+    
+    // query counters, and the depth of the node being visited by the current query.
+    struct StatsState {
+        KDQueryStats last;
+        KDQueryStats total;
+        index_t      depth = 0;
+    };
+    struct NoStats {};
+    [[no_unique_address]]
+    mutable std::conditional_t<QueryStats, StatsState, NoStats> _stats;
     
     static const KDStructureParams DefaultParameters;
     
+    // during a parallel build, subtrees with more objects than this are built by separate tasks.
+    static constexpr index_t ParallelBuildCutoff = 4096;
+    
+    // a subtree built independently by a parallel build. node indices are local to the fragment,
+    // and `nodes[0]` is the subtree root. leaves listed in `subtrees` are roots of other fragments.
+    struct KDFragment {
+        std::vector<KDNode> nodes;
+        std::vector<std::pair<KDNodeRef, std::unique_ptr<KDFragment>>> subtrees;
+    };
+    
     // in general, whenever we update the structure of the tree,
     // we must be careful to:
-    //   - update the relevant nodes' `nobjs`
+    //   - update the relevant nodes' object ranges
     //   - update the relevant nodes' bounds
-    //   - repair any invalidated iterators
+    //   - restore breadth-first order with _relayout()
+    //   - mirror the changed bounds with _sync_bounds() (_relayout() does this)
     //   - rebalance the tree if a node has become too heavy or light
     
 public:
@@ -285,32 +614,57 @@ public:
     
     
     /// Construct an empty KDTree with the default structure parameters for this dimension.
-    KDTree():params(DefaultParameters) {
+    KDTree():KDTree(Allocator()) {}
+    
+    
+    /// Construct an empty KDTree which uses the allocator `alloc`.
+    explicit KDTree(const Allocator& alloc):
+            nodes(alloc),
+            objects(alloc),
+            params(DefaultParameters),
+            box_lo(alloc),
+            box_hi(alloc) {
         nodes.push_back(KDNode());
-        KDNode&       n = nodes.front();
-        n.parent        = nodes.end();
-        n.child_begin   = nodes.end(); // no children
-        n.child_end     = nodes.end();
-        n.objects_begin = objects.begin();
-        n.objects_end   = objects.end();
-        n.nobjs         = 0;
+        _sync_bounds();
     }
     
     
-    /// Construct a KDTree initialized with `objs`. 
-    KDTree(Object* objs, index_t nobjs, const KDStructureParams params=DefaultParameters) {
-        //objects.reserve(nobjs);
-        objects.insert(objects.begin(), objs, objs + nobjs);
-        //nodes.reserve(std::ceil(std::log(nobjs, params.node_arity)));
+    /// Construct a KDTree initialized with `objs`.
+    KDTree(const Object* objs, index_t nobjs, const KDStructureParams params=DefaultParameters) {
+        objects.assign(objs, objs + nobjs);
         rebalance(params);
     }
     
     
+    /**
+     * Construct a KDTree initialized with `objs`, dividing the construction among the
+     * threads of `pool`. The result is identical to the single-threaded constructor.
+     */
+    KDTree(const Object* objs, index_t nobjs, WorkPool& pool, const KDStructureParams params=DefaultParameters) {
+        objects.assign(objs, objs + nobjs);
+        setStructureParams(params);
+        rebalance(pool);
+    }
+    
+    
     /// Construct a KDTree initialized with the objects contained in the interval [begin, end).
     template<typename ObjectIterator>
     KDTree(ObjectIterator begin, ObjectIterator end, const KDStructureParams params=DefaultParameters) {
-        objects.insert(objects.begin(), begin, end);
-        //nodes.reserve(std::ceil(std::log(objects.size(), params.node_arity)));
+        objects.assign(begin, end);
+        rebalance(params);
+    }
+    
+    
+    /**
+     * Construct a KDTree initialized with the objects contained in the interval [begin, end),
+     * using the allocator `alloc`.
+     */
+    template<typename ObjectIterator>
+    KDTree(ObjectIterator begin, ObjectIterator end, const Allocator& alloc, const KDStructureParams params=DefaultParameters):
+            nodes(alloc),
+            objects(begin, end, alloc),
+            box_lo(alloc),
+            box_hi(alloc) {
         rebalance(params);
     }
     
@@ -320,20 +674,32 @@ public:
      ************************************/
     
     
+    /// Return a copy of the allocator used by this tree.
+    inline Allocator get_allocator() const {
+        return Allocator(objects.get_allocator());
+    }
+    
+    
     /// Number of data objects in the tree.
     inline index_t nobjects() const {
-        return nodes.begin()->nobjs;
+        return objects.size();
+    }
+    
+    
+    /// Number of nodes in the tree, including the root.
+    inline index_t nnodes() const {
+        return nodes.size();
     }
     
     
     /**
-     * Return an iterator pointing at the root tree node. 
+     * Return an iterator pointing at the root tree node.
      * Use `+i` and `-i` to ascend and descend to the first-child and parent nodes
      * respectively. `++i` and `--i` navigate the tree in breadth-first order, and can
      * therefore be used to find the next and previous siblings.
      */
     inline node_iterator begin() {
-        return nodes.begin();
+        return node_iterator(this, 0);
     }
     
     
@@ -341,50 +707,59 @@ public:
      * Return an iterator pointing beyond the last node in the tree; conceptually the parent of the root.
      */
     inline node_iterator end() {
-        return nodes.end();
+        return node_iterator(this, NO_NODE);
     }
     
     
     /**
-     * Return a const iterator pointing at the root tree node. 
+     * Return a const iterator pointing at the root tree node.
      * Use `+i` and `-i` to ascend and descend to the first-child and parent nodes
      * respectively. `++i` and `--i` navigate the tree in breadth-first order, and can
      * therefore be used to find the next and previous siblings.
      */
     inline const_node_iterator begin() const {
-        return nodes.begin();
+        return const_node_iterator(this, 0);
     }
     
     
     /**
-     * Return a const iterator pointing beyond the last node in the tree in breadth-first order; 
+     * Return a const iterator pointing beyond the last node in the tree in breadth-first order;
      * conceptually the parent of the root.
      */
     inline const_node_iterator end() const {
-        return nodes.end();
+        return const_node_iterator(this, NO_NODE);
     }
     
     
     /**
      * Insert the given object into the tree under the given node.
      * The tree will be descended recursively until the best leaf is found.
+     *
+     * All object iterators are invalidated. If the receiving leaf overflows and
+     * must be split, all node iterators below the depth of `node` are also invalidated.
      */
     object_iterator insert(const node_iterator& node, const Object& obj) {
-        Rect<T,N> bnd = helper_t::bounds(obj);
+        Rect<T,N> bnd = bound_of(obj);
         Vec<T,N>  ctr = helper_t::getPoint(obj);
         
-        index_t depth;
+        index_t depth = 0;
         if (params.axis == KDAxisChoice::AXIS_CYCLICAL) {
-            // compute depth
-            depth = 0;
-            for (KDNodeRef i = node.node->parent; i != nodes.end(); i = i->parent) {
-                ++depth;
-            }
-        } else {
-            depth = 1;
+            // for now, we only need the depth if we are using a cyclical axis scheme
+            depth = depth_of(node.node);
         }
         
-        return insert_impl(node.node, obj, bnd, ctr, depth);
+        KDDataRef i = insert_impl(node.node, obj, bnd, ctr, depth);
+        _sync_bounds();
+        return objects.begin() + i;
+    }
+    
+    
+    /**
+     * Insert the given object into the tree, descending from the root until the best
+     * leaf is found.
+     */
+    inline object_iterator insert(const Object& obj) {
+        return insert(begin(), obj);
     }
     
     
@@ -392,46 +767,26 @@ public:
      * Remove the object at the given iterator from the given leaf node.
      *
      * If the node is not a leaf or does not contain the object, no change
-     * is made and the original iterator is returned. Otherwise, an iterator to the 
+     * is made and the original iterator is returned. Otherwise, an iterator to the
      * next object is returned.
      *
-     * Both iterators may be invalidated by this operation.
+     * All object iterators are invalidated by this operation.
      */
     object_iterator erase(const object_iterator& obj, const node_iterator& node) {
         KDNodeRef n = node.node;
+        KDDataRef i = obj - objects.begin();
         
-        // verify node is a leaf
-        if (n->child_begin != n->child_end) return obj;
-        
-        // verify `obj` is in this node
-        bool found = false;
-        Rect<T,N> bnd;
-        for (KDDataRef i = n->objects_begin; i != n->objects_end; ++i) {
-            if (i == obj) {
-                found = true;
-            } else {
-                bnd |= helper_t::bounds(*i);
-            }
-        }
-        
-        if (not found) {
-            return obj;
-        } else {
-            n->bounds = bnd;
-            n->nobjs--;
-        }
-        
-        // xxx todo: fixup anybody who used us as a first or a last.
+        // verify node is a leaf containing `obj`
+        if (not nodes[n].is_leaf()) return obj;
+        if (i < nodes[n].objects_begin or i >= nodes[n].objects_end) return obj;
         
-        // save this, because we might invalidate n
-        KDNodeRef parent = n->parent;
+        objects.erase(obj);
+        shift_for_erase(i, i + 1);
+        recalculateBounds(n);
+        refit_ancestors(n);
+        _sync_bounds();
         
-        // node is too empty. kill it.
-        if (n->npts < std::max(2, params.leaf_arity / 4)) {
-            // ? only one other sibling -> rebalance parent
-            // ? node has multiple siblings -> reinsert??
-            // xxx todo
-        }
+        return objects.begin() + i;
     }
     
     
@@ -442,17 +797,17 @@ public:
      * Any iterators pointing to descendents of the given node are invalidated.
      */
     void rebalance(const node_iterator& node) {
-        flatten(node);
-        index_t depth = -1;
+        KDNodeRef n = node.node;
+        index_t depth = 0;
         // for now, we only need the depth if we are using a cyclical axis scheme
         if (params.axis == KDAxisChoice::AXIS_CYCLICAL) {
-            depth = 0;
-            KDNodeRef n = node.node;
-            for (KDNodeRef n = node.node; n != nodes.end(); n = n->parent) {
-                depth++;
-            }
+            depth = depth_of(n);
         }
-        buildTree(node.node, depth);
+        // orphan the descendents and rebuild them at the end of the node array
+        nodes[n].child_begin = nodes[n].child_end = NO_NODE;
+        nodes[n].cost_built  = -1;
+        buildTree(n, depth);
+        _relayout();
     }
     
     
@@ -465,278 +820,758 @@ public:
         nodes.clear();
         nodes.push_back(KDNode());
         
-        KDNode&       n = nodes.front();
-        n.parent        = nodes.end();
-        n.child_begin   = n.child_end = nodes.end(); // no children
-        n.objects_begin = objects.begin();
-        n.objects_end   = objects.end();
-        n.nobjs         = objects.size();
+        KDNode& n = nodes.front();
+        n.objects_begin = 0;
+        n.objects_end   = objects.size();
         
-        buildTree(nodes.begin(), 0);
+        recalculateBounds(0);
+        // building from the root appends nodes in breadth-first order; no relayout needed.
+        buildTree(0, 0);
+        _sync_bounds();
+        _update_costs();
     }
     
     
     /**
-     * Change the balancing parameters of the tree, and rebuild it according to the new artings.
+     * Change the balancing parameters of the tree, and rebuild it according to the new settings.
      */
     inline void rebalance(const KDStructureParams& newParams) {
-        params = newParams;
-        params.node_arity = std::min(params.node_arity, (index_t)MAX_KDTREE_ARITY);
+        setStructureParams(newParams);
         rebalance();
     }
     
     
+    /**
+     * Rebuild the entire tree, dividing the work among the threads of `pool`.
+     *
+     * Subtrees are split independently, and then assembled in the same breadth-first
+     * order as `rebalance()`, so the resulting tree is identical to a single-threaded
+     * rebuild, regardless of the number of threads in the pool.
+     *
+     * All iterators are invalidated.
+     */
+    void rebalance(WorkPool& pool) {
+        KDFragment root;
+        root.nodes.push_back(KDNode());
+        root.nodes[0].objects_begin = 0;
+        root.nodes[0].objects_end   = objects.size();
+        root.nodes[0].bounds        = bounds_of_range(0, objects.size());
+        
+        WorkGroup group;
+        buildFragment(&root, 0, pool, group);
+        pool.wait(group);
+        
+        nodes.assign(root.nodes.begin(), root.nodes.end());
+        for (const auto& [i, sub] : root.subtrees) {
+            graftFragment(i, *sub);
+        }
+        _relayout();
+    }
+    
+    
+    /**
+     * Replace the contents of the tree with the objects in `[begin, end)`.
+     *
+     * If `presorted` is set, the objects are taken to be in a spatially coherent order
+     * already, such as the order given by `spatial_sort()` along a Hilbert curve. Then no
+     * splits are chosen: the tree is packed bottom-up in the order given, in `O(n)`, with
+     * each run of up to `leaf_arity` consecutive objects in a leaf, and each run of up to
+     * `node_arity` consecutive nodes under a common parent. Otherwise the tree is built
+     * as by `rebalance()`.
+     *
+     * All iterators are invalidated.
+     */
+    template <typename ObjectIterator>
+    void bulk_load(ObjectIterator begin, ObjectIterator end, bool presorted=false) {
+        objects.assign(begin, end);
+        if (presorted) {
+            pack_presorted();
+        } else {
+            rebalance();
+        }
+    }
+    
+    
+    /**
+     * Recompute the bounds of every node from the objects it contains, after objects
+     * have been moved or changed in place (for example through the iterators returned
+     * by `objects_begin()`). Runs in a single linear pass from the leaves upward, and
+     * does not change the structure of the tree.
+     *
+     * After a refit all queries remain correct, but they may slow down as objects drift
+     * away from the neighbors they were grouped with. Use `rebalance_degraded()` to
+     * rebuild the parts of the tree which have become inefficient.
+     */
+    void refit() {
+        // every node follows its parent in breadth-first order,
+        // so a reverse scan visits all children before their parent.
+        for (size_t i = nodes.size(); i-- > 0;) {
+            KDNode& x = nodes[i];
+            if (x.is_leaf()) {
+                x.bounds = bounds_of_range(x.objects_begin, x.objects_end);
+            } else {
+                Rect<T,N> bnd;
+                for (KDNodeRef c = x.child_begin; c < x.child_end; ++c) {
+                    bnd |= nodes[c].bounds;
+                }
+                x.bounds = bnd;
+            }
+            update_cost(i);
+        }
+        _sync_bounds();
+    }
+    
+    
+    /**
+     * Rebuild only the subtrees whose surface area heuristic (SAH) cost has grown by more
+     * than a factor of `max_growth` since they were built.
+     *
+     * The cost of a subtree estimates the expected work of a query that enters it, using
+     * the surface areas of its node boxes. As objects move and boxes swell and overlap, it grows.
+     * Degraded subtrees are rebuilt from the top down, so that if a subtree and some of its
+     * descendents are both degraded, only the outermost is rebuilt. Bounds should be current;
+     * call `refit()` first if objects have moved.
+     *
+     * Node iterators are invalidated if any subtree is rebuilt.
+     *
+     * @return The number of subtrees rebuilt.
+     */
+    index_t rebalance_degraded(T max_growth=1.5) {
+        _update_costs();
+        // nodes inside a subtree which is already being rebuilt
+        std::vector<bool> covered(nodes.size(), false);
+        std::vector<KDNodeRef> degraded;
+        for (KDNodeRef i = 0; i < nodes.size(); ++i) {
+            const KDNode& x = nodes[i];
+            if (x.parent != NO_NODE and covered[x.parent]) {
+                covered[i] = true;
+            } else if (not x.is_leaf() and x.cost > max_growth * x.cost_built) {
+                covered[i] = true;
+                degraded.push_back(i);
+            }
+        }
+        if (degraded.empty()) return 0;
+        
+        for (KDNodeRef n : degraded) {
+            index_t depth = 0;
+            if (params.axis == KDAxisChoice::AXIS_CYCLICAL) {
+                depth = depth_of(n);
+            }
+            nodes[n].child_begin = nodes[n].child_end = NO_NODE;
+            nodes[n].cost_built  = -1;
+            buildTree(n, depth);
+        }
+        _relayout();
+        return degraded.size();
+    }
+    
+    
     /**
      * Remove the given node, all of its children, and all the objects it contains.
-     * Runs in `O(n)` time on the node count of the deleted subtree.
+     * Runs in `O(n)` time on the size of the tree.
      *
      * The root node cannot be erased. If it is passed as an argument,
      * it is returned without deletion.
      *
-     * Any iterators pointing to this node, any of its descendents, or the objects
-     * contained therein are invalidated. If deleting this node leaves one remaining 
-     * sibling, then the sibling will be absorbed into its parent and its iterator
-     * will be invalidated.
-     * 
+     * All iterators are invalidated. If deleting this node leaves one remaining
+     * sibling, then the sibling will be absorbed into its parent.
+     *
      * @return The node after the deleted node, in breadth-first order.
      */
     node_iterator erase(const node_iterator& node) {
         KDNodeRef n = node.node;
-        if (n == nodes.begin()) return node; // do not erase root
+        if (n == 0) return node; // do not erase root
         
         clear(node); // empty this node
         
-        KDNodeRef tail = n; ++tail;
-        KDNodeRef parent = n->parent;
-        
-        // if we were the first child, parent needs a new favorite
-        if (parent->child_begin == n) {
-            parent->child_begin = tail;
-        }
-        
-        // we were an uncle's last-child
-        KDNodeRef fixup = n; --fixup;
-        fixup = fixup->parent;
-        if (fixup != nodes.end() and fixup->child_end == n) {
-            fixup->child_end = tail;
-        }
-        
-        tail = nodes.erase(node);
+        KDNodeRef parent = nodes[n].parent;
+        KDNodeRef cb     = nodes[parent].child_begin;
+        KDNodeRef ce     = nodes[parent].child_end;
         
-        KDNodeRef last_sibling = parent->child_end; --last_sibling;
-        if (parent->child_begin == last_sibling) {
-            // parent has one child. collapse it.
-            bool invalid_tail = parent->child_begin == tail;
-            KDNodeRef new_tail = flatten(parent);
-            if (invalid_tail) tail = new_tail;
+        // nodes which precede `n` in breadth-first order and will be removed
+        index_t removed_before = 0;
+        if (ce - cb <= 2) {
+            // parent will be left with one child. collapse it.
+            KDNodeRef sibling = (cb == n) ? n + 1 : cb;
+            if (sibling < n) removed_before = 1;
+            nodes[parent].child_begin = nodes[parent].child_end = NO_NODE;
+        } else {
+            // re-emit the remaining siblings as a new contiguous group
+            KDNodeRef new_cb = nodes.size();
+            for (KDNodeRef c = cb; c < ce; ++c) {
+                if (c == n) continue;
+                KDNode sib = nodes[c];
+                nodes.push_back(sib);
+            }
+            nodes[parent].child_begin = new_cb;
+            nodes[parent].child_end   = nodes.size();
         }
+        _relayout();
         
-        return tail;
+        // surviving nodes keep their relative breadth-first order
+        return node_iterator(this, n - removed_before);
     }
     
     
     /**
      * Empty the given node of all its objects, and delete all its child nodes.
-     * Runs in `O(n)` time on the node count of the emptied subtree.
+     * Runs in `O(n)` time on the size of the tree.
      *
-     * Any iterators pointing to nodes or objects in the deleted subtree are invalidated.
+     * Any iterators pointing to nodes below the given node, or to any objects,
+     * are invalidated.
      */
     void clear(const node_iterator& node) {
         KDNodeRef n = node.node;
-        KDDataRef tail = n->objects_end;
-        
-        // ascend the tree, looking for nodes that refer to the deleted range
-        // and close the hole we're about to make
-        KDNodeRef fixup = n->parent;
-        while (fixup != nodes.end() and fixup->objects_begin == n->objects_begin) {
-            // ancestor's range began with deleted range
-            if (fixup->objects_begin == fixup->objects_end) {
-                fixup->objects_begin  = fixup->objects_end = tail;
-            } else {
-                fixup->objects_begin = tail;
-            }
-            // ancestor's sibling ended with deleted range
-            KDNodeRef sibling = fixup; --sibling;
-            if (sibling != nodes.end() and sibling->objects_end == n->objects_begin) {
-                sibling->objects_end = tail;
-                if (sibling->objects_begin = n->objects_begin) {
-                    sibling->objects_begin = tail;
-                }
-            }
-        }
+        KDDataRef b = nodes[n].objects_begin;
+        KDDataRef e = nodes[n].objects_end;
         
-        // the right edge of the previous sibling subtree ends with the deleted range.
-        // fixup those nodes to point to the other side of the hole we just made.
-        // (nothing to do if there is no subtree to the left of us)
-        if (n->parent != nodes.end() and n != n->parent->child_begin) {
-            fixup = n; --fixup; // previous sibling (we know from test above that it exists)
-            while (true) {
-                fixup->objects_end = tail;
-                if (fixup->child_begin == fixup->child_end) break;
-                fixup = fixup->child_end; --fixup;
-            }
-        }
+        // remove objects and close the hole we made
+        objects.erase(objects.begin() + b, objects.begin() + e);
+        shift_for_erase(b, e);
         
         // remove child nodes
         flatten(node);
         
-        // remove objects
-        index_t removed_objs = n->nobjs;
-        objects.erase(n->objects_begin, n->objects_end);
-        n->objects_begin = n->objects_end = tail;
-        n->bounds = Rect<T,N>();
-        n->nobjs = 0;
-        
         // update ancestors' bounds to reflect missing objects
-        while (n->parent != nodes.end()) {
-            n = n->parent;
-            n->bounds = Rect<T,N>();
-            for (KDNodeRef i = n->child_begin; i != n->child_end; ++i) {
-                n->bounds |= i->bounds;
-            }
-            n->nobjs -= removed_objs;
-        }
+        nodes[n].bounds = Rect<T,N>();
+        refit_ancestors(n);
+        _sync_bounds();
     }
     
     
-    /** 
-     * Delete all the child nodes of the given node, and assign all the 
-     * objects below to it. Runs in `O(n)` time on the node count of the 
-     * emptied subtree.
+    /**
+     * Delete all the child nodes of the given node, and assign all the
+     * objects below to it. Runs in `O(n)` time on the size of the tree.
      *
      * Any iterators pointing to nodes in the deleted subtree are invalidated.
      */
     void flatten(const node_iterator& node) {
         KDNodeRef n = node.node;
-        if (n->child_begin == n->child_end) return;
-        for (KDNodeRef c = n->child_begin; c != n->child_end; c++) {
-            flatten(c);
-        }
-        
-        // we deleted a node that is some other node's child_end.
-        // we need to suture up the hole that we made.
-        KDNodeRef fixup = n.child_begin;
-        fixup = (--fixup)->parent;
-        KDNodeRef tail = nodes.erase(n.child_begin, n.child_end);
-        if (fixup != nodes.end()) {
-            if (fixup->child_begin == fixup->child_end) {
-                fixup->child_begin  = fixup->child_end = tail;
-            } else {
-                fixup->child_end = tail;
-            }
-        }
-        
-        // we now have no children.
-        n->child_begin = n->child_end = tail;
+        if (nodes[n].is_leaf()) return;
+        // objects are already contiguous under `n`, so we need only
+        // orphan the descendents and drop them from the node array.
+        nodes[n].child_begin = nodes[n].child_end = NO_NODE;
+        _relayout();
     }
     
     
-    /** 
+    /**
      * Insert a new tree node under the given node. If the created node is the
      * first child of `node`, then it will contain all of `node`'s objects,
      * otherwise it will be empty.
      *
+     * Node iterators deeper than `node` are invalidated.
+     *
      * @return The inserted node.
      */
     node_iterator insertChild(const node_iterator& node) {
         KDNodeRef n = node.node;
-        KDNodeRef new_node;
-        if (n->child_begin == n->child_end) {
+        KDNode new_node;
+        new_node.parent = n;
+        
+        KDNodeRef new_cb = nodes.size();
+        if (nodes[n].is_leaf()) {
             // creating the first child of `node`.
-            new_node = nodes.insert(n->child_end, *n);
-            new_node->child_begin = new_node->child_end = n->child_end;
-            new_node->parent = n;
-            n->child_begin = new_node;
-            if (n->parent != nodes.end() and n->parent->child_end == n->child_end) {
-                // are we creating a "first grandchild"?
-                // this node is the first one not a direct child of node->parent.
-                n->parent->child_end = new_node;
-            }
+            new_node.objects_begin = nodes[n].objects_begin;
+            new_node.objects_end   = nodes[n].objects_end;
+            new_node.bounds        = nodes[n].bounds;
         } else {
-            // creating a new sibling
-            new_node = nodes.insert(n->child_end, KDNode());
-            new_node->parent        = n;
-            new_node->child_begin   = new_node->child_end   = n->child_end;
-            new_node->objects_begin = new_node->objects_end = n->objects_end;
+            // creating a new sibling; re-emit the existing siblings as a new group
+            for (KDNodeRef c = nodes[n].child_begin; c < nodes[n].child_end; ++c) {
+                KDNode sib = nodes[c];
+                nodes.push_back(sib);
+            }
+            new_node.objects_begin = new_node.objects_end = nodes[n].objects_end;
         }
-        return new_node;
+        nodes.push_back(new_node);
+        nodes[n].child_begin = new_cb;
+        nodes[n].child_end   = nodes.size();
+        
+        // `n` is no deeper than before, so relayout does not move it.
+        _relayout();
+        return node_iterator(this, nodes[n].child_end - 1);
     }
     
     
     /**
      * Return the object in the tree closest to the query point `q`.
+     *
+     * The tree must not be empty.
      */
     const Object& nearest(const Vec<T,N>& p) const {
-        KDDataRef ref;
-        T big = std::numeric_limits<T>::max();
-        nearestInNode(nodes.begin(), p, &ref, big, big);
-        return *ref;
+        return objects[nearest_index(p)];
     }
     
     /**
      * Return the object in the tree closest to the query point `q`.
+     *
+     * The tree must not be empty.
      */
     Object& nearest(const Vec<T,N>& p) {
-        KDDataRef ref;
-        T big = std::numeric_limits<T>::max();
-        T best_d2    = big;
-        T worst_best = big;
-        nearestInNode(nodes.begin(), p, &ref, &best_d2, &worst_best);
-        return *ref;
+        return objects[nearest_index(p)];
     }
     
     
-    /// Get the parameters describing the current tree-balancing strategy.
-    inline const KDStructureParams& getStructureParams() { return params; }
-
-
-private:
+    /**
+     * Find the nearest object to each of the `n` query points in `pts`.
+     *
+     * The position of the nearest object to `pts[i]` within the tree's object array
+     * (i.e. its offset from `begin().objects_begin()`) is written to `out_indices[i]`.
+     * If `out_d2` is not null, the squared distance to that object is written to `out_d2[i]`.
+     *
+     * Queries are taken in blocks of `QueryBlock`, and each block is answered in
+     * Morton order, so that consecutive queries are near each other and revisit the same
+     * nodes while they are hot in cache. Each query's search begins with the previous answer
+     * as its bound, which also prunes most of the tree early. No memory is allocated.
+     *
+     * The tree must not be empty.
+     */
+    void nearest(const Vec<T,N>* pts, size_t n, index_t* out_indices, T* out_d2=nullptr) const {
+        if (n == 0) return;
+        Rect<T,N> frame = nodes[0].bounds;
+        for (size_t i = 0; i < n; ++i) {
+            frame |= pts[i];
+        }
+        SmallStorage<std::pair<uint64_t, size_t>, QueryBlock> order;
+        KDDataRef prev = NO_NODE;
+        for (size_t q0 = 0; q0 < n; q0 += QueryBlock) {
+            size_t q1 = std::min<size_t>(n, q0 + QueryBlock);
+            order.resize(q1 - q0);
+            for (size_t i = q0; i < q1; ++i) {
+                order[i - q0] = {morton_key(pts[i], frame), i};
+            }
+            std::sort(order.begin(), order.end());
+            
+            for (const auto& [key, q] : order) {
+                const Vec<T,N>& p = pts[q];
+                KDDataRef ref     = prev;
+                T best_d2         = std::numeric_limits<T>::max();
+                if (prev != NO_NODE) {
+                    best_d2 = helper_t::dist2(objects[prev], p);
+                }
+                T worst_best = best_d2;
+                QueryScope query(this);
+                nearestInNode(0, p, &ref, &best_d2, &worst_best);
+                out_indices[q] = ref;
+                if (out_d2) out_d2[q] = best_d2;
+                prev = ref;
+            }
+        }
+    }
     
     
     /**
-     * Recalculate the bound of the given node by directly unioning the bounds
-     * of all the objects inside.
+     * Find the `k` objects nearest to `p`.
+     *
+     * `out` must have room for `k` neighbors. It is filled with the nearest objects,
+     * sorted from nearest to farthest. No memory is allocated.
+     *
+     * @return The number of neighbors found; the lesser of `k` and the number of objects in the tree.
      */
-    Rect<T,N> recalculateBounds(KDNodeRef node) {
-        Rect<T,N> bnd;
-        for (KDDataRef i = node->objects_begin; i != node->objects_end; ++i) {
-            bnd |= helper_t::bounds(*i);
+    index_t knn(const Vec<T,N>& p, index_t k, KDNeighbor* out) const {
+        if (k <= 0 or objects.empty()) return 0;
+        index_t n_found = 0;
+        // `out` is used as a max-heap on distance while searching;
+        // the farthest of the best `k` so far is at the top.
+        QueryScope query(this);
+        knnInNode(0, p, k, out, &n_found);
+        std::sort_heap(out, out + n_found, nearer);
+        return n_found;
+    }
+    
+    
+    /**
+     * Call `visit(obj)` on each object which is no farther than `r` from `p`.
+     * Objects are visited in no particular order. No memory is allocated.
+     *
+     * The tree must not be modified during the search.
+     */
+    template <typename Visitor>
+    void within_radius(const Vec<T,N>& p, T r, Visitor&& visit) const {
+        if (objects.empty()) return;
+        QueryScope query(this);
+        withinRadiusInNode(0, p, r * r, visit);
+    }
+    
+    
+    /**
+     * Call `visit(obj)` on each object which overlaps `region`.
+     * Objects are visited in no particular order. No memory is allocated.
+     *
+     * The tree must not be modified during the search.
+     */
+    template <typename Visitor>
+    void in_rect(const Rect<T,N>& region, Visitor&& visit) const {
+        if (objects.empty()) return;
+        QueryScope query(this);
+        inRectInNode(0, region, visit);
+    }
+    
+    
+    /**
+     * Find the first object struck by `ray`, considering only the part of the ray
+     * with parameters in `s_range` (by default, the part in front of the origin).
+     *
+     * Nodes are visited front-to-back in the order the ray enters them, and any node
+     * which the ray enters after the nearest hit found so far is skipped.
+     *
+     * `Object` must be a `RayIntersectableObject`, or a pointer or pair keyed by one.
+     *
+     * @return The nearest hit, or nothing if the ray misses every object.
+     */
+    std::optional<KDRayHit> first_hit(
+            const Ray<T,N>& ray,
+            Rect<T,1> s_range=Rect<T,1>(0, std::numeric_limits<T>::infinity())) const
+    {
+        if (objects.empty()) return std::nullopt;
+        KDRayHit best {nullptr, Rect<T,1>()};
+        T best_s = s_range.hi;
+        QueryScope query(this);
+        firstHitInNode(0, ray, s_range, &best, &best_s);
+        if (best.object == nullptr) return std::nullopt;
+        return best;
+    }
+    
+    
+    /**
+     * Find all the objects struck by `ray`, considering only the part of the ray with
+     * parameters in `s_range` (by default, the part in front of the origin).
+     *
+     * The hits are appended to `hits`, sorted front-to-back by where the ray enters
+     * each object. If `hits` has sufficient capacity, no memory is allocated.
+     *
+     * @return The number of hits appended.
+     */
+    index_t all_hits(
+            const Ray<T,N>& ray,
+            std::vector<KDRayHit>* hits,
+            Rect<T,1> s_range=Rect<T,1>(0, std::numeric_limits<T>::infinity())) const
+    {
+        size_t n0 = hits->size();
+        if (not objects.empty()) {
+            QueryScope query(this);
+            allHitsInNode(0, ray, s_range, hits);
         }
-        node->bounds = bnd;
-        return bnd;
+        std::sort(hits->begin() + n0, hits->end(), [](const KDRayHit& a, const KDRayHit& b) {
+            return a.s.lo < b.s.lo;
+        });
+        return hits->size() - n0;
     }
     
     
     /**
-     * Make a new sibling of `split_child` (assumed a leaf) and divide its objects between them
-     * according to the current balance parameters. Do not check if the node needs to be split,
-     * or if splitting will exceed the desired node arity.
+     * Call `visit(obj)` on each object which overlaps `frustum`.
+     * Objects are visited in no particular order.
+     *
+     * `frustum` may be any convex shape that can test points for containment; for example
+     * a `ViewFrustum`. Subtrees which lie entirely inside the frustum are visited without
+     * any further tests, and subtrees entirely outside it are skipped. Convex objects are
+     * tested exactly; other objects are tested by their bounding boxes.
      */
-    void splitNode(KDNodeRef split_child, index_t depth) {
-        Vec<T,N> mean;
-        Vec<T,N> dim;
-        Vec<T,N> var;
-        
-        index_t split_axis = 0;
-        T pivot;
-        
+    template <typename Shape, typename Visitor>
+        requires ConvexObject<Shape> and RegionObject<Shape> and (Shape::N == N)
+    void frustum_cull(const Shape& frustum, Visitor&& visit) const {
+        if (objects.empty()) return;
+        Intersector<T,N> gjk;
+        QueryScope query(this);
+        cullInNode(0, frustum, frustum.bounds(), &gjk, visit);
+    }
+    
+    
+    /// Get the parameters describing the current tree-balancing strategy.
+    inline const KDStructureParams& getStructureParams() const { return params; }
+    
+    
+    /**
+     * Statistics about the work done by the most recent query. Each query point of a
+     * batch query counts as a separate query.
+     *
+     * Available only if `QueryStats` is set. Collecting statistics makes every query
+     * write to the tree, so queries on an instrumented tree must not run concurrently.
+     */
+    const KDQueryStats& last_query_stats() const requires QueryStats {
+        return _stats.last;
+    }
+    
+    
+    /**
+     * Statistics about the work done by all the queries since construction or the
+     * last call to `reset_query_stats()`. Available only if `QueryStats` is set.
+     */
+    const KDQueryStats& query_stats() const requires QueryStats {
+        return _stats.total;
+    }
+    
+    
+    /// Clear the accumulated query statistics. Available only if `QueryStats` is set.
+    void reset_query_stats() requires QueryStats {
+        _stats.last  = {};
+        _stats.total = {};
+    }
+    
+    
+    /**
+     * Measure the shape of the tree: the distribution of leaf depths and occupancies,
+     * and how much sibling nodes overlap. Takes `O(n)` time in the number of nodes,
+     * plus `O(k^2)` per internal node with `k` children.
+     */
+    KDTreeStatistics tree_statistics() const {
+        KDTreeStatistics st;
+        st.n_nodes   = nodes.size();
+        st.n_objects = objects.size();
+        st.sah_cost  = nodes[0].cost;
+        // parents precede their children, so each depth is known before it's needed.
+        std::vector<index_t> depth(nodes.size(), 0);
+        index_t n_filled = 0;
+        for (KDNodeRef i = 0; i < nodes.size(); ++i) {
+            const KDNode& nd = nodes[i];
+            if (i > 0) {
+                depth[i] = depth[nd.parent] + 1;
+                if (nd.nobjs() > 0) st.node_volume += nd.bounds.measure_interior();
+            }
+            if (nd.is_leaf()) {
+                index_t d = depth[i];
+                index_t k = nd.nobjs();
+                if ((index_t)st.leaf_depths.size()    <= d) st.leaf_depths.resize(d + 1, 0);
+                if ((index_t)st.leaf_occupancy.size() <= k) st.leaf_occupancy.resize(k + 1, 0);
+                st.leaf_depths[d]    += 1;
+                st.leaf_occupancy[k] += 1;
+                st.n_leaves          += 1;
+                st.max_depth = std::max(st.max_depth, d);
+                if (k > 0) n_filled  += 1;
+            } else {
+                for (KDNodeRef a = nd.child_begin; a < nd.child_end; ++a) {
+                    if (nodes[a].nobjs() == 0) continue;
+                    for (KDNodeRef b = a + 1; b < nd.child_end; ++b) {
+                        if (nodes[b].nobjs() == 0) continue;
+                        Rect<T,N> shared = nodes[a].bounds & nodes[b].bounds;
+                        if (not shared.is_empty()) {
+                            st.overlap_volume += shared.measure_interior();
+                        }
+                    }
+                }
+            }
+        }
+        if (n_filled > 0) st.mean_leaf_occupancy = st.n_objects / (T) n_filled;
+        return st;
+    }
+    
+    
+private:
+    
+    
+    void setStructureParams(const KDStructureParams& newParams) {
+        params = newParams;
+        params.node_arity = std::max(params.node_arity, (index_t)2);
+        params.leaf_arity = std::max(params.leaf_arity, (index_t)1);
+        params.sah_bins   = std::max(params.sah_bins,   (index_t)2);
+    }
+    
+    
+    /************************************
+     * Layout maintenance               *
+     ************************************/
+    
+    
+    /**
+     * Rewrite the node array in breadth-first order, starting from the root,
+     * and discard any nodes that are no longer reachable from it. Child groups
+     * may have been re-emitted anywhere in the array; `parent` links are rebuilt.
+     */
+    void _relayout() {
+        node_array_t out(nodes.get_allocator());
+        out.reserve(nodes.size());
+        out.push_back(nodes[0]);
+        out[0].parent = NO_NODE;
+        for (KDNodeRef i = 0; i < out.size(); ++i) {
+            KDNodeRef cb = out[i].child_begin;
+            KDNodeRef ce = out[i].child_end;
+            if (cb == ce) continue;
+            out[i].child_begin = out.size();
+            for (KDNodeRef c = cb; c < ce; ++c) {
+                out.push_back(nodes[c]);
+                out.back().parent = i;
+            }
+            out[i].child_end = out.size();
+        }
+        nodes.swap(out);
+        _sync_bounds();
+        _update_costs();
+    }
+    
+    
+    /**
+     * Recompute the SAH cost of every subtree, from the leaves up. Each subtree costs
+     * the surface area of its box for each traversal step, and for each object tested.
+     * Nodes whose built cost was not yet recorded take the current cost as their baseline.
+     */
+    void _update_costs() {
+        for (size_t i = nodes.size(); i-- > 0;) {
+            update_cost(i);
+        }
+    }
+    
+    
+    // children must have up-to-date costs.
+    void update_cost(KDNodeRef i) {
+        KDNode& x = nodes[i];
+        T area = x.nobjs() > 0 ? x.bounds.measure_boundary() : 0;
+        if (x.is_leaf()) {
+            x.cost = area * x.nobjs();
+        } else {
+            x.cost = area;
+            for (KDNodeRef c = x.child_begin; c < x.child_end; ++c) {
+                x.cost += nodes[c].cost;
+            }
+        }
+        if (x.cost_built < 0) x.cost_built = x.cost;
+    }
+    
+    
+    /// Copy the node bounds into the structure-of-arrays mirror.
+    void _sync_bounds() {
+        const size_t n = nodes.size();
+        box_lo.resize(N * n);
+        box_hi.resize(N * n);
+        for (index_t k = 0; k < N; ++k) {
+            T* lo = box_lo.data() + k * n;
+            T* hi = box_hi.data() + k * n;
+            for (size_t i = 0; i < n; ++i) {
+                lo[i] = nodes[i].bounds.lo[k];
+                hi[i] = nodes[i].bounds.hi[k];
+            }
+        }
+    }
+    
+    
+    /**
+     * Fix up object ranges after an object was inserted at `pos`, at the end
+     * of the range belonging to `leaf`.
+     */
+    void shift_for_insert(KDNodeRef leaf, KDDataRef pos) {
+        // everything at or beyond `pos` moves right...
+        for (KDNode& x : nodes) {
+            if (x.objects_begin >= pos) ++x.objects_begin;
+            if (x.objects_end   >  pos) ++x.objects_end;
+        }
+        // ...except the ranges which now contain the new object.
+        for (KDNodeRef a = leaf; a != NO_NODE; a = nodes[a].parent) {
+            KDNode& x = nodes[a];
+            if (x.objects_begin == pos + 1) x.objects_begin = pos;
+            if (x.objects_end   == pos)     x.objects_end   = pos + 1;
+        }
+    }
+    
+    
+    /**
+     * Fix up object ranges after the objects in `[b, e)` were erased.
+     */
+    void shift_for_erase(KDDataRef b, KDDataRef e) {
+        KDDataRef k = e - b;
+        for (KDNode& x : nodes) {
+            if      (x.objects_begin >= e) x.objects_begin -= k;
+            else if (x.objects_begin >  b) x.objects_begin  = b;
+            if      (x.objects_end   >= e) x.objects_end   -= k;
+            else if (x.objects_end   >  b) x.objects_end    = b;
+        }
+    }
+    
+    
+    /// Recompute the bounds of all the ancestors of `n` from their children.
+    void refit_ancestors(KDNodeRef n) {
+        for (KDNodeRef p = nodes[n].parent; p != NO_NODE; p = nodes[p].parent) {
+            Rect<T,N> bnd;
+            for (KDNodeRef c = nodes[p].child_begin; c < nodes[p].child_end; ++c) {
+                bnd |= nodes[c].bounds;
+            }
+            nodes[p].bounds = bnd;
+        }
+    }
+    
+    
+    /// Number of ancestors of `n`.
+    index_t depth_of(KDNodeRef n) const {
+        index_t depth = 0;
+        for (KDNodeRef p = nodes[n].parent; p != NO_NODE; p = nodes[p].parent) {
+            ++depth;
+        }
+        return depth;
+    }
+    
+    
+    static inline Rect<T,N> bound_of(const Object& obj) {
+        Rect<T,N> bnd;
+        bnd |= helper_t::bounds(obj);
+        return bnd;
+    }
+    
+    
+    /************************************
+     * Construction                     *
+     ************************************/
+    
+    
+    /**
+     * Recalculate the bound of the given node by directly unioning the bounds
+     * of all the objects inside.
+     */
+    Rect<T,N> recalculateBounds(KDNodeRef node) {
+        Rect<T,N> bnd = bounds_of_range(nodes[node].objects_begin, nodes[node].objects_end);
+        nodes[node].bounds = bnd;
+        return bnd;
+    }
+    
+    
+    Rect<T,N> bounds_of_range(KDDataRef b, KDDataRef e) const {
+        Rect<T,N> bnd;
+        for (KDDataRef i = b; i < e; ++i) {
+            bnd |= helper_t::bounds(objects[i]);
+        }
+        return bnd;
+    }
+    
+    
+    /**
+     * Divide the objects in `[b, e)` into two nonempty groups according to the current
+     * balance parameters, and return the index of the first object in the upper group.
+     * `b` and `e` must span at least two objects. If `track` is given, it is updated to
+     * follow the object it indexes as objects are moved.
+     */
+    KDDataRef splitRange(KDDataRef b, KDDataRef e, index_t depth, KDDataRef* track=nullptr) {
+        Vec<T,N> mean;
+        Vec<T,N> dim;
+        Vec<T,N> var;
+        index_t  nobjs = e - b;
+        
+        index_t split_axis = 0;
+        T pivot = 0;
+        bool have_mean = false;
+        
+        if (params.pivot == KDPivotChoice::PIVOT_SAH) {
+            // the SAH chooses its own axis
+            sahSplit(b, e, &split_axis, &pivot);
+            return partitionRange(b, e, split_axis, pivot, track);
+        }
+        
         // choose a split axis
         switch (params.axis) {
             case KDAxisChoice::AXIS_LONGEST:
-                dim = split_child->bounds.dimensions();
+                dim = bounds_of_range(b, e).dimensions();
                 goto CHOOSE_BIGGEST_AXIS;
             case KDAxisChoice::AXIS_CYCLICAL:
                 split_axis = depth % N;
                 break;
             case KDAxisChoice::AXIS_HIGHEST_VARIANCE: {
-                for (KDDataRef i = split_child->objects_begin; i != split_child->objects_end; ++i) {
-                    mean += helper_t::getPoint(*i);
+                for (KDDataRef i = b; i < e; ++i) {
+                    mean += helper_t::getPoint(objects[i]);
                 }
-                for (KDDataRef i = split_child->objects_begin; i != split_child->objects_end; ++i) {
-                    Vec<T,N> p = helper_t::getPoint(*i) - mean;
+                mean /= nobjs;
+                have_mean = true;
+                for (KDDataRef i = b; i < e; ++i) {
+                    Vec<T,N> p = helper_t::getPoint(objects[i]) - mean;
                     var += p * p;
                 }
-                var /= std::max<index_t>(1, split_child->nobjs - 1); // variance with Bessel's correction
+                var /= std::max<index_t>(1, nobjs - 1); // variance with Bessel's correction
                 dim = var;
                 
             CHOOSE_BIGGEST_AXIS:
@@ -747,206 +1582,787 @@ private:
                         big = dim[i];
                         split_axis = i;
                     }
-                }    
+                }
                 break;
             }
         }
         
         // choose a pivot
         switch (params.pivot) {
+            case KDPivotChoice::PIVOT_MEDIAN: {
+                KDDataRef mid = b + nobjs / 2;
+                auto by_axis = [split_axis](const Object& o0, const Object& o1) {
+                    return helper_t::getPoint(o0)[split_axis] < helper_t::getPoint(o1)[split_axis];
+                };
+                if (track == nullptr or *track < b or *track >= e) {
+                    // O(n) selection leaves the lower half of the objects before `mid`.
+                    std::nth_element(
+                        objects.begin() + b,
+                        objects.begin() + mid,
+                        objects.begin() + e,
+                        by_axis);
+                    return mid;
+                }
+                // selection can't follow the tracked object. set it aside while
+                // finding the median value, then partition around that value below.
+                std::swap(objects[b], objects[*track]);
+                *track = b;
+                std::nth_element(
+                    objects.begin() + b + 1,
+                    objects.begin() + mid,
+                    objects.begin() + e,
+                    by_axis);
+                pivot = helper_t::getPoint(objects[mid])[split_axis];
+                break;
+            }
             case KDPivotChoice::PIVOT_MEAN:
-                if (params.axis == KDAxisChoice::AXIS_HIGHEST_VARIANCE) {
+                if (have_mean) {
                     // already calculated mean above
                     pivot = mean[split_axis];
                 } else {
                     // calculate the mean now
-                    for (KDDataRef i = split_child->objects_begin; i != split_child->objects_end; ++i) {
-                        pivot += helper_t::getPoint(*i)[split_axis];
+                    for (KDDataRef i = b; i < e; ++i) {
+                        pivot += helper_t::getPoint(objects[i])[split_axis];
                     }
-                    pivot /= split_child->nobjs;
+                    pivot /= nobjs;
                 }
                 break;
-            case KDPivotChoice::PIVOT_MEDIAN:
-                // xxx: todo: this
+            case KDPivotChoice::PIVOT_SAH:
+                // handled above
                 break;
         }
         
-        // make a new child with no objects and no children
-        KDNodeRef new_sibling = insertChild(split_child->parent).node;
-        
-        // partition the objects; create bbox
-        split_child->bounds = Rect<T,N>();
-        index_t nobjs = split_child->nobjs;
-        KDDataRef middle = new_sibling->objects_end = split_child->objects_end;
-        for (KDDataRef i = split_child->objects_begin; i != middle; ) {
-            Vec<T,N> v = helper_t::getPoint(*i);
+        return partitionRange(b, e, split_axis, pivot, track);
+    }
+    
+    
+    /**
+     * Partition the objects in `[b, e)` so that those whose centers lie above `pivot`
+     * along `axis` come last, and return the index of the first of those. If either group
+     * would be empty, split the range in half instead. `track` follows the object it indexes.
+     */
+    KDDataRef partitionRange(KDDataRef b, KDDataRef e, index_t split_axis, T pivot, KDDataRef* track) {
+        index_t   nobjs  = e - b;
+        KDDataRef middle = e;
+        for (KDDataRef i = b; i != middle; ) {
+            Vec<T,N> v = helper_t::getPoint(objects[i]);
             if (v[split_axis] > pivot) {
-                // move this object to the new (upper) sibling
-                std::swap(*i, *--middle);
-                split_child->nobjs--;
-                new_sibling->bounds |= helper_t::bounds(*i);
+                // move this object to the upper group
+                --middle;
+                std::swap(objects[i], objects[middle]);
+                if (track) {
+                    if      (*track == i)      *track = middle;
+                    else if (*track == middle) *track = i;
+                }
                 // `i` now contains an unchecked object; don't increment.
             } else {
-                split_child->bounds |= helper_t::bounds(*i);
                 ++i;
             }
         }
-        split_child->objects_end = new_sibling->objects_begin = middle;
-        new_sibling->nobjs = nobjs - split_child->nobjs;
+        
+        if (middle == b or middle == e) {
+            // all the objects coincide along the split axis.
+            // any division is as good as any other.
+            middle = b + nobjs / 2;
+        }
+        return middle;
     }
     
     
     /**
-     * Recursively sort the objects in `node` into subtrees according to the
-     * current balancing parameters in `O(n log(n))` time.
+     * Choose the split of `[b, e)` which minimizes the surface area heuristic, by binning
+     * object centers into `sah_bins` equal slabs along each axis and scoring each boundary
+     * between slabs as `area(lower) * n_lower + area(upper) * n_upper`, where the areas
+     * are the boundary measures of the object bounds falling on either side.
+     *
+     * If all the object centers coincide, any pivot is as good as any other.
      */
-    void buildTree(KDNodeRef node, index_t depth) {
-        // root node needs to calc its box
-        if (depth == 0) {
-            recalculateBounds(node);
+    void sahSplit(KDDataRef b, KDDataRef e, index_t* best_axis, T* best_pivot) const {
+        struct Bin {
+            Rect<T,N> box;
+            index_t   count = 0;
+        };
+        
+        Rect<T,N> centers;
+        for (KDDataRef i = b; i < e; ++i) {
+            centers |= helper_t::getPoint(objects[i]);
         }
+        *best_axis  = 0;
+        *best_pivot = centers.lo[0];
         
-        if (node->nobjs > params.leaf_arity) {
-            
-            KDNodeRef split_child = insertChild(node).node;
-            index_t n_added = 1;
-            
-            while (n_added < params.node_arity and split_child != node->child_end) {
-                // continue splitting the oldest node 
-                // until we've either reached node arity or run out of splittable nodes
-                if (split_child->nobjs > params.leaf_arity) {
-                    splitNode(split_child, depth);
-                    ++n_added;
+        const index_t n_bins = params.sah_bins;
+        scratch_t<Bin> bins(n_bins);
+        // cost of everything in or below each bin
+        scratch_t<T> upper_cost(n_bins);
+        T best_cost = std::numeric_limits<T>::max();
+        for (index_t axis = 0; axis < N; ++axis) {
+            T lo     = centers.lo[axis];
+            T extent = centers.hi[axis] - lo;
+            if (not (extent > 0)) continue;
+            T scale  = n_bins / extent;
+            for (index_t j = 0; j < n_bins; ++j) bins[j] = Bin();
+            for (KDDataRef i = b; i < e; ++i) {
+                T x = helper_t::getPoint(objects[i])[axis];
+                index_t j = std::min<index_t>((index_t)((x - lo) * scale), n_bins - 1);
+                bins[j].box |= helper_t::bounds(objects[i]);
+                bins[j].count += 1;
+            }
+            // sweep from above, then from below
+            Rect<T,N> box;
+            index_t   count = 0;
+            for (index_t j = n_bins - 1; j > 0; --j) {
+                if (bins[j].count > 0) box |= bins[j].box;
+                count += bins[j].count;
+                upper_cost[j] = count > 0 ? box.measure_boundary() * count : 0;
+            }
+            box   = Rect<T,N>();
+            count = 0;
+            for (index_t j = 0; j < n_bins - 1; ++j) {
+                if (bins[j].count > 0) box |= bins[j].box;
+                count += bins[j].count;
+                T cost = (count > 0 ? box.measure_boundary() * count : 0) + upper_cost[j + 1];
+                if (cost < best_cost) {
+                    best_cost   = cost;
+                    *best_axis  = axis;
+                    *best_pivot = lo + (j + 1) / scale;
                 }
-                ++split_child;
             }
-            
-            // recurse
-            for (KDNodeRef i = node->child_begin; i != node->child_end; ++i) {
-                buildTree(i, depth + 1);
+        }
+    }
+    
+    
+    /**
+     * Divide the objects of the leaf `node` among up to `node_arity` new children,
+     * appended to the end of the node array `ns`. Do nothing if the node is not too heavy.
+     *
+     * @return The number of children created.
+     */
+    template <typename NodeArray>
+    index_t splitNode(NodeArray& ns, KDNodeRef node, index_t depth, KDDataRef* track=nullptr) {
+        struct Range {
+            KDDataRef begin;
+            KDDataRef end;
+        };
+        
+        if (ns[node].nobjs() <= params.leaf_arity) return 0;
+        
+        scratch_t<Range> ranges(params.node_arity);
+        index_t n_ranges = 1;
+        ranges[0] = {ns[node].objects_begin, ns[node].objects_end};
+        
+        // split every heavy group in turn, until we've either reached
+        // the node arity or run out of splittable groups
+        bool split_any = true;
+        while (split_any and n_ranges < params.node_arity) {
+            split_any = false;
+            index_t n_this_pass = n_ranges;
+            for (index_t i = 0; i < n_this_pass and n_ranges < params.node_arity; ++i) {
+                Range& r = ranges[i];
+                if ((index_t)(r.end - r.begin) > params.leaf_arity) {
+                    KDDataRef mid = splitRange(r.begin, r.end, depth, track);
+                    ranges[n_ranges++] = {mid, r.end};
+                    r.end     = mid;
+                    split_any = true;
+                }
             }
-            
+        }
+        
+        // children must appear in object order
+        std::sort(ranges.begin(), ranges.begin() + n_ranges, [](const Range& a, const Range& b) {
+            return a.begin < b.begin;
+        });
+        
+        KDNodeRef first_child = ns.size();
+        for (index_t i = 0; i < n_ranges; ++i) {
+            KDNode c;
+            c.parent        = node;
+            c.objects_begin = ranges[i].begin;
+            c.objects_end   = ranges[i].end;
+            c.bounds        = bounds_of_range(ranges[i].begin, ranges[i].end);
+            ns.push_back(c);
+        }
+        ns[node].child_begin = first_child;
+        ns[node].child_end   = ns.size();
+        return n_ranges;
+    }
+    
+    
+    /**
+     * Rebuild the tree over the objects in their current order, grouping consecutive
+     * objects into leaves, and consecutive nodes into parents, up to the root. Each level
+     * is divided as evenly as possible into the fewest nodes which respect the arity.
+     */
+    void pack_presorted() {
+        // first element of run `g`, dividing `m` items into `k` even runs
+        auto run_begin = [](size_t g, size_t m, size_t k) -> KDNodeRef {
+            return (uint64_t) g * m / k;
+        };
+        const size_t n_objs = objects.size();
+        const size_t leaf_k = params.leaf_arity;
+        const size_t node_k = params.node_arity;
+        // number of nodes in each level, from the leaves up to the root
+        std::vector<size_t> sizes {std::max<size_t>(1, (n_objs + leaf_k - 1) / leaf_k)};
+        while (sizes.back() > 1) {
+            sizes.push_back((sizes.back() + node_k - 1) / node_k);
+        }
+        // levels are laid out root first, which puts the array in breadth-first order
+        const index_t n_levels = sizes.size();
+        std::vector<size_t> offset(n_levels);
+        size_t n_nodes = 0;
+        for (index_t j = n_levels; j-- > 0;) {
+            offset[j] = n_nodes;
+            n_nodes  += sizes[j];
+        }
+        nodes.assign(n_nodes, KDNode());
+        for (size_t g = 0; g < sizes[0]; ++g) {
+            KDNode& x = nodes[offset[0] + g];
+            x.objects_begin = run_begin(g,     n_objs, sizes[0]);
+            x.objects_end   = run_begin(g + 1, n_objs, sizes[0]);
+        }
+        for (index_t j = 1; j < n_levels; ++j) {
+            for (size_t g = 0; g < sizes[j]; ++g) {
+                KDNodeRef i = offset[j] + g;
+                KDNode&   x = nodes[i];
+                x.child_begin   = offset[j - 1] + run_begin(g,     sizes[j - 1], sizes[j]);
+                x.child_end     = offset[j - 1] + run_begin(g + 1, sizes[j - 1], sizes[j]);
+                x.objects_begin = nodes[x.child_begin].objects_begin;
+                x.objects_end   = nodes[x.child_end - 1].objects_end;
+                for (KDNodeRef c = x.child_begin; c < x.child_end; ++c) {
+                    nodes[c].parent = i;
+                }
+            }
+        }
+        // bounds, costs, and the bounds mirror
+        refit();
+    }
+    
+    
+    /**
+     * Sort the objects in the leaf `node` into subtrees according to the
+     * current balancing parameters in `O(n log(n))` time. New nodes are appended
+     * to the node array in breadth-first order.
+     */
+    void buildTree(KDNodeRef node, index_t depth, KDDataRef* track=nullptr) {
+        KDNodeRef first_new = nodes.size();
+        std::vector<index_t> depths;
+        
+        index_t n_kids = splitNode(nodes, node, depth, track);
+        depths.insert(depths.end(), n_kids, depth + 1);
+        
+        // every node we append is a leaf which may need splitting in turn
+        for (KDNodeRef i = first_new; i < nodes.size(); ++i) {
+            index_t d = depths[i - first_new];
+            n_kids = splitNode(nodes, i, d, track);
+            depths.insert(depths.end(), n_kids, d + 1);
+        }
+    }
+    
+    
+    /**
+     * Split the subtree rooted at `frag->nodes[0]` in breadth-first order, as `buildTree()`
+     * does, but hand each heavy subtree below the root to a new task with its own fragment.
+     */
+    void buildFragment(KDFragment* frag, index_t depth, WorkPool& pool, WorkGroup& group) {
+        std::vector<KDNode>& ns = frag->nodes;
+        std::vector<index_t> depths {depth};
+        for (KDNodeRef i = 0; i < ns.size(); ++i) {
+            index_t d = depths[i];
+            if (i > 0 and ns[i].nobjs() > ParallelBuildCutoff) {
+                // the subtree owns a disjoint range of objects, so it can be built independently
+                KDFragment* sub = new KDFragment;
+                sub->nodes.push_back(ns[i]);
+                frag->subtrees.emplace_back(i, std::unique_ptr<KDFragment>(sub));
+                pool.submit(group, [this, sub, d, &pool, &group]() {
+                    buildFragment(sub, d, pool, group);
+                });
+                continue;
+            }
+            index_t n_kids = splitNode(ns, i, d);
+            depths.insert(depths.end(), n_kids, d + 1);
         }
     }
     
     
     /**
-     * Insert the given object into `node`, descending recursively until a leaf is found.
+     * Append the nodes of a completed fragment to the node array, as the descendents
+     * of `at`. The result must be re-laid in breadth-first order afterward.
      */
-    object_iterator insert_impl(
-            KDNodeRef node, 
-            const Object& obj, 
+    void graftFragment(KDNodeRef at, const KDFragment& frag) {
+        const KDNode& root = frag.nodes[0];
+        // fragment node `i` is placed at `i + offset`; the fragment root is `at` itself.
+        KDNodeRef offset = nodes.size() - 1;
+        nodes[at].child_begin = root.child_begin + offset;
+        nodes[at].child_end   = root.child_end   + offset;
+        for (KDNodeRef i = 1; i < frag.nodes.size(); ++i) {
+            KDNode x = frag.nodes[i];
+            if (not x.is_leaf()) {
+                x.child_begin += offset;
+                x.child_end   += offset;
+            }
+            nodes.push_back(x);
+        }
+        for (const auto& [i, sub] : frag.subtrees) {
+            graftFragment(i + offset, *sub);
+        }
+    }
+    
+    
+    /**
+     * Insert the given object into `node`, descending until a leaf is found.
+     * Return the index of the inserted object.
+     */
+    KDDataRef insert_impl(
+            KDNodeRef node,
+            const Object& obj,
             const Rect<T,N>& bnd,
             const Vec<T,N>& ctr,
             index_t depth) {
         
-        node->bounds |= bnd;
-        node->nobjs++;
-        
-        if (node->child_begin != node->child_end) {
-            KDNodeRef best;
+        while (not nodes[node].is_leaf()) {
+            nodes[node].bounds |= bnd;
+            KDNodeRef best = nodes[node].child_begin;
             T best_metric = std::numeric_limits<T>::max();
-            for (KDNodeRef i = node->child_begin; i != node->child_end; ++i) {
-                T metric;
+            for (KDNodeRef i = nodes[node].child_begin; i < nodes[node].child_end; ++i) {
+                const Rect<T,N>& i_bnd = nodes[i].bounds;
+                T metric = 0;
                 switch (params.insert) {
                     case KDInsertionChoice::INSERT_SHORTEST_DISTANCE:
-                        metric = i->bounds.dist2(ctr);
+                        metric = i_bnd.dist2(ctr);
                         break;
                     case KDInsertionChoice::INSERT_SMALLEST_VOLUME_INCREASE:
-                        T orig_vol = i->bounds.volume();
-                        T new_vol  = (i->bounds | bnd).volume();
+                        T orig_vol = i_bnd.measure_interior();
+                        T new_vol  = (i_bnd | bnd).measure_interior();
                         metric = new_vol - orig_vol;
                         break;
                 }
-                if (metric == 0) {
-                    metric = -1 / i->bounds.center().dist2(ctr);
+                if (metric == 0 and not i_bnd.is_empty()) {
+                    metric = -1 / i_bnd.center().dist2(ctr);
                 }
                 if (metric < best_metric) {
                     best = i;
                     best_metric = metric;
                 }
             }
-            object_iterator out = insert_impl(best, obj, bnd, ctr, depth + 1);
-        } else {
-            KDDataRef inserted = objects.insert(node->objects_end, obj);
-            
-            if (node->objects_begin == node->objects_end) {
-                // "separate" begin and end ptrs
-                node->objects_begin = inserted;
-                // uncommon/degenerate case: multiple layers of empty nodes:
-                for (KDNodeRef p = node->parent; p != nodes.end() and p->objects_begin == p->objects_end; p = p->parent) {
-                    p->objects_begin = inserted;
+            node = best;
+            ++depth;
+        }
+        
+        nodes[node].bounds |= bnd;
+        KDDataRef inserted = nodes[node].objects_end;
+        objects.insert(objects.begin() + inserted, obj);
+        shift_for_insert(node, inserted);
+        
+        // subdivide if necessary
+        if (nodes[node].nobjs() > params.leaf_arity) {
+            KDNodeRef parent = nodes[node].parent;
+            if (parent == NO_NODE or
+                    (index_t)(nodes[parent].child_end - nodes[parent].child_begin) >= params.node_arity) {
+                // root node cannot have new siblings, and full nodes cannot have more children.
+                // make a new subtree instead.
+                buildTree(node, depth, &inserted);
+            } else {
+                // new sibling
+                KDDataRef mid = splitRange(
+                    nodes[node].objects_begin,
+                    nodes[node].objects_end,
+                    depth,
+                    &inserted);
+                KDNode sibling;
+                sibling.objects_begin = mid;
+                sibling.objects_end   = nodes[node].objects_end;
+                sibling.bounds        = bounds_of_range(mid, sibling.objects_end);
+                nodes[node].objects_end = mid;
+                recalculateBounds(node);
+                // re-emit the sibling group with the new node just after `node`
+                KDNodeRef new_cb = nodes.size();
+                for (KDNodeRef c = nodes[parent].child_begin; c < nodes[parent].child_end; ++c) {
+                    KDNode sib = nodes[c];
+                    nodes.push_back(sib);
+                    if (c == node) nodes.push_back(sibling);
                 }
+                nodes[parent].child_begin = new_cb;
+                nodes[parent].child_end   = nodes.size();
             }
-            
-            // subdivide if necessary
-            if (node->nobjs > params.leaf_arity) {
-                index_t parent_arity = 0;
-                KDNodeRef parent = node->parent;
-                if (parent != nodes.end()) {
-                    // count parent's children
-                    for (KDNodeRef i = parent->child_begin; i != parent->child_end; ++i) {
-                        ++parent_arity;
-                    }
-                    // new sibling, or new subtree?
-                    if (parent_arity >= params.node_arity) {
-                        buildTree(node, depth);
-                    } else {
-                        splitNode(node, depth);
-                    }
-                } else {
-                    // root node cannot have new silbings
-                    buildTree(node, depth);
-                }
+            _relayout();
+        }
+        
+        return inserted;
+    }
+    
+    
+    /************************************
+     * Queries                          *
+     ************************************/
+    
+    
+    KDDataRef nearest_index(const Vec<T,N>& p) const {
+        KDDataRef ref = 0;
+        T best_d2    = std::numeric_limits<T>::max();
+        T worst_best = std::numeric_limits<T>::max();
+        QueryScope query(this);
+        nearestInNode(0, p, &ref, &best_d2, &worst_best);
+        return ref;
+    }
+    
+    
+    /************************************
+     * Query statistics                 *
+     ************************************/
+    
+    
+    // counts one query over the lifetime of the object. does nothing unless `QueryStats`.
+    struct QueryScope {
+        const KDTree* tree;
+        
+        explicit QueryScope(const KDTree* tree):tree(tree) {
+            if constexpr (QueryStats) {
+                tree->_stats.last         = {};
+                tree->_stats.last.queries = 1;
+                tree->_stats.depth        = 0;
             }
         }
+        
+        ~QueryScope() {
+            if constexpr (QueryStats) tree->_stats.total += tree->_stats.last;
+        }
+    };
+    
+    
+    // counts a visit to a node over the lifetime of the object. does nothing unless `QueryStats`.
+    struct NodeScope {
+        const KDTree* tree;
+        
+        explicit NodeScope(const KDTree* tree):tree(tree) {
+            if constexpr (QueryStats) {
+                StatsState& st = tree->_stats;
+                st.last.nodes_visited += 1;
+                st.last.max_depth      = std::max(st.last.max_depth, st.depth);
+                st.depth              += 1;
+            }
+        }
+        
+        ~NodeScope() {
+            if constexpr (QueryStats) tree->_stats.depth -= 1;
+        }
+    };
+    
+    
+    inline void count_leaf(index_t n_tested) const {
+        if constexpr (QueryStats) {
+            _stats.last.leaves_scanned += 1;
+            _stats.last.object_tests   += n_tested;
+        }
+    }
+    
+    
+    /************************************
+     * Search                           *
+     ************************************/
+    
+    
+    // see detail::kd_child_box_distances()
+    void childBoxDistances(KDNodeRef first, index_t n_kids, const Vec<T,N>& p, T* near2, T* worst2) const {
+        detail::kd_child_box_distances<T,N>(
+            box_lo.data(), box_hi.data(), nodes.size(), first, n_kids, p, near2, worst2);
     }
     
     
+    // exposes the tree to detail::kd_nearest_in_node().
+    struct NearestSource {
+        const KDTree* tree;
+        
+        const KDNode& node(KDNodeRef i) const { return tree->nodes[i]; }
+        T dist2(KDDataRef i, const Vec<T,N>& p) const { return helper_t::dist2(tree->objects[i], p); }
+        NodeScope visit() const { return NodeScope(tree); }
+        void count_leaf(index_t n_tested) const { tree->count_leaf(n_tested); }
+        void child_box_distances(KDNodeRef first, index_t n_kids, const Vec<T,N>& p, T* near2, T* worst2) const {
+            tree->childBoxDistances(first, n_kids, p, near2, worst2);
+        }
+    };
+    
+    
     /**
      * Find the object nearest `p` in the given node.
      */
     void nearestInNode(KDNodeRef node, const Vec<T,N>& p, KDDataRef* nearest, T* best_d2, T* worst_best) const {
+        detail::kd_nearest_in_node<T,N>(NearestSource{this}, node, p, nearest, best_d2, worst_best);
+    }
+    
+    
+    static inline bool nearer(const KDNeighbor& a, const KDNeighbor& b) {
+        return a.dist2 < b.dist2;
+    }
+    
+    
+    /**
+     * Gather the `k` objects nearest `p` in the given node into the max-heap `heap`,
+     * which currently holds `*n_found` objects.
+     */
+    void knnInNode(KDNodeRef node, const Vec<T,N>& p, index_t k, KDNeighbor* heap, index_t* n_found) const {
         struct SearchInfo {
             KDNodeRef n;
             T best_case;
         };
-        index_t child_ct   = 0;
+        const KDNode& nd = nodes[node];
+        NodeScope visiting(this);
+        
+        if (nd.is_leaf()) {
+            count_leaf(nd.nobjs());
+            for (KDDataRef i = nd.objects_begin; i < nd.objects_end; ++i) {
+                T d2 = helper_t::dist2(objects[i], p);
+                if (*n_found < k) {
+                    heap[(*n_found)++] = {&objects[i], d2};
+                    std::push_heap(heap, heap + *n_found, nearer);
+                } else if (d2 < heap[0].dist2) {
+                    // evict the farthest
+                    std::pop_heap(heap, heap + k, nearer);
+                    heap[k - 1] = {&objects[i], d2};
+                    std::push_heap(heap, heap + k, nearer);
+                }
+            }
+            return;
+        }
+        
+        index_t recurse_ct = 0;
+        index_t n_kids = nd.child_end - nd.child_begin;
+        scratch_t<SearchInfo> buf(n_kids);
+        scratch_t<T> near2(n_kids);
+        scratch_t<T> worst2(n_kids);
+        childBoxDistances(nd.child_begin, n_kids, p, near2.data(), worst2.data());
+        for (index_t c = 0; c < n_kids; ++c) {
+            KDNodeRef i = nd.child_begin + c;
+            if (nodes[i].nobjs() == 0) continue;
+            if (*n_found < k or near2[c] < heap[0].dist2) {
+                buf[recurse_ct++] = {i, near2[c]};
+            }
+        }
+        std::sort(buf.begin(), buf.begin() + recurse_ct, [](const SearchInfo& a, const SearchInfo& b) {
+            return a.best_case < b.best_case;
+        });
+        for (index_t j = 0; j < recurse_ct; ++j) {
+            // the heap may have tightened since we checked this node
+            if (*n_found < k or buf[j].best_case < heap[0].dist2) {
+                knnInNode(buf[j].n, p, k, heap, n_found);
+            }
+        }
+    }
+    
+    
+    template <typename Visitor>
+    void visitAll(KDNodeRef node, Visitor& visit) const {
+        const KDNode& nd = nodes[node];
+        for (KDDataRef i = nd.objects_begin; i < nd.objects_end; ++i) {
+            visit(objects[i]);
+        }
+    }
+    
+    
+    template <typename Visitor>
+    void withinRadiusInNode(KDNodeRef node, const Vec<T,N>& p, T r2, Visitor& visit) const {
+        const KDNode& nd = nodes[node];
+        NodeScope visiting(this);
+        if (nd.nobjs() == 0 or nd.bounds.dist2(p) > r2) return;
+        if (detail::farthest2(p, nd.bounds) <= r2) {
+            // entire node is inside the query sphere
+            visitAll(node, visit);
+        } else if (nd.is_leaf()) {
+            count_leaf(nd.nobjs());
+            for (KDDataRef i = nd.objects_begin; i < nd.objects_end; ++i) {
+                if (helper_t::dist2(objects[i], p) <= r2) visit(objects[i]);
+            }
+        } else {
+            for (KDNodeRef c = nd.child_begin; c < nd.child_end; ++c) {
+                withinRadiusInNode(c, p, r2, visit);
+            }
+        }
+    }
+    
+    
+    template <typename Visitor>
+    void inRectInNode(KDNodeRef node, const Rect<T,N>& region, Visitor& visit) const {
+        const KDNode& nd = nodes[node];
+        NodeScope visiting(this);
+        if (nd.nobjs() == 0 or (region & nd.bounds).is_empty()) return;
+        if (region.contains(nd.bounds)) {
+            // entire node is inside the query box
+            visitAll(node, visit);
+        } else if (nd.is_leaf()) {
+            count_leaf(nd.nobjs());
+            for (KDDataRef i = nd.objects_begin; i < nd.objects_end; ++i) {
+                if (not (region & bound_of(objects[i])).is_empty()) visit(objects[i]);
+            }
+        } else {
+            for (KDNodeRef c = nd.child_begin; c < nd.child_end; ++c) {
+                inRectInNode(c, region, visit);
+            }
+        }
+    }
+    
+    
+    /**
+     * For each of the `n_kids` sibling nodes starting at `first`, compute the range of
+     * parameters `[s0, s1]` over which `ray` is inside the box. The ray misses boxes
+     * for which `s0 > s1`. Like `childBoxDistances()`, this tests the whole sibling group
+     * at once using the SoA bounds.
+     */
+    void childRayIntervals(KDNodeRef first, index_t n_kids, const Ray<T,N>& ray, T* s0, T* s1) const {
+        const size_t stride = nodes.size();
+        for (index_t c = 0; c < n_kids; ++c) {
+            s0[c] = -std::numeric_limits<T>::infinity();
+            s1[c] =  std::numeric_limits<T>::infinity();
+        }
+        for (index_t k = 0; k < N; ++k) {
+            const T* lo = box_lo.data() + k * stride + first;
+            const T* hi = box_hi.data() + k * stride + first;
+            const T  o  = ray.origin[k];
+            const T  d  = ray.direction[k];
+            if (d == 0) {
+                // ray is parallel to this slab; it's either always or never inside
+                for (index_t c = 0; c < n_kids; ++c) {
+                    bool outside = o < lo[c] or o > hi[c];
+                    s0[c] = outside ? std::numeric_limits<T>::infinity() : s0[c];
+                }
+            } else {
+                const T inv = 1 / d;
+                for (index_t c = 0; c < n_kids; ++c) {
+                    T a = (lo[c] - o) * inv;
+                    T b = (hi[c] - o) * inv;
+                    s0[c] = std::max(s0[c], std::min(a, b));
+                    s1[c] = std::min(s1[c], std::max(a, b));
+                }
+            }
+        }
+    }
+    
+    
+    void firstHitInNode(
+            KDNodeRef node,
+            const Ray<T,N>& ray,
+            const Rect<T,1>& s_range,
+            KDRayHit* best,
+            T* best_s) const
+    {
+        struct SearchInfo {
+            KDNodeRef n;
+            T s_enter;
+        };
+        const KDNode& nd = nodes[node];
+        NodeScope visiting(this);
+        
+        if (nd.is_leaf()) {
+            count_leaf(nd.nobjs());
+            for (KDDataRef i = nd.objects_begin; i < nd.objects_end; ++i) {
+                Rect<T,1> h = helper_t::intersect(objects[i], ray) & s_range;
+                if (not h.is_empty() and (h.lo < *best_s or best->object == nullptr)) {
+                    *best   = {&objects[i], h};
+                    *best_s = h.lo;
+                }
+            }
+            return;
+        }
+        
         index_t recurse_ct = 0;
+        index_t n_kids = nd.child_end - nd.child_begin;
+        scratch_t<SearchInfo> buf(n_kids);
+        scratch_t<T> s0(n_kids);
+        scratch_t<T> s1(n_kids);
+        childRayIntervals(nd.child_begin, n_kids, ray, s0.data(), s1.data());
+        for (index_t c = 0; c < n_kids; ++c) {
+            KDNodeRef i = nd.child_begin + c;
+            if (nodes[i].nobjs() == 0) continue;
+            T enter = std::max(s0[c], s_range.lo);
+            T exit  = std::min(s1[c], s_range.hi);
+            if (enter <= exit and enter <= *best_s) {
+                buf[recurse_ct++] = {i, enter};
+            }
+        }
+        // front to back
+        std::sort(buf.begin(), buf.begin() + recurse_ct, [](const SearchInfo& a, const SearchInfo& b) {
+            return a.s_enter < b.s_enter;
+        });
+        for (index_t j = 0; j < recurse_ct; ++j) {
+            // a nearer hit may have been found since we checked this node
+            if (buf[j].s_enter <= *best_s) {
+                firstHitInNode(buf[j].n, ray, s_range, best, best_s);
+            }
+        }
+    }
+    
+    
+    void allHitsInNode(
+            KDNodeRef node,
+            const Ray<T,N>& ray,
+            const Rect<T,1>& s_range,
+            std::vector<KDRayHit>* hits) const
+    {
+        const KDNode& nd = nodes[node];
+        NodeScope visiting(this);
         
-        // todo: With a portable alloca(), this could be arbitrarily large or small.
-        // this is the only line of code where leaf arity is actually restricted. 
-        // but instead we are forced to use the maximum sane amount of memory in all cases.
-        // (ironically, the argument against alloca is that it "uses too much stack").
-        SearchInfo buf[MAX_KDTREE_ARITY];
-        
-        for (KDNodeRef i = node->child_begin; i != node->child_end and recurse_ct <= MAX_KDTREE_ARITY; ++i, ++child_ct) {
-            T box_d2 = i->bounds.dist2(p);
-            T box_worst_d2 = detail::worst_case_nearest2(p, i->bounds);
-            if (box_d2 < *best_d2 and box_d2 <= *worst_best) {
-                buf[recurse_ct++] = {i, box_d2};
-            }
-            *worst_best = std::min(*worst_best, box_worst_d2);
-        }
-        // recurse
-        while (--recurse_ct >= 0) {
-            // subsequently added nodes may have better worst cases than we knew about before,
-            // or subsequent recursions may have improved the best estimate, rendering our
-            // checks obsolete and allowing us to discard more nodes. check again plz.
-            if (buf[recurse_ct].best_case < *best_d2 and buf[recurse_ct].best_case <= *worst_best) {
-                nearestInNode(buf[recurse_ct].n, p, nearest, best_d2, worst_best);
-            }
-        }
-        // is leaf?
-        // seach objects for actual nearest obj.
-        if (child_ct == 0) {
-            for (KDDataRef i = node->objects_begin; i != node->objects_end; ++i) {
-                T d2 = helper_t::dist2(*i, p);
-                if (d2 < *best_d2) {
-                    *best_d2 = d2;
-                    *nearest = i;
+        if (nd.is_leaf()) {
+            count_leaf(nd.nobjs());
+            for (KDDataRef i = nd.objects_begin; i < nd.objects_end; ++i) {
+                Rect<T,1> h = helper_t::intersect(objects[i], ray) & s_range;
+                if (not h.is_empty()) {
+                    hits->push_back({&objects[i], h});
                 }
             }
+            return;
+        }
+        
+        index_t n_kids = nd.child_end - nd.child_begin;
+        scratch_t<T> s0(n_kids);
+        scratch_t<T> s1(n_kids);
+        childRayIntervals(nd.child_begin, n_kids, ray, s0.data(), s1.data());
+        for (index_t c = 0; c < n_kids; ++c) {
+            KDNodeRef i = nd.child_begin + c;
+            if (nodes[i].nobjs() == 0) continue;
+            if (std::max(s0[c], s_range.lo) <= std::min(s1[c], s_range.hi)) {
+                allHitsInNode(i, ray, s_range, hits);
+            }
+        }
+    }
+    
+    
+    /// Whether the convex `shape` contains every corner of `box`, and therefore all of it.
+    template <typename Shape>
+    static bool contains_box(const Shape& shape, const Rect<T,N>& box) {
+        for (index_t corner = 0; corner < (1 << N); ++corner) {
+            Vec<T,N> p;
+            for (index_t k = 0; k < N; ++k) {
+                p[k] = ((corner >> k) & 1) ? box.hi[k] : box.lo[k];
+            }
+            if (not shape.contains(p)) return false;
+        }
+        return true;
+    }
+    
+    
+    template <typename Shape, typename Visitor>
+    void cullInNode(
+            KDNodeRef node,
+            const Shape& frustum,
+            const Rect<T,N>& frustum_box,
+            Intersector<T,N>* gjk,
+            Visitor& visit) const
+    {
+        const KDNode& nd = nodes[node];
+        NodeScope visiting(this);
+        if (nd.nobjs() == 0 or (frustum_box & nd.bounds).is_empty()) return;
+        if (contains_box(frustum, nd.bounds)) {
+            // entire node is inside the frustum
+            visitAll(node, visit);
+            return;
+        }
+        if (not gjk->intersects(nd.bounds, frustum)) return;
+        if (nd.is_leaf()) {
+            count_leaf(nd.nobjs());
+            for (KDDataRef i = nd.objects_begin; i < nd.objects_end; ++i) {
+                if (helper_t::overlaps(objects[i], frustum, gjk)) visit(objects[i]);
+            }
+        } else {
+            for (KDNodeRef c = nd.child_begin; c < nd.child_end; ++c) {
+                cullInNode(c, frustum, frustum_box, gjk, visit);
+            }
         }
     }
     
@@ -962,15 +2378,16 @@ private:
  *****************************************/
 
 
-template <typename T, index_t N, typename Object, typename NodeData>
-const typename KDTree<T,N,Object,NodeData>::KDStructureParams KDTree<T,N,Object,NodeData>::DefaultParameters = 
+template <typename T, index_t N, typename Object, typename NodeData, bool QueryStats, typename Allocator>
+const typename KDTree<T,N,Object,NodeData,QueryStats,Allocator>::KDStructureParams KDTree<T,N,Object,NodeData,QueryStats,Allocator>::DefaultParameters =
 {
     KDAxisChoice::AXIS_LONGEST,
     KDPivotChoice::PIVOT_MEAN,
     KDInsertionChoice::INSERT_SMALLEST_VOLUME_INCREASE,
-    std::min(2 << N, MAX_KDTREE_ARITY),        // internal node arity
-    std::min(2 << N, MAX_KDTREE_ARITY)         // leaf node arity
+    std::min<index_t>(2 << N, InlineArity),    // internal node arity
+    std::min<index_t>(2 << N, InlineArity),    // leaf node arity
+    16                                         // SAH bins per axis
 };
 
 
-} // namespace geom
\ No newline at end of file
+} // namespace geom
@@ -0,0 +1,337 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+
+#include <geomc/GeomException.h>
+#include <geomc/shape/KDTree.h>
+
+namespace geom {
+
+namespace detail {
+
+/*****************************************
+ * Snapshot format                       *
+ *****************************************/
+
+// a snapshot is laid out as:
+//   header
+//   node records    (n_nodes   x KDSnapshotNode)
+//   box lower bound (N x n_nodes x T, axis-major)
+//   box upper bound (N x n_nodes x T, axis-major)
+//   objects         (n_objects x Object)
+// every section begins at a multiple of the snapshot alignment, and is located
+// by its offset from the start of the snapshot. nothing in the file is a pointer.
+
+struct KDSnapshotHeader {
+    char     magic[8];
+    uint32_t version;
+    // written as 0x01020304; reads differently on a machine of the other endianness.
+    uint32_t byte_order;
+    uint32_t dimension;
+    uint32_t coord_size;
+    uint32_t object_size;
+    uint32_t object_align;
+    uint64_t n_nodes;
+    uint64_t n_objects;
+    uint64_t nodes_offset;
+    uint64_t box_lo_offset;
+    uint64_t box_hi_offset;
+    uint64_t objects_offset;
+    uint64_t total_size;
+};
+
+struct KDSnapshotNode {
+    uint32_t child_begin;
+    uint32_t child_end;
+    uint32_t objects_begin;
+    uint32_t objects_end;
+};
+
+static constexpr char     KDSnapshotMagic[8]  = {'g','e','o','m','c','K','D','\0'};
+static constexpr uint32_t KDSnapshotByteOrder = 0x01020304;
+
+// whether an object can be stored in a snapshot: trivially copyable, and not a pointer,
+// which would dangle once the snapshot is loaded by another process. an object/value
+// pair (which is never trivially copyable, on account of its assignment operator) is
+// storable if both its members are.
+template <typename Object>
+struct KDSnapshotStorable : std::bool_constant<
+        std::is_trivially_copyable_v<Object> and
+        not std::is_pointer_v<std::remove_all_extents_t<Object>> and
+        not std::is_member_pointer_v<std::remove_all_extents_t<Object>>> {};
+
+template <typename K, typename V>
+struct KDSnapshotStorable<std::pair<K,V>> : std::bool_constant<
+        KDSnapshotStorable<K>::value and
+        KDSnapshotStorable<V>::value> {};
+
+} // namespace detail
+
+
+/** @addtogroup shape
+ *  @{
+ */
+
+/*****************************************
+ * KDTreeView class                      *
+ *****************************************/
+
+/**
+ * @brief A read-only view of a KDTree snapshot in memory.
+ *
+ * A snapshot is a flat, versioned binary image of a built tree, written with `write()`.
+ * It contains no pointers, so it can be loaded at any address, and the view reads it
+ * in place without any deserialization. Mapping a snapshot file with `mmap()` therefore
+ * makes a tree available almost instantly, and processes which map the same file
+ * share one copy of it in the page cache:
+ *
+ *     // writer
+ *     std::ofstream out("points.kdt", std::ios::binary);
+ *     KDTreeView<double,3,Vec3d>::write(tree, out);
+ *
+ *     // reader
+ *     int fd = open("points.kdt", O_RDONLY);
+ *     void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+ *     KDTreeView<double,3,Vec3d> view(data, size);
+ *     Vec3d q = view.nearest(p);
+ *
+ * Only trivially copyable objects which are not pointers, and pairs of them, may be
+ * stored in a snapshot. Per-node data is not
+ * saved. The snapshot header records the format version, the byte order, and the
+ * sizes of the coordinate and object types; a snapshot written by a mismatched build
+ * is rejected when the view is constructed. The remaining content is trusted.
+ *
+ * The view does not own the memory it reads, which must outlive it.
+ *
+ * @tparam T Numeric type.
+ * @tparam N Dimensionality of data.
+ * @tparam Object Spatial object indexed by the tree.
+ */
+template <typename T, index_t N, typename Object>
+class KDTreeView {
+    
+    static_assert(
+        detail::KDSnapshotStorable<Object>::value,
+        "KDTree snapshots can only hold trivially copyable objects without pointers");
+    
+    typedef detail::ShapeIndexHelper<T,N,Object> helper_t;
+    typedef detail::KDSnapshotNode               node_t;
+    
+    const node_t* _nodes     = nullptr;
+    const T*      _box_lo    = nullptr;
+    const T*      _box_hi    = nullptr;
+    const Object* _objects   = nullptr;
+    size_t        _n_nodes   = 0;
+    size_t        _n_objects = 0;
+    
+    static constexpr uint64_t align_up(uint64_t x) {
+        return (x + Alignment - 1) / Alignment * Alignment;
+    }
+    
+public:
+    
+    /// Version of the snapshot format written and read by this class.
+    static constexpr uint32_t Version = 1;
+    
+    /// Alignment of a snapshot in memory, and of each section within it.
+    static constexpr size_t Alignment = std::max<size_t>({64, alignof(T), alignof(Object)});
+    
+    /// Construct an empty view.
+    KDTreeView() = default;
+    
+    /**
+     * Construct a view of the `size` bytes of snapshot at `data`, which must be aligned
+     * to `Alignment` bytes. Page-aligned memory, such as that returned by `mmap()`,
+     * always is.
+     *
+     * Throws a `GeomException` if the memory does not contain a snapshot compatible
+     * with this type.
+     */
+    KDTreeView(const void* data, size_t size) {
+        const std::byte* base = static_cast<const std::byte*>(data);
+        detail::KDSnapshotHeader h;
+        if (reinterpret_cast<uintptr_t>(data) % Alignment != 0) {
+            throw GeomException("KDTree snapshot is misaligned in memory");
+        }
+        if (size < sizeof(h)) {
+            throw GeomException("KDTree snapshot is truncated");
+        }
+        std::memcpy(&h, data, sizeof(h));
+        if (std::memcmp(h.magic, detail::KDSnapshotMagic, sizeof(h.magic)) != 0) {
+            throw GeomException("not a KDTree snapshot");
+        }
+        if (h.version != Version) {
+            throw GeomException("unsupported KDTree snapshot version");
+        }
+        if (h.byte_order   != detail::KDSnapshotByteOrder or
+            h.dimension    != N                           or
+            h.coord_size   != sizeof(T)                   or
+            h.object_size  != sizeof(Object)              or
+            h.object_align != alignof(Object))
+        {
+            throw GeomException("KDTree snapshot was written for a different tree type or platform");
+        }
+        const uint64_t box_bytes = h.n_nodes * N * sizeof(T);
+        if (h.total_size > size or
+            h.n_nodes   == 0    or
+            h.n_nodes   >  std::numeric_limits<uint32_t>::max() or
+            h.n_objects >  std::numeric_limits<uint32_t>::max() or
+            h.nodes_offset   % Alignment != 0 or
+            h.box_lo_offset  % Alignment != 0 or
+            h.box_hi_offset  % Alignment != 0 or
+            h.objects_offset % Alignment != 0 or
+            h.nodes_offset   + h.n_nodes * sizeof(node_t)     > h.total_size or
+            h.box_lo_offset  + box_bytes                      > h.total_size or
+            h.box_hi_offset  + box_bytes                      > h.total_size or
+            h.objects_offset + h.n_objects * sizeof(Object)   > h.total_size)
+        {
+            throw GeomException("KDTree snapshot is truncated or corrupt");
+        }
+        _nodes     = reinterpret_cast<const node_t*>(base + h.nodes_offset);
+        _box_lo    = reinterpret_cast<const T*>     (base + h.box_lo_offset);
+        _box_hi    = reinterpret_cast<const T*>     (base + h.box_hi_offset);
+        _objects   = reinterpret_cast<const Object*>(base + h.objects_offset);
+        _n_nodes   = h.n_nodes;
+        _n_objects = h.n_objects;
+    }
+    
+    
+    /**
+     * Write a snapshot of `tree` to `out`, which should be opened in binary mode.
+     *
+     * Throws a `GeomException` if the stream fails; the partial snapshot left in it
+     * should be discarded.
+     *
+     * @return The number of bytes written.
+     */
+    template <typename NodeData, bool QueryStats, typename Allocator>
+    static size_t write(const KDTree<T,N,Object,NodeData,QueryStats,Allocator>& tree, std::ostream& out) {
+        const uint64_t n_nodes   = tree.nodes.size();
+        const uint64_t n_objects = tree.objects.size();
+        const uint64_t box_bytes = n_nodes * N * sizeof(T);
+        
+        detail::KDSnapshotHeader h {};
+        std::memcpy(h.magic, detail::KDSnapshotMagic, sizeof(h.magic));
+        h.version        = Version;
+        h.byte_order     = detail::KDSnapshotByteOrder;
+        h.dimension      = N;
+        h.coord_size     = sizeof(T);
+        h.object_size    = sizeof(Object);
+        h.object_align   = alignof(Object);
+        h.n_nodes        = n_nodes;
+        h.n_objects      = n_objects;
+        h.nodes_offset   = align_up(sizeof(h));
+        h.box_lo_offset  = align_up(h.nodes_offset  + n_nodes * sizeof(node_t));
+        h.box_hi_offset  = align_up(h.box_lo_offset + box_bytes);
+        h.objects_offset = align_up(h.box_hi_offset + box_bytes);
+        h.total_size     = h.objects_offset + n_objects * sizeof(Object);
+        
+        uint64_t written = 0;
+        auto emit = [&](const void* src, uint64_t offset, uint64_t bytes) {
+            static const char zeros[Alignment] = {};
+            // pad up to the start of the section
+            while (written < offset) {
+                uint64_t k = std::min<uint64_t>(offset - written, Alignment);
+                out.write(zeros, k);
+                written += k;
+            }
+            out.write(static_cast<const char*>(src), bytes);
+            written += bytes;
+        };
+        
+        emit(&h, 0, sizeof(h));
+        std::vector<node_t> recs(n_nodes);
+        for (size_t i = 0; i < n_nodes; ++i) {
+            const auto& nd = tree.nodes[i];
+            recs[i] = {nd.child_begin, nd.child_end, nd.objects_begin, nd.objects_end};
+        }
+        emit(recs.data(),          h.nodes_offset,   recs.size() * sizeof(node_t));
+        emit(tree.box_lo.data(),   h.box_lo_offset,  box_bytes);
+        emit(tree.box_hi.data(),   h.box_hi_offset,  box_bytes);
+        emit(tree.objects.data(),  h.objects_offset, n_objects * sizeof(Object));
+        out.flush();
+        if (not out) {
+            throw GeomException("failed to write KDTree snapshot");
+        }
+        return written;
+    }
+    
+    
+    /// Number of objects in the tree.
+    inline index_t nobjects() const { return _n_objects; }
+    
+    /// Number of nodes in the tree.
+    inline index_t nnodes() const { return _n_nodes; }
+    
+    /// Pointer to the first object in the tree. Objects are in leaf order.
+    inline const Object* begin() const { return _objects; }
+    
+    /// Pointer just past the last object in the tree.
+    inline const Object* end() const { return _objects + _n_objects; }
+    
+    /// Bounding box of all the objects in the tree.
+    Rect<T,N> bounds() const {
+        Rect<T,N> r;
+        if (_n_nodes == 0) return r;
+        for (index_t k = 0; k < N; ++k) {
+            r.lo[k] = _box_lo[k * _n_nodes];
+            r.hi[k] = _box_hi[k * _n_nodes];
+        }
+        return r;
+    }
+    
+    
+    /**
+     * Return the object in the tree closest to the query point `p`.
+     *
+     * The tree must not be empty.
+     */
+    const Object& nearest(const Vec<T,N>& p) const {
+        return _objects[nearest_index(p)];
+    }
+    
+    
+    /**
+     * Return the position of the object closest to `p` within the object array.
+     *
+     * The tree must not be empty.
+     */
+    index_t nearest_index(const Vec<T,N>& p) const {
+        uint32_t ref  = 0;
+        T best_d2    = std::numeric_limits<T>::max();
+        T worst_best = std::numeric_limits<T>::max();
+        nearestInNode(0, p, &ref, &best_d2, &worst_best);
+        return ref;
+    }
+    
+private:
+    
+    // exposes the view to detail::kd_nearest_in_node().
+    struct NearestSource {
+        const KDTreeView* view;
+        
+        struct NoScope {};
+        
+        const node_t& node(uint32_t i) const { return view->_nodes[i]; }
+        T dist2(uint32_t i, const Vec<T,N>& p) const { return helper_t::dist2(view->_objects[i], p); }
+        NoScope visit() const { return {}; }
+        void count_leaf(index_t) const {}
+        void child_box_distances(uint32_t first, index_t n_kids, const Vec<T,N>& p, T* near2, T* worst2) const {
+            detail::kd_child_box_distances<T,N>(
+                view->_box_lo, view->_box_hi, view->_n_nodes, first, n_kids, p, near2, worst2);
+        }
+    };
+    
+    void nearestInNode(uint32_t node, const Vec<T,N>& p, uint32_t* nearest, T* best_d2, T* worst_best) const {
+        detail::kd_nearest_in_node<T,N>(NearestSource{this}, node, p, nearest, best_d2, worst_best);
+    }
+    
+};
+
+/// @} // addtogroup shape
+
+} // namespace geom
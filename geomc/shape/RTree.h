@@ -0,0 +1,950 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <boost/iterator/iterator_facade.hpp>
+#include <geomc/Tree.h>
+#include <geomc/shape/Rect.h>
+#include <geomc/shape/shapedetail/IndexHelpers.h>
+
+// todo: reinserted subtrees (not objects) are placed one at a time, and their old
+//       node keeps its full bound while it's choosing. R* shrinks it first.
+// todo: bulk insertion into a non-empty tree (merge an STR-packed batch as subtrees).
+
+namespace geom {
+
+/** @addtogroup shape
+ *  @{
+ */
+
+
+namespace detail {
+
+// closed box overlap. unlike Rect::intersects(), boxes which merely touch (including
+// degenerate boxes, like those around points) overlap.
+template <typename T, index_t N>
+inline bool rtree_overlaps(const Rect<T,N>& a, const Rect<T,N>& b) {
+    for (index_t k = 0; k < N; ++k) {
+        if (coord(a.hi, k) < coord(b.lo, k) or coord(b.hi, k) < coord(a.lo, k)) return false;
+    }
+    return true;
+}
+
+// sum of the edge lengths of `r`; the R* "margin".
+template <typename T, index_t N>
+inline T rtree_margin(const Rect<T,N>& r) {
+    auto d = r.dimensions();
+    T m = 0;
+    for (index_t k = 0; k < N; ++k) m += std::max(coord(d, k), (T)0);
+    return m;
+}
+
+} // namespace detail
+
+
+/**
+ * @brief A dynamic R*-tree: a balanced spatial index of boxes, for finding the
+ * objects which overlap, contain, or are contained by a query box.
+ *
+ * An RTree "has a" Tree: each node of the underlying `Tree<Rect<T,N>, Object>` holds
+ * the bounding box of everything below it, and its leaves hold the objects. Every
+ * node except the root has between `min_entries` and `max_entries` entries (children,
+ * or objects for a leaf), and all the leaves are at the same depth.
+ *
+ * A tree constructed from a batch of objects is packed with Sort-Tile-Recursive
+ * (STR) loading: the objects are sorted into slabs along each axis in turn and
+ * chunked into full leaves, and the same is done for each level of nodes above.
+ * This is `O(n log n)`, and produces nearly full nodes with little overlap.
+ *
+ * Objects inserted afterward follow the R* rules: a leaf is chosen to least
+ * enlarge the overlap between it and its siblings, and the first time a level
+ * overflows during an insertion, the `reinsert_entries` entries farthest from
+ * the center of the overflowing node are removed and inserted again, rather
+ * than splitting the node. Only if a node still overflows is it split, along
+ * the axis and at the position which minimize the margin and overlap of the halves.
+ * Erasing an object dissolves any node left with too few entries, and reinserts
+ * its objects.
+ *
+ * Queries treat boxes as closed; boxes that only touch are considered to overlap.
+ * The queries are iterators over the matching objects, driven by the `QueryIterator`
+ * of the underlying tree; `root()` gives access to the tree for any other kind of
+ * search (for example, nearest-first with `best_first()` from TreeSearch.h).
+ *
+ * All iterators into the tree are invalidated by `insert()` and `erase()`.
+ *
+ * @tparam T Numeric type.
+ * @tparam N Dimensionality of data.
+ * @tparam Object Spatial object to be indexed. May be a `Rect<T,N>`, a `Vec<T,N>`,
+ * another `BoundedObject`, or a `std::pair<K,V>` with `K` any of the former.
+ * @tparam Allocator Allocator for the underlying Tree.
+ */
+template <typename T, index_t N, typename Object, typename Allocator>
+class RTree {
+public:
+    
+    /// Type of the underlying tree of boxes.
+    typedef Tree<Rect<T,N>, Object, Allocator> tree_t;
+    /// Const iterator to the nodes of the underlying tree.
+    typedef typename tree_t::const_subtree_t   const_subtree_t;
+    /// Const iterator to the objects of the tree.
+    typedef typename const_subtree_t::const_item_iterator const_object_iterator;
+    
+    /// Parameters for the shape of an RTree.
+    struct RStructureParams {
+        /// Maximum number of entries (children, or objects in a leaf) of any node. At least 4.
+        index_t max_entries      = 16;
+        /// Minimum number of entries of any node but the root, after a split or an erase.
+        /// Clamped to `[1, max_entries / 2]`. R* suggests 40% of `max_entries`.
+        index_t min_entries      = 6;
+        /// Number of entries removed and reinserted from a node which overflows,
+        /// before resorting to a split. Zero disables reinsertion. R* suggests 30% of
+        /// `max_entries`. Clamped so that the node keeps at least `min_entries`.
+        index_t reinsert_entries = 5;
+    };
+    
+private:
+    
+    typedef typename tree_t::subtree_t               subtree_t;
+    typedef typename subtree_t::item_iterator        item_iterator;
+    typedef detail::ShapeIndexHelper<T,N,Object>     helper_t;
+    typedef typename Rect<T,N>::point_t              point_t;
+    
+    // a box to be packed by bulk loading. `id` is the index of an object or of a
+    // packed node in the level below.
+    struct Slot {
+        Rect<T,N> box;
+        index_t   id;
+    };
+    
+    // query predicates. `node()` must be true of every node above an object for which
+    // `object()` is true.
+    
+    struct OverlapTest {
+        static bool node(const Rect<T,N>& n, const Rect<T,N>& q)   { return detail::rtree_overlaps(n, q); }
+        static bool object(const Rect<T,N>& b, const Rect<T,N>& q) { return detail::rtree_overlaps(b, q); }
+    };
+    
+    struct ContainedTest {
+        static bool node(const Rect<T,N>& n, const Rect<T,N>& q)   { return detail::rtree_overlaps(n, q); }
+        static bool object(const Rect<T,N>& b, const Rect<T,N>& q) { return q.contains(b); }
+    };
+    
+    struct ContainingTest {
+        static bool node(const Rect<T,N>& n, const Rect<T,N>& q)   { return n.contains(q); }
+        static bool object(const Rect<T,N>& b, const Rect<T,N>& q) { return b.contains(q); }
+    };
+    
+    // adapt a predicate to the node bound / node test of Tree::QueryIterator
+    template <typename Test>
+    struct NodeBound {
+        bool operator()(const const_subtree_t& s, const Rect<T,N>& q) const {
+            return Test::node(*s, q);
+        }
+    };
+    
+    template <typename Test>
+    struct LeafTest {
+        bool operator()(const const_subtree_t& s, const Rect<T,N>& q) const {
+            return s.node_count() == 0 and s.item_count() > 0 and Test::node(*s, q);
+        }
+    };
+    
+    template <typename Test>
+    using leaf_query_t = typename const_subtree_t::template QueryIterator<
+        const_subtree_t, Rect<T,N>, NodeBound<Test>, LeafTest<Test>>;
+        
+public:
+    
+    /**
+     * @brief A forward iterator over the objects of an RTree which pass a query.
+     *
+     * Visits the leaves whose boxes pass the query with the underlying tree's
+     * `QueryIterator`, and the matching objects in each. The iterator is
+     * exhausted when it compares equal to `std::default_sentinel`.
+     */
+    template <typename Test>
+    class ObjectQueryIterator : public boost::iterator_facade<
+            ObjectQueryIterator<Test>,
+            const Object,
+            boost::forward_traversal_tag> {
+        
+        friend class boost::iterator_core_access;
+        
+        leaf_query_t<Test>    _leaf;
+        const_subtree_t       _end;
+        const_object_iterator _obj;
+        Rect<T,N>             _key;
+        
+    public:
+        
+        /// Construct an iterator over the objects below `root` which pass the query for `key`.
+        ObjectQueryIterator(const const_subtree_t& root, const Rect<T,N>& key):
+                _leaf(root, key, NodeBound<Test>(), LeafTest<Test>()),
+                _end(root.end()),
+                _key(key) {
+            if (not done()) {
+                _obj = _leaf->items_begin();
+                find_result();
+            }
+        }
+        
+        /// Return `true` if there are no more objects to visit.
+        inline bool done() const {
+            return _leaf == _end;
+        }
+        
+        /// Return an iterator to the current object in the tree. The query must not be `done()`.
+        inline const_object_iterator object() const {
+            return _obj;
+        }
+        
+        /// Return `true` if the query is `done()`.
+        inline bool operator==(std::default_sentinel_t) const {
+            return done();
+        }
+        
+        /// Return `true` if the query is not `done()`.
+        inline bool operator!=(std::default_sentinel_t) const {
+            return not done();
+        }
+        
+    private:
+        
+        // advance to the first matching object at or after `_obj`.
+        void find_result() {
+            while (not done()) {
+                for (; _obj != _leaf->items_end(); ++_obj) {
+                    if (Test::object(bound_of(*_obj), _key)) return;
+                }
+                ++_leaf;
+                if (not done()) _obj = _leaf->items_begin();
+            }
+        }
+        
+        // iterator_facade:
+        
+        void increment() {
+            ++_obj;
+            find_result();
+        }
+        
+        bool equal(const ObjectQueryIterator& other) const {
+            if (done() or other.done()) return done() == other.done();
+            return _obj == other._obj;
+        }
+        
+        const Object& dereference() const {
+            return *_obj;
+        }
+        
+    };
+    
+private:
+    
+    /************************************
+     * Members                          *
+     ************************************/
+    
+    // invariants:
+    //   - every node's box is the minimal box around the objects below it.
+    //   - all leaves are at level 0, and the root is at level `_height`.
+    //   - every node but the root has at most `max_entries` entries. nodes made by
+    //     splits and erasures have at least `min_entries`.
+    
+    tree_t           _tree;
+    index_t          _height = 0;
+    RStructureParams _params;
+    
+public:
+    
+    /************************************
+     * Structors                        *
+     ************************************/
+    
+    /// Construct an empty RTree.
+    RTree(): RTree(Allocator()) {}
+    
+    
+    /// Construct an empty RTree which uses the allocator `alloc`.
+    explicit RTree(const Allocator& alloc, const RStructureParams& params=RStructureParams()):
+            _tree(alloc) {
+        set_params(params);
+    }
+    
+    
+    /// Construct an RTree initialized with the objects in `[begin, end)`, packed by STR loading.
+    template <typename ObjectIterator>
+    RTree(ObjectIterator begin, ObjectIterator end, const RStructureParams& params=RStructureParams()):
+            RTree(begin, end, Allocator(), params) {}
+    
+    
+    /**
+     * @brief Construct an RTree initialized with the objects in `[begin, end)`, packed
+     * by STR loading, using the allocator `alloc`.
+     */
+    template <typename ObjectIterator>
+    RTree(ObjectIterator begin,
+          ObjectIterator end,
+          const Allocator& alloc,
+          const RStructureParams& params=RStructureParams()):
+            _tree(alloc) {
+        set_params(params);
+        bulk_load(begin, end);
+    }
+    
+    
+    /************************************
+     * Functions                        *
+     ************************************/
+    
+    /// Return a copy of the allocator used by this tree.
+    inline Allocator get_allocator() const {
+        return _tree.get_allocator();
+    }
+    
+    
+    /// Return the parameters governing the shape of this tree.
+    inline const RStructureParams& params() const {
+        return _params;
+    }
+    
+    
+    /// Number of objects in the tree.
+    inline index_t size() const {
+        return _tree.item_count();
+    }
+    
+    
+    /// Return `true` if the tree holds no objects.
+    inline bool empty() const {
+        return size() == 0;
+    }
+    
+    
+    /// Number of levels of nodes above the leaves. Zero if the root is a leaf.
+    inline index_t height() const {
+        return _height;
+    }
+    
+    
+    /// Bounding box of all the objects in the tree. Empty if the tree is empty.
+    inline Rect<T,N> bounds() const {
+        return *_tree.root();
+    }
+    
+    
+    /**
+     * @brief Return a const iterator to the root of the underlying tree.
+     *
+     * Each node holds the bounding box of its subtree, and each leaf holds its objects.
+     */
+    inline const_subtree_t root() const {
+        return _tree.root();
+    }
+    
+    
+    /// Read-only access to the underlying tree.
+    inline const tree_t& tree() const {
+        return _tree;
+    }
+    
+    
+    /// Remove all the objects from the tree.
+    void clear() {
+        _tree.root().clear();
+        *_tree.root() = Rect<T,N>();
+        _height = 0;
+    }
+    
+    
+    /**
+     * @brief Replace the contents of the tree with the objects in `[begin, end)`,
+     * packed by Sort-Tile-Recursive loading.
+     *
+     * Every node is full except possibly the last of each level, which is evened out
+     * with its neighbor so that no node is left with fewer than `min_entries` entries.
+     * `O(n log n)`.
+     *
+     * If `presorted` is set, the objects are taken to be in a spatially coherent order
+     * already, such as the order given by `spatial_sort()` along a Hilbert curve. Then
+     * each level is packed in the order given, without sorting, in `O(n)`.
+     */
+    template <typename ObjectIterator>
+    void bulk_load(ObjectIterator begin, ObjectIterator end, bool presorted=false) {
+        clear();
+        std::vector<Object> objs(begin, end);
+        if (objs.empty()) return;
+        const index_t M = _params.max_entries;
+        subtree_t root  = _tree.root();
+        
+        if ((index_t) objs.size() <= M) {
+            root.insert_items(objs.begin(), objs.end());
+            *root = box_of(root);
+            return;
+        }
+        
+        // levels[0] is the objects in leaf order. levels[j] for j > 0 is the nodes
+        // of tree level j - 1; node `g` of it holds `levels[j - 1][starts[j][g]...starts[j][g + 1]]`.
+        std::vector<std::vector<Slot>>    levels;
+        std::vector<std::vector<index_t>> starts(1);
+        std::vector<Slot> cur(objs.size());
+        for (index_t i = 0; i < (index_t) objs.size(); ++i) {
+            cur[i] = {bound_of(objs[i]), i};
+        }
+        while (true) {
+            if (not presorted) str_sort(cur.data(), cur.data() + cur.size(), 0);
+            index_t n = cur.size();
+            levels.push_back(std::move(cur));
+            if (n <= M) break;
+            
+            // chunk into full nodes, and even out the last two
+            std::vector<index_t> s;
+            for (index_t b = 0; b < n; b += M) s.push_back(b);
+            s.push_back(n);
+            index_t k = s.size() - 1;
+            if (k > 1 and s[k] - s[k - 1] < _params.min_entries) {
+                s[k - 1] = s[k - 2] + (s[k] - s[k - 2]) / 2;
+            }
+            const std::vector<Slot>& below = levels.back();
+            cur.resize(k);
+            for (index_t g = 0; g < k; ++g) {
+                Rect<T,N> box;
+                for (index_t i = s[g]; i < s[g + 1]; ++i) box |= below[i].box;
+                cur[g] = {box, g};
+            }
+            starts.push_back(std::move(s));
+        }
+        
+        // build the tree top-down from the packed levels
+        _height = levels.size() - 1;
+        std::vector<Object> batch;
+        fill_node(root, levels, starts, objs, levels.size() - 1, 0, levels.back().size(), &batch);
+        *root = box_of(root);
+    }
+    
+    
+    /**
+     * @brief Insert `obj` into the tree.
+     *
+     * `O(M^2 log n)` for `M` the maximum node size, including reinsertions and splits.
+     */
+    void insert(const Object& obj) {
+        uint64_t reinserted = 0;
+        insert_object(obj, &reinserted);
+    }
+    
+    
+    /// Insert each of the objects in `[begin, end)` into the tree.
+    template <typename ObjectIterator>
+    void insert(ObjectIterator begin, ObjectIterator end) {
+        for (; begin != end; ++begin) insert(*begin);
+    }
+    
+    
+    /**
+     * @brief Find an object in the tree equal to `obj`.
+     *
+     * Only the nodes whose boxes contain the bounds of `obj` are searched.
+     *
+     * @return An iterator to the object, or `objects_end()` if there is none.
+     */
+    const_object_iterator find(const Object& obj) const {
+        const_subtree_t leaf = _tree.end();
+        const_object_iterator i;
+        if (find_object(_tree.root(), obj, bound_of(obj), &leaf, &i)) return i;
+        return objects_end();
+    }
+    
+    
+    /**
+     * @brief Remove one object equal to `obj` from the tree.
+     *
+     * If the object's leaf is left with fewer than `min_entries` objects, it is removed,
+     * and its objects reinserted; this is repeated for its ancestors.
+     *
+     * @return `true` if an object was found and removed; `false` if the tree is unchanged.
+     */
+    bool erase(const Object& obj) {
+        subtree_t leaf = _tree.end();
+        item_iterator i;
+        if (not find_object(_tree.root(), obj, bound_of(obj), &leaf, &i)) return false;
+        leaf.erase(i);
+        condense(leaf);
+        return true;
+    }
+    
+    
+    /// Iterator to the first object in the tree.
+    inline const_object_iterator objects_begin() const {
+        return _tree.root().items_begin();
+    }
+    
+    
+    /// Off-end iterator to the objects in the tree.
+    inline const_object_iterator objects_end() const {
+        return _tree.root().items_end();
+    }
+    
+    
+    /************************************
+     * Queries                          *
+     ************************************/
+    
+    /**
+     * @brief Visit the objects whose bounds overlap `region`, including those which only
+     * touch its boundary.
+     *
+     *     for (auto i = rtree.overlapping(box); i != std::default_sentinel; ++i) {
+     *         // ...
+     *     }
+     */
+    inline ObjectQueryIterator<OverlapTest> overlapping(const Rect<T,N>& region) const {
+        return ObjectQueryIterator<OverlapTest>(_tree.root(), region);
+    }
+    
+    
+    /// Visit the objects whose bounds are entirely inside `region`.
+    inline ObjectQueryIterator<ContainedTest> contained_in(const Rect<T,N>& region) const {
+        return ObjectQueryIterator<ContainedTest>(_tree.root(), region);
+    }
+    
+    
+    /// Visit the objects whose bounds entirely contain `region`.
+    inline ObjectQueryIterator<ContainingTest> containing(const Rect<T,N>& region) const {
+        return ObjectQueryIterator<ContainingTest>(_tree.root(), region);
+    }
+    
+    
+private:
+    
+    void set_params(const RStructureParams& params) {
+        _params = params;
+        _params.max_entries      = std::max<index_t>(_params.max_entries, 4);
+        _params.min_entries      = std::clamp<index_t>(_params.min_entries, 1, _params.max_entries / 2);
+        _params.reinsert_entries = std::clamp<index_t>(
+            _params.reinsert_entries,
+            0,
+            _params.max_entries + 1 - _params.min_entries);
+    }
+    
+    
+    static inline Rect<T,N> bound_of(const Object& obj) {
+        Rect<T,N> bnd;
+        bnd |= helper_t::bounds(obj);
+        return bnd;
+    }
+    
+    
+    // number of entries in the node `s`
+    static inline index_t entry_count(const subtree_t& s) {
+        return s.node_count() > 0 ? s.node_count() : s.item_count();
+    }
+    
+    
+    // the minimal box around the entries of `s`
+    template <typename S>
+    static Rect<T,N> box_of(const S& s) {
+        Rect<T,N> box;
+        if (s.node_count() > 0) {
+            for (S c = s.begin(); c != s.end(); ++c) box |= *c;
+        } else {
+            for (auto i = s.items_begin(); i != s.items_end(); ++i) box |= bound_of(*i);
+        }
+        return box;
+    }
+    
+    
+    // recompute the box of `s` and its ancestors, until one is unchanged.
+    void refit(subtree_t s) {
+        while (true) {
+            Rect<T,N> box = box_of(s);
+            if (box == *s) return;
+            *s = box;
+            if (s.is_root()) return;
+            s = s.parent();
+        }
+    }
+    
+    
+    // grow the box of `s` and its ancestors to include `box`.
+    static void enlarge(subtree_t s, const Rect<T,N>& box) {
+        while (true) {
+            *s |= box;
+            if (s.is_root()) return;
+            s = s.parent();
+        }
+    }
+    
+    
+    /************************************
+     * STR loading                      *
+     ************************************/
+    
+    static inline T center(const Rect<T,N>& r, index_t axis) {
+        return coord(r.center(), axis);
+    }
+    
+    
+    // order the slots in `[b, e)` so that runs of `max_entries` are tiles of space:
+    // sort along `axis`, cut into slabs holding a whole number of tiles, and
+    // recursively tile each slab along the remaining axes.
+    void str_sort(Slot* b, Slot* e, index_t axis) const {
+        const index_t M = _params.max_entries;
+        index_t n = e - b;
+        std::sort(b, e, [axis](const Slot& x, const Slot& y) {
+            return center(x.box, axis) < center(y.box, axis);
+        });
+        if (axis == N - 1 or n <= M) return;
+        index_t n_tiles = (n + M - 1) / M;
+        index_t n_slabs = (index_t) std::ceil(std::pow((double) n_tiles, 1. / (N - axis)));
+        index_t slab    = M * ((n_tiles + n_slabs - 1) / n_slabs);
+        for (Slot* s = b; s < e; s += std::min<index_t>(slab, e - s)) {
+            str_sort(s, s + std::min<index_t>(slab, e - s), axis + 1);
+        }
+    }
+    
+    
+    // give `node` the entries `levels[j][b...e]`.
+    void fill_node(
+            subtree_t node,
+            const std::vector<std::vector<Slot>>&    levels,
+            const std::vector<std::vector<index_t>>& starts,
+            const std::vector<Object>&               objs,
+            index_t j,
+            index_t b,
+            index_t e,
+            std::vector<Object>* batch) {
+        const std::vector<Slot>& slots = levels[j];
+        if (j == 0) {
+            batch->clear();
+            for (index_t i = b; i < e; ++i) batch->push_back(objs[slots[i].id]);
+            node.insert_items(batch->begin(), batch->end());
+            return;
+        }
+        // siblings first, so that they're laid out contiguously
+        std::vector<Rect<T,N>> boxes;
+        for (index_t i = b; i < e; ++i) boxes.push_back(slots[i].box);
+        subtree_t c = node.insert_child_nodes(boxes.begin(), boxes.end());
+        for (index_t i = b; i < e; ++i, ++c) {
+            index_t g = slots[i].id;
+            fill_node(c, levels, starts, objs, j - 1, starts[j][g], starts[j][g + 1], batch);
+        }
+    }
+    
+    
+    /************************************
+     * Insertion                        *
+     ************************************/
+    
+    // the node at `level` whose box best admits `box`. below the level just above the
+    // leaves, this is the child needing least area enlargement; among the children of
+    // that level, it's the leaf needing least enlargement of its overlap with its siblings.
+    subtree_t choose_node(const Rect<T,N>& box, index_t level) {
+        subtree_t s = _tree.root();
+        for (index_t lvl = _height; lvl > level; --lvl) {
+            bool leaves = lvl == 1;
+            subtree_t best = s.end();
+            T best_overlap = 0;
+            T best_enlarge = 0;
+            T best_area    = 0;
+            T best_margin  = 0;
+            for (subtree_t c = s.begin(); c != s.end(); ++c) {
+                Rect<T,N> grown   = *c | box;
+                T         area    = c->measure_interior();
+                T         enlarge = grown.measure_interior() - area;
+                T         margin  = detail::rtree_margin(grown) - detail::rtree_margin(*c);
+                T         overlap = 0;
+                if (leaves) {
+                    for (subtree_t d = s.begin(); d != s.end(); ++d) {
+                        if (d == c) continue;
+                        overlap += (grown & *d).measure_interior() - (*c & *d).measure_interior();
+                    }
+                }
+                bool better;
+                if (best == s.end())              better = true;
+                else if (overlap != best_overlap) better = overlap < best_overlap;
+                else if (enlarge != best_enlarge) better = enlarge < best_enlarge;
+                else if (area    != best_area)    better = area    < best_area;
+                else                              better = margin  < best_margin;
+                if (better) {
+                    best         = c;
+                    best_overlap = overlap;
+                    best_enlarge = enlarge;
+                    best_area    = area;
+                    best_margin  = margin;
+                }
+            }
+            s = best;
+        }
+        return s;
+    }
+    
+    
+    // `reinserted` has a bit set for each level which has already reinserted
+    // entries during the current top-level insertion.
+    void insert_object(const Object& obj, uint64_t* reinserted) {
+        Rect<T,N> box  = bound_of(obj);
+        subtree_t leaf = choose_node(box, 0);
+        leaf.insert_item(obj);
+        enlarge(leaf, box);
+        overflow(leaf, 0, reinserted);
+    }
+    
+    
+    // resolve overflow of node `s`, at `level`, by reinsertion or splitting.
+    void overflow(subtree_t s, index_t level, uint64_t* reinserted) {
+        while (entry_count(s) > _params.max_entries) {
+            uint64_t bit = uint64_t(1) << std::min<index_t>(level, 63);
+            if (not s.is_root() and _params.reinsert_entries > 0 and not (*reinserted & bit)) {
+                *reinserted |= bit;
+                reinsert(s, level, reinserted);
+            } else {
+                s = split(s, level);
+                ++level;
+            }
+        }
+    }
+    
+    
+    // remove the entries of `s` farthest from its center, and insert them again,
+    // nearest first ("close reinsert").
+    void reinsert(subtree_t s, index_t level, uint64_t* reinserted) {
+        const point_t ctr = s->center();
+        const index_t p   = _params.reinsert_entries;
+        auto dist2 = [&ctr](const Rect<T,N>& b) {
+            T d2 = 0;
+            for (index_t k = 0; k < N; ++k) {
+                T d = coord(b.center(), k) - coord(ctr, k);
+                d2 += d * d;
+            }
+            return d2;
+        };
+        auto farther = [](const auto& a, const auto& b) { return a.first > b.first; };
+        
+        if (level == 0) {
+            std::vector<std::pair<T, item_iterator>> entries;
+            for (item_iterator i = s.items_begin(); i != s.items_end(); ++i) {
+                entries.push_back({dist2(bound_of(*i)), i});
+            }
+            std::stable_sort(entries.begin(), entries.end(), farther);
+            std::vector<Object> picks;
+            for (index_t i = 0; i < p; ++i) {
+                picks.push_back(*entries[i].second);
+                s.erase(entries[i].second);
+            }
+            refit(s);
+            for (index_t i = p - 1; i >= 0; --i) {
+                insert_object(picks[i], reinserted);
+            }
+        } else {
+            std::vector<std::pair<T, subtree_t>> entries;
+            for (subtree_t c = s.begin(); c != s.end(); ++c) {
+                entries.push_back({dist2(*c), c});
+            }
+            std::stable_sort(entries.begin(), entries.end(), farther);
+            for (index_t i = p - 1; i >= 0; --i) {
+                subtree_t c      = entries[i].second;
+                subtree_t target = choose_node(*c, level);
+                if (target == c.parent()) continue;
+                subtree_t from = c.parent();
+                target.take(c);
+                enlarge(target, *c);
+                refit(from);
+                overflow(target, level, reinserted);
+            }
+        }
+    }
+    
+    
+    // split the overfull node `s` at `level` in two, and return their parent.
+    // if `s` is the root, the tree grows a level.
+    subtree_t split(subtree_t s, index_t level) {
+        if (s.is_root()) {
+            subtree_t c;
+            if (s.node_count() == 0) {
+                // the new child takes all the root's objects
+                c = s.insert_child_node(*s);
+            } else {
+                std::vector<subtree_t> kids;
+                for (subtree_t k = s.begin(); k != s.end(); ++k) kids.push_back(k);
+                c = s.insert_child_node(s.end(), *s);
+                for (const subtree_t& k : kids) c.take(k);
+            }
+            ++_height;
+            s = c;
+        }
+        
+        // the entries' boxes
+        std::vector<Rect<T,N>>     boxes;
+        std::vector<subtree_t>     kids;
+        std::vector<item_iterator> items;
+        if (level == 0) {
+            for (item_iterator i = s.items_begin(); i != s.items_end(); ++i) {
+                items.push_back(i);
+                boxes.push_back(bound_of(*i));
+            }
+        } else {
+            for (subtree_t k = s.begin(); k != s.end(); ++k) {
+                kids.push_back(k);
+                boxes.push_back(*k);
+            }
+        }
+        std::vector<index_t> order;
+        index_t cut = choose_split(boxes, &order);
+        
+        // move the entries after the cut to a new sibling
+        subtree_t parent = s.parent();
+        subtree_t next   = s; ++next;
+        subtree_t sib    = parent.insert_child_node(next, Rect<T,N>());
+        if (level == 0) {
+            std::vector<Object> moved;
+            for (index_t i = cut; i < (index_t) order.size(); ++i) {
+                moved.push_back(*items[order[i]]);
+                s.erase(items[order[i]]);
+            }
+            sib.insert_items(moved.begin(), moved.end());
+        } else {
+            for (index_t i = cut; i < (index_t) order.size(); ++i) {
+                sib.take(kids[order[i]]);
+            }
+        }
+        *s   = box_of(s);
+        *sib = box_of(sib);
+        return parent;
+    }
+    
+    
+    // choose the R* split of `boxes`: along the axis where the halves have the least
+    // total margin, at the cut where they overlap least (then have least total area).
+    // the entries are written to `order`; the first group is `order[0...cut]`.
+    index_t choose_split(const std::vector<Rect<T,N>>& boxes, std::vector<index_t>* order) const {
+        const index_t n = boxes.size();
+        const index_t m = _params.min_entries;
+        std::vector<index_t>   idx(n);
+        std::vector<Rect<T,N>> lo_box(n + 1);
+        std::vector<Rect<T,N>> hi_box(n + 1);
+        
+        // sort `idx` along `axis` by lower (`upper == false`) or upper extreme, and
+        // fill the boxes around each prefix and suffix.
+        auto sweep = [&](index_t axis, bool upper) {
+            for (index_t i = 0; i < n; ++i) idx[i] = i;
+            std::sort(idx.begin(), idx.end(), [&](index_t a, index_t b) {
+                const Rect<T,N>& x = boxes[a];
+                const Rect<T,N>& y = boxes[b];
+                if (upper) return coord(x.hi, axis) < coord(y.hi, axis);
+                else       return coord(x.lo, axis) < coord(y.lo, axis);
+            });
+            lo_box[0] = hi_box[n] = Rect<T,N>();
+            for (index_t i = 0; i < n; ++i) lo_box[i + 1] = lo_box[i] | boxes[idx[i]];
+            for (index_t i = n; i > 0; --i) hi_box[i - 1] = hi_box[i] | boxes[idx[i - 1]];
+        };
+        
+        index_t best_axis   = 0;
+        T       best_margin = 0;
+        for (index_t axis = 0; axis < N; ++axis) {
+            T margin = 0;
+            for (bool upper : {false, true}) {
+                sweep(axis, upper);
+                for (index_t cut = m; cut <= n - m; ++cut) {
+                    margin += detail::rtree_margin(lo_box[cut]) + detail::rtree_margin(hi_box[cut]);
+                }
+            }
+            if (axis == 0 or margin < best_margin) {
+                best_axis   = axis;
+                best_margin = margin;
+            }
+        }
+        
+        index_t best_cut     = -1;
+        T       best_overlap = 0;
+        T       best_area    = 0;
+        for (bool upper : {false, true}) {
+            sweep(best_axis, upper);
+            for (index_t cut = m; cut <= n - m; ++cut) {
+                T overlap = (lo_box[cut] & hi_box[cut]).measure_interior();
+                T area    = lo_box[cut].measure_interior() + hi_box[cut].measure_interior();
+                if (best_cut < 0 or overlap < best_overlap or (overlap == best_overlap and area < best_area)) {
+                    best_cut     = cut;
+                    best_overlap = overlap;
+                    best_area    = area;
+                    *order       = idx;
+                }
+            }
+        }
+        return best_cut;
+    }
+    
+    
+    /************************************
+     * Erasure                          *
+     ************************************/
+    
+    // find the leaf and item holding an object equal to `obj`, searching
+    // only the nodes whose boxes contain `box`.
+    template <typename S, typename I>
+    static bool find_object(const S& s, const Object& obj, const Rect<T,N>& box, S* leaf, I* item) {
+        if (not s->contains(box)) return false;
+        if (s.node_count() == 0) {
+            for (auto i = s.items_begin(); i != s.items_end(); ++i) {
+                if (*i == obj) {
+                    *leaf = s;
+                    *item = i;
+                    return true;
+                }
+            }
+            return false;
+        }
+        for (S c = s.begin(); c != s.end(); ++c) {
+            if (find_object(c, obj, box, leaf, item)) return true;
+        }
+        return false;
+    }
+    
+    
+    // after an erasure from `leaf`, dissolve the nodes on the path to the root which
+    // have too few entries, shrink the boxes of the rest, and reinsert the orphans.
+    void condense(subtree_t s) {
+        std::vector<Object> orphans;
+        while (not s.is_root()) {
+            subtree_t parent = s.parent();
+            if (entry_count(s) < _params.min_entries) {
+                orphans.insert(orphans.end(), s.items_begin(), s.items_end());
+                parent.erase(s);
+            } else {
+                *s = box_of(s);
+            }
+            s = parent;
+        }
+        *s = box_of(s);
+        
+        // a root with one child is replaced by that child
+        while (s.node_count() == 1) {
+            subtree_t c = s.begin();
+            if (c.node_count() == 0) {
+                std::vector<Object> objs(c.items_begin(), c.items_end());
+                s.erase(c);
+                s.insert_items(objs.begin(), objs.end());
+            } else {
+                std::vector<subtree_t> kids;
+                for (subtree_t k = c.begin(); k != c.end(); ++k) kids.push_back(k);
+                for (const subtree_t& k : kids) s.take(k);
+                s.erase(c);
+            }
+            --_height;
+        }
+        if (s.node_count() == 0) _height = 0;
+        
+        for (const Object& obj : orphans) insert(obj);
+    }
+    
+};
+
+/// @} // addtogroup shape
+
+} // namespace geom
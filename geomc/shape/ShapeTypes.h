@@ -8,6 +8,7 @@
  */
 
 #include <geomc/linalg/LinalgTypes.h>
+#include <memory>
 
 /** 
  * @defgroup shape Shape
@@ -131,8 +132,19 @@ using SphericalShell = Dilated<Hollow<Sphere<T,N>>>;
 template <typename T>
 using Circle = Sphere<T,2>;
 
-template <typename T, index_t N, typename Object, typename NodeData=void*>
+template <typename T, index_t N, typename Object, typename NodeData=void*, bool QueryStats=false,
+          typename Allocator=std::allocator<Object>>
     class KDTree;
+template <typename T, index_t N, typename Object>
+    class KDTreeView;
+template <typename T, index_t N, typename Object, typename Allocator=std::allocator<Object>>
+    class RTree;
+template <typename T, index_t N, typename O>
+    class HashGrid;
+template <typename T, index_t N, typename O>
+    class ConcurrentHashGrid;
+template <typename T, index_t N, typename Object>
+    class HierarchicalGrid;
 template <typename T, index_t N, ArrayOrder Order=ARRAYORDER_FIRST_DIM_CONSECUTIVE>
     class GridIterator;
 
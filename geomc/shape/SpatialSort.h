@@ -0,0 +1,518 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+#include <geomc/linalg/Vec.h>
+#include <geomc/shape/Rect.h>
+#include <geomc/WorkPool.h>
+
+// todo: curve keys wider than 64 bits, for more than 21 bits per axis in 3D.
+
+namespace geom {
+
+/** @addtogroup shape
+ *  @{
+ */
+
+
+/// A space-filling curve, by which points may be ordered so that points near each other tend to be near each other in order.
+enum class SpatialCurve {
+    /**
+     * The Z-order (Morton) curve. Keys are the interleaved bits of the coordinates.
+     * Very cheap to compute, but the curve makes long jumps at power-of-two boundaries.
+     */
+    CURVE_MORTON,
+    /**
+     * The Hilbert curve. Consecutive cells are always adjacent, so runs of points in
+     * Hilbert order are more compact than runs in Morton order. Costs `O(N)` more per key.
+     */
+    CURVE_HILBERT
+};
+
+
+/**
+ * @brief Number of bits of each coordinate represented in a 64-bit curve key in
+ * `N` dimensions: 32 in 1D and 2D, 21 in 3D, 16 in 4D, and so on.
+ */
+template <index_t N>
+inline constexpr index_t curve_bits = std::min<index_t>(64 / N, 32);
+
+
+namespace detail {
+
+// a mask with every `N`th bit set, starting at bit 0, over the low `curve_bits<N> * N` bits.
+template <index_t N>
+constexpr uint64_t curve_lane_mask() {
+    uint64_t m = 0;
+    for (index_t b = 0; b < curve_bits<N>; ++b) m |= uint64_t(1) << (b * N);
+    return m;
+}
+
+// spread the low `curve_bits<N>` bits of `x` so that there are `N - 1` zeros between each.
+template <index_t N>
+constexpr uint64_t spread_bits(uint64_t x) {
+    x &= (uint64_t(1) << curve_bits<N>) - 1;
+    if constexpr (N == 1) {
+        return x;
+    } else {
+#if defined(__BMI2__)
+        if (not std::is_constant_evaluated()) return _pdep_u64(x, curve_lane_mask<N>());
+#endif
+        if constexpr (N == 2) {
+            x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+            x = (x | (x <<  8)) & 0x00FF00FF00FF00FFULL;
+            x = (x | (x <<  4)) & 0x0F0F0F0F0F0F0F0FULL;
+            x = (x | (x <<  2)) & 0x3333333333333333ULL;
+            x = (x | (x <<  1)) & 0x5555555555555555ULL;
+            return x;
+        } else if constexpr (N == 3) {
+            x = (x | (x << 32)) & 0x001F00000000FFFFULL;
+            x = (x | (x << 16)) & 0x001F0000FF0000FFULL;
+            x = (x | (x <<  8)) & 0x100F00F00F00F00FULL;
+            x = (x | (x <<  4)) & 0x10C30C30C30C30C3ULL;
+            x = (x | (x <<  2)) & 0x1249249249249249ULL;
+            return x;
+        } else {
+            uint64_t r = 0;
+            for (index_t b = 0; b < curve_bits<N>; ++b) r |= ((x >> b) & 1) << (b * N);
+            return r;
+        }
+    }
+}
+
+// the inverse of `spread_bits()`: gather every `N`th bit of `x`, starting with bit 0.
+template <index_t N>
+constexpr uint64_t gather_bits(uint64_t x) {
+    if constexpr (N == 1) {
+        return x & ((uint64_t(1) << curve_bits<N>) - 1);
+    } else {
+#if defined(__BMI2__)
+        if (not std::is_constant_evaluated()) return _pext_u64(x, curve_lane_mask<N>());
+#endif
+        if constexpr (N == 2) {
+            x &= 0x5555555555555555ULL;
+            x = (x | (x >>  1)) & 0x3333333333333333ULL;
+            x = (x | (x >>  2)) & 0x0F0F0F0F0F0F0F0FULL;
+            x = (x | (x >>  4)) & 0x00FF00FF00FF00FFULL;
+            x = (x | (x >>  8)) & 0x0000FFFF0000FFFFULL;
+            x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+            return x;
+        } else if constexpr (N == 3) {
+            x &= 0x1249249249249249ULL;
+            x = (x | (x >>  2)) & 0x10C30C30C30C30C3ULL;
+            x = (x | (x >>  4)) & 0x100F00F00F00F00FULL;
+            x = (x | (x >>  8)) & 0x001F0000FF0000FFULL;
+            x = (x | (x >> 16)) & 0x001F00000000FFFFULL;
+            x = (x | (x >> 32)) & 0x00000000001FFFFFULL;
+            return x;
+        } else {
+            uint64_t r = 0;
+            for (index_t b = 0; b < curve_bits<N>; ++b) r |= ((x >> (b * N)) & 1) << b;
+            return r;
+        }
+    }
+}
+
+// interleave `x[0..N)` into a key, with the bits of `x[0]` the most significant of each group.
+template <index_t N>
+constexpr uint64_t interleave(const uint64_t* x) {
+    uint64_t key = 0;
+    for (index_t k = 0; k < N; ++k) key |= spread_bits<N>(x[k]) << (N - 1 - k);
+    return key;
+}
+
+template <index_t N>
+constexpr void deinterleave(uint64_t key, uint64_t* x) {
+    for (index_t k = 0; k < N; ++k) x[k] = gather_bits<N>(key >> (N - 1 - k));
+}
+
+// convert coordinates in place to the "transposed" form of their Hilbert index,
+// whose interleaved bits are the index. after J. Skilling, "Programming the
+// Hilbert curve", AIP Conf. Proc. 707 (2004).
+template <index_t N>
+constexpr void hilbert_axes_to_transpose(uint64_t* x) {
+    constexpr index_t  B = curve_bits<N>;
+    constexpr uint64_t M = uint64_t(1) << (B - 1);
+    // inverse undo
+    for (uint64_t q = M; q > 1; q >>= 1) {
+        uint64_t p = q - 1;
+        for (index_t i = 0; i < N; ++i) {
+            if (x[i] & q) {
+                x[0] ^= p;
+            } else {
+                uint64_t t = (x[0] ^ x[i]) & p;
+                x[0] ^= t;
+                x[i] ^= t;
+            }
+        }
+    }
+    // gray encode
+    for (index_t i = 1; i < N; ++i) x[i] ^= x[i - 1];
+    uint64_t t = 0;
+    for (uint64_t q = M; q > 1; q >>= 1) {
+        if (x[N - 1] & q) t ^= q - 1;
+    }
+    for (index_t i = 0; i < N; ++i) x[i] ^= t;
+}
+
+// the inverse of `hilbert_axes_to_transpose()`.
+template <index_t N>
+constexpr void hilbert_transpose_to_axes(uint64_t* x) {
+    constexpr index_t  B   = curve_bits<N>;
+    constexpr uint64_t end = uint64_t(2) << (B - 1);
+    // gray decode
+    uint64_t t = x[N - 1] >> 1;
+    for (index_t i = N - 1; i > 0; --i) x[i] ^= x[i - 1];
+    x[0] ^= t;
+    // undo excess work
+    for (uint64_t q = 2; q != end; q <<= 1) {
+        uint64_t p = q - 1;
+        for (index_t i = N - 1; i >= 0; --i) {
+            if (x[i] & q) {
+                x[0] ^= p;
+            } else {
+                t = (x[0] ^ x[i]) & p;
+                x[0] ^= t;
+                x[i] ^= t;
+            }
+        }
+    }
+}
+
+template <index_t N>
+inline std::array<index_t,N> curve_array(const Vec<index_t,N>& v) {
+    std::array<index_t,N> a;
+    std::copy(v.begin(), v.end(), a.begin());
+    return a;
+}
+
+template <typename P>
+struct CurvePoint {};
+
+template <typename T, index_t N>
+struct CurvePoint<Vec<T,N>> {
+    typedef T elem_t;
+    static constexpr index_t dim = N;
+};
+
+} // namespace detail
+
+
+/*****************************************
+ * Curve keys                            *
+ *****************************************/
+
+/**
+ * @brief The Morton (Z-order) key of the grid cell `cell`.
+ *
+ * Only the low `curve_bits<N>` bits of each (non-negative) coordinate are used.
+ * When the BMI2 instruction set is available, the bits are interleaved with one
+ * `pdep` instruction per axis; otherwise with a short sequence of shifts and masks.
+ * This form may be evaluated at compile time.
+ */
+template <size_t N>
+constexpr uint64_t morton_encode(const std::array<index_t,N>& cell) {
+    uint64_t x[N] {};
+    for (size_t k = 0; k < N; ++k) x[k] = (uint64_t) cell[k];
+    return detail::interleave<N>(x);
+}
+
+
+/// The grid cell with Morton key `key`. Inverse of `morton_encode()`. May be evaluated at compile time.
+template <size_t N>
+constexpr std::array<index_t,N> morton_decode_array(uint64_t key) {
+    uint64_t x[N] {};
+    detail::deinterleave<N>(key, x);
+    std::array<index_t,N> cell {};
+    for (size_t k = 0; k < N; ++k) cell[k] = (index_t) x[k];
+    return cell;
+}
+
+
+/**
+ * @brief The index of the grid cell `cell` along an `N`-dimensional Hilbert curve
+ * passing through a grid of `2^curve_bits<N>` cells on a side.
+ *
+ * Only the low `curve_bits<N>` bits of each (non-negative) coordinate are used.
+ * This form may be evaluated at compile time.
+ */
+template <size_t N>
+constexpr uint64_t hilbert_encode(const std::array<index_t,N>& cell) {
+    uint64_t x[N] {};
+    for (size_t k = 0; k < N; ++k) {
+        x[k] = (uint64_t) cell[k] & ((uint64_t(1) << curve_bits<N>) - 1);
+    }
+    if constexpr (N > 1) detail::hilbert_axes_to_transpose<N>(x);
+    return detail::interleave<N>(x);
+}
+
+
+/// The grid cell at index `key` along the Hilbert curve. Inverse of `hilbert_encode()`. May be evaluated at compile time.
+template <size_t N>
+constexpr std::array<index_t,N> hilbert_decode_array(uint64_t key) {
+    uint64_t x[N] {};
+    detail::deinterleave<N>(key, x);
+    if constexpr (N > 1) detail::hilbert_transpose_to_axes<N>(x);
+    std::array<index_t,N> cell {};
+    for (size_t k = 0; k < N; ++k) cell[k] = (index_t) x[k];
+    return cell;
+}
+
+
+/// The Morton key of the grid cell `cell`. See `morton_encode(const std::array<index_t,N>&)`.
+template <index_t N>
+inline uint64_t morton_encode(const Vec<index_t,N>& cell) {
+    return morton_encode(detail::curve_array(cell));
+}
+
+
+/// The grid cell with Morton key `key`.
+template <index_t N>
+inline Vec<index_t,N> morton_decode(uint64_t key) {
+    return Vec<index_t,N>(morton_decode_array<N>(key).data());
+}
+
+
+/// The Hilbert index of the grid cell `cell`. See `hilbert_encode(const std::array<index_t,N>&)`.
+template <index_t N>
+inline uint64_t hilbert_encode(const Vec<index_t,N>& cell) {
+    return hilbert_encode(detail::curve_array(cell));
+}
+
+
+/// The grid cell at index `key` along the Hilbert curve.
+template <index_t N>
+inline Vec<index_t,N> hilbert_decode(uint64_t key) {
+    return Vec<index_t,N>(hilbert_decode_array<N>(key).data());
+}
+
+
+/**
+ * @brief The cell containing `p` in a grid of `2^curve_bits<N>` cells on a side
+ * spanning `frame`. Points outside `frame` are clamped to it.
+ */
+template <typename T, index_t N>
+Vec<index_t,N> curve_cell(const Vec<T,N>& p, const Rect<T,N>& frame) {
+    constexpr double qmax = (double)((uint64_t(1) << curve_bits<N>) - 1);
+    Vec<index_t,N> cell;
+    for (index_t k = 0; k < N; ++k) {
+        double extent = frame.hi[k] - frame.lo[k];
+        double s = extent > 0 ? (p[k] - frame.lo[k]) / extent : 0;
+        cell[k] = (index_t)(std::clamp(s, 0., 1.) * qmax);
+    }
+    return cell;
+}
+
+
+/// The Morton key of `p`, quantized within `frame`.
+template <typename T, index_t N>
+inline uint64_t morton_key(const Vec<T,N>& p, const Rect<T,N>& frame) {
+    return morton_encode(curve_cell(p, frame));
+}
+
+
+/// The Hilbert index of `p`, quantized within `frame`.
+template <typename T, index_t N>
+inline uint64_t hilbert_key(const Vec<T,N>& p, const Rect<T,N>& frame) {
+    return hilbert_encode(curve_cell(p, frame));
+}
+
+
+/// The key of `p` along `curve`, quantized within `frame`.
+template <typename T, index_t N>
+inline uint64_t curve_key(SpatialCurve curve, const Vec<T,N>& p, const Rect<T,N>& frame) {
+    return curve == SpatialCurve::CURVE_HILBERT ? hilbert_key(p, frame) : morton_key(p, frame);
+}
+
+
+/*****************************************
+ * Sorting                               *
+ *****************************************/
+
+namespace detail {
+
+template <typename Item, typename KeyFn>
+void radix_sort_impl(Item* items, index_t n, KeyFn& key, WorkPool* pool) {
+    typedef std::pair<uint64_t, index_t> keyed_t;
+    if (n < 2) return;
+    
+    // split the array into chunks; one per task
+    index_t n_chunks = 1;
+    if (pool) {
+        n_chunks = std::clamp<index_t>(n / 4096, 1, 4 * (pool->thread_count() + 1));
+    }
+    const index_t chunk = (n + n_chunks - 1) / n_chunks;
+    auto for_each_chunk = [&](auto&& fn) {
+        if (pool and n_chunks > 1) {
+            WorkGroup group;
+            for (index_t c = 0; c < n_chunks; ++c) {
+                pool->submit(group, [&fn, c, chunk, n]() {
+                    fn(c, c * chunk, std::min(n, (c + 1) * chunk));
+                });
+            }
+            pool->wait(group);
+        } else {
+            for (index_t c = 0; c < n_chunks; ++c) {
+                fn(c, c * chunk, std::min(n, (c + 1) * chunk));
+            }
+        }
+    };
+    
+    // compute each key once. note which bits vary at all.
+    std::vector<keyed_t>  a(n);
+    std::vector<keyed_t>  b(n);
+    std::vector<uint64_t> any_one(n_chunks, 0);
+    std::vector<uint64_t> all_one(n_chunks, ~uint64_t(0));
+    for_each_chunk([&](index_t c, index_t i0, index_t i1) {
+        for (index_t i = i0; i < i1; ++i) {
+            uint64_t k = key(items[i]);
+            a[i] = {k, i};
+            any_one[c] |= k;
+            all_one[c] &= k;
+        }
+    });
+    uint64_t varying = 0;
+    for (index_t c = 0; c < n_chunks; ++c) varying |= any_one[c] ^ all_one[c];
+    for (index_t c = 1; c < n_chunks; ++c) varying |= any_one[c] ^ any_one[0];
+    
+    // one stable counting sort per varying byte, least significant first
+    std::vector<index_t> counts(n_chunks * 256);
+    for (index_t shift = 0; shift < 64; shift += 8) {
+        if (((varying >> shift) & 0xFF) == 0) continue;
+        std::fill(counts.begin(), counts.end(), 0);
+        for_each_chunk([&](index_t c, index_t i0, index_t i1) {
+            index_t* h = counts.data() + c * 256;
+            for (index_t i = i0; i < i1; ++i) h[(a[i].first >> shift) & 0xFF] += 1;
+        });
+        // each chunk's run of each digit goes after the same digit in earlier chunks
+        index_t sum = 0;
+        for (index_t d = 0; d < 256; ++d) {
+            for (index_t c = 0; c < n_chunks; ++c) {
+                index_t k = counts[c * 256 + d];
+                counts[c * 256 + d] = sum;
+                sum += k;
+            }
+        }
+        for_each_chunk([&](index_t c, index_t i0, index_t i1) {
+            index_t* pos = counts.data() + c * 256;
+            for (index_t i = i0; i < i1; ++i) b[pos[(a[i].first >> shift) & 0xFF]++] = a[i];
+        });
+        std::swap(a, b);
+    }
+    
+    // permute the items
+    std::vector<Item> sorted;
+    sorted.reserve(n);
+    for (index_t i = 0; i < n; ++i) sorted.push_back(std::move(items[a[i].second]));
+    for_each_chunk([&](index_t, index_t i0, index_t i1) {
+        std::move(sorted.begin() + i0, sorted.begin() + i1, items + i0);
+    });
+}
+
+
+template <typename Item, typename PointFn>
+void spatial_sort_impl(Item* items, index_t n, PointFn& point_of, SpatialCurve curve, WorkPool* pool) {
+    typedef std::decay_t<decltype(point_of(*items))> point_t;
+    typedef typename CurvePoint<point_t>::elem_t     T;
+    constexpr index_t N = CurvePoint<point_t>::dim;
+    Rect<T,N> frame;
+    for (index_t i = 0; i < n; ++i) frame |= point_of(items[i]);
+    auto key = [&](const Item& item) { return curve_key(curve, point_of(item), frame); };
+    radix_sort_impl(items, n, key, pool);
+}
+
+} // namespace detail
+
+
+/**
+ * @brief Stably sort the `n` items of `items` by the unsigned 64-bit integer `key(item)`.
+ *
+ * This is a least-significant-digit radix sort over bytes, in `O(n)`. Each key is
+ * computed only once, and bytes which are the same in every key are skipped, so keys
+ * which use only their low bits sort in fewer passes. Uses `O(n)` scratch memory.
+ */
+template <typename Item, typename KeyFn>
+void radix_sort(Item* items, index_t n, KeyFn&& key) {
+    detail::radix_sort_impl(items, n, key, nullptr);
+}
+
+
+/**
+ * @brief Stably sort the `n` items of `items` by the unsigned 64-bit integer `key(item)`,
+ * dividing the work between the threads of `pool`.
+ *
+ * Keys are computed, digits counted, and items scattered in parallel over chunks of
+ * the array. `key()` must be safe to call concurrently.
+ */
+template <typename Item, typename KeyFn>
+void radix_sort(Item* items, index_t n, KeyFn&& key, WorkPool& pool) {
+    detail::radix_sort_impl(items, n, key, &pool);
+}
+
+
+/**
+ * @brief Sort the `n` items of `items` along a space-filling curve through the
+ * bounding box of their locations, given by `point_of(item)` as a `Vec<T,N>`.
+ *
+ * Afterwards, items which are near each other in the array tend to be near each
+ * other in space. The sorted array may be given to `RTree::bulk_load()` or
+ * `KDTree::bulk_load()` with `presorted` set, or to `HashGrid`, whose bins are then
+ * laid out in the same order.
+ */
+template <typename Item, typename PointFn>
+    requires std::invocable<PointFn&, const Item&>
+void spatial_sort(
+        Item*        items,
+        index_t      n,
+        PointFn&&    point_of,
+        SpatialCurve curve=SpatialCurve::CURVE_HILBERT)
+{
+    detail::spatial_sort_impl(items, n, point_of, curve, nullptr);
+}
+
+
+/**
+ * @brief Sort the `n` items of `items` along a space-filling curve, dividing the work
+ * between the threads of `pool`.
+ *
+ * See `spatial_sort(Item*, index_t, PointFn&&, SpatialCurve)`.
+ */
+template <typename Item, typename PointFn>
+    requires std::invocable<PointFn&, const Item&>
+void spatial_sort(
+        Item*        items,
+        index_t      n,
+        PointFn&&    point_of,
+        WorkPool&    pool,
+        SpatialCurve curve=SpatialCurve::CURVE_HILBERT)
+{
+    detail::spatial_sort_impl(items, n, point_of, curve, &pool);
+}
+
+
+/// Sort the `n` points of `pts` along a space-filling curve through their bounding box.
+template <typename T, index_t N>
+void spatial_sort(Vec<T,N>* pts, index_t n, SpatialCurve curve=SpatialCurve::CURVE_HILBERT) {
+    spatial_sort(pts, n, [](const Vec<T,N>& p) -> const Vec<T,N>& { return p; }, curve);
+}
+
+
+/// Sort the `n` points of `pts` along a space-filling curve, dividing the work between the threads of `pool`.
+template <typename T, index_t N>
+void spatial_sort(Vec<T,N>* pts, index_t n, WorkPool& pool, SpatialCurve curve=SpatialCurve::CURVE_HILBERT) {
+    spatial_sort(pts, n, [](const Vec<T,N>& p) -> const Vec<T,N>& { return p; }, pool, curve);
+}
+
+/// @} // addtogroup shape
+
+} // namespace geom
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include <geomc/linalg/Vec.h>
+#include <geomc/linalg/Orthogonal.h>
+#include <geomc/shape/Simplex.h>
+#include <geomc/shape/shapedetail/SimplexProject.h>
+
+// todo: the closest face is found by a linear scan. a heap keyed on face
+//       distance would be better for the large polytopes of very round shapes.
+
+namespace geom {
+
+template <typename T, index_t N> struct ConvexPenetration;
+
+namespace detail {
+
+// a vertex of the minkowski difference `A - B`, and the supports of A and B it came from.
+template <typename T, index_t N>
+struct PolytopeVertex {
+    Vec<T,N> p;
+    Vec<T,N> a;
+    Vec<T,N> b;
+};
+
+
+// pool of buffers for the expanding polytope algorithm (EPA), which finds the point
+// on the boundary of the minkowski difference `A - B` nearest to the origin, starting
+// from a simplex which encloses the origin. the polytope is grown toward the boundary
+// by adding the support point beyond its nearest face, until the face is (nearly) on
+// the boundary. buffers are kept between runs, so that steady-state use does not allocate.
+//
+// only two and three dimensions are implemented.
+template <typename T, index_t N>
+struct ExpandingPolytope {};
+
+
+// shared by the 2D and 3D polytopes.
+template <typename T, index_t N>
+struct PolytopeBase {
+    typedef PolytopeVertex<T,N> vertex_t;
+    
+    std::vector<vertex_t> verts;
+    
+    // add vertices to the simplex `s` (with `support` points of A and B) in the
+    // directions orthogonal to it, until it is full. returns false if the
+    // minkowski difference is flat, and there is no such direction.
+    template <typename SupportFn>
+    static bool complete_simplex(vertex_t* s, index_t* n, SupportFn& support) {
+        while (*n < N + 1) {
+            // directions orthogonal to the simplex
+            Vec<T,N> dirs[N];
+            index_t  n_dirs;
+            if (*n == 1) {
+                for (index_t k = 0; k < N; ++k) {
+                    dirs[k]    = {};
+                    dirs[k][k] = 1;
+                }
+                n_dirs = N;
+            } else {
+                Vec<T,N> edges[N];
+                for (index_t i = 1; i < *n; ++i) edges[i - 1] = s[i].p - s[0].p;
+                if (not nullspace(edges, *n - 1, dirs)) return false;
+                n_dirs = N - (*n - 1);
+            }
+            bool grew = false;
+            for (index_t i = 0; i < n_dirs and not grew; ++i) {
+                if (dirs[i].mag2() == 0) continue;
+                Vec<T,N> d = dirs[i].unit();
+                for (T sign : {(T) 1, (T) -1}) {
+                    vertex_t v = support(sign * d);
+                    T h = std::abs((v.p - s[0].p).dot(d));
+                    if (h > std::numeric_limits<T>::epsilon() * (1 + v.p.mag())) {
+                        s[(*n)++] = v;
+                        grew = true;
+                        break;
+                    }
+                }
+            }
+            if (not grew) return false;
+        }
+        return true;
+    }
+    
+    // fill in the contact from the nearest boundary point, `depth * normal`, which
+    // lies in the span of the `n` vertices `vs`.
+    static void make_contact(
+            const vertex_t* const* vs,
+            index_t n,
+            Vec<T,N> normal,
+            T depth,
+            ConvexPenetration<T,N>* out)
+    {
+        Vec<T,N> pts[N];
+        T        w[N];
+        for (index_t i = 0; i < n; ++i) pts[i] = vs[i]->p;
+        barycentric_coords(pts, n, normal * depth, w);
+        out->point_a = out->point_b = {};
+        for (index_t i = 0; i < n; ++i) {
+            out->point_a += w[i] * vs[i]->a;
+            out->point_b += w[i] * vs[i]->b;
+        }
+        out->normal = normal;
+        out->depth  = depth;
+    }
+};
+
+
+template <typename T>
+struct ExpandingPolytope<T,2> : public PolytopeBase<T,2> {
+    typedef PolytopeVertex<T,2> vertex_t;
+    using PolytopeBase<T,2>::verts;
+    
+    // `verts` is a counterclockwise polygon
+    template <typename SupportFn>
+    bool expand(
+            vertex_t* s,
+            index_t n,
+            SupportFn support,
+            index_t max_iterations,
+            T tolerance,
+            ConvexPenetration<T,2>* out)
+    {
+        out->overlapping = true;
+        if (not this->complete_simplex(s, &n, support)) {
+            // the shapes are flat, and merely touch
+            out->depth   = 0;
+            out->point_a = out->point_b = s[0].a;
+            return false;
+        }
+        verts.assign(s, s + 3);
+        Vec<T,2> e0 = verts[1].p - verts[0].p;
+        Vec<T,2> e1 = verts[2].p - verts[0].p;
+        if (e0.x * e1.y - e0.y * e1.x < 0) std::swap(verts[1], verts[2]);
+        
+        index_t  best = 0;
+        T        best_d;
+        Vec<T,2> best_n;
+        for (index_t iter = 0; ; ++iter) {
+            // find the edge nearest the origin
+            best_d = std::numeric_limits<T>::max();
+            for (index_t i = 0; i < (index_t) verts.size(); ++i) {
+                Vec<T,2> e = verts[(i + 1) % verts.size()].p - verts[i].p;
+                T m = e.mag();
+                if (m == 0) continue;
+                Vec<T,2> nrm = e.right_perpendicular() / m;
+                T d = nrm.dot(verts[i].p);
+                if (d < best_d) {
+                    best   = i;
+                    best_d = d;
+                    best_n = nrm;
+                }
+            }
+            if (iter >= max_iterations) break;
+            vertex_t v = support(best_n);
+            T        h = best_n.dot(v.p);
+            // the edge is on the boundary
+            if (h - best_d <= tolerance * std::max<T>(std::abs(h), 1)) break;
+            verts.insert(verts.begin() + best + 1, v);
+        }
+        const vertex_t* edge[2] = {&verts[best], &verts[(best + 1) % verts.size()]};
+        this->make_contact(edge, 2, best_n, std::max<T>(best_d, 0), out);
+        return true;
+    }
+};
+
+
+template <typename T>
+struct ExpandingPolytope<T,3> : public PolytopeBase<T,3> {
+    typedef PolytopeVertex<T,3> vertex_t;
+    using PolytopeBase<T,3>::verts;
+    
+    struct Face {
+        index_t  v[3];
+        Vec<T,3> normal;
+        T        dist;
+    };
+    
+    std::vector<Face> faces;
+    // the boundary of the faces removed by a new vertex, as directed edges
+    std::vector<std::pair<index_t, index_t>> horizon;
+    
+    // add the face `(i, j, k)`, wound counterclockwise when seen from outside.
+    // returns false if the face is degenerate.
+    bool add_face(index_t i, index_t j, index_t k) {
+        Vec<T,3> nrm = (verts[j].p - verts[i].p) ^ (verts[k].p - verts[i].p);
+        T m = nrm.mag();
+        if (m == 0) return false;
+        nrm /= m;
+        faces.push_back({{i, j, k}, nrm, nrm.dot(verts[i].p)});
+        return true;
+    }
+    
+    void add_horizon_edge(index_t i, index_t j) {
+        // an edge shared by two removed faces is interior to the hole
+        for (auto e = horizon.begin(); e != horizon.end(); ++e) {
+            if (e->first == j and e->second == i) {
+                *e = horizon.back();
+                horizon.pop_back();
+                return;
+            }
+        }
+        horizon.push_back({i, j});
+    }
+    
+    template <typename SupportFn>
+    bool expand(
+            vertex_t* s,
+            index_t n,
+            SupportFn support,
+            index_t max_iterations,
+            T tolerance,
+            ConvexPenetration<T,3>* out)
+    {
+        out->overlapping = true;
+        if (not this->complete_simplex(s, &n, support)) {
+            out->depth   = 0;
+            out->point_a = out->point_b = s[0].a;
+            return false;
+        }
+        verts.assign(s, s + 4);
+        faces.clear();
+        // orient the tetrahedron so that its faces wind outward
+        Vec<T,3> e1 = verts[1].p - verts[0].p;
+        Vec<T,3> e2 = verts[2].p - verts[0].p;
+        Vec<T,3> e3 = verts[3].p - verts[0].p;
+        if ((e1 ^ e2).dot(e3) > 0) std::swap(verts[1], verts[2]);
+        bool ok = add_face(0, 1, 2) and add_face(0, 3, 1) and add_face(0, 2, 3) and add_face(1, 3, 2);
+        if (not ok) {
+            out->depth   = 0;
+            out->point_a = out->point_b = s[0].a;
+            return false;
+        }
+        
+        index_t best = 0;
+        for (index_t iter = 0; ; ++iter) {
+            // find the face nearest the origin
+            best = 0;
+            for (index_t f = 1; f < (index_t) faces.size(); ++f) {
+                if (faces[f].dist < faces[best].dist) best = f;
+            }
+            if (iter >= max_iterations) break;
+            const Face& nearest = faces[best];
+            vertex_t v = support(nearest.normal);
+            T        h = nearest.normal.dot(v.p);
+            // the face is on the boundary
+            if (h - nearest.dist <= tolerance * std::max<T>(std::abs(h), 1)) break;
+            
+            // remove the faces which can see the new vertex, and
+            // patch the hole with a fan of faces around it
+            index_t vi = verts.size();
+            verts.push_back(v);
+            horizon.clear();
+            for (index_t f = 0; f < (index_t) faces.size(); ) {
+                const Face& face = faces[f];
+                if (face.normal.dot(v.p - verts[face.v[0]].p) > 0) {
+                    add_horizon_edge(face.v[0], face.v[1]);
+                    add_horizon_edge(face.v[1], face.v[2]);
+                    add_horizon_edge(face.v[2], face.v[0]);
+                    faces[f] = faces.back();
+                    faces.pop_back();
+                } else {
+                    ++f;
+                }
+            }
+            for (const auto& [i, j] : horizon) add_face(i, j, vi);
+            // numerical failure
+            if (faces.empty()) break;
+        }
+        if (faces.empty()) {
+            out->depth   = 0;
+            out->point_a = out->point_b = s[0].a;
+            return false;
+        }
+        const Face& f = faces[best];
+        const vertex_t* tri[3] = {&verts[f.v[0]], &verts[f.v[1]], &verts[f.v[2]]};
+        this->make_contact(tri, 3, f.normal, std::max<T>(f.dist, 0), out);
+        return true;
+    }
+};
+
+} // namespace detail
+} // namespace geom
@@ -1,6 +1,10 @@
+#pragma once
+
+#include <algorithm>
 #include <utility>
 
 #include <geomc/shape/Rect.h>
+#include <geomc/shape/Intersect.h>
 
 namespace geom {
 
@@ -11,8 +15,8 @@ namespace detail {
  *****************************************/
 
 
-// basic shape
-// (works on rects)
+// bounded shapes
+// (works on rects, and anything else with a bounds())
 template <typename T, index_t N, typename D>
 struct ShapeIndexHelper {
     
@@ -21,17 +25,36 @@ struct ShapeIndexHelper {
     typedef Rect<T,N> bound_t;
     
     static inline Vec<T,N> getPoint(const D& obj) {
-        return obj.center();
+        return obj.bounds().center();
     }
     
     static inline T dist2(const D& obj, const Vec<T,N>& p) {
-        return obj.dist2(p);
+        // prefer the shape's exact distance, if it has one
+        if constexpr (requires { { obj.dist2(p) } -> std::convertible_to<T>; }) {
+            return obj.dist2(p);
+        } else {
+            return obj.bounds().dist2(p);
+        }
     }
     
     static inline bound_t bounds(const D& obj) {
         return obj.bounds();
     }
     
+    static inline Rect<T,1> intersect(const D& obj, const Ray<T,N>& r) {
+        return obj.intersect(r);
+    }
+    
+    // does `obj` overlap the convex `region`? non-convex objects are tested by their bounds.
+    template <typename Region>
+    static inline bool overlaps(const D& obj, const Region& region, Intersector<T,N>* gjk) {
+        if constexpr (ConvexObject<D>) {
+            return gjk->intersects(obj, region);
+        } else {
+            return gjk->intersects(obj.bounds(), region);
+        }
+    }
+    
 };
 
 
@@ -46,13 +69,22 @@ struct ShapeIndexHelper< T, N, D* > {
     }
     
     static inline T dist2(const D* obj, const Vec<T,N>& p) {
-        return ShapeIndexHelper<T,N,D>::getDist2(*obj, p);
+        return ShapeIndexHelper<T,N,D>::dist2(*obj, p);
     }
     
     static inline bound_t bounds(const D* obj) {
         return ShapeIndexHelper<T,N,D>::bounds(*obj);
     }
     
+    static inline Rect<T,1> intersect(const D* obj, const Ray<T,N>& r) {
+        return ShapeIndexHelper<T,N,D>::intersect(*obj, r);
+    }
+    
+    template <typename Region>
+    static inline bool overlaps(const D* obj, const Region& region, Intersector<T,N>* gjk) {
+        return ShapeIndexHelper<T,N,D>::overlaps(*obj, region, gjk);
+    }
+    
 };
 
 
@@ -68,13 +100,22 @@ struct ShapeIndexHelper< T, N, std::pair<K, V> > {
     }
     
     static inline T dist2(const std::pair<K,V>& obj, const Vec<T,N>& p) {
-        return ShapeIndexHelper<T,N,K>::getDist2(obj.first);
+        return ShapeIndexHelper<T,N,K>::dist2(obj.first, p);
     }
     
     static inline bound_t bounds(const std::pair<K,V>& obj) {
         return ShapeIndexHelper<T,N,K>::bounds(obj.first);
     }
     
+    static inline Rect<T,1> intersect(const std::pair<K,V>& obj, const Ray<T,N>& r) {
+        return ShapeIndexHelper<T,N,K>::intersect(obj.first, r);
+    }
+    
+    template <typename Region>
+    static inline bool overlaps(const std::pair<K,V>& obj, const Region& region, Intersector<T,N>* gjk) {
+        return ShapeIndexHelper<T,N,K>::overlaps(obj.first, region, gjk);
+    }
+    
 };
 
 
@@ -96,25 +137,9 @@ struct ShapeIndexHelper< T, N, Vec<T,N> > {
         return v;
     }
     
-};
-
-
-// bounded shapes
-template <typename T, index_t N>
-struct ShapeIndexHelper< T, N, Bounded<T,N> > {
-    
-    typedef Rect<T,N> bound_t;
-    
-    inline Vec<T,N> getPoint(const Bounded<T,N>& r) {
-        return r.bounds().center();
-    }
-    
-    static inline T dist2(const Bounded<T,N>& r, const Vec<T,N>& p) {
-        return r.bounds().clip(p).dist2(p);
-    }
-    
-    static inline bound_t bounds(const Bounded<T,N>& r) {
-        return r.bounds();
+    template <typename Region>
+    static inline bool overlaps(const Vec<T,N>& v, const Region& region, Intersector<T,N>*) {
+        return region.contains(v);
     }
     
 };
@@ -149,6 +174,19 @@ T worst_case_nearest2(const Vec<T,N>& p, const Rect<T,N>& r) {
     }
     return result;
 }
+
+
+// returns the squared distance from `p` to the farthest point of `r`.
+// everything inside `r` is at least this close to `p`.
+template <typename T, index_t N>
+T farthest2(const Vec<T,N>& p, const Rect<T,N>& r) {
+    T result = 0;
+    for (index_t axis = 0; axis < N; axis++) {
+        T d = std::max(std::abs(p[axis] - r.lo[axis]), std::abs(p[axis] - r.hi[axis]));
+        result += d * d;
+    }
+    return result;
+}
     
 } // namespace detail
 
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
 #include <geomc/linalg/Vec.h>
 #include <geomc/shape/ShapeTypes.h>
 
@@ -378,5 +382,52 @@ public:
 
 };
 
+
+/**
+ * @brief Find the barycentric coordinates of `p` with respect to the `n` points `pts`.
+ *
+ * `p` is assumed to lie in the affine span of `pts`. The coordinates are written
+ * to `out`, and sum to one. Degenerate directions in the span are given zero weight.
+ */
+template <typename T, index_t N>
+void barycentric_coords(const Vec<T,N>* pts, index_t n, Vec<T,N> p, T* out) {
+    // solve the normal equations for the weights of the
+    // edges from the final vertex, by gaussian elimination.
+    const index_t m = n - 1;
+    const Vec<T,N>& root = pts[m];
+    const Vec<T,N>  to_p = p - root;
+    Vec<T,N> e[N];
+    T g[N][N + 1];
+    for (index_t i = 0; i < m; ++i) e[i] = pts[i] - root;
+    for (index_t i = 0; i < m; ++i) {
+        for (index_t j = 0; j < m; ++j) g[i][j] = e[i].dot(e[j]);
+        g[i][m] = e[i].dot(to_p);
+    }
+    index_t col_of[N];
+    index_t rank = 0;
+    for (index_t c = 0; c < m; ++c) {
+        index_t best = rank;
+        for (index_t r = rank + 1; r < m; ++r) {
+            if (std::abs(g[r][c]) > std::abs(g[best][c])) best = r;
+        }
+        if (rank >= m or g[best][c] == 0) continue;
+        std::swap(g[best], g[rank]);
+        for (index_t r = 0; r < m; ++r) {
+            if (r == rank or g[r][c] == 0) continue;
+            T f = g[r][c] / g[rank][c];
+            for (index_t k = c; k <= m; ++k) g[r][k] -= f * g[rank][k];
+        }
+        col_of[rank++] = c;
+    }
+    T sum = 0;
+    std::fill(out, out + m, T(0));
+    for (index_t r = 0; r < rank; ++r) {
+        index_t c = col_of[r];
+        out[c] = g[r][m] / g[r][c];
+        sum += out[c];
+    }
+    out[m] = 1 - sum;
+}
+
 } // namespace detail
 } // namespace geom
@@ -0,0 +1,583 @@
+#define TEST_MODULE_NAME ArrayTree
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <random>
+#include <vector>
+#include <gtest/gtest.h>
+#include <geomc/ArrayTree.h>
+
+
+using namespace geom;
+using namespace std;
+
+#define RANDOM_SEED 493866457312
+
+typedef ArrayTree<int, int>       tree_t;
+typedef tree_t::subtree_t         subtree_t;
+typedef tree_t::const_subtree_t   const_subtree_t;
+
+
+/****************************************
+ * Reference model                      *
+ ****************************************/
+
+// a plain pointer tree, to check ArrayTree against.
+struct Model {
+    static inline int serial = 0;
+
+    int uid  = serial++; // unique, even among copies
+    int data = 0;
+    vector<int> items;
+    vector<unique_ptr<Model>> kids;
+    Model* parent = nullptr;
+
+    unique_ptr<Model> copy() const {
+        auto m = make_unique<Model>();
+        m->data  = data;
+        m->items = items;
+        for (const auto& k : kids) {
+            m->kids.push_back(k->copy());
+            m->kids.back()->parent = m.get();
+        }
+        return m;
+    }
+
+    void all_items(vector<int>* out) const {
+        if (kids.empty()) {
+            out->insert(out->end(), items.begin(), items.end());
+        } else {
+            for (const auto& k : kids) k->all_items(out);
+        }
+    }
+
+    size_t item_count() const {
+        vector<int> v;
+        all_items(&v);
+        return v.size();
+    }
+
+    // children are visited before grandchildren ("sibling-contiguous" order)
+    void traverse(vector<Model*>* out) {
+        for (auto& k : kids) out->push_back(k.get());
+        for (auto& k : kids) k->traverse(out);
+    }
+
+    vector<Model*> order() {
+        vector<Model*> out {this};
+        traverse(&out);
+        return out;
+    }
+
+    size_t index_of_child(const Model* c) const {
+        for (size_t i = 0; i < kids.size(); ++i) {
+            if (kids[i].get() == c) return i;
+        }
+        return kids.size();
+    }
+};
+
+
+vector<subtree_t> handles(tree_t& t) {
+    vector<subtree_t> out;
+    for (subtree_t s = t.begin(); s != t.end(); ++s) out.push_back(s);
+    return out;
+}
+
+
+// exhaustively check that `t` has exactly the structure of `m`.
+void check_tree(tree_t& t, Model& m) {
+    vector<Model*>    mo = m.order();
+    vector<subtree_t> to = handles(t);
+    ASSERT_EQ(mo.size(), to.size());
+    ASSERT_EQ(t.size(),  mo.size());
+    ASSERT_EQ(t.item_count(), m.item_count());
+
+    for (size_t i = 0; i < mo.size(); ++i) {
+        Model*    x = mo[i];
+        subtree_t s = to[i];
+        ASSERT_EQ(*s, x->data);
+        ASSERT_EQ(s.node_count(), (index_t) x->kids.size());
+        ASSERT_EQ(s.is_root(), x == &m);
+
+        // children and their parent links
+        size_t k = 0;
+        for (subtree_t c = s.begin(); c != s.end(); ++c, ++k) {
+            ASSERT_LT(k, x->kids.size());
+            ASSERT_EQ(*c, x->kids[k]->data);
+            ASSERT_TRUE(c.parent() == s);
+        }
+        ASSERT_EQ(k, x->kids.size());
+
+        // items of the whole subtree
+        vector<int> expect;
+        x->all_items(&expect);
+        vector<int> got(s.items_begin(), s.items_end());
+        ASSERT_EQ(got, expect);
+        ASSERT_EQ(s.item_count(), (index_t) expect.size());
+
+        // every node of the subtree, and nothing else
+        vector<Model*> below;
+        x->traverse(&below);
+        size_t n = 0;
+        for (subtree_t d = s.subtree_begin(); d != s.subtree_end(); ++d, ++n) {
+            ASSERT_LT(n, below.size());
+            ASSERT_EQ(*d, below[n]->data);
+        }
+        ASSERT_EQ(n, below.size());
+
+        // leaves own their items
+        if (x->kids.empty()) {
+            for (auto j = s.items_begin(); j != s.items_end(); ++j) {
+                ASSERT_TRUE(t.root().find_parent(j) == s);
+            }
+        }
+    }
+}
+
+
+/****************************************
+ * Helpers                              *
+ ****************************************/
+
+
+inline index_t compare(int a, int b) {
+    return a - b;
+}
+
+
+void fill_tree(const subtree_t& t) {
+    *t = -1;
+    // three kids for root
+    auto c1  = t.insert_child_node(1);
+    auto c2  = t.insert_child_node(2);
+    t.insert_child_node(3);
+    // one grandchild
+    auto gc1 = c2.insert_child_node(4);
+    // items. items for you.
+    c1.insert_item(1);
+    c1.insert_item(2);
+    c1.insert_item(3);
+    gc1.insert_item(4);
+    gc1.insert_item(5);
+    gc1.insert_item(6);
+}
+
+
+// build a binary tree by splitting leaves at their median until they hold few items.
+void split_subtree(subtree_t s, index_t max_items) {
+    if (s.item_count() <= max_items) return;
+    vector<int> v(s.items_begin(), s.items_end());
+    std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    int pivot = v[v.size() / 2];
+    // the new child takes all the items; split it in two.
+    subtree_t hi = s.insert_child_node(0);
+    subtree_t lo = hi.split(compare, pivot, 0);
+    if (lo == hi.end() or lo.item_count() == 0) return;
+    split_subtree(lo, max_items);
+    split_subtree(hi, max_items);
+}
+
+
+/****************************************
+ * Tests                                *
+ ****************************************/
+
+
+TEST(TEST_MODULE_NAME, construct_small_tree) {
+    tree_t t;
+    fill_tree(t.root());
+
+    EXPECT_EQ(t.size(),       5u);
+    EXPECT_EQ(t.item_count(), 6u);
+
+    // sibling-contiguous order
+    vector<int> order;
+    for (auto s = t.begin(); s != t.end(); ++s) order.push_back(*s);
+    EXPECT_EQ(order, vector<int>({-1, 1, 2, 3, 4}));
+
+    vector<int> items(t.root().items_begin(), t.root().items_end());
+    EXPECT_EQ(items, vector<int>({1, 2, 3, 4, 5, 6}));
+
+    auto c2 = std::next(t.root().begin());
+    EXPECT_EQ(*c2, 2);
+    EXPECT_EQ(c2.item_count(), 3);
+    EXPECT_EQ(*c2.begin(), 4);
+    EXPECT_TRUE(c2.begin().parent() == c2);
+    EXPECT_TRUE(t.root().parent() == t.end());
+
+    // items can go before existing ones
+    auto c1 = t.root().begin();
+    c1.insert_item(c1.items_begin(), 0);
+    items.assign(t.root().items_begin(), t.root().items_end());
+    EXPECT_EQ(items, vector<int>({0, 1, 2, 3, 4, 5, 6}));
+
+    // a foreign item is refused
+    auto gc1 = c2.begin();
+    auto end = gc1.insert_item(c1.items_begin(), 99);
+    EXPECT_TRUE(end == gc1.items_end());
+    EXPECT_EQ(t.item_count(), 7u);
+}
+
+
+TEST(TEST_MODULE_NAME, split_flat_tree) {
+    std::mt19937_64 rng(RANDOM_SEED);
+    vector<int> v(1000);
+    for (int& x : v) x = rng() % 100000;
+
+    tree_t t(v.begin(), v.end());
+    EXPECT_EQ(t.item_count(), v.size());
+    split_subtree(t.root(), 8);
+
+    // every leaf is small, and the leaves are in order.
+    int prev_max = std::numeric_limits<int>::min();
+    size_t n = 0;
+    for (auto s = t.root().subtree_begin(); s != t.root().subtree_end(); ++s) {
+        if (s.node_count() > 0) continue;
+        EXPECT_LE(s.item_count(), 8);
+        n += s.item_count();
+    }
+    EXPECT_EQ(n, v.size());
+    std::function<void(subtree_t)> check_order = [&](subtree_t s) {
+        if (s.node_count() > 0) {
+            for (auto c = s.begin(); c != s.end(); ++c) check_order(c);
+            return;
+        }
+        auto [lo, hi] = std::minmax_element(s.items_begin(), s.items_end());
+        EXPECT_LE(prev_max, *lo);
+        prev_max = *hi;
+    };
+    check_order(t.root());
+
+    vector<int> got(t.root().items_begin(), t.root().items_end());
+    std::sort(got.begin(), got.end());
+    std::sort(v.begin(),   v.end());
+    EXPECT_EQ(got, v);
+}
+
+
+TEST(TEST_MODULE_NAME, search_tree) {
+    std::mt19937_64 rng(RANDOM_SEED + 1);
+    vector<int> v(2000);
+    for (size_t i = 0; i < v.size(); ++i) v[i] = 2 * i;
+    std::shuffle(v.begin(), v.end(), rng);
+
+    tree_t t(v.begin(), v.end());
+    split_subtree(t.root(), 4);
+    t.compact();
+    for (auto s = t.begin(); s != t.end(); ++s) {
+        *s = *std::min_element(s.items_begin(), s.items_end());
+    }
+
+    // each node knows the smallest item beneath it. a subtree can hold `key`
+    // only if the key lies between its own bound and that of its next sibling.
+    auto bound = [](const subtree_t& s, int key) {
+        if (key < *s) return false;
+        if (s.is_root()) return true;
+        subtree_t next = std::next(s);
+        return next == s.parent().end() or key < *next;
+    };
+    auto test = [&](const subtree_t& s, int key) {
+        return s.node_count() == 0 and bound(s, key);
+    };
+
+    for (int k = 0; k < 200; ++k) {
+        int key = rng() % (2 * v.size());
+        size_t found = 0;
+        auto q = t.root().query(key, bound, test);
+        for (; q != t.root().end(); ++q) {
+            subtree_t leaf = *q;
+            bool has = std::find(leaf.items_begin(), leaf.items_end(), key) != leaf.items_end();
+            EXPECT_EQ(has, key % 2 == 0);
+            ++found;
+        }
+        EXPECT_EQ(found, 1u);
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, copy_and_compare) {
+    tree_t a;
+    fill_tree(a.root());
+    tree_t b = a;
+    EXPECT_TRUE(a == b);
+
+    // same content built in a different order compares equal
+    tree_t c;
+    *c.root() = -1;
+    auto c1  = c.root().insert_child_node(1);
+    c1.insert_item(3);
+    c1.insert_item(c1.items_begin(), 1);
+    c1.insert_item(std::next(c1.items_begin()), 2);
+    auto c2  = c.root().insert_child_node(2);
+    c.root().insert_child_node(3);
+    auto gc1 = c2.insert_child_node(4);
+    int gi[] = {4, 5, 6};
+    gc1.insert_items(gi, gi + 3);
+    EXPECT_TRUE(a == c);
+    c.compact();
+    EXPECT_TRUE(a == c);
+
+    *std::next(b.root().begin(), 2) = 33;
+    EXPECT_TRUE(a != b);
+
+    // a tree made from a subtree
+    tree_t d(std::next(a.root().begin()));
+    EXPECT_EQ(d.size(), 2u);
+    EXPECT_EQ(*d.root(), 2);
+    vector<int> items(d.root().items_begin(), d.root().items_end());
+    EXPECT_EQ(items, vector<int>({4, 5, 6}));
+}
+
+
+TEST(TEST_MODULE_NAME, adopt_self) {
+    tree_t t;
+    fill_tree(t.root());
+    Model m;
+    m.data = -1;
+    for (int i = 1; i <= 3; ++i) {
+        m.kids.push_back(make_unique<Model>());
+        m.kids.back()->data   = i;
+        m.kids.back()->parent = &m;
+    }
+    m.kids[0]->items = {1, 2, 3};
+    m.kids[1]->kids.push_back(make_unique<Model>());
+    m.kids[1]->kids[0]->data   = 4;
+    m.kids[1]->kids[0]->parent = m.kids[1].get();
+    m.kids[1]->kids[0]->items  = {4, 5, 6};
+    check_tree(t, m);
+
+    // re-adopt the whole tree beneath one of its own leaves
+    auto gc1 = t.root().begin(); ++gc1; gc1 = gc1.begin();
+    auto r = gc1.adopt(t.root(), gc1.end());
+    EXPECT_EQ(*r, -1);
+
+    Model* mgc1 = m.kids[1]->kids[0].get();
+    auto   copy = m.copy();
+    // the adopted node inherits the items of its formerly childless parent,
+    // which pass down to its leftmost leaf.
+    Model* leftmost = copy.get();
+    while (not leftmost->kids.empty()) leftmost = leftmost->kids[0].get();
+    leftmost->items.insert(leftmost->items.begin(), mgc1->items.begin(), mgc1->items.end());
+    mgc1->items.clear();
+    copy->parent = mgc1;
+    mgc1->kids.push_back(std::move(copy));
+    check_tree(t, m);
+}
+
+
+TEST(TEST_MODULE_NAME, random_edits) {
+    std::mt19937_64 rng(RANDOM_SEED + 2);
+    auto rand = [&](size_t n) { return (size_t) (rng() % n); };
+
+    tree_t t;
+    Model  m;
+    int    next_id = 0;
+
+    // some handles to keep an eye on, paired with the ids they should see.
+    vector<pair<subtree_t, Model*>> watched;
+
+    for (int step = 0; step < 1500; ++step) {
+        vector<Model*>    mo = m.order();
+        vector<subtree_t> to = handles(t);
+        size_t i = rand(mo.size());
+        Model*    x = mo[i];
+        subtree_t s = to[i];
+
+        switch (rand(10)) {
+            case 0:
+            case 1: {
+                // insert child node(s)
+                size_t at = rand(x->kids.size() + 1);
+                subtree_t before = s.begin();
+                if (x->kids.empty()) before = s.end();
+                else for (size_t j = 0; j < at; ++j) ++before;
+                size_t k = 1 + rand(3);
+                vector<int> ids;
+                for (size_t j = 0; j < k; ++j) ids.push_back(next_id++);
+                subtree_t c = s.insert_child_nodes(before, ids.begin(), ids.end());
+                ASSERT_EQ(*c, ids[0]);
+                vector<unique_ptr<Model>> nk;
+                for (int id : ids) {
+                    nk.push_back(make_unique<Model>());
+                    nk.back()->data   = id;
+                    nk.back()->parent = x;
+                }
+                if (x->kids.empty()) std::swap(nk[0]->items, x->items);
+                x->kids.insert(x->kids.begin() + at,
+                               std::make_move_iterator(nk.begin()),
+                               std::make_move_iterator(nk.end()));
+                if (rand(4) == 0) watched.emplace_back(c, x->kids[at].get());
+                break;
+            }
+            case 2:
+            case 3:
+            case 4: {
+                // insert item(s) into a leaf
+                if (not x->kids.empty()) break;
+                size_t at = rand(x->items.size() + 1);
+                auto   b  = std::next(s.items_begin(), x->items.empty() ? 0 : at);
+                size_t k  = 1 + rand(4);
+                vector<int> v(k);
+                for (int& y : v) y = (int) rand(1000);
+                if (k == 1) {
+                    auto r = s.insert_item(b, v[0]);
+                    ASSERT_EQ(*r, v[0]);
+                } else {
+                    index_t placed = 0;
+                    auto r = s.insert_items(b, v.begin(), v.end(), &placed);
+                    ASSERT_EQ(placed, (index_t) k);
+                    ASSERT_EQ(*r, v[0]);
+                }
+                x->items.insert(x->items.begin() + at, v.begin(), v.end());
+                break;
+            }
+            case 5: {
+                // erase an item
+                if (not x->kids.empty() or x->items.empty()) break;
+                size_t at = rand(x->items.size());
+                bool ok = false;
+                s.erase(std::next(s.items_begin(), at), &ok);
+                ASSERT_TRUE(ok);
+                x->items.erase(x->items.begin() + at);
+                break;
+            }
+            case 6: {
+                // split a leaf
+                if (x == &m or not x->kids.empty() or x->items.size() < 2) break;
+                int pivot = x->items[rand(x->items.size())];
+                int id    = next_id++;
+                subtree_t lo = s.split(compare, pivot, id);
+                ASSERT_EQ(*lo, id);
+                vector<int> lo_items(lo.items_begin(), lo.items_end());
+                vector<int> hi_items(s.items_begin(),  s.items_end());
+                for (int y : lo_items) ASSERT_LT(y, pivot);
+                for (int y : hi_items) ASSERT_GE(y, pivot);
+                vector<int> all = lo_items;
+                all.insert(all.end(), hi_items.begin(), hi_items.end());
+                vector<int> expect = x->items;
+                std::sort(all.begin(), all.end());
+                std::sort(expect.begin(), expect.end());
+                ASSERT_EQ(all, expect);
+                // the order within the split nodes is unspecified; adopt the tree's.
+                auto n = make_unique<Model>();
+                n->data   = id;
+                n->parent = x->parent;
+                n->items  = lo_items;
+                x->items  = hi_items;
+                Model* p  = x->parent;
+                p->kids.insert(p->kids.begin() + p->index_of_child(x), std::move(n));
+                break;
+            }
+            case 7: {
+                // erase a child subtree
+                if (x->kids.empty()) break;
+                size_t at = rand(x->kids.size());
+                subtree_t c = std::next(s.begin(), at);
+                bool ok = false;
+                subtree_t r = s.erase(c, &ok);
+                ASSERT_TRUE(ok);
+                if (at + 1 < x->kids.size()) {
+                    ASSERT_EQ(*r, x->kids[at + 1]->data);
+                }
+                x->kids.erase(x->kids.begin() + at);
+                break;
+            }
+            case 8: {
+                // flatten or clear
+                if (rand(2)) {
+                    s.flatten();
+                    vector<int> v;
+                    x->all_items(&v);
+                    x->kids.clear();
+                    x->items = v;
+                } else {
+                    s.clear();
+                    x->kids.clear();
+                    x->items.clear();
+                }
+                break;
+            }
+            case 9: {
+                // adopt a copy of some other subtree (possibly an ancestor)
+                size_t    j   = rand(mo.size());
+                subtree_t src = to[j];
+                size_t    at  = rand(x->kids.size() + 1);
+                subtree_t before = x->kids.empty() ? s.end() : std::next(s.begin(), at);
+                subtree_t r = s.adopt(src, before);
+                ASSERT_EQ(*r, mo[j]->data);
+                auto copy = mo[j]->copy();
+                if (x->kids.empty()) {
+                    Model* leftmost = copy.get();
+                    while (not leftmost->kids.empty()) leftmost = leftmost->kids[0].get();
+                    leftmost->items.insert(leftmost->items.begin(), x->items.begin(), x->items.end());
+                    x->items.clear();
+                    at = 0;
+                }
+                copy->parent = x;
+                x->kids.insert(x->kids.begin() + at, std::move(copy));
+                break;
+            }
+        }
+
+        if (step % 25 == 0) t.compact();
+
+        // watched handles still see their nodes, unless those were deleted.
+        // (model nodes are compared by uid, since freed addresses may be reused).
+        vector<Model*> live = m.order();
+        std::erase_if(watched, [&](const pair<subtree_t, Model*>& w) {
+            return std::none_of(live.begin(), live.end(),
+                [&](Model* y) { return y == w.second and y->uid == w.second->uid; });
+        });
+        for (auto& w : watched) ASSERT_EQ(*w.first, w.second->data);
+
+        if (step % 10 == 0) {
+            check_tree(t, m);
+            if (HasFatalFailure()) return;
+        }
+    }
+    check_tree(t, m);
+
+    // copies of an edited tree are identical
+    tree_t u = t;
+    EXPECT_TRUE(u == t);
+    check_tree(u, m);
+    tree_t w(t.root());
+    EXPECT_TRUE(w == t);
+}
+
+
+TEST(TEST_MODULE_NAME, large_build) {
+    // building in order is linear; this would take minutes if every
+    // insertion shifted the whole tree.
+    std::mt19937_64 rng(RANDOM_SEED + 3);
+    tree_t t;
+    size_t n_leaves = 0;
+    std::function<void(subtree_t, int)> build = [&](subtree_t s, int depth) {
+        if (depth == 0) {
+            for (int i = 0; i < 4; ++i) s.insert_item((int) (rng() % 1000));
+            ++n_leaves;
+            return;
+        }
+        int kids[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+        subtree_t c = s.insert_child_nodes(kids, kids + 8);
+        for (int i = 0; i < 8; ++i, ++c) build(c, depth - 1);
+    };
+    build(t.root(), 6);
+    EXPECT_EQ(n_leaves, 262144);
+    EXPECT_EQ(t.item_count(), 4 * n_leaves);
+    EXPECT_EQ(t.size(), (size_t) (1 + 8 + 64 + 512 + 4096 + 32768 + 262144));
+
+    // scattered edits near each other stay cheap
+    subtree_t leaf = t.root();
+    while (leaf.node_count() > 0) leaf = std::next(leaf.begin(), 3);
+    for (int i = 0; i < 10000; ++i) {
+        leaf.insert_item(leaf.items_begin(), i);
+        leaf.parent().begin().insert_item(-i);
+    }
+    EXPECT_EQ(t.item_count(), 4 * n_leaves + 20000);
+    EXPECT_EQ(leaf.item_count(), 10004);
+    EXPECT_TRUE(t.root().find_parent(leaf.items_begin()) == leaf);
+}
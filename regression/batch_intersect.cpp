@@ -0,0 +1,164 @@
+#define TEST_MODULE_NAME BatchIntersect
+
+#include <memory>
+#include <random>
+#include <utility>
+#include <variant>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include <geomc/shape/BatchIntersect.h>
+#include <geomc/shape/Capsule.h>
+#include <geomc/shape/Rect.h>
+#include <geomc/shape/Sphere.h>
+#include <geomc/shape/Transformed.h>
+
+using namespace geom;
+using namespace std;
+
+#define RANDOM_SEED 3027188461ULL
+
+typedef mt19937_64 rng_t;
+typedef BatchIntersector<double,3>::pair_t pair_t;
+typedef variant<Sphere<double,3>, Rect<double,3>, Capsule<double,3>, AffineBox<double,3>> shape_t;
+
+
+Vec3d random_point(rng_t& rng, double extent) {
+    uniform_real_distribution<double> u(-extent, extent);
+    return Vec3d(u(rng), u(rng), u(rng));
+}
+
+
+shape_t random_shape(rng_t& rng) {
+    uniform_real_distribution<double> r(0.1, 1);
+    Vec3d p = random_point(rng, 5);
+    switch (rng() % 4) {
+        case 0:  return Sphere<double,3>(p, r(rng));
+        case 1:  return Rect<double,3>::from_corners(p, p + random_point(rng, 1.5));
+        case 2:  return Capsule<double,3>(p, p + random_point(rng, 1.5), r(rng));
+        default: {
+            AffineBox<double,3> b;
+            b.shape = Rect<double,3>::from_corners(random_point(rng, 1), random_point(rng, 1));
+            b.xf    = translation(p) * rotation(random_point(rng, 1).unit(), r(rng) * 3);
+            return b;
+        }
+    }
+}
+
+
+vector<pair_t> random_pairs(rng_t& rng, index_t n_shapes, index_t n_pairs) {
+    vector<pair_t> pairs;
+    for (index_t i = 0; i < n_pairs; ++i) {
+        pairs.push_back({(index_t) (rng() % n_shapes), (index_t) (rng() % n_shapes)});
+    }
+    return pairs;
+}
+
+
+// `axis` separates the disjoint shapes `a` and `b`
+template <typename A, typename B>
+void check_axis(const A& a, const B& b, const Vec3d& axis) {
+    Vec3d w = a.convex_support(axis) - b.convex_support(-axis);
+    EXPECT_LT(w.dot(axis), 0);
+}
+
+
+TEST(TEST_MODULE_NAME, homogeneous) {
+    rng_t rng(RANDOM_SEED);
+    uniform_real_distribution<double> r(0.1, 1);
+    vector<Sphere<double,3>> spheres;
+    vector<Capsule<double,3>> capsules;
+    for (int i = 0; i < 500; ++i) {
+        spheres.push_back(Sphere<double,3>(random_point(rng, 5), r(rng)));
+        Vec3d p = random_point(rng, 5);
+        capsules.push_back(Capsule<double,3>(p, p + random_point(rng, 1.5), r(rng)));
+    }
+    vector<pair_t> pairs = random_pairs(rng, 500, 20000);
+    unique_ptr<bool[]>  hits(new bool[pairs.size()]);
+    unique_ptr<bool[]>  hits_mt(new bool[pairs.size()]);
+    unique_ptr<Vec3d[]> axes(new Vec3d[pairs.size()]);
+
+    BatchIntersector<double,3> batch;
+    WorkPool pool(4);
+    batch.intersects(spheres.data(), capsules.data(), pairs, hits.get(), axes.get());
+    EXPECT_EQ(batch.task_count(), 1);
+    // the same intersector is used for every batch
+    for (int k = 0; k < 2; ++k) {
+        batch.intersects(spheres.data(), capsules.data(), pairs, hits_mt.get(), nullptr, pool);
+        EXPECT_GT(batch.task_count(), 1);
+    }
+
+    Intersector<double,3> gjk;
+    index_t n_hit = 0;
+    for (index_t i = 0; i < (index_t) pairs.size(); ++i) {
+        const auto& s = spheres[pairs[i].first];
+        const auto& c = capsules[pairs[i].second];
+        double d = c.sdf(s.center) - s.radius;
+        if (std::abs(d) > 1e-6) {
+            EXPECT_EQ(hits[i], d < 0);
+        }
+        EXPECT_EQ(hits[i], hits_mt[i]);
+        if (not hits[i]) check_axis(s, c, axes[i]);
+        n_hit += hits[i];
+    }
+    EXPECT_GT(n_hit, 100);
+
+    // pairs drawn from one array
+    batch.intersects(spheres.data(), pairs, hits.get(), axes.get(), pool);
+    for (index_t i = 0; i < (index_t) pairs.size(); ++i) {
+        const auto& a = spheres[pairs[i].first];
+        const auto& b = spheres[pairs[i].second];
+        EXPECT_EQ(hits[i], gjk.intersects(a, b));
+        if (not hits[i]) check_axis(a, b, axes[i]);
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, mixed) {
+    rng_t rng(RANDOM_SEED + 1);
+    vector<shape_t> shapes;
+    for (int i = 0; i < 1000; ++i) shapes.push_back(random_shape(rng));
+    vector<pair_t> pairs = random_pairs(rng, shapes.size(), 40000);
+    unique_ptr<bool[]>  hits(new bool[pairs.size()]);
+    unique_ptr<Vec3d[]> axes(new Vec3d[pairs.size()]);
+
+    BatchIntersector<double,3> batch;
+    WorkPool pool(4);
+    for (int k = 0; k < 2; ++k) {
+        batch.intersects(shapes.data(), pairs, hits.get(), axes.get(), pool);
+        // every combination of types is present
+        EXPECT_EQ(batch.group_count(), 16);
+        EXPECT_GE(batch.task_count(), 16);
+
+        Intersector<double,3> gjk;
+        index_t n_hit = 0;
+        for (index_t i = 0; i < (index_t) pairs.size(); ++i) {
+            visit([&](const auto& a, const auto& b) {
+                EXPECT_EQ(hits[i], gjk.intersects(a, b));
+                if (not hits[i]) check_axis(a, b, axes[i]);
+            }, shapes[pairs[i].first], shapes[pairs[i].second]);
+            n_hit += hits[i];
+        }
+        EXPECT_GT(n_hit, 100);
+    }
+
+    // without a pool, and with fewer types present
+    vector<shape_t> spheres;
+    for (int i = 0; i < 100; ++i) spheres.push_back(Sphere<double,3>(random_point(rng, 2), 0.5));
+    vector<pair_t> few = random_pairs(rng, spheres.size(), 300);
+    batch.intersects(spheres.data(), few, hits.get());
+    EXPECT_EQ(batch.group_count(), 1);
+    for (index_t i = 0; i < (index_t) few.size(); ++i) {
+        const auto& a = get<Sphere<double,3>>(spheres[few[i].first]);
+        const auto& b = get<Sphere<double,3>>(spheres[few[i].second]);
+        double d = a.center.dist(b.center) - 1;
+        if (std::abs(d) > 1e-9) {
+            EXPECT_EQ(hits[i], d < 0);
+        }
+    }
+
+    // an empty batch
+    batch.intersects(shapes.data(), span<const pair_t>(), hits.get(), nullptr, pool);
+    EXPECT_EQ(batch.group_count(), 0);
+    EXPECT_EQ(batch.task_count(), 0);
+}
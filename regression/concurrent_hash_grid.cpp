@@ -0,0 +1,146 @@
+#define TEST_MODULE_NAME ConcurrentHashGrid
+
+#include <algorithm>
+#include <random>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+#include <geomc/shape/ConcurrentHashGrid.h>
+#include <geomc/WorkPool.h>
+
+using namespace geom;
+using namespace std;
+
+#define RANDOM_SEED 2205730113ULL
+
+typedef ConcurrentHashGrid<double,3,int> cgrid3d;
+
+
+vector<cgrid3d::item_t> random_items(int n, double extent, uint64_t seed) {
+    mt19937_64 rng(seed);
+    uniform_real_distribution<double> u(-extent, extent);
+    vector<cgrid3d::item_t> v;
+    for (int i = 0; i < n; ++i) {
+        v.push_back({Vec3d(u(rng), u(rng), u(rng)), i});
+    }
+    return v;
+}
+
+
+// the frozen grid holds exactly `items`, each in its proper bin.
+void check_contents(const HashGrid<double,3,int>& grid, const vector<cgrid3d::item_t>& items) {
+    ASSERT_EQ(grid.size(), (index_t) items.size());
+    vector<int> seen(items.size(), 0);
+    for (index_t b = 0; b < grid.bin_count(); ++b) {
+        for (const auto& item : grid.bin_items(b)) {
+            EXPECT_TRUE(grid.bin_of(item.first) == grid.bin_key(b));
+            EXPECT_EQ(item.first, items[item.second].first);
+            seen[item.second] += 1;
+        }
+    }
+    EXPECT_TRUE(all_of(seen.begin(), seen.end(), [](int c) { return c == 1; }));
+}
+
+
+TEST(TEST_MODULE_NAME, threaded_insert) {
+    const int n_threads = 8;
+    auto items = random_items(80000, 40, RANDOM_SEED);
+    cgrid3d cgrid(2., 4);
+    EXPECT_EQ(cgrid.stripe_count(), 4);
+    vector<thread> threads;
+    for (int t = 0; t < n_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            // more threads than stripes; some will share
+            for (size_t i = t; i < items.size(); i += n_threads) {
+                cgrid.insert(items[i].first, items[i].second);
+            }
+        });
+    }
+    for (thread& t : threads) t.join();
+    EXPECT_EQ(cgrid.staged_count(), (index_t) items.size());
+    const auto& grid = cgrid.freeze();
+    EXPECT_EQ(&grid, &cgrid.grid());
+    EXPECT_EQ(cgrid.staged_count(), 0);
+    check_contents(grid, items);
+
+    // same answers as a grid filled serially
+    HashGrid<double,3,int> serial(items.begin(), items.end(), 2.);
+    EXPECT_EQ(grid.bin_count(), serial.bin_count());
+    vector<int> a, b;
+    grid.within_radius(Vec3d(1., 2., 3.), 5., [&](const auto& item) { a.push_back(item.second); });
+    serial.within_radius(Vec3d(1., 2., 3.), 5., [&](const auto& item) { b.push_back(item.second); });
+    sort(a.begin(), a.end());
+    sort(b.begin(), b.end());
+    EXPECT_EQ(a, b);
+}
+
+
+TEST(TEST_MODULE_NAME, pool_refill) {
+    WorkPool pool(4);
+    cgrid3d cgrid(1.5);
+    for (int frame = 0; frame < 3; ++frame) {
+        auto items = random_items(30000 + 5000 * frame, 25, RANDOM_SEED + frame);
+        cgrid.clear();
+        WorkGroup group;
+        const size_t chunk = 1000;
+        for (size_t c = 0; c < items.size(); c += chunk) {
+            pool.submit(group, [&, c]() {
+                size_t end = std::min(c + chunk, items.size());
+                if (c % (2 * chunk) == 0) {
+                    cgrid.insert(items.begin() + c, items.begin() + end);
+                } else {
+                    for (size_t i = c; i < end; ++i) cgrid.insert(items[i].first, items[i].second);
+                }
+            });
+        }
+        pool.wait(group);
+        check_contents(cgrid.freeze(), items);
+    }
+
+    // items not yet frozen are discarded by clear()
+    cgrid.insert(Vec3d(0.), 0);
+    cgrid.clear();
+    EXPECT_EQ(cgrid.staged_count(), 0);
+    EXPECT_TRUE(cgrid.freeze().empty());
+}
+
+
+// exposes which values sit in each stripe, before freezing.
+struct striped_grid : public cgrid3d {
+    using cgrid3d::cgrid3d;
+
+    vector<set<int>> stripe_values() const {
+        vector<set<int>> v(stripe_count());
+        for (index_t i = 0; i < stripe_count(); ++i) {
+            for (const auto& item : _stripes[i].items) v[i].insert(item.second);
+        }
+        return v;
+    }
+};
+
+
+TEST(TEST_MODULE_NAME, stripes_after_thread_churn) {
+    striped_grid cgrid(1., 4);
+    // threads which insert, then exit
+    auto fill = [&](int first_tag) {
+        cgrid.insert(Vec3d(0.), first_tag);
+        vector<thread> threads;
+        for (int t = 1; t < 4; ++t) {
+            threads.emplace_back([&, t]() { cgrid.insert(Vec3d(t), first_tag + t); });
+        }
+        for (thread& t : threads) t.join();
+    };
+    // in every fill, a long-lived thread and three new ones (no more than there
+    // are stripes) each get a stripe to themselves.
+    for (int round = 0; round < 8; ++round) {
+        fill(10 * round);
+        for (const set<int>& values : cgrid.stripe_values()) {
+            EXPECT_EQ(values.size(), 1u);
+        }
+        EXPECT_EQ(cgrid.staged_count(), 4);
+        cgrid.freeze();
+    }
+    EXPECT_EQ(cgrid.grid().size(), 32);
+}
@@ -0,0 +1,280 @@
+#define TEST_MODULE_NAME GJK
+
+#include <random>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include <geomc/shape/Intersect.h>
+#include <geomc/shape/Capsule.h>
+#include <geomc/shape/Rect.h>
+#include <geomc/shape/Sphere.h>
+#include <geomc/shape/Transformed.h>
+
+using namespace geom;
+using namespace std;
+
+#define RANDOM_SEED 901442267ULL
+
+typedef mt19937_64 rng_t;
+
+
+template <typename T, index_t N>
+Vec<T,N> random_point(rng_t& rng, T extent) {
+    uniform_real_distribution<T> u(-extent, extent);
+    Vec<T,N> p;
+    for (index_t k = 0; k < N; ++k) p[k] = u(rng);
+    return p;
+}
+
+
+template <typename T, index_t N>
+Sphere<T,N> random_sphere(rng_t& rng) {
+    uniform_real_distribution<T> r(0.1, 2);
+    return Sphere<T,N>(random_point<T,N>(rng, 4), r(rng));
+}
+
+
+template <typename T, index_t N>
+Rect<T,N> random_rect(rng_t& rng) {
+    Vec<T,N> p = random_point<T,N>(rng, 4);
+    return Rect<T,N>::from_corners(p, p + random_point<T,N>(rng, 2));
+}
+
+
+template <typename T, index_t N>
+Capsule<T,N> random_capsule(rng_t& rng) {
+    uniform_real_distribution<T> r(0.1, 1);
+    Vec<T,N> p = random_point<T,N>(rng, 4);
+    return Capsule<T,N>(p, p + random_point<T,N>(rng, 2), r(rng));
+}
+
+
+template <typename T, index_t N>
+AffineBox<T,N> random_box(rng_t& rng) {
+    uniform_real_distribution<T> angle(0, 2 * M_PI);
+    AffineBox<T,N> b;
+    b.shape = Rect<T,N>::from_corners(random_point<T,N>(rng, 1), random_point<T,N>(rng, 1));
+    b.xf    = translation(random_point<T,N>(rng, 4)) * rotation(random_point<T,N>(rng, 1).unit(), angle(rng));
+    return b;
+}
+
+
+// the inlined and virtual paths run the same algorithm, so they should
+// agree exactly, iteration for iteration.
+template <typename A, typename B>
+void check_paths_agree(const A& a, const B& b) {
+    typedef typename A::elem_t T;
+    constexpr index_t N = A::N;
+    Intersector<T,N> direct;
+    Intersector<T,N> virt;
+    bool hit = direct.intersects(a, b);
+    EXPECT_EQ(hit, virt.intersects(as_any_convex(a), as_any_convex(b)));
+    EXPECT_EQ(direct.iterations, virt.iterations);
+    EXPECT_EQ(direct.separation_axis, virt.separation_axis);
+}
+
+
+TEST(TEST_MODULE_NAME, direct_matches_virtual) {
+    rng_t rng(RANDOM_SEED);
+    for (int i = 0; i < 2000; ++i) {
+        check_paths_agree(random_sphere<double,3>(rng),  random_rect<double,3>(rng));
+        check_paths_agree(random_capsule<double,3>(rng), random_sphere<double,3>(rng));
+        check_paths_agree(random_box<double,3>(rng),     random_capsule<double,3>(rng));
+        check_paths_agree(random_rect<float,2>(rng),     random_sphere<float,2>(rng));
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, direct_exact) {
+    // compare against exact tests, away from the boundary cases
+    rng_t rng(RANDOM_SEED + 1);
+    Intersector<double,3> gjk;
+    for (int i = 0; i < 5000; ++i) {
+        Sphere<double,3>  s = random_sphere<double,3>(rng);
+        Rect<double,3>    r = random_rect<double,3>(rng);
+        Capsule<double,3> c = random_capsule<double,3>(rng);
+        double d_sr = std::sqrt(r.dist2(s.center)) - s.radius;
+        if (std::abs(d_sr) > 1e-6) {
+            EXPECT_EQ(gjk.intersects(s, r), d_sr < 0);
+        }
+        double d_sc = c.sdf(s.center) - s.radius;
+        if (std::abs(d_sc) > 1e-6) {
+            EXPECT_EQ(gjk.intersects(c, s), d_sc < 0);
+        }
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, distance) {
+    rng_t rng(RANDOM_SEED + 2);
+    Intersector<double,3> gjk;
+    index_t n_apart = 0;
+    for (int i = 0; i < 3000; ++i) {
+        Sphere<double,3> s = random_sphere<double,3>(rng);
+        Rect<double,3>   r = random_rect<double,3>(rng);
+        double expect = std::max(std::sqrt(r.dist2(s.center)) - s.radius, 0.);
+        ConvexDistance<double,3> d = gjk.distance(s, r);
+        EXPECT_NEAR(d.distance, expect, 1e-6);
+        EXPECT_EQ(d.overlapping, expect == 0);
+        EXPECT_FALSE(d.beyond_threshold);
+        if (not d.overlapping) {
+            ++n_apart;
+            // the witnesses are on the surfaces, and as far apart as the shapes
+            EXPECT_NEAR(d.point_a.dist(s.center), s.radius, 1e-6);
+            EXPECT_NEAR(r.dist2(d.point_b), 0, 1e-10);
+            EXPECT_NEAR(d.point_a.dist(d.point_b), d.distance, 1e-6);
+        } else {
+            EXPECT_EQ(d.point_a, d.point_b);
+            EXPECT_TRUE(s.contains(d.point_a) or s.center.dist(d.point_a) < s.radius + 1e-9);
+        }
+
+        // the virtual path agrees
+        ConvexDistance<double,3> dv = gjk.distance(as_any_convex(s), as_any_convex(r));
+        EXPECT_NEAR(dv.distance, d.distance, 1e-6);
+        
+        // polytopes converge exactly
+        Rect<double,3> r2 = random_rect<double,3>(rng);
+        ConvexDistance<double,3> dr = gjk.distance(r, r2);
+        double expect_rr = std::sqrt(std::max(
+            (r.clip(dr.point_b) - dr.point_b).mag2(),
+            (r2.clip(dr.point_a) - dr.point_a).mag2()));
+        EXPECT_NEAR(dr.distance, expect_rr, 1e-9);
+        Vec3d gap;
+        for (index_t k = 0; k < 3; ++k) {
+            gap[k] = std::max({r.lo[k] - r2.hi[k], r2.lo[k] - r.hi[k], 0.});
+        }
+        EXPECT_NEAR(dr.distance, gap.mag(), 1e-9);
+    }
+    EXPECT_GT(n_apart, 100);
+}
+
+
+TEST(TEST_MODULE_NAME, distance_threshold) {
+    Intersector<double,2> gjk;
+    Sphere<double,2>  a(Vec2d(0., 0.), 1.);
+    Capsule<double,2> b(Vec2d(10., -5.), Vec2d(10., 5.), 0.5);
+    ConvexDistance<double,2> d = gjk.distance(a, b);
+    EXPECT_NEAR(d.distance, 8.5, 1e-6);
+    EXPECT_NEAR(d.point_a.x, 1.,  1e-6);
+    EXPECT_NEAR(d.point_b.x, 9.5, 1e-6);
+
+    // a threshold beyond the distance changes nothing
+    d = gjk.distance(a, b, 9.);
+    EXPECT_FALSE(d.beyond_threshold);
+    EXPECT_NEAR(d.distance, 8.5, 1e-6);
+
+    // a closer threshold stops early, with a lower bound
+    gjk.separation_axis = Vec2d(0., 1.);
+    d = gjk.distance(a, b, 2.);
+    EXPECT_TRUE(d.beyond_threshold);
+    EXPECT_GT(d.distance, 2.);
+    EXPECT_LE(d.distance, 8.5 + 1e-9);
+    EXPECT_LE(gjk.iterations, 2);
+    
+    // overlapping shapes are zero apart
+    d = gjk.distance(a, Sphere<double,2>(Vec2d(1.5, 0.), 1.));
+    EXPECT_TRUE(d.overlapping);
+    EXPECT_EQ(d.distance, 0);
+    EXPECT_LE(d.point_a.mag(), 1. + 1e-9);
+    EXPECT_LE(d.point_a.dist(Vec2d(1.5, 0.)), 1. + 1e-9);
+}
+
+
+// depth of the overlap of two boxes, and the axis along which it's least.
+template <typename T, index_t N>
+T box_overlap(const Rect<T,N>& a, const Rect<T,N>& b, Vec<T,N>* normal) {
+    T depth = std::numeric_limits<T>::max();
+    for (index_t k = 0; k < N; ++k) {
+        // move `b` up or down along axis k
+        T up   = a.hi[k] - b.lo[k];
+        T down = b.hi[k] - a.lo[k];
+        if (std::min(up, down) < depth) {
+            depth   = std::min(up, down);
+            *normal = {};
+            (*normal)[k] = up < down ? 1 : -1;
+        }
+    }
+    return depth;
+}
+
+
+template <typename T, index_t N>
+void check_penetration(rng_t& rng, index_t iters) {
+    Intersector<T,N> gjk;
+    // curved shapes take many vertices to approximate closely
+    gjk.max_penetration_iterations = 512;
+    index_t n_hit = 0;
+    for (index_t i = 0; i < iters; ++i) {
+        // spheres
+        Sphere<T,N> a = random_sphere<T,N>(rng);
+        Sphere<T,N> b = random_sphere<T,N>(rng);
+        T gap = a.center.dist(b.center);
+        ConvexPenetration<T,N> p = gjk.penetration(a, b);
+        EXPECT_EQ(p.overlapping, gjk.intersects(a, b));
+        if (p.overlapping and gap > 1e-3) {
+            ++n_hit;
+            T tol = std::is_same_v<T,float> ? 2e-3 : 1e-5;
+            EXPECT_NEAR(p.depth, a.radius + b.radius - gap, tol);
+            EXPECT_NEAR(p.normal.dot((b.center - a.center) / gap), 1, tol);
+            EXPECT_NEAR(p.point_a.dist(a.center), a.radius, tol);
+            EXPECT_NEAR(p.point_b.dist(b.center), b.radius, tol);
+            EXPECT_NEAR((p.point_a - p.point_b - p.normal * p.depth).mag(), 0, tol);
+        }
+
+        // boxes
+        Rect<T,N> r0 = random_rect<T,N>(rng);
+        Rect<T,N> r1 = random_rect<T,N>(rng);
+        if ((r0 & r1).is_empty()) continue;
+        Vec<T,N> axis;
+        T depth = box_overlap(r0, r1, &axis);
+        p = gjk.penetration(r0, r1);
+        EXPECT_TRUE(p.overlapping);
+        T tol = std::is_same_v<T,float> ? 1e-4 : 1e-9;
+        EXPECT_NEAR(p.depth, depth, tol);
+        EXPECT_NEAR((p.point_a - p.point_b - p.normal * p.depth).mag(), 0, tol);
+        // moving `r1` out along the normal separates the boxes
+        Rect<T,N> moved = r1 + p.normal * (p.depth * 1.001 + tol);
+        EXPECT_FALSE(gjk.intersects(r0, moved));
+    }
+    EXPECT_GT(n_hit, iters / 20);
+}
+
+
+TEST(TEST_MODULE_NAME, penetration) {
+    rng_t rng(RANDOM_SEED + 3);
+    check_penetration<double,2>(rng, 2000);
+    check_penetration<double,3>(rng, 2000);
+    check_penetration<float,3>(rng, 500);
+}
+
+
+TEST(TEST_MODULE_NAME, penetration_shapes) {
+    Intersector<double,3> gjk;
+    // a sphere resting into the side of a capsule
+    Capsule<double,3> c(Vec3d(0., 0., -5.), Vec3d(0., 0., 5.), 1.);
+    Sphere<double,3>  s(Vec3d(1.5, 0., 1.), 1.);
+    ConvexPenetration<double,3> p = gjk.penetration(c, s);
+    EXPECT_TRUE(p.overlapping);
+    EXPECT_NEAR(p.depth, 0.5, 1e-6);
+    EXPECT_NEAR(p.normal.x, 1., 1e-6);
+    EXPECT_NEAR(p.point_a.x, 1., 1e-6);
+    EXPECT_NEAR(p.point_b.x, 0.5, 1e-6);
+
+    // the virtual path agrees
+    ConvexPenetration<double,3> pv = gjk.penetration(as_any_convex(c), as_any_convex(s));
+    EXPECT_NEAR(pv.depth, p.depth, 1e-6);
+
+    // disjoint shapes don't overlap
+    EXPECT_FALSE(gjk.penetration(c, Sphere<double,3>(Vec3d(3., 0., 0.), 1.)).overlapping);
+
+    // a rotated box pushed into a flat one
+    AffineBox<double,3> tilted;
+    tilted.shape = Rect<double,3>(Vec3d(-1.), Vec3d(1.));
+    tilted.xf    = translation(Vec3d(0., 0., 1.2)) * rotation(Vec3d(1., 0., 0.), M_PI / 4);
+    Rect<double,3> floor(Vec3d(-10., -10., -1.), Vec3d(10., 10., 0.));
+    p = gjk.penetration(floor, tilted);
+    EXPECT_TRUE(p.overlapping);
+    EXPECT_NEAR(p.depth, std::sqrt(2.) - 1.2, 1e-6);
+    EXPECT_NEAR(p.normal.z, 1., 1e-6);
+    EXPECT_NEAR(p.point_b.z, 1.2 - std::sqrt(2.), 1e-6);
+}
@@ -0,0 +1,248 @@
+#define TEST_MODULE_NAME HashGrid
+
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+#include <geomc/shape/HashGrid.h>
+#include <geomc/WorkPool.h>
+
+using namespace geom;
+using namespace std;
+
+#define RANDOM_SEED 1188203471ULL
+
+typedef HashGrid<double,3,int> grid3d;
+
+
+vector<grid3d::item_t> random_items(int n, double extent, uint64_t seed=RANDOM_SEED) {
+    mt19937_64 rng(seed);
+    uniform_real_distribution<double> u(-extent, extent);
+    vector<grid3d::item_t> v;
+    for (int i = 0; i < n; ++i) {
+        v.push_back({Vec3d(u(rng), u(rng), u(rng)), i});
+    }
+    return v;
+}
+
+
+template <typename G, typename Items>
+void check_bins(const G& grid, const Items& items) {
+    index_t n = 0;
+    for (index_t b = 0; b < grid.bin_count(); ++b) {
+        auto span = grid.bin_items(b);
+        EXPECT_GT(span.size(), 0u);
+        for (const auto& item : span) {
+            EXPECT_TRUE(grid.bin_of(item.first) == grid.bin_key(b));
+        }
+        EXPECT_EQ(grid.find_bin(grid.bin_key(b)), b);
+        n += span.size();
+    }
+    EXPECT_EQ(n, (index_t) items.size());
+    EXPECT_EQ(grid.size(), (index_t) items.size());
+    EXPECT_EQ(grid.end() - grid.begin(), (index_t) items.size());
+}
+
+
+template <typename G, typename Items>
+void check_queries(const G& grid, const Items& items, double extent, uint64_t seed) {
+    mt19937_64 rng(seed);
+    uniform_real_distribution<double> u(-extent, extent);
+    uniform_real_distribution<double> rad(0, extent / 3);
+    for (int q = 0; q < 50; ++q) {
+        Vec3d p(u(rng), u(rng), u(rng));
+        double r = rad(rng);
+        vector<int> expect, got;
+        for (const auto& item : items) {
+            if (item.first.dist2(p) <= r * r) expect.push_back(item.second);
+        }
+        grid.within_radius(p, r, [&](const auto& item) { got.push_back(item.second); });
+        sort(expect.begin(), expect.end());
+        sort(got.begin(), got.end());
+        EXPECT_EQ(got, expect);
+
+        Rect<double,3> box(p, p + Vec3d(r, 2 * r, r / 2));
+        expect.clear();
+        got.clear();
+        for (const auto& item : items) {
+            if (box.contains(item.first)) expect.push_back(item.second);
+        }
+        grid.in_rect(box, [&](const auto& item) { got.push_back(item.second); });
+        sort(expect.begin(), expect.end());
+        sort(got.begin(), got.end());
+        EXPECT_EQ(got, expect);
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, build_and_query) {
+    auto items = random_items(20000, 50);
+    grid3d grid(items.begin(), items.end(), 2.5);
+    EXPECT_EQ(grid.staged_count(), 0);
+    check_bins(grid, items);
+    check_queries(grid, items, 50, 1);
+    EXPECT_EQ(grid.find_bin(grid.bin_of(Vec3d(1000.))), -1);
+    EXPECT_TRUE(grid.items_in(grid.bin_of(Vec3d(1000.))).empty());
+}
+
+
+TEST(TEST_MODULE_NAME, large_regions) {
+    // query regions much larger than the occupied part of the grid
+    auto items = random_items(500, 3);
+    grid3d grid(items.begin(), items.end(), 0.5);
+    check_queries(grid, items, 3, 2);
+    vector<int> got;
+    grid.in_rect(Rect<double,3>(Vec3d(-1e6), Vec3d(1e6)), [&](const auto& item) {
+        got.push_back(item.second);
+    });
+    EXPECT_EQ(got.size(), 500u);
+}
+
+
+TEST(TEST_MODULE_NAME, staged_insert) {
+    auto items = random_items(3000, 20);
+    grid3d grid(2);
+    grid.insert(items.begin(), items.begin() + 1000);
+    EXPECT_EQ(grid.size(), 0);
+    EXPECT_EQ(grid.staged_count(), 1000);
+    grid.rebuild();
+    EXPECT_EQ(grid.size(), 1000);
+
+    // staged items aren't visible until the next rebuild
+    for (index_t i = 1000; i < 3000; ++i) grid.insert(items[i].first, items[i].second);
+    vector<grid3d::item_t> first(items.begin(), items.begin() + 1000);
+    check_queries(grid, first, 20, 3);
+    grid.rebuild();
+    check_bins(grid, items);
+    check_queries(grid, items, 20, 4);
+}
+
+
+TEST(TEST_MODULE_NAME, rebuild_reuses_memory) {
+    auto a = random_items(5000, 10, 5);
+    auto b = random_items(5000, 10, 6);
+    grid3d grid(1);
+    grid.build(a.begin(), a.end());
+    const grid3d::item_t* storage = grid.begin();
+    for (int frame = 0; frame < 4; ++frame) {
+        const auto& items = (frame % 2) ? a : b;
+        grid.clear();
+        EXPECT_TRUE(grid.empty());
+        EXPECT_EQ(grid.bin_count(), 0);
+        for (const auto& item : items) grid.insert(item.first, item.second);
+        grid.rebuild();
+        EXPECT_EQ(grid.begin(), storage);
+        check_bins(grid, items);
+    }
+    check_queries(grid, a, 10, 7);
+}
+
+
+TEST(TEST_MODULE_NAME, shared_locations) {
+    // many items in few bins, including negative coordinates
+    grid3d grid(1);
+    vector<grid3d::item_t> items;
+    for (int i = 0; i < 300; ++i) {
+        items.push_back({Vec3d(i % 3 - 1.5, -0.5, 0.25), i});
+    }
+    grid.build(items.begin(), items.end());
+    EXPECT_EQ(grid.bin_count(), 3);
+    check_bins(grid, items);
+    auto in = grid.items_in(grid.bin_of(Vec3d(-1.5, -0.5, 0.25)));
+    ASSERT_EQ(in.size(), 100u);
+    // insertion order is kept within a bin
+    for (size_t i = 1; i < in.size(); ++i) EXPECT_LT(in[i - 1].second, in[i].second);
+}
+
+
+TEST(TEST_MODULE_NAME, one_dimension) {
+    HashGrid<float,1,int> grid(0.5f);
+    vector<pair<float,int>> items;
+    for (int i = 0; i < 1000; ++i) items.push_back({(float)(i % 97) * 0.37f - 10.f, i});
+    grid.build(items.begin(), items.end());
+    check_bins(grid, items);
+    vector<int> expect, got;
+    for (const auto& item : items) {
+        if (std::abs(item.first - 1.f) <= 2.f) expect.push_back(item.second);
+    }
+    grid.within_radius(1.f, 2.f, [&](const auto& item) { got.push_back(item.second); });
+    sort(expect.begin(), expect.end());
+    sort(got.begin(), got.end());
+    EXPECT_EQ(got, expect);
+}
+
+
+// compare a batch result against single queries.
+template <typename G>
+void check_neighbors(const G& grid, const typename G::point_t* pts, index_t n, double r, const NeighborList& nbrs) {
+    ASSERT_EQ(nbrs.query_count(), n);
+    const typename G::item_t* base = grid.begin();
+    for (index_t q = 0; q < n; ++q) {
+        vector<index_t> expect, got(nbrs[q].begin(), nbrs[q].end());
+        grid.within_radius(pts[q], r, [&](const auto& item) { expect.push_back(&item - base); });
+        sort(expect.begin(), expect.end());
+        sort(got.begin(), got.end());
+        EXPECT_EQ(got, expect);
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, batch_within_radius) {
+    auto items   = random_items(6000, 20, 8);
+    auto queries = random_items(2000, 22, 9);
+    vector<Vec3d> pts;
+    for (const auto& q : queries) pts.push_back(q.first);
+    grid3d grid(items.begin(), items.end(), 1.5);
+
+    NeighborList serial;
+    grid.within_radius(pts.data(), pts.size(), 2., &serial);
+    check_neighbors(grid, pts.data(), pts.size(), 2., serial);
+    EXPECT_GT(serial.size(), 0);
+
+    for (index_t n_threads : {0, 3}) {
+        WorkPool pool(n_threads);
+        NeighborList par;
+        grid.within_radius(pts.data(), pts.size(), 2., &par, pool);
+        EXPECT_EQ(par.offsets, serial.offsets);
+        check_neighbors(grid, pts.data(), pts.size(), 2., par);
+    }
+
+    // a radius spanning many bins, and an empty batch
+    NeighborList wide;
+    grid.within_radius(pts.data(), 50, 9., &wide);
+    check_neighbors(grid, pts.data(), 50, 9., wide);
+    grid.within_radius(pts.data(), 0, 9., &wide);
+    EXPECT_EQ(wide.query_count(), 0);
+    EXPECT_EQ(wide.size(), 0);
+}
+
+
+TEST(TEST_MODULE_NAME, all_neighbors) {
+    auto items = random_items(8000, 15, 10);
+    grid3d grid(items.begin(), items.end(), 1);
+    vector<Vec3d> pts;
+    for (const auto& item : grid) pts.push_back(item.first);
+
+    WorkPool pool(4);
+    NeighborList nbrs;
+    grid.neighbors(1.25, &nbrs, pool);
+    check_neighbors(grid, pts.data(), pts.size(), 1.25, nbrs);
+    for (index_t i = 0; i < grid.size(); ++i) {
+        // each item is its own neighbor, and neighborship is symmetric
+        auto mine = nbrs[i];
+        EXPECT_TRUE(find(mine.begin(), mine.end(), i) != mine.end());
+        for (index_t j : mine) {
+            auto theirs = nbrs[j];
+            EXPECT_TRUE(find(theirs.begin(), theirs.end(), i) != theirs.end());
+        }
+    }
+
+    NeighborList serial;
+    grid.neighbors(1.25, &serial);
+    EXPECT_EQ(serial.offsets, nbrs.offsets);
+
+    grid3d empty;
+    empty.neighbors(1, &serial);
+    EXPECT_EQ(serial.query_count(), 0);
+}
@@ -0,0 +1,258 @@
+#define TEST_MODULE_NAME HierarchicalGrid
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+#include <geomc/shape/HierarchicalGrid.h>
+#include <geomc/shape/Sphere.h>
+
+using namespace geom;
+using namespace std;
+
+#define RANDOM_SEED 3349120765ULL
+
+typedef Rect<double,3> box3d;
+typedef HierarchicalGrid<double,3,box3d> grid3d;
+
+
+// boxes with sizes spread over five orders of magnitude
+vector<box3d> random_boxes(int n, double extent, uint64_t seed) {
+    mt19937_64 rng(seed);
+    uniform_real_distribution<double> u(-extent, extent);
+    uniform_real_distribution<double> log_size(-2, 3);
+    vector<box3d> v;
+    for (int i = 0; i < n; ++i) {
+        Vec3d p(u(rng), u(rng), u(rng));
+        Vec3d d;
+        for (index_t k = 0; k < 3; ++k) d[k] = std::pow(10., log_size(rng));
+        v.push_back(box3d(p, p + d));
+    }
+    return v;
+}
+
+
+bool touch(const box3d& a, const box3d& b) {
+    for (index_t k = 0; k < 3; ++k) {
+        if (a.hi[k] < b.lo[k] or b.hi[k] < a.lo[k]) return false;
+    }
+    return true;
+}
+
+
+// compare overlap queries against a brute-force search over `live` (id, box) pairs.
+void check_queries(const grid3d& grid, const vector<pair<index_t,box3d>>& live, double extent, uint64_t seed) {
+    mt19937_64 rng(seed);
+    uniform_real_distribution<double> u(-extent, extent);
+    uniform_real_distribution<double> log_size(-2, 2.5);
+    for (int q = 0; q < 60; ++q) {
+        Vec3d p(u(rng), u(rng), u(rng));
+        double s = std::pow(10., log_size(rng));
+        box3d region(p, p + Vec3d(s, s / 2, 2 * s));
+        vector<index_t> expect, got;
+        for (const auto& [id, b] : live) {
+            if (touch(b, region)) expect.push_back(id);
+        }
+        grid.overlapping(region, [&](index_t id, const box3d& b) {
+            EXPECT_EQ(b, grid[id]);
+            got.push_back(id);
+        });
+        sort(expect.begin(), expect.end());
+        sort(got.begin(), got.end());
+        EXPECT_EQ(got, expect);
+
+        expect.clear();
+        got.clear();
+        for (const auto& [id, b] : live) {
+            if (b.dist2(p) <= s * s) expect.push_back(id);
+        }
+        grid.within_radius(p, s, [&](index_t id, const box3d&) { got.push_back(id); });
+        sort(expect.begin(), expect.end());
+        sort(got.begin(), got.end());
+        EXPECT_EQ(got, expect);
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, levels) {
+    grid3d grid(0.5);
+    EXPECT_EQ(grid.level_for(box3d(Vec3d(0.), Vec3d(0.01))), 0);
+    EXPECT_EQ(grid.level_for(box3d(Vec3d(0.), Vec3d(0.5))),  0);
+    EXPECT_EQ(grid.level_for(box3d(Vec3d(0.), Vec3d(0.6))),  1);
+    EXPECT_EQ(grid.level_for(box3d(Vec3d(0.), Vec3d(1.))),   1);
+    EXPECT_EQ(grid.level_for(box3d(Vec3d(0.), Vec3d(0.1, 7., 0.1))), 4);
+    EXPECT_EQ(grid.level_for(box3d(Vec3d(0.), Vec3d(1e300))), grid3d::max_levels - 1);
+    EXPECT_EQ(grid.cell_size(3), 4.);
+
+    // every object sits at the finest level which is wide enough for it
+    auto boxes = random_boxes(2000, 100, 1);
+    for (const box3d& b : boxes) {
+        index_t id = grid.insert(b);
+        index_t L  = grid.level_of(id);
+        double  w  = max({b.dimensions()[0], b.dimensions()[1], b.dimensions()[2]});
+        EXPECT_LE(w, grid.cell_size(L));
+        if (L > 0) {
+            EXPECT_GT(w, grid.cell_size(L - 1));
+        }
+    }
+    index_t n = 0;
+    for (index_t L = 0; L < grid3d::max_levels; ++L) n += grid.level_size(L);
+    EXPECT_EQ(n, grid.size());
+}
+
+
+TEST(TEST_MODULE_NAME, mixed_sizes) {
+    auto boxes = random_boxes(10000, 200, 2);
+    grid3d grid(boxes.begin(), boxes.end(), 0.05);
+    EXPECT_EQ(grid.size(), 10000);
+    vector<pair<index_t,box3d>> live;
+    for (index_t i = 0; i < (index_t) boxes.size(); ++i) live.push_back({i, boxes[i]});
+    check_queries(grid, live, 250, 3);
+}
+
+
+TEST(TEST_MODULE_NAME, erase_and_update) {
+    auto boxes = random_boxes(4000, 50, 4);
+    grid3d grid(0.1);
+    vector<index_t> ids;
+    for (const box3d& b : boxes) ids.push_back(grid.insert(b));
+
+    mt19937_64 rng(5);
+    uniform_real_distribution<double> u(-20, 20);
+    vector<bool> alive(boxes.size(), true);
+    for (index_t i = 0; i < (index_t) boxes.size(); ++i) {
+        switch (rng() % 3) {
+            case 0:
+                grid.erase(ids[i]);
+                alive[i] = false;
+                break;
+            case 1:
+                // move, and change size (and so level)
+                {
+                    Vec3d lo = boxes[i].lo + Vec3d(u(rng));
+                    boxes[i] = box3d(lo, lo + Vec3d(std::abs(u(rng))));
+                }
+                grid.update(ids[i], boxes[i]);
+                break;
+        }
+    }
+    // erased ids are reused
+    auto more = random_boxes(500, 50, 6);
+    for (const box3d& b : more) {
+        index_t id = grid.insert(b);
+        EXPECT_LT(id, (index_t) boxes.size());
+        EXPECT_FALSE(alive[id]);
+        alive[id] = true;
+        boxes[id] = b;
+    }
+
+    vector<pair<index_t,box3d>> live;
+    for (index_t i = 0; i < (index_t) boxes.size(); ++i) {
+        if (alive[i]) live.push_back({i, boxes[i]});
+    }
+    EXPECT_EQ(grid.size(), (index_t) live.size());
+    check_queries(grid, live, 60, 7);
+
+    grid.clear();
+    EXPECT_TRUE(grid.empty());
+    index_t n = 0;
+    grid.overlapping(box3d(Vec3d(-1e9), Vec3d(1e9)), [&](index_t, const box3d&) { ++n; });
+    EXPECT_EQ(n, 0);
+}
+
+
+TEST(TEST_MODULE_NAME, bin_churn) {
+    // small boxes all on level 0, one to a bin, so that bins are emptied and
+    // refilled many times over, and the levels' hash tables shift slots back.
+    mt19937_64 rng(9);
+    uniform_int_distribution<int> cell(-20, 20);
+    grid3d grid(1);
+    vector<box3d>   boxes;
+    vector<index_t> ids;
+    vector<bool>    alive;
+    for (int round = 0; round < 40; ++round) {
+        for (int i = 0; i < 100; ++i) {
+            Vec3d p(cell(rng) + 0.25, cell(rng) + 0.25, cell(rng) + 0.25);
+            box3d b(p, p + Vec3d(0.5));
+            index_t id = grid.insert(b);
+            if (id >= (index_t) boxes.size()) {
+                boxes.resize(id + 1);
+                alive.resize(id + 1, false);
+            }
+            boxes[id] = b;
+            alive[id] = true;
+        }
+        for (index_t id = 0; id < (index_t) boxes.size(); ++id) {
+            if (alive[id] and rng() % 2) {
+                grid.erase(id);
+                alive[id] = false;
+            }
+        }
+    }
+    vector<pair<index_t,box3d>> live;
+    for (index_t i = 0; i < (index_t) boxes.size(); ++i) {
+        if (alive[i]) live.push_back({i, boxes[i]});
+    }
+    EXPECT_EQ(grid.size(), (index_t) live.size());
+    EXPECT_EQ(grid.level_size(0), grid.size());
+    check_queries(grid, live, 25, 10);
+}
+
+
+TEST(TEST_MODULE_NAME, overlapping_pairs) {
+    auto boxes = random_boxes(1500, 60, 8);
+    grid3d grid(boxes.begin(), boxes.end(), 0.2);
+    vector<pair<index_t,index_t>> expect, got;
+    for (index_t i = 0; i < (index_t) boxes.size(); ++i) {
+        for (index_t j = i + 1; j < (index_t) boxes.size(); ++j) {
+            if (touch(boxes[i], boxes[j])) expect.push_back({i, j});
+        }
+    }
+    grid.overlapping_pairs([&](index_t a, index_t b) {
+        EXPECT_NE(a, b);
+        got.push_back({min(a, b), max(a, b)});
+    });
+    sort(got.begin(), got.end());
+    EXPECT_EQ(got, expect);
+}
+
+
+TEST(TEST_MODULE_NAME, shapes_and_points) {
+    // shapes without an exact distance are measured by their bounds
+    mt19937_64 rng(9);
+    uniform_real_distribution<double> u(-30, 30);
+    uniform_real_distribution<double> rad(0.01, 8);
+    vector<Sphere<double,2>> spheres;
+    for (int i = 0; i < 3000; ++i) spheres.push_back(Sphere<double,2>(Vec2d(u(rng), u(rng)), rad(rng)));
+    HierarchicalGrid<double,2,Sphere<double,2>> grid(spheres.begin(), spheres.end(), 0.1);
+    for (int q = 0; q < 50; ++q) {
+        Vec2d p(u(rng), u(rng));
+        vector<index_t> expect, got;
+        for (index_t i = 0; i < (index_t) spheres.size(); ++i) {
+            if (spheres[i].bounds().dist2(p) <= 4.) expect.push_back(i);
+        }
+        grid.within_radius(p, 2., [&](index_t id, const auto&) { got.push_back(id); });
+        sort(got.begin(), got.end());
+        EXPECT_EQ(got, expect);
+    }
+
+    // points all live at the finest level
+    HierarchicalGrid<double,2,Vec2d> pts(0.25);
+    for (int i = 0; i < 100; ++i) pts.insert(Vec2d(i * 0.1, 1.));
+    EXPECT_EQ(pts.level_size(0), 100);
+    index_t n = 0;
+    pts.overlapping(Rect<double,2>(Vec2d(2.05, 0.), Vec2d(3.05, 1.)), [&](index_t, const Vec2d&) { ++n; });
+    EXPECT_EQ(n, 10);
+
+    // intervals on a line
+    HierarchicalGrid<double,1,Rect<double,1>> line(0.25);
+    for (int i = 0; i < 100; ++i) line.insert(Rect<double,1>(i, i + 0.1 * (i % 40)));
+    n = 0;
+    line.overlapping(Rect<double,1>(50.5, 55.), [&](index_t, const Rect<double,1>& b) {
+        EXPECT_TRUE(b.hi >= 50.5 and b.lo <= 55.);
+        ++n;
+    });
+    EXPECT_EQ(n, 6);
+}
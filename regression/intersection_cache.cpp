@@ -0,0 +1,183 @@
+#define TEST_MODULE_NAME IntersectionCache
+
+#include <cmath>
+#include <random>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include <geomc/shape/IntersectionCache.h>
+#include <geomc/shape/Capsule.h>
+#include <geomc/shape/Rect.h>
+#include <geomc/shape/Sphere.h>
+#include <geomc/shape/Transformed.h>
+
+using namespace geom;
+using namespace std;
+
+#define RANDOM_SEED 1718229043ULL
+
+typedef mt19937_64 rng_t;
+
+
+Vec3d random_point(rng_t& rng, double extent) {
+    uniform_real_distribution<double> u(-extent, extent);
+    return Vec3d(u(rng), u(rng), u(rng));
+}
+
+
+// a rotating box and a sphere, drifting slowly past one another
+struct Body {
+    AffineBox<double,3> box;
+    Vec3d               axis;
+    Sphere<double,3>    sphere;
+    Vec3d               velocity;
+};
+
+
+vector<Body> random_bodies(rng_t& rng, int n) {
+    uniform_real_distribution<double> r(0.2, 1.5);
+    vector<Body> bodies;
+    for (int i = 0; i < n; ++i) {
+        Body b;
+        b.box.shape = Rect<double,3>::from_corners(random_point(rng, 1), random_point(rng, 1));
+        b.box.xf    = translation(random_point(rng, 1.5));
+        b.axis      = random_point(rng, 1).unit();
+        b.sphere    = Sphere<double,3>(random_point(rng, 2.5), r(rng));
+        b.velocity  = random_point(rng, 0.02);
+        bodies.push_back(b);
+    }
+    return bodies;
+}
+
+
+void step(Body& b) {
+    Vec3d c = b.box.xf * Vec3d(0.);
+    b.box.xf = translation(c) * rotation(b.axis, 0.01) * translation(-c) * b.box.xf;
+    b.sphere.center += b.velocity;
+}
+
+
+TEST(TEST_MODULE_NAME, coherent_pairs) {
+    rng_t rng(RANDOM_SEED);
+    auto bodies = random_bodies(rng, 400);
+    IntersectionCache<double,3,index_t> cache;
+    Intersector<double,3> cold;
+    // iterations taken, by whether the shapes overlapped
+    index_t warm_iters[2] = {0, 0};
+    index_t cold_iters[2] = {0, 0};
+    index_t n_tests[2]    = {0, 0};
+    const int frames = 40;
+    for (int f = 0; f < frames; ++f) {
+        for (index_t i = 0; i < (index_t) bodies.size(); ++i) {
+            const Body& b = bodies[i];
+            bool hit = cache.intersects(i, b.box, b.sphere);
+            // a fresh intersector every time, so nothing is carried over
+            cold = Intersector<double,3>();
+            EXPECT_EQ(hit, cold.intersects(b.box, b.sphere));
+            if (f > 0) {
+                // the first frame has nothing to start from
+                warm_iters[hit] += cache.intersector().iterations;
+                cold_iters[hit] += cold.iterations;
+                n_tests[hit]    += 1;
+            }
+        }
+        EXPECT_EQ(cache.end_frame(), 0);
+        for (Body& b : bodies) step(b);
+    }
+    EXPECT_EQ(cache.size(), (index_t) bodies.size());
+    EXPECT_EQ(cache.frame(), (uint64_t) frames);
+    // both outcomes are well represented
+    EXPECT_GT(n_tests[0], 1000);
+    EXPECT_GT(n_tests[1], 1000);
+    // most pairs finish right away
+    EXPECT_LT(warm_iters[0], 1.1 * n_tests[0]);
+    EXPECT_LT(warm_iters[1], 1.3 * n_tests[1]);
+    // overlapping pairs take several iterations from a cold start
+    EXPECT_LT(2 * warm_iters[1], cold_iters[1]);
+}
+
+
+TEST(TEST_MODULE_NAME, agrees_with_exact) {
+    // warm starts from a pair's own history never change the answer,
+    // even when the shapes jump far between tests
+    rng_t rng(RANDOM_SEED + 1);
+    uniform_real_distribution<double> r(0.1, 1.5);
+    IntersectionCache<double,3,pair<int,int>> cache;
+    for (int i = 0; i < 20000; ++i) {
+        pair<int,int> key(i % 7, i % 13);
+        Sphere<double,3>  s(random_point(rng, 2), r(rng));
+        Capsule<double,3> c(random_point(rng, 2), random_point(rng, 2), r(rng));
+        double d = c.sdf(s.center) - s.radius;
+        bool hit = cache.intersects(key, c, s);
+        if (std::abs(d) > 1e-6) {
+            EXPECT_EQ(hit, d < 0);
+        }
+        // the virtual path shares the cache
+        Sphere<double,3> s2(s.center + random_point(rng, 0.01), s.radius);
+        double d2 = c.sdf(s2.center) - s2.radius;
+        bool hit2 = cache.intersects(key, as_any_convex(c), as_any_convex(s2));
+        if (std::abs(d2) > 1e-6) {
+            EXPECT_EQ(hit2, d2 < 0);
+        }
+    }
+    EXPECT_EQ(cache.size(), 7 * 13);
+}
+
+
+TEST(TEST_MODULE_NAME, eviction) {
+    IntersectionCache<double,2> cache;
+    Sphere<double,2> a(Vec2d(0.), 1.);
+    Sphere<double,2> b(Vec2d(1.5, 0.), 1.);
+    Sphere<double,2> c(Vec2d(5., 0.), 1.);
+    EXPECT_TRUE (cache.intersects({0, 1}, a, b));
+    EXPECT_FALSE(cache.intersects({0, 2}, a, c));
+    EXPECT_TRUE (cache.intersects({1, 0}, b, a));
+    EXPECT_EQ(cache.size(), 3);
+    EXPECT_EQ(cache.end_frame(), 0);
+
+    // only {0, 1} is tested this frame
+    EXPECT_TRUE(cache.intersects({0, 1}, a, b));
+    EXPECT_EQ(cache.end_frame(1), 0);
+    EXPECT_EQ(cache.size(), 3);
+    EXPECT_TRUE(cache.intersects({0, 1}, a, b));
+    // the others have gone two frames untested
+    EXPECT_EQ(cache.end_frame(1), 2);
+    EXPECT_TRUE (cache.contains({0, 1}));
+    EXPECT_FALSE(cache.contains({0, 2}));
+    EXPECT_FALSE(cache.contains({1, 0}));
+
+    EXPECT_TRUE (cache.erase({0, 1}));
+    EXPECT_FALSE(cache.erase({0, 1}));
+    EXPECT_EQ(cache.size(), 0);
+    cache.intersects({3, 4}, a, c);
+    cache.clear();
+    EXPECT_EQ(cache.size(), 0);
+    EXPECT_EQ(cache.frame(), 3u);
+}
+
+
+// exposes whether a warm start is waiting to be consumed.
+struct SeedIntersector : public Intersector<double,2> {
+    bool seeded() const { return seed_n > 0; }
+};
+
+
+TEST(TEST_MODULE_NAME, distance_discards_warm_start) {
+    Sphere<double,2> a(Vec2d(0.), 1.);
+    Sphere<double,2> b(Vec2d(1.5, 0.), 1.);
+    SeedIntersector gjk;
+    EXPECT_TRUE(gjk.intersects(a, b));
+    IntersectorWarmStart<double,2> w = gjk.warm_start_state(true);
+    ASSERT_GT(w.n, 0);
+
+    gjk.warm_start(w);
+    EXPECT_TRUE(gjk.seeded());
+    EXPECT_TRUE(gjk.distance(a, b).overlapping);
+    EXPECT_FALSE(gjk.seeded());
+
+    // an overlap test consumes it, too
+    gjk.warm_start(w);
+    EXPECT_TRUE(gjk.intersects(a, b));
+    EXPECT_FALSE(gjk.seeded());
+}
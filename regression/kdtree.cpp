@@ -0,0 +1,789 @@
+#define TEST_MODULE_NAME KDTree
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <pcg_random.hpp>
+#include <gtest/gtest.h>
+#include <geomc/shape/Rect.h>
+#include <geomc/shape/Sphere.h>
+#include <geomc/shape/Frustum.h>
+#include <geomc/shape/Transformed.h>
+#include <geomc/shape/KDTree.h>
+#include <geomc/shape/KDTreeView.h>
+
+using namespace geom;
+using namespace std;
+
+typedef pcg64 rng_t;
+
+#define RANDOM_SEED 1973210958109245ULL
+
+template <index_t N, typename Object>
+using Tree = KDTree<double, N, Object>;
+
+template <index_t N, typename Object>
+using Helper = detail::ShapeIndexHelper<double, N, Object>;
+
+
+template <index_t N>
+Vec<double,N> rnd_pt(rng_t* rng) {
+    std::uniform_real_distribution<double> u(-10, 10);
+    Vec<double,N> p;
+    for (index_t i = 0; i < N; ++i) p[i] = u(*rng);
+    return p;
+}
+
+
+template <index_t N>
+Rect<double,N> rnd_box(rng_t* rng) {
+    std::uniform_real_distribution<double> s(0, 1);
+    Vec<double,N> dims;
+    for (index_t i = 0; i < N; ++i) dims[i] = s(*rng);
+    return Rect<double,N>::from_center(rnd_pt<N>(rng), dims);
+}
+
+
+// verify the structural invariants of the flat node layout.
+template <index_t N, typename Object>
+void check_layout(const Tree<N,Object>& tree) {
+    typedef typename Tree<N,Object>::const_node_iterator it_t;
+    typedef Helper<N,Object> helper_t;
+    const auto& params = tree.getStructureParams();
+    it_t root = tree.begin();
+    EXPECT_EQ(-it_t(root), tree.end());
+    EXPECT_EQ(root.nobjects(), tree.nobjects());
+    index_t n_nodes     = 0;
+    index_t n_leaf_objs = 0;
+    for (it_t i = tree.begin(); i != tree.end(); ++i) {
+        ++n_nodes;
+        // bounds contain all objects
+        for (auto o = i.objects_begin(); o != i.objects_end(); ++o) {
+            EXPECT_TRUE(i.bound().contains(helper_t::bounds(*o)));
+        }
+        if (i.is_leaf()) {
+            EXPECT_LE(i.nobjects(), params.leaf_arity);
+            n_leaf_objs += i.nobjects();
+            continue;
+        }
+        // children tile the parent's objects, in order
+        auto o = i.objects_begin();
+        index_t n_kids = 0;
+        for (it_t c = i.begin(); c != i.end(); ++c) {
+            it_t parent = c;
+            EXPECT_EQ(-parent, i);
+            EXPECT_EQ(c.objects_begin(), o);
+            o = c.objects_end();
+            ++n_kids;
+        }
+        EXPECT_EQ(o, i.objects_end());
+        EXPECT_LE(n_kids, params.node_arity);
+    }
+    EXPECT_EQ(n_nodes, tree.nnodes());
+    EXPECT_EQ(n_leaf_objs, tree.nobjects());
+}
+
+
+// compare nearest-object queries against brute force.
+template <index_t N, typename Object>
+void check_nearest(const Tree<N,Object>& tree, rng_t* rng, index_t n_queries) {
+    typedef Helper<N,Object> helper_t;
+    std::vector<Object> objs(tree.begin().objects_begin(), tree.begin().objects_end());
+    for (index_t q = 0; q < n_queries; ++q) {
+        Vec<double,N> p = rnd_pt<N>(rng);
+        double best = std::numeric_limits<double>::max();
+        for (const Object& o : objs) {
+            best = std::min(best, helper_t::dist2(o, p));
+        }
+        EXPECT_EQ(helper_t::dist2(tree.nearest(p), p), best);
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, build_points) {
+    rng_t rng(RANDOM_SEED);
+    std::vector<Vec3d> pts;
+    for (index_t i = 0; i < 1000; ++i) pts.push_back(rnd_pt<3>(&rng));
+    Tree<3,Vec3d> tree(pts.data(), pts.size());
+    EXPECT_EQ(tree.nobjects(), 1000);
+    EXPECT_GT(tree.nnodes(), 1);
+    check_layout(tree);
+    check_nearest(tree, &rng, 250);
+}
+
+
+TEST(TEST_MODULE_NAME, build_boxes) {
+    rng_t rng(RANDOM_SEED);
+    std::vector<Rect<double,2>> boxes;
+    for (index_t i = 0; i < 500; ++i) boxes.push_back(rnd_box<2>(&rng));
+    Tree<2,Rect<double,2>> tree(boxes.begin(), boxes.end());
+    check_layout(tree);
+    check_nearest(tree, &rng, 250);
+}
+
+
+TEST(TEST_MODULE_NAME, build_strategies) {
+    rng_t rng(RANDOM_SEED);
+    std::vector<Vec3d> pts;
+    for (index_t i = 0; i < 400; ++i) pts.push_back(rnd_pt<3>(&rng));
+    Tree<3,Vec3d> tree(pts.data(), pts.size());
+    for (KDAxisChoice axis : {
+            KDAxisChoice::AXIS_LONGEST,
+            KDAxisChoice::AXIS_HIGHEST_VARIANCE,
+            KDAxisChoice::AXIS_CYCLICAL}) {
+        auto params = tree.getStructureParams();
+        params.axis = axis;
+        params.node_arity = 3;
+        params.leaf_arity = 5;
+        tree.rebalance(params);
+        check_layout(tree);
+        check_nearest(tree, &rng, 50);
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, coincident_points) {
+    std::vector<Vec3d> pts(100, Vec3d(1, 2, 3));
+    Tree<3,Vec3d> tree(pts.data(), pts.size());
+    check_layout(tree);
+    EXPECT_EQ(tree.nearest(Vec3d()), (Vec3d(1, 2, 3)));
+}
+
+
+TEST(TEST_MODULE_NAME, incremental_insert) {
+    rng_t rng(RANDOM_SEED);
+    Tree<3,Vec3d> tree;
+    for (index_t i = 0; i < 600; ++i) {
+        Vec3d p = rnd_pt<3>(&rng);
+        auto o = tree.insert(p);
+        EXPECT_EQ(*o, p);
+    }
+    EXPECT_EQ(tree.nobjects(), 600);
+    check_layout(tree);
+    check_nearest(tree, &rng, 250);
+}
+
+
+TEST(TEST_MODULE_NAME, erase_objects) {
+    rng_t rng(RANDOM_SEED);
+    std::vector<Rect<double,2>> boxes;
+    for (index_t i = 0; i < 300; ++i) boxes.push_back(rnd_box<2>(&rng));
+    Tree<2,Rect<double,2>> tree(boxes.data(), boxes.size());
+    // erase the first object of the first leaf, repeatedly
+    for (index_t k = 0; k < 150; ++k) {
+        auto leaf = tree.begin();
+        while (not leaf.is_leaf() or leaf.nobjects() == 0) ++leaf;
+        tree.erase(leaf.objects_begin(), leaf);
+    }
+    EXPECT_EQ(tree.nobjects(), 150);
+    check_layout(tree);
+    check_nearest(tree, &rng, 100);
+}
+
+
+TEST(TEST_MODULE_NAME, erase_nodes) {
+    rng_t rng(RANDOM_SEED);
+    std::vector<Vec3d> pts;
+    for (index_t i = 0; i < 800; ++i) pts.push_back(rnd_pt<3>(&rng));
+    Tree<3,Vec3d> tree(pts.data(), pts.size());
+    // remove a whole child subtree of the root
+    auto child = +tree.begin();
+    index_t n = child.nobjects();
+    tree.erase(child);
+    EXPECT_EQ(tree.nobjects(), 800 - n);
+    check_layout(tree);
+    check_nearest(tree, &rng, 100);
+    // flattening keeps all objects
+    auto root = tree.begin();
+    tree.flatten(root);
+    EXPECT_EQ(tree.nnodes(), 1);
+    EXPECT_EQ(tree.nobjects(), 800 - n);
+    check_nearest(tree, &rng, 20);
+    // clearing keeps none
+    tree.clear(tree.begin());
+    EXPECT_EQ(tree.nobjects(), 0);
+}
+
+
+TEST(TEST_MODULE_NAME, knn) {
+    typedef Tree<3,Vec3d>::KDNeighbor neighbor_t;
+    rng_t rng(RANDOM_SEED);
+    std::vector<Vec3d> pts;
+    for (index_t i = 0; i < 1000; ++i) pts.push_back(rnd_pt<3>(&rng));
+    Tree<3,Vec3d> tree(pts.data(), pts.size());
+    neighbor_t out[64];
+    std::vector<double> d2s;
+    for (index_t q = 0; q < 100; ++q) {
+        Vec3d p = rnd_pt<3>(&rng);
+        index_t k = 1 + q % 64;
+        EXPECT_EQ(tree.knn(p, k, out), k);
+        d2s.clear();
+        for (const Vec3d& x : pts) d2s.push_back(x.dist2(p));
+        std::sort(d2s.begin(), d2s.end());
+        for (index_t i = 0; i < k; ++i) {
+            EXPECT_EQ(out[i].dist2, d2s[i]);
+            EXPECT_EQ(out[i].object->dist2(p), d2s[i]);
+        }
+    }
+    // fewer objects than requested
+    Tree<3,Vec3d> small(pts.data(), 5);
+    EXPECT_EQ(small.knn(Vec3d(), 64, out), 5);
+    for (index_t i = 1; i < 5; ++i) EXPECT_LE(out[i - 1].dist2, out[i].dist2);
+}
+
+
+TEST(TEST_MODULE_NAME, within_radius) {
+    rng_t rng(RANDOM_SEED);
+    std::vector<Rect<double,2>> boxes;
+    for (index_t i = 0; i < 800; ++i) boxes.push_back(rnd_box<2>(&rng));
+    Tree<2,Rect<double,2>> tree(boxes.data(), boxes.size());
+    for (index_t q = 0; q < 100; ++q) {
+        Vec2d p  = rnd_pt<2>(&rng);
+        double r = (q % 10) * 1.5;
+        index_t expected = 0;
+        for (const auto& b : boxes) expected += b.dist2(p) <= r * r;
+        index_t found = 0;
+        tree.within_radius(p, r, [&](const Rect<double,2>& b) {
+            EXPECT_LE(b.dist2(p), r * r);
+            ++found;
+        });
+        EXPECT_EQ(found, expected);
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, in_rect) {
+    rng_t rng(RANDOM_SEED);
+    std::vector<Vec3d> pts;
+    for (index_t i = 0; i < 1000; ++i) pts.push_back(rnd_pt<3>(&rng));
+    Tree<3,Vec3d> tree(pts.data(), pts.size());
+    for (index_t q = 0; q < 100; ++q) {
+        Rect<double,3> region = Rect<double,3>::from_center(rnd_pt<3>(&rng), Vec3d((q % 10) * 2.));
+        index_t expected = 0;
+        for (const Vec3d& x : pts) expected += region.contains(x);
+        index_t found = 0;
+        tree.in_rect(region, [&](const Vec3d& x) {
+            EXPECT_TRUE(region.contains(x));
+            ++found;
+        });
+        EXPECT_EQ(found, expected);
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, median_pivot) {
+    rng_t rng(RANDOM_SEED);
+    std::vector<Vec3d> pts;
+    for (index_t i = 0; i < 1024; ++i) pts.push_back(rnd_pt<3>(&rng));
+    Tree<3,Vec3d> tree;
+    auto params = tree.getStructureParams();
+    params.pivot      = KDPivotChoice::PIVOT_MEDIAN;
+    params.node_arity = 2;
+    params.leaf_arity = 4;
+    tree = Tree<3,Vec3d>(pts.data(), pts.size(), params);
+    check_layout(tree);
+    check_nearest(tree, &rng, 100);
+    // a power-of-two population divides exactly in half at every level
+    for (auto i = tree.begin(); i != tree.end(); ++i) {
+        if (i.is_leaf()) {
+            EXPECT_EQ(i.nobjects(), 4);
+        }
+    }
+    // inserting splits with the median too
+    for (index_t i = 0; i < 200; ++i) {
+        Vec3d p = rnd_pt<3>(&rng);
+        EXPECT_EQ(*tree.insert(p), p);
+    }
+    check_layout(tree);
+    check_nearest(tree, &rng, 100);
+}
+
+
+template <index_t N, typename Object>
+double sah_cost(const Tree<N,Object>& tree) {
+    double cost = 0;
+    for (auto i = tree.begin(); i != tree.end(); ++i) {
+        double a = i.bound().measure_boundary();
+        cost += i.is_leaf() ? a * i.nobjects() : a;
+    }
+    return cost;
+}
+
+
+TEST(TEST_MODULE_NAME, sah_pivot) {
+    typedef Rect<double,3> box_t;
+    rng_t rng(RANDOM_SEED);
+    std::uniform_real_distribution<double> s(0, 1);
+    // a scattering of large boxes among many small ones
+    std::vector<box_t> boxes;
+    for (index_t i = 0; i < 2000; ++i) {
+        double size = (i % 50 == 0) ? 1 : 0.01;
+        boxes.push_back(box_t::from_center(rnd_pt<3>(&rng), Vec3d(s(rng), s(rng), s(rng)) * size));
+    }
+    Tree<3,box_t> mean_tree(boxes.data(), boxes.size());
+    auto params = mean_tree.getStructureParams();
+    params.pivot    = KDPivotChoice::PIVOT_SAH;
+    params.sah_bins = 8;
+    Tree<3,box_t> sah_tree(boxes.data(), boxes.size(), params);
+    EXPECT_EQ(sah_tree.getStructureParams().sah_bins, 8);
+    check_layout(sah_tree);
+    check_nearest(sah_tree, &rng, 100);
+    EXPECT_LT(sah_cost(sah_tree), sah_cost(mean_tree));
+
+    // ray queries agree with brute force
+    Rect<double,1> fwd(0, std::numeric_limits<double>::infinity());
+    for (index_t q = 0; q < 100; ++q) {
+        Ray<double,3> ray(rnd_pt<3>(&rng) * 1.2, rnd_pt<3>(&rng));
+        index_t expected = 0;
+        for (const box_t& b : boxes) {
+            if (not (b.intersect(ray) & fwd).is_empty()) ++expected;
+        }
+        std::vector<Tree<3,box_t>::KDRayHit> hits;
+        EXPECT_EQ(sah_tree.all_hits(ray, &hits), expected);
+    }
+
+    // insertion splits with the SAH too
+    for (index_t i = 0; i < 300; ++i) sah_tree.insert(rnd_box<3>(&rng));
+    check_layout(sah_tree);
+    check_nearest(sah_tree, &rng, 100);
+
+    // coincident objects still divide
+    std::vector<Vec3d> same(100, Vec3d(1, 2, 3));
+    Tree<3,Vec3d> same_tree;
+    auto pt_params  = same_tree.getStructureParams();
+    pt_params.pivot = KDPivotChoice::PIVOT_SAH;
+    same_tree = Tree<3,Vec3d>(same.data(), same.size(), pt_params);
+    check_layout(same_tree);
+    EXPECT_EQ(same_tree.nobjects(), 100);
+}
+
+
+TEST(TEST_MODULE_NAME, parallel_build_deterministic) {
+    rng_t rng(RANDOM_SEED);
+    std::vector<Vec3d> pts;
+    for (index_t i = 0; i < 200000; ++i) pts.push_back(rnd_pt<3>(&rng));
+    for (KDPivotChoice pivot : {
+            KDPivotChoice::PIVOT_MEAN,
+            KDPivotChoice::PIVOT_MEDIAN,
+            KDPivotChoice::PIVOT_SAH}) {
+        Tree<3,Vec3d> serial;
+        auto params  = serial.getStructureParams();
+        params.pivot = pivot;
+        serial = Tree<3,Vec3d>(pts.data(), pts.size(), params);
+        for (index_t n_threads : {0, 1, 3, 8}) {
+            WorkPool pool(n_threads);
+            Tree<3,Vec3d> parallel(pts.data(), pts.size(), pool, params);
+            ASSERT_EQ(parallel.nnodes(), serial.nnodes());
+            auto a = serial.begin();
+            auto b = parallel.begin();
+            for (; a != serial.end(); ++a, ++b) {
+                EXPECT_EQ(a.bound(), b.bound());
+                EXPECT_EQ(a.is_leaf(), b.is_leaf());
+                EXPECT_EQ(a.objects_begin() - serial.begin().objects_begin(),
+                          b.objects_begin() - parallel.begin().objects_begin());
+                EXPECT_EQ(a.nobjects(), b.nobjects());
+            }
+            EXPECT_TRUE(std::equal(
+                serial.begin().objects_begin(),
+                serial.begin().objects_end(),
+                parallel.begin().objects_begin()));
+        }
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, batch_nearest) {
+    rng_t rng(RANDOM_SEED);
+    std::vector<Rect<double,2>> boxes;
+    for (index_t i = 0; i < 2000; ++i) boxes.push_back(rnd_box<2>(&rng));
+    Tree<2,Rect<double,2>> tree(boxes.data(), boxes.size());
+    // include some queries outside the tree's bounds
+    std::vector<Vec2d> qs;
+    for (index_t i = 0; i < 500; ++i) qs.push_back(rnd_pt<2>(&rng) * 1.5);
+    std::vector<index_t> idx(qs.size());
+    std::vector<double>  d2s(qs.size());
+    tree.nearest(qs.data(), qs.size(), idx.data(), d2s.data());
+    auto objs = tree.begin().objects_begin();
+    for (size_t i = 0; i < qs.size(); ++i) {
+        const Rect<double,2>& single = tree.nearest(qs[i]);
+        EXPECT_EQ(objs[idx[i]].dist2(qs[i]), single.dist2(qs[i]));
+        EXPECT_EQ(d2s[i], single.dist2(qs[i]));
+    }
+    // distances are optional
+    std::vector<index_t> idx2(qs.size());
+    tree.nearest(qs.data(), qs.size(), idx2.data());
+    EXPECT_EQ(idx, idx2);
+}
+
+
+std::vector<Sphere<double,3>> rnd_spheres(rng_t* rng, index_t n) {
+    std::uniform_real_distribution<double> r(0.05, 0.5);
+    std::vector<Sphere<double,3>> sphs;
+    for (index_t i = 0; i < n; ++i) sphs.push_back(Sphere<double,3>(rnd_pt<3>(rng), r(*rng)));
+    return sphs;
+}
+
+
+TEST(TEST_MODULE_NAME, ray_hits) {
+    typedef Sphere<double,3> sph_t;
+    typedef Tree<3,sph_t>::KDRayHit hit_t;
+    rng_t rng(RANDOM_SEED);
+    std::vector<sph_t> sphs = rnd_spheres(&rng, 1000);
+    Tree<3,sph_t> tree(sphs.data(), sphs.size());
+    std::vector<hit_t> hits;
+    index_t n_hit = 0;
+    for (index_t q = 0; q < 200; ++q) {
+        // include some axis-aligned rays
+        Vec3d d = rnd_pt<3>(&rng);
+        if (q % 10 == 0) d = Vec3d(0, 0, 1);
+        Ray<double,3> ray(rnd_pt<3>(&rng) * 1.2, d);
+        // brute force
+        double best_s = std::numeric_limits<double>::infinity();
+        index_t expected = 0;
+        Rect<double,1> fwd(0, std::numeric_limits<double>::infinity());
+        for (const sph_t& s : sphs) {
+            Rect<double,1> h = s.intersect(ray) & fwd;
+            if (not h.is_empty()) {
+                ++expected;
+                best_s = std::min(best_s, h.lo);
+            }
+        }
+        auto first = tree.first_hit(ray);
+        EXPECT_EQ(first.has_value(), expected > 0);
+        if (first) {
+            EXPECT_EQ(first->s.lo, best_s);
+            ++n_hit;
+        }
+        hits.clear();
+        EXPECT_EQ(tree.all_hits(ray, &hits), expected);
+        for (size_t i = 1; i < hits.size(); ++i) {
+            EXPECT_LE(hits[i - 1].s.lo, hits[i].s.lo);
+        }
+        if (first) {
+            EXPECT_EQ(hits.front().s.lo, first->s.lo);
+        }
+    }
+    // make sure the test is meaningful
+    EXPECT_GT(n_hit, 20);
+}
+
+
+TEST(TEST_MODULE_NAME, wide_nodes) {
+    // arities beyond the inline scratch capacity
+    typedef Sphere<double,3> sph_t;
+    typedef Tree<3,Vec3d>::KDNeighbor neighbor_t;
+    rng_t rng(RANDOM_SEED);
+    std::vector<Vec3d> pts;
+    for (index_t i = 0; i < 5000; ++i) pts.push_back(rnd_pt<3>(&rng));
+    Tree<3,Vec3d> tree;
+    auto params = tree.getStructureParams();
+    params.node_arity = 48;
+    params.leaf_arity = 40;
+    tree = Tree<3,Vec3d>(pts.data(), pts.size(), params);
+    check_layout(tree);
+    check_nearest(tree, &rng, 100);
+    index_t widest = 0;
+    for (auto i = tree.begin(); i != tree.end(); ++i) {
+        index_t n_kids = 0;
+        for (auto c = i.begin(); c != i.end(); ++c) ++n_kids;
+        widest = std::max(widest, n_kids);
+    }
+    EXPECT_GT(widest, (Tree<3,Vec3d>::InlineArity));
+    
+    neighbor_t out[20];
+    std::vector<double> d2s;
+    for (index_t q = 0; q < 20; ++q) {
+        Vec3d p = rnd_pt<3>(&rng);
+        EXPECT_EQ(tree.knn(p, 20, out), 20);
+        d2s.clear();
+        for (const Vec3d& x : pts) d2s.push_back(x.dist2(p));
+        std::sort(d2s.begin(), d2s.end());
+        for (index_t i = 0; i < 20; ++i) EXPECT_EQ(out[i].dist2, d2s[i]);
+    }
+    for (index_t i = 0; i < 500; ++i) tree.insert(rnd_pt<3>(&rng));
+    check_layout(tree);
+    check_nearest(tree, &rng, 100);
+    
+    std::vector<sph_t> sphs = rnd_spheres(&rng, 1000);
+    Tree<3,sph_t> sph_tree;
+    auto sph_params = sph_tree.getStructureParams();
+    sph_params.node_arity = 64;
+    sph_params.leaf_arity = 2;
+    sph_tree = Tree<3,sph_t>(sphs.data(), sphs.size(), sph_params);
+    check_layout(sph_tree);
+    Rect<double,1> fwd(0, std::numeric_limits<double>::infinity());
+    for (index_t q = 0; q < 50; ++q) {
+        Ray<double,3> ray(rnd_pt<3>(&rng) * 1.2, rnd_pt<3>(&rng));
+        double best_s = std::numeric_limits<double>::infinity();
+        for (const sph_t& s : sphs) {
+            Rect<double,1> h = s.intersect(ray) & fwd;
+            if (not h.is_empty()) best_s = std::min(best_s, h.lo);
+        }
+        auto first = sph_tree.first_hit(ray);
+        EXPECT_EQ(first.has_value(), best_s < fwd.hi);
+        if (first) {
+            EXPECT_EQ(first->s.lo, best_s);
+        }
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, frustum_cull) {
+    typedef Sphere<double,3> sph_t;
+    rng_t rng(RANDOM_SEED);
+    std::vector<sph_t> sphs = rnd_spheres(&rng, 1000);
+    std::vector<Vec3d> pts;
+    for (index_t i = 0; i < 1000; ++i) pts.push_back(rnd_pt<3>(&rng));
+    Tree<3,sph_t> sph_tree(sphs.data(), sphs.size());
+    Tree<3,Vec3d> pt_tree(pts.data(), pts.size());
+
+    Frustum<Rect<double,2>> f(Rect<double,2>(Vec2d(-0.5), Vec2d(0.5)), 0.5, 12);
+    for (index_t q = 0; q < 10; ++q) {
+        Vec3d axis = rnd_pt<3>(&rng);
+        Transformed<Frustum<Rect<double,2>>> view(
+            f,
+            rotation(axis, q * 0.7) * translation(Vec3d(0, 0, -6)));
+        Intersector<double,3> gjk;
+        index_t expected = 0;
+        for (const sph_t& s : sphs) {
+            expected += gjk.intersects(as_any_convex(s), as_any_convex(view));
+        }
+        index_t found = 0;
+        sph_tree.frustum_cull(view, [&](const sph_t&) { ++found; });
+        EXPECT_EQ(found, expected);
+        EXPECT_GT(found, 0);
+
+        expected = 0;
+        for (const Vec3d& p : pts) expected += view.contains(p);
+        found = 0;
+        pt_tree.frustum_cull(view, [&](const Vec3d& p) {
+            EXPECT_TRUE(view.contains(p));
+            ++found;
+        });
+        EXPECT_EQ(found, expected);
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, refit_and_rebalance_degraded) {
+    rng_t rng(RANDOM_SEED);
+    std::vector<Vec3d> pts;
+    for (index_t i = 0; i < 4000; ++i) pts.push_back(rnd_pt<3>(&rng));
+    Tree<3,Vec3d> tree(pts.data(), pts.size());
+    // nothing has moved yet
+    EXPECT_EQ(tree.rebalance_degraded(), 0);
+
+    // jiggle every object slightly; bounds grow a little
+    std::uniform_real_distribution<double> jiggle(-0.05, 0.05);
+    for (auto o = tree.begin().objects_begin(); o != tree.begin().objects_end(); ++o) {
+        *o += Vec3d(jiggle(rng), jiggle(rng), jiggle(rng));
+    }
+    tree.refit();
+    check_layout(tree);
+    check_nearest(tree, &rng, 100);
+    EXPECT_EQ(tree.rebalance_degraded(), 0);
+
+    // shuffle the objects of one subtree within its own box. only that subtree degrades.
+    auto child = +tree.begin();
+    Rect<double,3> child_box = child.bound();
+    auto sibling = child;
+    ++sibling;
+    std::vector<Vec3d> sibling_objs(sibling.objects_begin(), sibling.objects_end());
+    for (auto o = child.objects_begin(); o != child.objects_end(); ++o) {
+        Vec3d s = rnd_pt<3>(&rng) / 20 + Vec3d(0.5);
+        *o = child_box.lo + s * child_box.dimensions();
+    }
+    tree.refit();
+    EXPECT_EQ(tree.rebalance_degraded(), 1);
+    // the rest of the tree is untouched
+    sibling = +tree.begin();
+    ++sibling;
+    EXPECT_TRUE(std::equal(sibling_objs.begin(), sibling_objs.end(), sibling.objects_begin()));
+    check_layout(tree);
+    check_nearest(tree, &rng, 100);
+
+    // scatter the objects of one subtree across the whole space
+    child = +tree.begin();
+    for (auto o = child.objects_begin(); o != child.objects_end(); ++o) {
+        *o = rnd_pt<3>(&rng);
+    }
+    tree.refit();
+    check_layout(tree);
+    check_nearest(tree, &rng, 100);
+
+    index_t n_nodes = tree.nnodes();
+    index_t rebuilt = tree.rebalance_degraded();
+    EXPECT_GT(rebuilt, 0);
+    check_layout(tree);
+    check_nearest(tree, &rng, 100);
+    EXPECT_EQ(tree.nobjects(), 4000);
+    // the tree is healthy again
+    EXPECT_EQ(tree.rebalance_degraded(), 0);
+    EXPECT_GT(tree.nnodes(), n_nodes / 2);
+}
+
+
+TEST(TEST_MODULE_NAME, snapshot_view) {
+    typedef KDTreeView<double,3,Vec3d> view_t;
+    rng_t rng(RANDOM_SEED);
+    std::vector<Vec3d> pts;
+    for (index_t i = 0; i < 5000; ++i) pts.push_back(rnd_pt<3>(&rng));
+    Tree<3,Vec3d> tree(pts.data(), pts.size());
+    std::ostringstream out;
+    size_t n_bytes = view_t::write(tree, out);
+    std::string bytes = out.str();
+    ASSERT_EQ(bytes.size(), n_bytes);
+
+    // load at two different addresses
+    const size_t align = view_t::Alignment;
+    const size_t cap   = (n_bytes + align - 1) / align * align;
+    void* a = std::aligned_alloc(align, cap);
+    void* b = std::aligned_alloc(align, cap);
+    std::memcpy(a, bytes.data(), n_bytes);
+    std::memcpy(b, bytes.data(), n_bytes);
+    view_t va(a, n_bytes);
+    std::memset(a, 0, n_bytes);
+    std::free(a);
+    view_t vb(b, n_bytes);
+    EXPECT_EQ(vb.nobjects(), tree.nobjects());
+    EXPECT_EQ(vb.nnodes(),   tree.nnodes());
+    EXPECT_EQ(vb.bounds(),   tree.begin().bound());
+    for (index_t q = 0; q < 500; ++q) {
+        Vec3d p = rnd_pt<3>(&rng) * 1.2;
+        EXPECT_EQ(vb.nearest(p), tree.nearest(p));
+    }
+
+    // mismatched or damaged snapshots are refused
+    EXPECT_THROW((KDTreeView<double,3,Rect<double,3>>(b, n_bytes)), GeomException);
+    EXPECT_THROW((KDTreeView<double,2,Vec2d>(b, n_bytes)), GeomException);
+    EXPECT_THROW(view_t(b, n_bytes - 1), GeomException);
+    EXPECT_THROW(view_t(static_cast<char*>(b) + 8, n_bytes - 8), GeomException);
+    static_cast<char*>(b)[0] = 'x';
+    EXPECT_THROW(view_t(b, n_bytes), GeomException);
+    std::free(b);
+    
+    // a failed stream is reported
+    std::ofstream closed;
+    EXPECT_THROW(view_t::write(tree, closed), GeomException);
+    
+    // objects which would hold a pointer into the writer's memory are refused
+    static_assert(    detail::KDSnapshotStorable<Vec3d>::value);
+    static_assert(    detail::KDSnapshotStorable<std::pair<Vec3d,int>>::value);
+    static_assert(not detail::KDSnapshotStorable<const Vec3d*>::value);
+    static_assert(not detail::KDSnapshotStorable<std::pair<Vec3d,int*>>::value);
+    static_assert(not detail::KDSnapshotStorable<std::pair<const char*,Vec3d>>::value);
+    static_assert(not detail::KDSnapshotStorable<std::pair<Vec3d,std::pair<int,int*>>>::value);
+}
+
+
+TEST(TEST_MODULE_NAME, snapshot_mmap) {
+    typedef Sphere<double,3> sph_t;
+    typedef KDTreeView<double,3,sph_t> view_t;
+    rng_t rng(RANDOM_SEED);
+    std::vector<sph_t> sphs = rnd_spheres(&rng, 2000);
+    Tree<3,sph_t> tree(sphs.data(), sphs.size());
+    std::string path = testing::TempDir() + "geomc_kdtree_snapshot.kdt";
+    {
+        std::ofstream out(path, std::ios::binary);
+        view_t::write(tree, out);
+    }
+    int fd = open(path.c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    size_t size = lseek(fd, 0, SEEK_END);
+    void* data  = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NE(data, MAP_FAILED);
+    view_t view(data, size);
+    EXPECT_EQ(view.nobjects(), sphs.size());
+    for (index_t q = 0; q < 200; ++q) {
+        Vec3d p = rnd_pt<3>(&rng);
+        EXPECT_EQ(view.nearest(p), tree.nearest(p));
+    }
+    munmap(data, size);
+    close(fd);
+    std::remove(path.c_str());
+}
+
+
+TEST(TEST_MODULE_NAME, query_stats) {
+    typedef KDTree<double,3,Vec3d,void*,true> stats_tree_t;
+    rng_t rng(RANDOM_SEED);
+    std::vector<Vec3d> pts;
+    for (index_t i = 0; i < 4000; ++i) pts.push_back(rnd_pt<3>(&rng));
+    stats_tree_t tree(pts.data(), pts.size());
+    Tree<3,Vec3d> plain(pts.data(), pts.size());
+    EXPECT_EQ(tree.query_stats().queries, 0);
+
+    size_t nodes_visited = 0;
+    for (index_t q = 0; q < 50; ++q) {
+        Vec3d p = rnd_pt<3>(&rng);
+        EXPECT_EQ(tree.nearest(p), plain.nearest(p));
+        const KDQueryStats& st = tree.last_query_stats();
+        EXPECT_EQ(st.queries, 1);
+        EXPECT_GE(st.nodes_visited, 2);
+        EXPECT_LE(st.nodes_visited, tree.nnodes());
+        EXPECT_GE(st.leaves_scanned, 1);
+        EXPECT_GE(st.object_tests, st.leaves_scanned);
+        EXPECT_LE(st.object_tests, tree.nobjects());
+        EXPECT_GE(st.max_depth, 1);
+        nodes_visited += st.nodes_visited;
+    }
+    EXPECT_EQ(tree.query_stats().queries, 50);
+    EXPECT_EQ(tree.query_stats().nodes_visited, nodes_visited);
+
+    // a batch counts each of its points
+    std::vector<Vec3d>   qs(20);
+    std::vector<index_t> idx(20);
+    for (Vec3d& q : qs) q = rnd_pt<3>(&rng);
+    tree.nearest(qs.data(), qs.size(), idx.data());
+    EXPECT_EQ(tree.query_stats().queries, 70);
+
+    // visiting everything touches every node
+    tree.reset_query_stats();
+    index_t n_seen = 0;
+    tree.within_radius(Vec3d(), 100, [&](const Vec3d&) { ++n_seen; });
+    EXPECT_EQ(n_seen, tree.nobjects());
+    EXPECT_EQ(tree.query_stats().queries, 1);
+    EXPECT_EQ(tree.query_stats().nodes_visited, 1);
+    EXPECT_EQ(tree.query_stats().object_tests, 0);
+}
+
+
+TEST(TEST_MODULE_NAME, tree_statistics) {
+    rng_t rng(RANDOM_SEED);
+    std::vector<Vec3d> pts;
+    for (index_t i = 0; i < 3000; ++i) pts.push_back(rnd_pt<3>(&rng));
+    Tree<3,Vec3d> tree(pts.data(), pts.size());
+    auto st = tree.tree_statistics();
+    EXPECT_EQ(st.n_nodes,   tree.nnodes());
+    EXPECT_EQ(st.n_objects, tree.nobjects());
+    index_t n_leaves  = 0;
+    index_t n_objects = 0;
+    for (index_t n : st.leaf_depths) n_leaves += n;
+    for (size_t k = 0; k < st.leaf_occupancy.size(); ++k) n_objects += k * st.leaf_occupancy[k];
+    EXPECT_EQ(n_leaves,  st.n_leaves);
+    EXPECT_EQ(n_objects, st.n_objects);
+    EXPECT_EQ(st.leaf_depths.size(), st.max_depth + 1);
+    EXPECT_LE(st.leaf_occupancy.size(), tree.getStructureParams().leaf_arity + 1);
+    EXPECT_GT(st.mean_leaf_occupancy, 0);
+    EXPECT_GT(st.sah_cost, 0);
+    // point groups split by planes don't overlap
+    EXPECT_EQ(st.overlap_volume, 0);
+    EXPECT_GT(st.node_volume, 0);
+
+    // large boxes do
+    std::vector<Rect<double,3>> boxes;
+    for (index_t i = 0; i < 500; ++i) {
+        boxes.push_back(Rect<double,3>::from_center(rnd_pt<3>(&rng), Vec3d(4)));
+    }
+    Tree<3,Rect<double,3>> box_tree(boxes.data(), boxes.size());
+    auto box_st = box_tree.tree_statistics();
+    EXPECT_GT(box_st.overlap_volume, 0);
+    EXPECT_EQ(box_st.n_objects, 500);
+}
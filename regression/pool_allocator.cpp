@@ -0,0 +1,163 @@
+#define TEST_MODULE_NAME PoolAllocator
+
+#include <list>
+#include <optional>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <geomc/PoolAllocator.h>
+#include <geomc/Tree.h>
+#include <geomc/shape/KDTree.h>
+
+using namespace geom;
+using namespace std;
+
+typedef Tree<int, int, PoolAllocator<int>> pooled_tree_t;
+
+// destroyed after the main thread's chunk cache, at program exit.
+pooled_tree_t g_static_tree;
+
+
+inline index_t compare(int a, int b) {
+    return a - b;
+}
+
+
+TEST(TEST_MODULE_NAME, list_reuses_blocks) {
+    PoolAllocator<int> alloc;
+    list<int, PoolAllocator<int>> l(alloc);
+    for (int i = 0; i < 10000; ++i) l.push_back(i);
+    size_t chunks = alloc.chunk_count();
+    EXPECT_GT(chunks, 0u);
+
+    // freed nodes are handed out again before any new chunk is drawn.
+    for (int k = 0; k < 10; ++k) {
+        for (int i = 0; i < 5000; ++i) l.pop_front();
+        for (int i = 0; i < 5000; ++i) l.push_back(i);
+    }
+    EXPECT_EQ(alloc.chunk_count(), chunks);
+    EXPECT_EQ(l.size(), 10000u);
+}
+
+
+TEST(TEST_MODULE_NAME, chunks_return_to_thread) {
+    auto& cache = detail::PoolChunkCache::local();
+    size_t chunks;
+    size_t before;
+    {
+        PoolAllocator<double> alloc;
+        vector<double*> ptrs;
+        for (int i = 0; i < 10000; ++i) ptrs.push_back(alloc.allocate(1));
+        chunks = alloc.chunk_count();
+        before = cache.count;
+        // the arena releases its chunks when it dies, whether or not
+        // every block was individually freed.
+    }
+    EXPECT_EQ(cache.count, std::min(before + chunks, detail::PoolChunkCache::MaxChunks));
+
+    // a new arena draws on the thread's cache first.
+    if (cache.count > 0) {
+        size_t n = cache.count;
+        PoolAllocator<double> alloc;
+        alloc.deallocate(alloc.allocate(1), 1);
+        EXPECT_EQ(cache.count, n - 1);
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, large_and_aligned_requests) {
+    struct alignas(64) Wide { char c[64]; };
+    PoolAllocator<Wide> a;
+    Wide* w = a.allocate(3);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(w) % 64, 0u);
+    a.deallocate(w, 3);
+    EXPECT_EQ(a.chunk_count(), 0u);
+
+    PoolAllocator<int> b(a);
+    int* big = b.allocate(100000);
+    big[99999] = 1;
+    b.deallocate(big, 100000);
+    EXPECT_EQ(b.chunk_count(), 0u);
+    EXPECT_TRUE(a == b);
+    EXPECT_TRUE(a != PoolAllocator<Wide>());
+}
+
+
+TEST(TEST_MODULE_NAME, pooled_tree) {
+    vector<int> v;
+    for (int i = 0; i < 2000; ++i) v.push_back((i * 7919) % 2000);
+    pooled_tree_t t(v.begin(), v.end());
+
+    // split the root's items into a binary tree, a few levels deep.
+    vector<pooled_tree_t::subtree_t> leaves {t.root()};
+    for (int depth = 0; depth < 5; ++depth) {
+        vector<pooled_tree_t::subtree_t> next;
+        for (auto s : leaves) {
+            int lo = *min_element(s.items_begin(), s.items_end());
+            int hi = *max_element(s.items_begin(), s.items_end());
+            auto c = s.insert_child_node(depth);
+            auto d = c.split(compare, (lo + hi + 1) / 2, depth);
+            next.push_back(c);
+            next.push_back(d);
+        }
+        leaves = next;
+    }
+    EXPECT_EQ(t.item_count(), v.size());
+    EXPECT_GT(t.get_allocator().chunk_count(), 0u);
+
+    // a copy gets an arena of its own
+    pooled_tree_t u = t;
+    EXPECT_TRUE(u == t);
+    EXPECT_TRUE(u.get_allocator() != t.get_allocator());
+
+    // moving carries the arena along
+    PoolAllocator<int> ua = u.get_allocator();
+    pooled_tree_t w = std::move(u);
+    EXPECT_TRUE(w.get_allocator() == ua);
+    EXPECT_TRUE(w == t);
+
+    vector<int> items(w.root().items_begin(), w.root().items_end());
+    sort(items.begin(), items.end());
+    for (int i = 0; i < 2000; ++i) EXPECT_EQ(items[i], i);
+}
+
+
+TEST(TEST_MODULE_NAME, pooled_kdtree) {
+    typedef KDTree<double, 3, Vec3d, void*, false, PoolAllocator<Vec3d>> pooled_kdtree_t;
+    vector<Vec3d> pts;
+    for (int i = 0; i < 1000; ++i) {
+        pts.push_back(Vec3d(i % 10, (i / 10) % 10, i / 100));
+    }
+    PoolAllocator<Vec3d> alloc;
+    pooled_kdtree_t t(pts.begin(), pts.end(), alloc);
+    EXPECT_TRUE(t.get_allocator() == alloc);
+    EXPECT_EQ(t.nobjects(), 1000);
+    for (int i = 0; i < 50; ++i) t.insert(Vec3d(i + 0.5, 0.25, 0.25));
+    EXPECT_EQ(t.nobjects(), 1050);
+    EXPECT_EQ(t.nearest(Vec3d(3.1, 4.1, 5.9)), Vec3d(3, 4, 6));
+    EXPECT_EQ(t.nearest(Vec3d(40.4, 0.3, 0.2)), Vec3d(40.5, 0.25, 0.25));
+
+    // a copy gets an arena of its own
+    pooled_kdtree_t u = t;
+    EXPECT_TRUE(u.get_allocator() != t.get_allocator());
+    EXPECT_EQ(u.nearest(Vec3d(3.1, 4.1, 5.9)), Vec3d(3, 4, 6));
+}
+
+
+TEST(TEST_MODULE_NAME, arenas_outlive_chunk_cache) {
+    vector<int> v;
+    for (int i = 0; i < 5000; ++i) v.push_back(i);
+    // returns its chunks after this thread's cache is gone; see `g_static_tree`.
+    for (int i : v) g_static_tree.root().insert_item(i);
+    EXPECT_GT(g_static_tree.get_allocator().chunk_count(), 0u);
+
+    // a thread_local constructed before the thread's cache is destroyed after it.
+    std::thread worker([&v]() {
+        static thread_local std::optional<pooled_tree_t> t;
+        EXPECT_EQ(detail::PoolChunkCache::state(), detail::PoolChunkCache::State::Unborn);
+        t.emplace();
+        for (int i : v) t->root().insert_item(i);
+        EXPECT_EQ(detail::PoolChunkCache::state(), detail::PoolChunkCache::State::Alive);
+    });
+    worker.join();
+}
@@ -0,0 +1,236 @@
+#define TEST_MODULE_NAME RTree
+
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+#include <geomc/shape/RTree.h>
+#include <geomc/TreeSearch.h>
+
+using namespace geom;
+using namespace std;
+
+#define RANDOM_SEED 3314159826ULL
+
+typedef Rect<double,2>           box2d;
+typedef RTree<double,2,box2d>    rtree2d;
+
+
+vector<box2d> random_boxes(index_t n, double max_size, uint64_t seed=RANDOM_SEED) {
+    mt19937_64 rng(seed);
+    uniform_real_distribution<double> pos(0, 100);
+    uniform_real_distribution<double> size(0, max_size);
+    vector<box2d> v;
+    for (index_t i = 0; i < n; ++i) {
+        Vec2d p(pos(rng), pos(rng));
+        v.push_back(box2d::from_corners(p, p + Vec2d(size(rng), size(rng))));
+    }
+    return v;
+}
+
+
+// verify the bounds, fill, and balance of each node. return the depth of its leaves.
+template <typename S, typename Params>
+index_t check_node(S s, const Params& params, bool is_root, index_t* n_items) {
+    Rect<double,2> box;
+    index_t depth = 0;
+    if (s.node_count() > 0) {
+        EXPECT_LE(s.node_count(), params.max_entries);
+        if (not is_root) {
+            EXPECT_GE(s.node_count(), params.min_entries);
+        } else {
+            EXPECT_GE(s.node_count(), 2);
+        }
+        index_t d = -1;
+        for (S c = s.begin(); c != s.end(); ++c) {
+            EXPECT_TRUE(c.parent() == s);
+            index_t cd = check_node(c, params, false, n_items);
+            if (d >= 0) {
+                EXPECT_EQ(cd, d);
+            }
+            d = cd;
+            box |= *c;
+        }
+        depth = d + 1;
+    } else {
+        EXPECT_LE(s.item_count(), params.max_entries);
+        if (not is_root) {
+            EXPECT_GE(s.item_count(), 1);
+        }
+        for (auto i = s.items_begin(); i != s.items_end(); ++i) box |= i->bounds();
+        *n_items += s.item_count();
+    }
+    EXPECT_TRUE(box == *s);
+    return depth;
+}
+
+
+template <typename RT>
+void check_tree(const RT& t) {
+    index_t n = 0;
+    index_t depth = check_node(t.root(), t.params(), true, &n);
+    EXPECT_EQ(depth, t.height());
+    EXPECT_EQ(n, t.size());
+}
+
+
+template <typename I, typename F>
+vector<box2d> collect(I i, F f) {
+    vector<box2d> got;
+    for (; i != default_sentinel; ++i) got.push_back(*i);
+    sort(got.begin(), got.end(), f);
+    return got;
+}
+
+
+bool box_less(const box2d& a, const box2d& b) {
+    for (index_t k = 0; k < 2; ++k) {
+        if (a.lo[k] != b.lo[k]) return a.lo[k] < b.lo[k];
+    }
+    for (index_t k = 0; k < 2; ++k) {
+        if (a.hi[k] != b.hi[k]) return a.hi[k] < b.hi[k];
+    }
+    return false;
+}
+
+
+void check_queries(const rtree2d& t, const vector<box2d>& boxes, uint64_t seed) {
+    vector<box2d> queries = random_boxes(20, 25, seed);
+    for (const box2d& q : queries) {
+        vector<box2d> over, inside, around;
+        for (const box2d& b : boxes) {
+            bool o = true;
+            for (index_t k = 0; k < 2; ++k) {
+                if (b.hi[k] < q.lo[k] or q.hi[k] < b.lo[k]) o = false;
+            }
+            if (o)               over.push_back(b);
+            if (q.contains(b))   inside.push_back(b);
+            if (b.contains(q))   around.push_back(b);
+        }
+        sort(over.begin(),   over.end(),   box_less);
+        sort(inside.begin(), inside.end(), box_less);
+        sort(around.begin(), around.end(), box_less);
+        EXPECT_EQ(collect(t.overlapping(q),  box_less), over);
+        EXPECT_EQ(collect(t.contained_in(q), box_less), inside);
+        EXPECT_EQ(collect(t.containing(q),   box_less), around);
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, bulk_load) {
+    vector<box2d> boxes = random_boxes(20000, 2);
+    rtree2d t(boxes.begin(), boxes.end());
+    EXPECT_EQ(t.size(), 20000);
+    EXPECT_GE(t.height(), 3);
+    check_tree(t);
+    check_queries(t, boxes, 11);
+
+    // a batch which fits in one leaf
+    rtree2d small(boxes.begin(), boxes.begin() + 5);
+    EXPECT_EQ(small.height(), 0);
+    check_tree(small);
+
+    // nothing at all
+    rtree2d e;
+    EXPECT_TRUE(e.empty());
+    EXPECT_TRUE(e.overlapping(box2d(Vec2d(0.), Vec2d(100.))) == default_sentinel);
+}
+
+
+TEST(TEST_MODULE_NAME, insert) {
+    vector<box2d> boxes = random_boxes(5000, 5);
+    rtree2d t;
+    for (index_t i = 0; i < (index_t) boxes.size(); ++i) {
+        t.insert(boxes[i]);
+        if (i % 997 == 0) check_tree(t);
+    }
+    EXPECT_EQ(t.size(), 5000);
+    check_tree(t);
+    check_queries(t, boxes, 12);
+    for (index_t i = 0; i < 100; ++i) {
+        auto f = t.find(boxes[i]);
+        ASSERT_TRUE(f != t.objects_end());
+        EXPECT_TRUE(*f == boxes[i]);
+    }
+    EXPECT_TRUE(t.find(box2d(Vec2d(-5.), Vec2d(-4.))) == t.objects_end());
+}
+
+
+TEST(TEST_MODULE_NAME, insert_without_reinsertion) {
+    vector<box2d> boxes = random_boxes(3000, 5);
+    rtree2d::RStructureParams params;
+    params.max_entries      = 8;
+    params.min_entries      = 3;
+    params.reinsert_entries = 0;
+    rtree2d t(std::allocator<box2d>(), params);
+    t.insert(boxes.begin(), boxes.end());
+    check_tree(t);
+    check_queries(t, boxes, 13);
+}
+
+
+TEST(TEST_MODULE_NAME, erase) {
+    vector<box2d> boxes = random_boxes(4000, 5);
+    rtree2d t(boxes.begin(), boxes.begin() + 2000);
+    t.insert(boxes.begin() + 2000, boxes.end());
+    mt19937_64 rng(RANDOM_SEED);
+    shuffle(boxes.begin(), boxes.end(), rng);
+
+    vector<box2d> kept(boxes.begin() + 3000, boxes.end());
+    for (index_t i = 0; i < 3000; ++i) {
+        EXPECT_TRUE(t.erase(boxes[i]));
+        if (i % 499 == 0) check_tree(t);
+    }
+    EXPECT_FALSE(t.erase(boxes[0]));
+    EXPECT_EQ(t.size(), 1000);
+    check_tree(t);
+    check_queries(t, kept, 14);
+
+    for (const box2d& b : kept) EXPECT_TRUE(t.erase(b));
+    EXPECT_TRUE(t.empty());
+    EXPECT_EQ(t.height(), 0);
+    check_tree(t);
+
+    // the emptied tree can be reused
+    t.insert(kept.begin(), kept.begin() + 100);
+    check_tree(t);
+}
+
+
+TEST(TEST_MODULE_NAME, points_and_pairs) {
+    // degenerate boxes around points; every query box boundary counts
+    typedef pair<Vec3d, int> item_t;
+    mt19937_64 rng(RANDOM_SEED);
+    uniform_int_distribution<int> grid(0, 20);
+    vector<item_t> pts;
+    for (int i = 0; i < 3000; ++i) {
+        pts.push_back({Vec3d(grid(rng), grid(rng), grid(rng)), i});
+    }
+    RTree<double,3,item_t> t(pts.begin(), pts.begin() + 1500);
+    t.insert(pts.begin() + 1500, pts.end());
+
+    Rect<double,3> q(Vec3d(5.), Vec3d(10.));
+    vector<int> expect, got;
+    for (const item_t& p : pts) if (q.contains(p.first)) expect.push_back(p.second);
+    for (auto i = t.overlapping(q); i != default_sentinel; ++i) got.push_back(i->second);
+    sort(expect.begin(), expect.end());
+    sort(got.begin(), got.end());
+    EXPECT_EQ(got, expect);
+    EXPECT_GT(got.size(), 0u);
+}
+
+
+TEST(TEST_MODULE_NAME, nearest_with_tree_search) {
+    vector<box2d> boxes = random_boxes(2000, 3);
+    rtree2d t(boxes.begin(), boxes.end());
+    Vec2d p(50, 50);
+    auto i = best_first(
+        t.root(), p,
+        [](const rtree2d::const_subtree_t& s, const Vec2d& p) { return s->dist2(p); },
+        [](const box2d& b, const Vec2d& p) { return b.dist2(p); });
+    double best = numeric_limits<double>::infinity();
+    for (const box2d& b : boxes) best = min(best, b.dist2(p));
+    ASSERT_TRUE(i != default_sentinel);
+    EXPECT_EQ(i.distance(), best);
+}
@@ -0,0 +1,226 @@
+#define TEST_MODULE_NAME SpatialSort
+
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+#include <geomc/shape/SpatialSort.h>
+#include <geomc/shape/RTree.h>
+#include <geomc/shape/KDTree.h>
+#include <geomc/WorkPool.h>
+
+using namespace geom;
+using namespace std;
+
+#define RANDOM_SEED 6620913377ULL
+
+// the curves can be evaluated at compile time
+static_assert(morton_encode(array<index_t,2> {1, 0}) == 2);
+static_assert(morton_encode(array<index_t,2> {0, 1}) == 1);
+static_assert(morton_decode_array<3>(morton_encode(array<index_t,3> {5, 9, 1234567})) == array<index_t,3> {5, 9, 1234567});
+static_assert(hilbert_decode_array<2>(hilbert_encode(array<index_t,2> {77, 3})) == array<index_t,2> {77, 3});
+static_assert(hilbert_encode(array<index_t,2> {0, 0}) == 0);
+
+
+template <index_t N>
+Vec<index_t,N> random_cell(mt19937_64& rng) {
+    Vec<index_t,N> c;
+    for (index_t k = 0; k < N; ++k) c[k] = rng() & ((uint64_t(1) << curve_bits<N>) - 1);
+    return c;
+}
+
+
+template <index_t N>
+index_t manhattan(const Vec<index_t,N>& a, const Vec<index_t,N>& b) {
+    index_t d = 0;
+    for (index_t k = 0; k < N; ++k) d += std::abs(a[k] - b[k]);
+    return d;
+}
+
+
+// straightforward bit-at-a-time interleaving
+template <index_t N>
+uint64_t slow_morton(const Vec<index_t,N>& c) {
+    uint64_t key = 0;
+    for (index_t b = curve_bits<N> - 1; b >= 0; --b) {
+        for (index_t k = 0; k < N; ++k) key = (key << 1) | ((c[k] >> b) & 1);
+    }
+    return key;
+}
+
+
+template <index_t N>
+void check_curves() {
+    mt19937_64 rng(RANDOM_SEED + N);
+    for (int i = 0; i < 2000; ++i) {
+        Vec<index_t,N> c = random_cell<N>(rng);
+        EXPECT_EQ(morton_encode(c), slow_morton(c));
+        EXPECT_EQ(morton_decode<N>(morton_encode(c)), c);
+        EXPECT_EQ(hilbert_decode<N>(hilbert_encode(c)), c);
+    }
+    // consecutive Hilbert indices are adjacent cells, both at the start
+    // of the curve and anywhere along it
+    const uint64_t last_key = (curve_bits<N> * N == 64) ? ~uint64_t(0) : (uint64_t(1) << (curve_bits<N> * N)) - 1;
+    for (uint64_t k = 0; k < 4096; ++k) {
+        EXPECT_EQ(manhattan(hilbert_decode<N>(k), hilbert_decode<N>(k + 1)), 1) << k;
+    }
+    for (int i = 0; i < 2000; ++i) {
+        uint64_t k = rng() % last_key;
+        EXPECT_EQ(manhattan(hilbert_decode<N>(k), hilbert_decode<N>(k + 1)), 1) << k;
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, curves_2d) {
+    check_curves<2>();
+}
+
+
+TEST(TEST_MODULE_NAME, curves_3d) {
+    check_curves<3>();
+}
+
+
+TEST(TEST_MODULE_NAME, curves_5d) {
+    check_curves<5>();
+}
+
+
+TEST(TEST_MODULE_NAME, curve_keys) {
+    Rect<double,2> frame(Vec2d(-1.), Vec2d(1.));
+    EXPECT_EQ(morton_key(Vec2d(-1.), frame), 0u);
+    EXPECT_EQ(morton_key(Vec2d(1.), frame), ~uint64_t(0));
+    // outside points are clamped
+    EXPECT_EQ(hilbert_key(Vec2d(-5.), frame), hilbert_key(Vec2d(-1.), frame));
+    EXPECT_EQ(curve_key(SpatialCurve::CURVE_MORTON, Vec2d(0.3, -0.2), frame), morton_key(Vec2d(0.3, -0.2), frame));
+}
+
+
+TEST(TEST_MODULE_NAME, radix_sort) {
+    mt19937_64 rng(RANDOM_SEED);
+    for (uint64_t mask : {~uint64_t(0), uint64_t(0xFFF), uint64_t(0xFF00FF0000)}) {
+        vector<pair<uint64_t,int>> v;
+        for (int i = 0; i < 50000; ++i) v.push_back({rng() & mask, i});
+        vector<pair<uint64_t,int>> expect = v;
+        auto key = [](const pair<uint64_t,int>& x) { return x.first; };
+        stable_sort(expect.begin(), expect.end(), [](const auto& a, const auto& b) {
+            return a.first < b.first;
+        });
+
+        vector<pair<uint64_t,int>> serial = v;
+        radix_sort(serial.data(), serial.size(), key);
+        EXPECT_EQ(serial, expect);
+
+        WorkPool pool(3);
+        vector<pair<uint64_t,int>> par = v;
+        radix_sort(par.data(), par.size(), key, pool);
+        EXPECT_EQ(par, expect);
+    }
+    // trivial cases
+    vector<pair<uint64_t,int>> one {{5, 0}};
+    radix_sort(one.data(), 1, [](const auto& x) { return x.first; });
+    radix_sort(one.data(), 0, [](const auto& x) { return x.first; });
+    EXPECT_EQ(one[0].second, 0);
+}
+
+
+TEST(TEST_MODULE_NAME, spatial_sort_points) {
+    mt19937_64 rng(RANDOM_SEED);
+    uniform_real_distribution<double> u(-10, 10);
+    vector<Vec3d> pts;
+    for (int i = 0; i < 20000; ++i) pts.push_back(Vec3d(u(rng), u(rng), u(rng)));
+    Rect<double,3> frame;
+    for (const Vec3d& p : pts) frame |= p;
+
+    for (SpatialCurve curve : {SpatialCurve::CURVE_MORTON, SpatialCurve::CURVE_HILBERT}) {
+        vector<Vec3d> s = pts;
+        spatial_sort(s.data(), s.size(), curve);
+        for (size_t i = 1; i < s.size(); ++i) {
+            EXPECT_LE(curve_key(curve, s[i - 1], frame), curve_key(curve, s[i], frame));
+        }
+        vector<Vec3d> a = pts, b = s;
+        auto lex = [](const Vec3d& x, const Vec3d& y) {
+            return lexicographical_compare(x.begin(), x.end(), y.begin(), y.end());
+        };
+        sort(a.begin(), a.end(), lex);
+        sort(b.begin(), b.end(), lex);
+        EXPECT_EQ(a, b);
+
+        WorkPool pool(4);
+        vector<Vec3d> par = pts;
+        spatial_sort(par.data(), par.size(), pool, curve);
+        EXPECT_EQ(par, s);
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, presorted_rtree) {
+    typedef Rect<double,2> box2d;
+    mt19937_64 rng(RANDOM_SEED);
+    uniform_real_distribution<double> u(0, 100);
+    vector<box2d> boxes;
+    for (int i = 0; i < 10000; ++i) {
+        Vec2d p(u(rng), u(rng));
+        boxes.push_back(box2d(p, p + Vec2d(0.5)));
+    }
+    spatial_sort(boxes.data(), boxes.size(), [](const box2d& b) { return b.center(); });
+
+    RTree<double,2,box2d> t;
+    t.bulk_load(boxes.begin(), boxes.end(), true);
+    EXPECT_EQ(t.size(), 10000);
+    // the leaves hold consecutive runs of the sorted array
+    auto leaf = t.root();
+    while (leaf.node_count() > 0) leaf = leaf.begin();
+    EXPECT_TRUE(equal(leaf.items_begin(), leaf.items_end(), boxes.begin()));
+
+    box2d q(Vec2d(20.), Vec2d(35.));
+    index_t expect = 0, got = 0;
+    for (const box2d& b : boxes) expect += b.intersects(q) ? 1 : 0;
+    for (auto i = t.overlapping(q); i != default_sentinel; ++i) ++got;
+    EXPECT_EQ(got, expect);
+}
+
+
+TEST(TEST_MODULE_NAME, presorted_kdtree) {
+    typedef KDTree<double,3,Vec3d> tree_t;
+    mt19937_64 rng(RANDOM_SEED);
+    uniform_real_distribution<double> u(-10, 10);
+    vector<Vec3d> pts;
+    for (int i = 0; i < 10000; ++i) pts.push_back(Vec3d(u(rng), u(rng), u(rng)));
+    spatial_sort(pts.data(), pts.size());
+
+    tree_t t;
+    t.bulk_load(pts.begin(), pts.end(), true);
+    EXPECT_EQ(t.nobjects(), 10000);
+    // the objects keep their sorted order, and no node is over its arity
+    EXPECT_TRUE(equal(pts.begin(), pts.end(), t.begin().objects_begin()));
+    const auto& params = t.getStructureParams();
+    for (auto i = t.begin(); i != t.end(); ++i) {
+        EXPECT_TRUE(i.bound().contains(*i.objects_begin()));
+        if (i.is_leaf()) {
+            EXPECT_GT(i.nobjects(), 0);
+            EXPECT_LE(i.nobjects(), params.leaf_arity);
+        } else {
+            index_t n_kids = 0;
+            for (auto c = i.begin(); c != i.end(); ++c) ++n_kids;
+            EXPECT_LE(n_kids, params.node_arity);
+        }
+    }
+
+    tree_t built(pts.begin(), pts.end());
+    for (int q = 0; q < 200; ++q) {
+        Vec3d p(u(rng), u(rng), u(rng));
+        EXPECT_EQ(t.nearest(p), built.nearest(p));
+    }
+
+    // the tree can still be edited, and small inputs make a single leaf
+    t.insert(Vec3d(20.));
+    EXPECT_EQ(t.nearest(Vec3d(21.)), Vec3d(20.));
+    tree_t small;
+    small.bulk_load(pts.begin(), pts.begin() + 3, true);
+    EXPECT_EQ(small.nobjects(), 3);
+    EXPECT_TRUE(small.begin().is_leaf());
+    small.bulk_load(pts.begin(), pts.begin(), true);
+    EXPECT_EQ(small.nobjects(), 0);
+}
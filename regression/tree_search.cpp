@@ -0,0 +1,185 @@
+#define TEST_MODULE_NAME TreeSearch
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+#include <geomc/Tree.h>
+#include <geomc/ArrayTree.h>
+#include <geomc/TreeSearch.h>
+
+using namespace geom;
+using namespace std;
+
+#define RANDOM_SEED 2219473310984ULL
+
+// each node keeps the range of the items below it.
+typedef pair<double,double> interval_t;
+
+
+inline index_t compare(double a, double b) {
+    return (a < b) ? -1 : ((a > b) ? 1 : 0);
+}
+
+
+// split `s` in half by value, recursively, until its leaves hold few items.
+template <typename S>
+void build(S s) {
+    if (s.item_count() <= 8) return;
+    vector<double> v(s.items_begin(), s.items_end());
+    nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    S a = s.insert_child_node(interval_t());
+    S b = a.split(compare, v[v.size() / 2], interval_t());
+    build(a);
+    build(b);
+}
+
+
+template <typename S>
+void fill_bounds(S s) {
+    auto [lo, hi] = minmax_element(s.items_begin(), s.items_end());
+    *s = (s.item_count() > 0) ? interval_t(*lo, *hi) : interval_t(1, -1);
+    for (S c = s.begin(); c != s.end(); ++c) fill_bounds(c);
+}
+
+
+template <typename TreeT>
+TreeT make_tree(const vector<double>& items) {
+    TreeT t(items.begin(), items.end());
+    build(t.root());
+    fill_bounds(t.root());
+    return t;
+}
+
+
+template <typename S>
+double interval_dist(const S& s, double x) {
+    const interval_t& r = *s;
+    if (r.first > r.second) return numeric_limits<double>::infinity();
+    return max({r.first - x, x - r.second, 0.});
+}
+
+
+inline double item_dist(double item, double x) {
+    return std::abs(item - x);
+}
+
+
+vector<double> random_items(int n) {
+    mt19937_64 rng(RANDOM_SEED);
+    uniform_real_distribution<double> u(0, 1000);
+    vector<double> v;
+    for (int i = 0; i < n; ++i) v.push_back(u(rng));
+    return v;
+}
+
+
+template <typename TreeT>
+void check_best_first() {
+    typedef typename TreeT::subtree_t subtree_t;
+    vector<double> items = random_items(1000);
+    TreeT t = make_tree<TreeT>(items);
+
+    for (double x : {-5., 0., 137.2, 500., 999.9, 2000.}) {
+        vector<double> expect = items;
+        sort(expect.begin(), expect.end(), [x](double a, double b) {
+            return item_dist(a, x) < item_dist(b, x);
+        });
+
+        vector<double> got;
+        double last = 0;
+        for (auto i = best_first(t.root(), x, interval_dist<subtree_t>, item_dist);
+                i != std::default_sentinel;
+                ++i) {
+            EXPECT_GE(i.distance(), last);
+            EXPECT_EQ(i.distance(), item_dist(*i, x));
+            last = i.distance();
+            got.push_back(*i);
+        }
+        ASSERT_EQ(got.size(), expect.size());
+        for (size_t k = 0; k < got.size(); ++k) {
+            EXPECT_EQ(item_dist(got[k], x), item_dist(expect[k], x));
+        }
+    }
+}
+
+
+template <typename TreeT>
+void check_nearest_items() {
+    typedef typename TreeT::subtree_t subtree_t;
+    vector<double> items = random_items(1000);
+    TreeT t = make_tree<TreeT>(items);
+
+    double x = 421.5;
+    vector<double> expect = items;
+    sort(expect.begin(), expect.end(), [x](double a, double b) {
+        return item_dist(a, x) < item_dist(b, x);
+    });
+
+    // the search is lazy; finding one item opens only a few nodes.
+    index_t n_bounds = 0;
+    auto counting_bound = [&n_bounds](const subtree_t& s, double x) {
+        ++n_bounds;
+        return interval_dist(s, x);
+    };
+    vector<typename subtree_t::item_iterator> found;
+    index_t n = nearest_items(t.root(), x, counting_bound, item_dist, 10, back_inserter(found));
+    EXPECT_EQ(n, 10);
+    ASSERT_EQ(found.size(), 10u);
+    for (index_t k = 0; k < n; ++k) {
+        EXPECT_EQ(*found[k], expect[k]);
+    }
+    EXPECT_LT(n_bounds, 50);
+
+    // asking for more than there are
+    found.clear();
+    n = nearest_items(t.root(), x, interval_dist<subtree_t>, item_dist, 5000, back_inserter(found));
+    EXPECT_EQ(n, 1000);
+
+    // an empty tree
+    TreeT e;
+    found.clear();
+    n = nearest_items(e.root(), x, interval_dist<subtree_t>, item_dist, 3, back_inserter(found));
+    EXPECT_EQ(n, 0);
+}
+
+
+TEST(TEST_MODULE_NAME, best_first_tree) {
+    check_best_first<Tree<interval_t, double>>();
+}
+
+
+TEST(TEST_MODULE_NAME, best_first_array_tree) {
+    check_best_first<ArrayTree<interval_t, double>>();
+}
+
+
+TEST(TEST_MODULE_NAME, nearest_items_tree) {
+    check_nearest_items<Tree<interval_t, double>>();
+}
+
+
+TEST(TEST_MODULE_NAME, nearest_items_array_tree) {
+    check_nearest_items<ArrayTree<interval_t, double>>();
+}
+
+
+TEST(TEST_MODULE_NAME, resume_copy) {
+    typedef Tree<interval_t, double> tree_t;
+    vector<double> items = random_items(200);
+    tree_t t = make_tree<tree_t>(items);
+
+    auto i = best_first(t.root(), 50., interval_dist<tree_t::subtree_t>, item_dist);
+    ++i; ++i;
+    auto j = i;
+    EXPECT_TRUE(i == j);
+    double d = *i;
+    ++i;
+    EXPECT_FALSE(i == j);
+    EXPECT_EQ(*j, d);
+    ++j;
+    EXPECT_TRUE(i == j);
+}
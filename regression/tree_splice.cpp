@@ -0,0 +1,362 @@
+#define TEST_MODULE_NAME TreeSplice
+
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <gtest/gtest.h>
+#include <geomc/Tree.h>
+#include <geomc/PoolAllocator.h>
+
+using namespace geom;
+using namespace std;
+
+#define RANDOM_SEED 8812309741ULL
+
+typedef Tree<int, int>      tree_t;
+typedef tree_t::subtree_t   subtree_t;
+
+
+inline index_t compare(int a, int b) {
+    return a - b;
+}
+
+
+// split `s` in half by value, recursively, until its leaves hold few items.
+// nodes are labeled with `*label`, counting up.
+template <typename S>
+void build(S s, int* label) {
+    if (s.item_count() <= 6) return;
+    vector<int> v(s.items_begin(), s.items_end());
+    nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    S a = s.insert_child_node((*label)++);
+    S b = a.split(compare, v[v.size() / 2], (*label)++);
+    build(a, label);
+    build(b, label);
+}
+
+
+template <typename TreeT>
+TreeT make_tree(int lo, int hi, int* label) {
+    vector<int> items;
+    for (int i = lo; i < hi; ++i) items.push_back(i);
+    TreeT t(items.begin(), items.end());
+    *t.root() = (*label)++;
+    build(t.root(), label);
+    return t;
+}
+
+
+// children of each node are visited before grandchildren.
+template <typename S>
+void canonical_order(S s, vector<int>* out) {
+    for (S c = s.begin(); c != s.end(); ++c) out->push_back(*c);
+    for (S c = s.begin(); c != s.end(); ++c) canonical_order(c, out);
+}
+
+
+// check the node's item range, counts, and child links; return its items.
+template <typename S>
+vector<int> check_subtree(S s) {
+    vector<int> items(s.items_begin(), s.items_end());
+    EXPECT_EQ((index_t) items.size(), s.item_count());
+    if (s.node_count() > 0) {
+        vector<int> from_kids;
+        index_t n_kids = 0;
+        for (S c = s.begin(); c != s.end(); ++c, ++n_kids) {
+            EXPECT_TRUE(c.parent() == s);
+            vector<int> k = check_subtree(c);
+            from_kids.insert(from_kids.end(), k.begin(), k.end());
+        }
+        EXPECT_EQ(n_kids, s.node_count());
+        EXPECT_EQ(items, from_kids);
+    }
+    return items;
+}
+
+
+// verify the structure of `t`, and that its nodes are laid out in sibling-contiguous order.
+template <typename TreeT>
+void check_tree(TreeT& t) {
+    auto root = t.root();
+    EXPECT_TRUE(root.is_root());
+    vector<int> items = check_subtree(root);
+    EXPECT_EQ((index_t) items.size(), t.item_count());
+
+    vector<int> expect {*root};
+    canonical_order(root, &expect);
+    vector<int> layout;
+    for (auto n = root.global_begin(); n != root.global_end(); ++n) layout.push_back(*n);
+    EXPECT_EQ(layout, expect);
+}
+
+
+template <typename S>
+S find_label(S s, int label) {
+    if (*s == label) return s;
+    for (S c = s.begin(); c != s.end(); ++c) {
+        S x = find_label(c, label);
+        if (x != s.tree().root().global_end()) return x;
+    }
+    return s.tree().root().global_end();
+}
+
+
+template <typename S>
+void all_nodes(S s, vector<S>* out) {
+    out->push_back(s);
+    for (S c = s.begin(); c != s.end(); ++c) all_nodes(c, out);
+}
+
+
+template <typename S>
+bool is_ancestor(S a, S s) {
+    for (; not s.is_root(); s = s.parent()) {
+        if (s == a) return true;
+    }
+    return s == a;
+}
+
+
+TEST(TEST_MODULE_NAME, build_layout) {
+    int label = 0;
+    tree_t t = make_tree<tree_t>(0, 500, &label);
+    check_tree(t);
+}
+
+
+TEST(TEST_MODULE_NAME, take_within_tree) {
+    int label = 0;
+    tree_t t = make_tree<tree_t>(0, 500, &label);
+    vector<int> orig(t.root().items_begin(), t.root().items_end());
+    subtree_t a = t.root().begin();   // lower half
+    subtree_t b = a; ++b;             // upper half
+    subtree_t g = a.begin();          // lowest quarter
+    vector<int> g_items(g.items_begin(), g.items_end());
+    auto g_item = g.items_begin();
+    int g_label = *g;
+
+    subtree_t m = b.take(g);
+    ASSERT_TRUE(m == g);
+    EXPECT_EQ(*m, g_label);
+    EXPECT_TRUE(m.parent() == b);
+    EXPECT_EQ(a.item_count() + b.item_count(), 500);
+    EXPECT_EQ(vector<int>(m.items_begin(), m.items_end()), g_items);
+    // item iterators and subtrees survive the move
+    EXPECT_EQ(*g_item, g_items[0]);
+    EXPECT_TRUE(m.items_begin() == g_item);
+    check_tree(t);
+
+    // ...and back again, to the front
+    subtree_t back = a.take(m, a.begin());
+    ASSERT_TRUE(back == g);
+    EXPECT_TRUE(a.begin() == g);
+    check_tree(t);
+    EXPECT_EQ(vector<int>(t.root().items_begin(), t.root().items_end()), orig);
+}
+
+
+TEST(TEST_MODULE_NAME, take_reroot) {
+    int label = 0;
+    tree_t t = make_tree<tree_t>(0, 500, &label);
+    subtree_t deep = t.root().begin().begin().begin();
+    index_t n = deep.item_count();
+    subtree_t m = t.root().take(deep, t.root().begin());
+    ASSERT_TRUE(m == deep);
+    EXPECT_TRUE(m.parent() == t.root());
+    EXPECT_TRUE(t.root().begin() == m);
+    EXPECT_EQ(m.item_count(), n);
+    EXPECT_EQ(t.root().node_count(), 3);
+    EXPECT_EQ(t.root().item_count(), 500);
+    check_tree(t);
+}
+
+
+TEST(TEST_MODULE_NAME, take_into_empty_leaf) {
+    int label = 0;
+    tree_t t = make_tree<tree_t>(0, 100, &label);
+    subtree_t a = t.root().begin();
+    subtree_t b = a; ++b;
+    // an empty leaf at the end of the tree, and one in the middle
+    subtree_t e0 = t.root().insert_child_node(-1);
+    subtree_t e1 = a.insert_child_node(a.begin(), -2);
+    check_tree(t);
+
+    subtree_t m = e0.take(b.begin());
+    ASSERT_TRUE(m != e0.end());
+    EXPECT_TRUE(m.parent() == e0);
+    check_tree(t);
+
+    m = e1.take(b);
+    ASSERT_TRUE(m == b);
+    EXPECT_TRUE(b.parent() == e1);
+    EXPECT_EQ(t.root().item_count(), 100);
+    check_tree(t);
+}
+
+
+TEST(TEST_MODULE_NAME, take_between_trees) {
+    int label = 0;
+    tree_t t = make_tree<tree_t>(0, 500, &label);
+    tree_t u = make_tree<tree_t>(1000, 1400, &label);
+
+    subtree_t s = u.root().begin();
+    ++s;
+    vector<int> s_items(s.items_begin(), s.items_end());
+    auto s_item = s.items_begin();
+    index_t n = s.item_count();
+
+    subtree_t x = t.root().begin();
+    ++x;
+    subtree_t m = x.take(s, x.begin());
+    ASSERT_TRUE(m != x.end());
+    EXPECT_TRUE(&m.tree() == &t);
+    EXPECT_TRUE(m.parent() == x);
+    EXPECT_EQ(t.root().item_count(), 500 + n);
+    EXPECT_EQ(u.root().item_count(), 400 - n);
+    EXPECT_EQ(vector<int>(m.items_begin(), m.items_end()), s_items);
+    EXPECT_TRUE(m.items_begin() == s_item);
+    EXPECT_TRUE(x.find_parent(s_item) != x.end());
+    check_tree(t);
+    check_tree(u);
+
+    // take the other tree's last remaining child, leaving it an empty root
+    subtree_t rest = u.root().begin();
+    m = t.root().take(rest);
+    ASSERT_TRUE(m != t.root().end());
+    EXPECT_EQ(u.root().item_count(), 0);
+    EXPECT_EQ(u.root().node_count(), 0);
+    EXPECT_EQ(t.root().item_count(), 900);
+    check_tree(t);
+    check_tree(u);
+
+    // the donor tree can be reused
+    u.root().insert_item(u.root().items_end(), 7);
+    EXPECT_EQ(u.root().item_count(), 1);
+    check_tree(u);
+    
+    // move a deep subtree (with an empty leaf inside it) out of a tree which
+    // is then destroyed; the moved leaves must not refer to the old tree.
+    subtree_t deep;
+    index_t n_deep = 0;
+    {
+        tree_t v = make_tree<tree_t>(2000, 2300, &label);
+        subtree_t d = v.root().begin();
+        ASSERT_GT(d.begin().node_count(), 0);
+        d.begin().begin().insert_child_node(-3);
+        n_deep = d.item_count();
+        deep = t.root().take(d, t.root().begin());
+        ASSERT_TRUE(deep != t.root().end());
+        check_tree(v);
+    }
+    check_tree(t);
+    vector<subtree_t> moved;
+    all_nodes(deep, &moved);
+    EXPECT_GT(moved.size(), 3u);
+    index_t n_added = 0;
+    for (subtree_t leaf : moved) {
+        if (leaf.node_count() > 0) continue;
+        if (leaf.item_count() == 0) {
+            leaf.insert_child_node(-4);
+        } else {
+            leaf.insert_item(leaf.items_end(), 5000);
+            leaf.insert_item(leaf.items_begin(), 5001);
+            n_added += 2;
+        }
+    }
+    EXPECT_EQ(t.root().item_count(), 900 + n_deep + n_added);
+    check_tree(t);
+}
+
+
+TEST(TEST_MODULE_NAME, take_invalid) {
+    int label = 0;
+    tree_t t = make_tree<tree_t>(0, 200, &label);
+    subtree_t a = t.root().begin();
+    subtree_t leaf = a;
+    while (leaf.node_count() > 0) leaf = leaf.begin();
+    subtree_t b = a; ++b;
+
+    // can't take a root
+    EXPECT_TRUE(a.take(t.root()) == a.end());
+    // can't take an ancestor (or oneself)
+    EXPECT_TRUE(a.begin().take(a) == a.begin().end());
+    EXPECT_TRUE(a.take(a) == a.end());
+    // can't take into a leaf holding items
+    EXPECT_TRUE(leaf.take(b.begin()) == leaf.end());
+    // insert_before must be a child of the receiving node
+    EXPECT_TRUE(a.take(b.begin(), b) == a.end());
+    check_tree(t);
+    EXPECT_EQ(t.root().item_count(), 200);
+
+    // the trees' allocators must agree
+    typedef Tree<int, int, PoolAllocator<int>> pooled_t;
+    pooled_t p = make_tree<pooled_t>(0, 50, &label);
+    pooled_t q = make_tree<pooled_t>(0, 50, &label);
+    EXPECT_TRUE(p.root().take(q.root().begin()) == p.root().end());
+    EXPECT_EQ(q.root().item_count(), 50);
+    pooled_t r(q.get_allocator());
+    EXPECT_TRUE(r.root().take(q.root().begin()) != r.root().end());
+    check_tree(q);
+    check_tree(r);
+}
+
+
+TEST(TEST_MODULE_NAME, take_random) {
+    mt19937_64 rng(RANDOM_SEED);
+    int label = 0;
+    tree_t t = make_tree<tree_t>(0, 1000, &label);
+    for (int k = 0; k < 300; ++k) {
+        vector<subtree_t> nodes;
+        all_nodes(t.root(), &nodes);
+        subtree_t s   = nodes[rng() % nodes.size()];
+        subtree_t dst = nodes[rng() % nodes.size()];
+        if (s.is_root() or is_ancestor(s, dst)) continue;
+        if (dst.node_count() == 0 and dst.item_count() > 0) continue;
+        // insert before a random child, or at the end
+        subtree_t ins = dst.end();
+        index_t i = rng() % (dst.node_count() + 1);
+        if (i < dst.node_count()) {
+            ins = dst.begin();
+            while (i-- > 0) ++ins;
+        }
+        int s_label = *s;
+        index_t n = s.item_count();
+        subtree_t m = dst.take(s, ins);
+        ASSERT_TRUE(m == s);
+        EXPECT_EQ(*m, s_label);
+        EXPECT_EQ(m.item_count(), n);
+        EXPECT_TRUE(m.parent() == dst);
+        check_tree(t);
+        if (HasFailure()) break;
+    }
+    vector<int> items(t.root().items_begin(), t.root().items_end());
+    sort(items.begin(), items.end());
+    ASSERT_EQ(items.size(), 1000u);
+    for (int i = 0; i < 1000; ++i) EXPECT_EQ(items[i], i);
+}
+
+
+TEST(TEST_MODULE_NAME, take_grandchildren_to_root) {
+    int label = 0;
+    tree_t t = make_tree<tree_t>(0, 500, &label);
+    subtree_t root = t.root();
+    // gather the root's children under one new child...
+    vector<subtree_t> kids;
+    for (subtree_t k = root.begin(); k != root.end(); ++k) kids.push_back(k);
+    subtree_t c = root.insert_child_node(-1);
+    for (const subtree_t& k : kids) c.take(k);
+    EXPECT_EQ(root.node_count(), 1);
+    check_tree(t);
+    // ...and lift them back out. the first of them lies just past the
+    // root's last child, i.e. at `root.end()`.
+    for (const subtree_t& k : kids) {
+        EXPECT_TRUE(root.take(k) == k);
+        EXPECT_TRUE(k.parent() == root);
+    }
+    EXPECT_EQ(c.node_count(), 0);
+    EXPECT_EQ(c.item_count(), 0);
+    root.erase(c);
+    EXPECT_EQ(root.node_count(), 2);
+    EXPECT_EQ(root.item_count(), 500);
+    check_tree(t);
+}
@@ -0,0 +1,119 @@
+#define TEST_MODULE_NAME WorkPool
+
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <geomc/WorkPool.h>
+
+using namespace geom;
+using namespace std;
+
+
+// sum [b, e) by recursive subdivision, spawning subtasks from inside tasks.
+void subdivide(WorkPool& pool, WorkGroup& group, std::atomic<int64_t>& sum, int64_t b, int64_t e) {
+    if (e - b <= 64) {
+        int64_t s = 0;
+        for (int64_t i = b; i < e; ++i) s += i;
+        sum += s;
+        return;
+    }
+    int64_t m = (b + e) / 2;
+    pool.submit(group, [&pool, &group, &sum, b, m]() { subdivide(pool, group, sum, b, m); });
+    subdivide(pool, group, sum, m, e);
+}
+
+
+TEST(TEST_MODULE_NAME, flat_tasks) {
+    for (index_t n_threads : {0, 1, 4}) {
+        WorkPool pool(n_threads);
+        EXPECT_EQ(pool.thread_count(), n_threads);
+        std::vector<int> hits(1000, 0);
+        WorkGroup group;
+        for (index_t i = 0; i < 1000; ++i) {
+            pool.submit(group, [&hits, i]() { hits[i] += 1; });
+        }
+        pool.wait(group);
+        EXPECT_EQ(group.pending(), 0);
+        for (int h : hits) EXPECT_EQ(h, 1);
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, nested_tasks) {
+    for (index_t n_threads : {0, 2, 7}) {
+        WorkPool pool(n_threads);
+        WorkGroup group;
+        std::atomic<int64_t> sum {0};
+        pool.submit(group, [&]() { subdivide(pool, group, sum, 0, 100000); });
+        pool.wait(group);
+        EXPECT_EQ(sum.load(), 100000LL * 99999 / 2);
+    }
+}
+
+
+TEST(TEST_MODULE_NAME, exceptions) {
+    WorkPool pool(2);
+    WorkGroup group;
+    std::atomic<int> ran {0};
+    for (index_t i = 0; i < 10; ++i) {
+        pool.submit(group, [&ran, i]() {
+            ++ran;
+            if (i == 5) throw std::runtime_error("task failed");
+        });
+    }
+    EXPECT_THROW(pool.wait(group), std::runtime_error);
+    EXPECT_EQ(ran.load(), 10);
+    // the group is reusable afterward
+    pool.submit(group, [&ran]() { ++ran; });
+    EXPECT_NO_THROW(pool.wait(group));
+    EXPECT_EQ(ran.load(), 11);
+}
+
+
+TEST(TEST_MODULE_NAME, worker_index) {
+    WorkPool pool(3);
+    EXPECT_EQ(pool.worker_index(), 3);
+    // each slot is only ever used by one thread at a time
+    std::vector<std::atomic<int>> busy(4);
+    std::atomic<bool> overlap {false};
+    WorkGroup group;
+    for (index_t i = 0; i < 2000; ++i) {
+        pool.submit(group, [&]() {
+            index_t w = pool.worker_index();
+            ASSERT_GE(w, 0);
+            ASSERT_LE(w, 3);
+            if (busy[w].fetch_add(1) != 0) overlap = true;
+            std::this_thread::yield();
+            busy[w].fetch_sub(1);
+        });
+    }
+    pool.wait(group);
+    EXPECT_FALSE(overlap.load());
+}
+
+TEST(TEST_MODULE_NAME, late_submissions) {
+    // the waiter runs out of queued work while the group is still running, and
+    // must wake both for tasks queued later and for the group's completion.
+    for (index_t n_threads : {0, 1, 3}) {
+        WorkPool pool(n_threads);
+        std::atomic<index_t> ran {0};
+        WorkGroup group;
+        pool.submit(group, [&]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            for (index_t i = 0; i < 8; ++i) {
+                pool.submit(group, [&]() {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                    ran.fetch_add(1);
+                });
+            }
+            ran.fetch_add(1);
+        });
+        pool.wait(group);
+        EXPECT_EQ(ran.load(), 9);
+        EXPECT_EQ(group.pending(), 0);
+    }
+}